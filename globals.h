@@ -1271,6 +1271,7 @@ struct s_client
 	int8_t          autoau;
 	LLIST           *ra_buf;         // EMM reassembly buffer for viaccess
 	struct emm_rass *cw_rass;          // EMM reassembly buffer for cryptoworks
+	struct s_emm_route *emm_routes;    // au readers matching an emm, see do_emm()
 	int8_t          monlvl;
 	CAIDTAB         ctab;
 	TUNTAB          ttab;
@@ -1965,7 +1966,7 @@ struct s_reader
 	LLIST		*ll_biss2_rsa_keys;	        // BISS2 RSA keys - Read from external PEM files
 #endif
 	uint8_t         cnxlastecm;                     // == 0 - last ecm has not been paired ecm, > 0 last ecm has been paired ecm
-	LLIST           *emmstat;                       //emm stats
+	struct s_emmstat_index *emmstat;                //emm stats, see ncam-emm-cache.c
 	CS_MUTEX_LOCK   emmstat_lock;
 	struct s_reader *next;
 };
@@ -2285,7 +2286,6 @@ struct s_config
 	int8_t          http_overwrite_bak_file;
 	int32_t         failbantime;
 	int32_t         failbancount;
-	LLIST           *v_list; // Failban list
 #ifdef MODULE_CAMD33
 	int32_t         c33_port;
 	IN_ADDR_T       c33_srvip;
@@ -2491,7 +2491,14 @@ struct s_config
 	int8_t      stream_relay_enabled;
 	uint32_t    stream_relay_buffer_time;
 	int8_t      stream_relay_reconnect_count;
+	uint32_t    stream_relay_max_connections;   // size of the stream relay connection table, applied on restart
+	uint32_t    stream_relay_buffer_packets;    // ts packets per stream buffer
+	uint8_t     stream_relay_buffers;           // stream buffers in the pipeline of a stream
+	int8_t      stream_relay_zerocopy;          // send stream buffers to the clients with MSG_ZEROCOPY
 	CAIDTAB     stream_relay_ctab;              // use the stream server for these caids
+#define DEFAULT_STREAM_RELAY_MAX_CONNECTIONS 16
+#define DEFAULT_STREAM_RELAY_BUFFER_PACKETS 278
+#define DEFAULT_STREAM_RELAY_BUFFERS 8
 #ifdef WITH_NEUTRINO
 #define DEFAULT_STREAM_SOURCE_PORT 31339 //Neutrino
 #else
@@ -7,11 +7,13 @@
 
 #include "cscrypt/rc6.h"
 #include "cscrypt/idea.h"
+#include "ncam-hashtable.h"
 
 #define CAID_KEY 0x20
 
 #define CC_MAXMSGSIZE 0x400 // by Project::Keynation: Buffer size is limited on "O" CCCam to 1024 bytes
 #define CC_MAX_PROV 32
+#define CC_RECV_AHEAD_SIZE 0x2000 // read-ahead buffer, holds several messages per recv()
 #define SWAPC(X, Y) do { char p; p = *X; *X = *Y; *Y = p; } while(0)
 
 #if (defined(WIN32) || defined(__CYGWIN__)) && !defined(MSG_WAITALL)
@@ -92,6 +94,21 @@ struct cc_srvid_block
 	time_t blocked_till;
 };
 
+struct cc_sid_count
+{
+	uint16_t sid;
+	uint32_t good; // entries with this sid in goodsids
+	uint32_t bad; // entries with this sid in badsids
+	node ht_node;
+	node ll_node;
+};
+
+struct cc_sid_index
+{
+	hash_table ht_sids; // struct cc_sid_count by sid
+	list ll_sids;
+};
+
 struct cc_provider
 {
 	uint32_t prov; // provider
@@ -121,6 +138,7 @@ struct cc_card
 	LLIST *badsids; // sids that have failed to decode (struct cc_srvid_block)
 	LLIST *goodsids; // sids that could decoded (struct cc_srvid)
 	LLIST *remote_nodes; // remote note id, 8 bytes
+	struct cc_sid_index *sid_index; // sid lookup for goodsids/badsids, NULL = not indexed
 	struct s_reader *origin_reader;
 	uint32_t origin_id;
 	cc_card_type card_type;
@@ -131,6 +149,8 @@ struct cc_card
 	time_t timeout;
 	uint8_t is_ext;
 	int8_t rating;
+	node ht_node; // sharelist hash node (module-cccshare)
+	node ll_node; // sharelist list node (module-cccshare)
 };
 
 typedef enum
@@ -153,6 +173,14 @@ typedef enum
 	MODE_CMD_0x0C_IDEA = 5,
 } cc_cmd0c_mode;
 
+struct cc_caid_cards
+{
+	uint16_t caid;
+	LLIST *cards; // cards with this caid, in cc->cards order
+	node ht_node;
+	node ll_node;
+};
+
 struct cc_extended_ecm_idx
 {
 	uint8_t send_idx;
@@ -195,12 +223,19 @@ struct cc_data
 	uint8_t receive_buffer[CC_MAXMSGSIZE];
 	uint8_t send_buffer[CC_MAXMSGSIZE];
 
+	uint8_t recv_ahead[CC_RECV_AHEAD_SIZE]; // raw (still encrypted) bytes received ahead of framing
+	int32_t recv_ahead_pos;
+	int32_t recv_ahead_len;
+
 	LLIST *cards; // cards list
+	hash_table ht_cards_caid; // cards list indexed by caid (struct cc_caid_cards)
+	list ll_cards_caid;
 
 	int32_t max_ecms;
 	int32_t ecm_counter;
 	int32_t card_added_count;
 	int32_t card_removed_count;
+	int32_t card_shared_count; // added cards passed to the sharelist without rebuild
 	uint8_t just_logged_in; // true for checking NOK direct after login
 	uint8_t key_table; // key for CMD 0B
 
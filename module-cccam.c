@@ -383,11 +383,127 @@ int32_t sid_eq_bb(struct cc_srvid_block *srvid1, struct cc_srvid_block *srvid2)
 				&& (srvid1->blocked_till == srvid2->blocked_till || !srvid1->blocked_till || !srvid2->blocked_till));
 }
 
+static pthread_rwlock_t cc_sid_index_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static int compare_sid_count(const void *arg, const void *obj)
+{
+	return memcmp(arg, &((const struct cc_sid_count *)obj)->sid, sizeof(uint16_t));
+}
+
+/**
+ * reader + server:
+ * count goodsids/badsids entries by sid. The index is only created while both
+ * lists are empty, so when present it covers every entry and a zero count
+ * proves the sid is not listed. Call before appending and after removing.
+ */
+static void cc_sid_index_update(struct cc_card *card, uint16_t sid, int8_t bad, int8_t add)
+{
+	struct cc_sid_index *index;
+	struct cc_sid_count *count;
+	uint32_t *num;
+
+	SAFE_RWLOCK_WRLOCK(&cc_sid_index_lock);
+
+	if(!card->sid_index && add && !ll_count(card->goodsids) && !ll_count(card->badsids))
+	{
+		if(cs_malloc(&card->sid_index, sizeof(struct cc_sid_index)))
+		{
+			init_hash_table(&card->sid_index->ht_sids, &card->sid_index->ll_sids);
+		}
+	}
+
+	index = card->sid_index;
+	if(index)
+	{
+		count = find_hash_table(&index->ht_sids, &sid, sizeof(uint16_t), &compare_sid_count);
+		if(!count && add && cs_malloc(&count, sizeof(struct cc_sid_count)))
+		{
+			count->sid = sid;
+			add_hash_table(&index->ht_sids, &count->ht_node, &index->ll_sids, &count->ll_node, count, &count->sid, sizeof(uint16_t));
+		}
+
+		if(count)
+		{
+			num = bad ? &count->bad : &count->good;
+			if(add)
+			{
+				(*num)++;
+			}
+			else if(*num)
+			{
+				(*num)--;
+			}
+
+			if(!count->good && !count->bad)
+			{
+				remove_elem_list(&index->ll_sids, &count->ll_node);
+				remove_elem_hash_table(&index->ht_sids, &count->ht_node);
+				NULLFREE(count);
+			}
+		}
+	}
+
+	SAFE_RWLOCK_UNLOCK(&cc_sid_index_lock);
+}
+
+void cc_sid_index_add(struct cc_card *card, uint16_t sid, int8_t bad)
+{
+	cc_sid_index_update(card, sid, bad, 1);
+}
+
+/**
+ * reader + server:
+ * returns 0 only if the sid is known not to be in goodsids (bad=0) or badsids (bad=1)
+ */
+static int8_t cc_sid_index_has(struct cc_card *card, uint16_t sid, int8_t bad)
+{
+	struct cc_sid_count *count;
+	int8_t found = 1;
+
+	SAFE_RWLOCK_RDLOCK(&cc_sid_index_lock);
+
+	if(card->sid_index)
+	{
+		count = find_hash_table(&card->sid_index->ht_sids, &sid, sizeof(uint16_t), &compare_sid_count);
+		found = count && (bad ? count->bad : count->good);
+	}
+
+	SAFE_RWLOCK_UNLOCK(&cc_sid_index_lock);
+
+	return found;
+}
+
+static void cc_sid_index_free(struct cc_card *card)
+{
+	struct cc_sid_count *count;
+
+	SAFE_RWLOCK_WRLOCK(&cc_sid_index_lock);
+
+	if(card->sid_index)
+	{
+		while((count = get_first_elem_list(&card->sid_index->ll_sids)))
+		{
+			remove_elem_list(&card->sid_index->ll_sids, &count->ll_node);
+			remove_elem_hash_table(&card->sid_index->ht_sids, &count->ht_node);
+			NULLFREE(count);
+		}
+		deinitialize_hash_table(&card->sid_index->ht_sids);
+		NULLFREE(card->sid_index);
+	}
+
+	SAFE_RWLOCK_UNLOCK(&cc_sid_index_lock);
+}
+
 struct cc_srvid_block *is_sid_blocked(struct cc_card *card, struct cc_srvid *srvid_blocked)
 {
 	LL_ITER it = ll_iter_create(card->badsids);
 	struct cc_srvid_block *srvid;
 
+	if(!cc_sid_index_has(card, srvid_blocked->sid, 1))
+	{
+		return NULL;
+	}
+
 	while((srvid = ll_iter_next(&it)))
 	{
 		if(sid_eq_nb(srvid_blocked, srvid))
@@ -396,7 +512,9 @@ struct cc_srvid_block *is_sid_blocked(struct cc_card *card, struct cc_srvid *srv
 		}
 		else if(srvid->ecmlen && ((struct cc_srvid_block *)srvid)->blocked_till > time(NULL))
 		{
+			uint16_t sid = srvid->sid;
 			ll_iter_remove_data(&it);
+			cc_sid_index_update(card, sid, 1, 0);
 		}
 	}
 	return srvid;
@@ -422,6 +540,11 @@ struct cc_srvid *is_good_sid(struct cc_card *card, struct cc_srvid *srvid_good)
 	LL_ITER it = ll_iter_create(card->goodsids);
 	struct cc_srvid *srvid;
 
+	if(!cc_sid_index_has(card, srvid_good->sid, 0))
+	{
+		return NULL;
+	}
+
 	while((srvid = ll_iter_next(&it)))
 	{
 		if(sid_eq(srvid, srvid_good))
@@ -453,6 +576,7 @@ void add_sid_block(struct cc_card *card, struct cc_srvid *srvid_blocked, bool te
 		srvid->blocked_till = time(NULL) + BLOCKING_SECONDS;
 	}
 
+	cc_sid_index_add(card, srvid->sid, 1);
 	ll_append(card->badsids, srvid);
 	cs_log_dbg(D_READER, "added sid block %04X(CHID %04X, length %d) for card %08x",
 				srvid_blocked->sid, srvid_blocked->chid, srvid_blocked->ecmlen, card->id);
@@ -467,7 +591,9 @@ void remove_sid_block(struct cc_card *card, struct cc_srvid *srvid_blocked)
 	{
 		if(sid_eq_nb(srvid_blocked, srvid))
 		{
+			uint16_t sid = srvid->sid;
 			ll_iter_remove_data(&it);
+			cc_sid_index_update(card, sid, 1, 0);
 		}
 	}
 
@@ -491,6 +617,7 @@ void add_good_sid(struct cc_card *card, struct cc_srvid *srvid_good)
 	}
 
 	memcpy(srvid, srvid_good, sizeof(struct cc_srvid));
+	cc_sid_index_add(card, srvid->sid, 0);
 	ll_append(card->goodsids, srvid);
 
 	cs_log_dbg(D_READER, "added good sid %04X(%d) for card %08x",
@@ -506,7 +633,9 @@ void remove_good_sid(struct cc_card *card, struct cc_srvid *srvid_good)
 	{
 		if(sid_eq(srvid, srvid_good))
 		{
+			uint16_t sid = srvid->sid;
 			ll_iter_remove_data(&it);
+			cc_sid_index_update(card, sid, 0, 0);
 		}
 	}
 
@@ -514,6 +643,16 @@ void remove_good_sid(struct cc_card *card, struct cc_srvid *srvid_good)
 				srvid_good->sid, srvid_good->ecmlen, card->id);
 }
 
+/**
+ * reader + server:
+ * drop any data left in the read-ahead buffer (connection closed or reopened)
+ */
+static void cc_recv_ahead_reset(struct cc_data *cc)
+{
+	cc->recv_ahead_pos = 0;
+	cc->recv_ahead_len = 0;
+}
+
 /**
  * reader
  * clears and frees values for reinit
@@ -564,6 +703,7 @@ void cc_cli_close(struct s_client *cl, int32_t call_conclose)
 
 	cc->ecm_busy = 0;
 	cc->just_logged_in = 0;
+	cc_recv_ahead_reset(cc);
 }
 
 struct cc_extended_ecm_idx *add_extended_ecm_idx(struct s_client *cl, uint8_t send_idx, uint16_t ecm_idx,
@@ -708,10 +848,99 @@ void free_extended_ecm_idx(struct cc_data *cc)
 	}
 }
 
+/**
+ * reader + server:
+ * take len raw bytes from the read-ahead buffer. When it runs short, refill it
+ * with as much as the socket has available in a single recv().
+ * Bytes stay encrypted until framed, as the decrypt state may change between messages.
+ */
+static int32_t cc_recv_ahead(struct s_client *cl, uint8_t *buf, int32_t len)
+{
+	struct cc_data *cc = cl->cc;
+	int32_t n;
+
+	if(len > CC_RECV_AHEAD_SIZE)
+	{
+		return -1;
+	}
+
+	while(cc->recv_ahead_len < len)
+	{
+		if(cc->recv_ahead_pos) // move partial message to the buffer start
+		{
+			memmove(cc->recv_ahead, cc->recv_ahead + cc->recv_ahead_pos, cc->recv_ahead_len);
+			cc->recv_ahead_pos = 0;
+		}
+
+		n = cs_recv(cl->udp_fd, cc->recv_ahead + cc->recv_ahead_len, CC_RECV_AHEAD_SIZE - cc->recv_ahead_len, 0);
+
+		if(n < 0 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if(n <= 0) // return the incomplete read like MSG_WAITALL would
+		{
+			return cc->recv_ahead_len ? cc->recv_ahead_len : n;
+		}
+
+		cc->recv_ahead_len += n;
+	}
+
+	memcpy(buf, cc->recv_ahead + cc->recv_ahead_pos, len);
+	cc->recv_ahead_pos += len;
+	cc->recv_ahead_len -= len;
+
+	if(!cc->recv_ahead_len)
+	{
+		cc->recv_ahead_pos = 0;
+	}
+
+	return len;
+}
+
+/**
+ * reader + server:
+ * check if a complete message is already waiting in the read-ahead buffer
+ */
+static int8_t cc_msg_pending(struct s_client *cl)
+{
+	struct cc_data *cc = cl->cc;
+	struct cc_crypt_block block;
+	uint8_t header[4];
+	int8_t pending = 0;
+
+	if(!cc || cl->udp_fd <= 0 || cl->kill)
+	{
+		return 0;
+	}
+
+	cs_writelock(__func__, &cc->lockcmd);
+
+	if(cc->recv_ahead_len >= 4)
+	{
+		// decrypt the header with a copy of the crypt state, the real one advances on cc_msg_recv()
+		memcpy(&block, &cc->block[DECRYPT], sizeof(block));
+		memcpy(header, cc->recv_ahead + cc->recv_ahead_pos, 4);
+		cc_crypt(&block, header, 4, DECRYPT);
+		pending = cc->recv_ahead_len >= 4 + ((header[2] << 8) | header[3]);
+	}
+
+	cs_writeunlock(__func__, &cc->lockcmd);
+
+	return pending;
+}
+
 int32_t cc_recv_to(struct s_client *cl, uint8_t *buf, int32_t len)
 {
 	int32_t rc;
 	struct pollfd pfd;
+	struct cc_data *cc = cl->cc;
+
+	if(cc && cc->recv_ahead_len >= len)
+	{
+		return cc_recv_ahead(cl, buf, len);
+	}
 
 	while(1)
 	{
@@ -746,6 +975,11 @@ int32_t cc_recv_to(struct s_client *cl, uint8_t *buf, int32_t len)
 			return -2; // timeout!!
 		}
 	}
+
+	if(cc)
+	{
+		return cc_recv_ahead(cl, buf, len);
+	}
 	return cs_recv(cl->udp_fd, buf, len, MSG_WAITALL);
 }
 
@@ -799,7 +1033,7 @@ int32_t cc_msg_recv(struct s_client *cl, uint8_t *buf, int32_t maxlen)
 		return -1;
 	}
 
-	len = cs_recv(handle, buf, 4, MSG_WAITALL);
+	len = cc_recv_ahead(cl, buf, 4);
 
 	if(len != 4) // invalid header length read
 	{
@@ -833,7 +1067,7 @@ int32_t cc_msg_recv(struct s_client *cl, uint8_t *buf, int32_t maxlen)
 			return 0;
 		}
 
-		len = cs_recv(handle, buf + 4, size, MSG_WAITALL);
+		len = cc_recv_ahead(cl, buf + 4, size);
 
 		if(rdr && (buf[1] == MSG_CW_ECM
 #ifdef CS_CACHEEX_AIO
@@ -871,6 +1105,31 @@ int32_t cc_msg_recv(struct s_client *cl, uint8_t *buf, int32_t maxlen)
 	return len;
 }
 
+/**
+ * writes the command header and data to netbuf (len + 4 bytes)
+ * returns the message length
+ */
+int32_t cc_cmd_frame(struct cc_data *cc, uint8_t *netbuf, uint8_t *buf, int32_t len, cc_msg_type_t cmd)
+{
+	if(cmd == MSG_NO_HEADER)
+	{
+		memcpy(netbuf, buf, len);
+		return len;
+	}
+
+	// build command message
+	netbuf[0] = cc->g_flag; // flags?
+	netbuf[1] = cmd & 0xff;
+	netbuf[2] = len >> 8;
+	netbuf[3] = len & 0xff;
+
+	if(buf)
+	{
+		memcpy(netbuf + 4, buf, len);
+	}
+	return len + 4;
+}
+
 /**
  * reader + server
  * send a message
@@ -907,24 +1166,7 @@ int32_t cc_cmd_send(struct s_client *cl, uint8_t *buf, int32_t len, cc_msg_type_
 		return -1;
 	}
 
-	if(cmd == MSG_NO_HEADER)
-	{
-		memcpy(netbuf, buf, len);
-	}
-	else
-	{
-		// build command message
-		netbuf[0] = cc->g_flag; // flags?
-		netbuf[1] = cmd & 0xff;
-		netbuf[2] = len >> 8;
-		netbuf[3] = len & 0xff;
-
-		if(buf)
-		{
-			memcpy(netbuf + 4, buf, len);
-		}
-		len += 4;
-	}
+	len = cc_cmd_frame(cc, netbuf, buf, len, cmd);
 
 	cs_log_dump_dbg(D_CLIENT, netbuf, len, "cccam: send:");
 	cc_crypt(&cc->block[ENCRYPT], netbuf, len, ENCRYPT);
@@ -951,6 +1193,64 @@ int32_t cc_cmd_send(struct s_client *cl, uint8_t *buf, int32_t len, cc_msg_type_
 	return n;
 }
 
+#define CC_SEND_TIMEOUT 5000
+
+/**
+ * server
+ * sends messages framed by cc_cmd_frame(), the buffer is encrypted in place.
+ * lockcmd is held until all is sent, partial sends are continued
+ * returns len or -1 if the client was disconnected
+ */
+int32_t cc_cmd_send_frames(struct s_client *cl, uint8_t *netbuf, int32_t len)
+{
+	struct cc_data *cc = cl->cc;
+	struct pollfd pfd;
+	int32_t n, sent = 0;
+
+	if(!cl->udp_fd || !cc || cl->kill)
+		{ return -1; }
+
+	cs_writelock(__func__, &cc->lockcmd);
+
+	if(!cl->cc || cl->kill)
+	{
+		cs_writeunlock(__func__, &cc->lockcmd);
+		return -1;
+	}
+
+	cs_log_dump_dbg(D_CLIENT, netbuf, len, "cccam: send:");
+	cc_crypt(&cc->block[ENCRYPT], netbuf, len, ENCRYPT);
+
+	while(sent < len)
+	{
+		n = send(cl->udp_fd, netbuf + sent, len - sent, 0);
+		if(n > 0)
+		{
+			sent += n;
+			continue;
+		}
+		if(n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+		{
+			pfd.fd = cl->udp_fd;
+			pfd.events = POLLOUT;
+			n = poll(&pfd, 1, CC_SEND_TIMEOUT);
+			if(n > 0 || (n < 0 && errno == EINTR))
+				{ continue; }
+		}
+		break;
+	}
+
+	cs_writeunlock(__func__, &cc->lockcmd);
+
+	if(sent != len)
+	{
+		cs_disconnect_client(cl);
+		return -1;
+	}
+
+	return sent;
+}
+
 #define CC_DEFAULT_VERSION 1
 #define CC_VERSIONS 11
 static char *version[CC_VERSIONS]  = { "2.0.9", "2.0.11", "2.1.1", "2.1.2", "2.1.3", "2.1.4", "2.2.0", "2.2.1", "2.3.0", "2.3.1", "2.3.2"};
@@ -1532,6 +1832,85 @@ int32_t same_card(struct cc_card *card1, struct cc_card *card2)
 			same_first_node(card1, card2));
 }
 
+static int compare_caid_cards(const void *arg, const void *obj)
+{
+	return memcmp(arg, &((const struct cc_caid_cards *)obj)->caid, sizeof(uint16_t));
+}
+
+/**
+ * reader:
+ * cards of cc->cards with this caid, call with cards_busy locked
+ */
+static struct cc_caid_cards *cc_get_caid_cards(struct cc_data *cc, uint16_t caid)
+{
+	return find_hash_table(&cc->ht_cards_caid, &caid, sizeof(uint16_t), &compare_caid_cards);
+}
+
+/**
+ * reader:
+ * add a card of cc->cards to the caid index, call with cards_busy write locked
+ */
+static void cc_index_card(struct cc_data *cc, struct cc_card *card)
+{
+	struct cc_caid_cards *caid_cards = cc_get_caid_cards(cc, card->caid);
+
+	if(!caid_cards)
+	{
+		if(!cs_malloc(&caid_cards, sizeof(struct cc_caid_cards)))
+		{
+			return;
+		}
+
+		caid_cards->caid = card->caid;
+		caid_cards->cards = ll_create("caid_cards");
+		add_hash_table(&cc->ht_cards_caid, &caid_cards->ht_node, &cc->ll_cards_caid, &caid_cards->ll_node,
+						caid_cards, &caid_cards->caid, sizeof(uint16_t));
+	}
+
+	ll_append(caid_cards->cards, card);
+}
+
+/**
+ * reader:
+ * remove a card from the caid index, call with cards_busy write locked
+ */
+static void cc_unindex_card(struct cc_data *cc, struct cc_card *card)
+{
+	struct cc_caid_cards *caid_cards = cc_get_caid_cards(cc, card->caid);
+
+	if(!caid_cards)
+	{
+		return;
+	}
+
+	ll_remove(caid_cards->cards, card);
+
+	if(!ll_count(caid_cards->cards))
+	{
+		remove_elem_list(&cc->ll_cards_caid, &caid_cards->ll_node);
+		remove_elem_hash_table(&cc->ht_cards_caid, &caid_cards->ht_node);
+		ll_destroy(&caid_cards->cards);
+		NULLFREE(caid_cards);
+	}
+}
+
+/**
+ * reader:
+ * drop the caid index before cc->cards is cleared, call with cards_busy write locked
+ */
+static void cc_clear_cards_index(struct cc_data *cc)
+{
+	struct cc_caid_cards *caid_cards;
+
+	while((caid_cards = get_first_elem_list(&cc->ll_cards_caid)))
+	{
+		remove_elem_list(&cc->ll_cards_caid, &caid_cards->ll_node);
+		remove_elem_hash_table(&cc->ht_cards_caid, &caid_cards->ht_node);
+		ll_destroy(&caid_cards->cards);
+		NULLFREE(caid_cards);
+	}
+}
+
 struct cc_card *get_matching_card(struct s_client *cl, ECM_REQUEST *cur_er, int8_t chk_only)
 {
 	struct cc_data *cc = cl->cc;
@@ -1549,100 +1928,128 @@ struct cc_card *get_matching_card(struct s_client *cl, ECM_REQUEST *cur_er, int8
 
 	int32_t best_rating = MIN_RATING - 1, rating;
 
-	LL_ITER it = ll_iter_create(cc->cards);
-	struct cc_card *card = NULL, *ncard, *xcard = NULL;
+	// only the cards of the requested caid (and its system caid for wantemu) can match,
+	// except for beta-tunnel checks which accept cards of the tunnelled system
+	LLIST *candidates[2];
+	int32_t i, num_candidates = 0;
+	struct cc_caid_cards *caid_cards;
 
-	while((ncard = ll_iter_next(&it)))
+	if(config_enabled(WITH_LB) && chk_only && cfg.lb_mode && cfg.lb_auto_betatunnel
+		&& (caid_is_nagra(cur_er->caid) || caid_is_betacrypt(cur_er->caid)))
+	{
+		candidates[num_candidates++] = cc->cards;
+	}
+	else
 	{
-		int lb_match = 0;
-		if(config_enabled(WITH_LB))
+		if((caid_cards = cc_get_caid_cards(cc, cur_er->caid)))
 		{
-			// accept beta card when beta-tunnel is on
-			lb_match = chk_only && cfg.lb_mode && cfg.lb_auto_betatunnel &&
-					((caid_is_nagra(cur_er->caid) && caid_is_betacrypt(ncard->caid) && cfg.lb_auto_betatunnel_mode <= 3) ||
-					(caid_is_betacrypt(cur_er->caid) && caid_is_nagra(ncard->caid) && cfg.lb_auto_betatunnel_mode >= 1));
+			candidates[num_candidates++] = caid_cards->cards;
 		}
 
-		if((ncard->caid == cur_er->caid // caid matches
-			|| (rdr->cc_want_emu && (ncard->caid == (cur_er->caid & 0xFF00))))
-			|| lb_match) // or system matches if caid ends with 00 (needed for wantemu)
+		if(rdr->cc_want_emu && (cur_er->caid & 0xFF) && (caid_cards = cc_get_caid_cards(cc, cur_er->caid & 0xFF00)))
 		{
-			int32_t goodSidCount = ll_count(ncard->goodsids);
-			int32_t badSidCount = ll_count(ncard->badsids);
-			struct cc_srvid *good_sid;
-			struct cc_srvid_block *blocked_sid;
+			candidates[num_candidates++] = caid_cards->cards;
+		}
+	}
 
-			if(goodSidCount && !badSidCount) // only good sids -> check if sid is good
-			{
-				good_sid = is_good_sid(ncard, &cur_srvid);
-				if(!good_sid)
-				{
-					continue;
-				}
-			}
-			else if(!goodSidCount && badSidCount) // only bad sids -> check if sid is bad
+	LL_ITER it;
+	struct cc_card *card = NULL, *ncard, *xcard = NULL;
+
+	for(i = 0; i < num_candidates; i++)
+	{
+		it = ll_iter_create(candidates[i]);
+		while((ncard = ll_iter_next(&it)))
+		{
+			int lb_match = 0;
+			if(config_enabled(WITH_LB))
 			{
-				blocked_sid = is_sid_blocked(ncard, &cur_srvid);
-				if(blocked_sid && (!chk_only || blocked_sid->blocked_till == 0))
-				{
-					continue;
-				}
+				// accept beta card when beta-tunnel is on
+				lb_match = chk_only && cfg.lb_mode && cfg.lb_auto_betatunnel &&
+						((caid_is_nagra(cur_er->caid) && caid_is_betacrypt(ncard->caid) && cfg.lb_auto_betatunnel_mode <= 3) ||
+						(caid_is_betacrypt(cur_er->caid) && caid_is_nagra(ncard->caid) && cfg.lb_auto_betatunnel_mode >= 1));
 			}
-			else if(goodSidCount && badSidCount) // bad and good sids -> check not blocked and good
+
+			if((ncard->caid == cur_er->caid // caid matches
+				|| (rdr->cc_want_emu && (ncard->caid == (cur_er->caid & 0xFF00))))
+				|| lb_match) // or system matches if caid ends with 00 (needed for wantemu)
 			{
-				blocked_sid = is_sid_blocked(ncard, &cur_srvid);
-				good_sid = is_good_sid(ncard, &cur_srvid);
+				int32_t goodSidCount = ll_count(ncard->goodsids);
+				int32_t badSidCount = ll_count(ncard->badsids);
+				struct cc_srvid *good_sid;
+				struct cc_srvid_block *blocked_sid;
 
-				if(blocked_sid && (!chk_only || blocked_sid->blocked_till == 0))
+				if(goodSidCount && !badSidCount) // only good sids -> check if sid is good
 				{
-					continue;
+					good_sid = is_good_sid(ncard, &cur_srvid);
+					if(!good_sid)
+					{
+						continue;
+					}
 				}
-
-				if(!good_sid)
+				else if(!goodSidCount && badSidCount) // only bad sids -> check if sid is bad
 				{
-					continue;
+					blocked_sid = is_sid_blocked(ncard, &cur_srvid);
+					if(blocked_sid && (!chk_only || blocked_sid->blocked_till == 0))
+					{
+						continue;
+					}
 				}
-			}
+				else if(goodSidCount && badSidCount) // bad and good sids -> check not blocked and good
+				{
+					blocked_sid = is_sid_blocked(ncard, &cur_srvid);
+					good_sid = is_good_sid(ncard, &cur_srvid);
 
-			if(!(rdr->cc_want_emu) && caid_is_nagra(ncard->caid) && (!xcard || ncard->hop < xcard->hop))
-			{
-				xcard = ncard; // remember card (D+ / 1810 fix) if request has no provider, but card has
-			}
+					if(blocked_sid && (!chk_only || blocked_sid->blocked_till == 0))
+					{
+						continue;
+					}
 
-			rating = ncard->rating - ncard->hop * HOP_RATING;
-			if(rating < MIN_RATING)
-			{
-				rating = MIN_RATING;
-			}
-			else if(rating > MAX_RATING)
-			{
-				rating = MAX_RATING;
-			}
+					if(!good_sid)
+					{
+						continue;
+					}
+				}
 
-			if(!ll_count(ncard->providers)) // card has no providers:
-			{
-				if(rating > best_rating)
+				if(!(rdr->cc_want_emu) && caid_is_nagra(ncard->caid) && (!xcard || ncard->hop < xcard->hop))
 				{
-					// ncard is closer
-					card = ncard;
-					best_rating = rating; // ncard has been matched
+					xcard = ncard; // remember card (D+ / 1810 fix) if request has no provider, but card has
 				}
 
-			}
-			else // card has providers
-			{
-				LL_ITER it2 = ll_iter_create(ncard->providers);
-				struct cc_provider *provider;
+				rating = ncard->rating - ncard->hop * HOP_RATING;
+				if(rating < MIN_RATING)
+				{
+					rating = MIN_RATING;
+				}
+				else if(rating > MAX_RATING)
+				{
+					rating = MAX_RATING;
+				}
 
-				while((provider = ll_iter_next(&it2)))
+				if(!ll_count(ncard->providers)) // card has no providers:
 				{
-					if(!cur_er->prid || !provider->prov || (provider->prov == cur_er->prid)) // provid matches
+					if(rating > best_rating)
 					{
-						if(rating > best_rating)
+						// ncard is closer
+						card = ncard;
+						best_rating = rating; // ncard has been matched
+					}
+
+				}
+				else // card has providers
+				{
+					LL_ITER it2 = ll_iter_create(ncard->providers);
+					struct cc_provider *provider;
+
+					while((provider = ll_iter_next(&it2)))
+					{
+						if(!cur_er->prid || !provider->prov || (provider->prov == cur_er->prid)) // provid matches
 						{
-							// ncard is closer
-							card = ncard;
-							best_rating = rating; // ncard has been matched
+							if(rating > best_rating)
+							{
+								// ncard is closer
+								card = ncard;
+								best_rating = rating; // ncard has been matched
+							}
 						}
 					}
 				}
@@ -1663,7 +2070,14 @@ static void reopen_sids(struct cc_data *cc, int8_t ignore_time, ECM_REQUEST *cur
 {
 	time_t utime = time(NULL);
 	struct cc_card *card;
-	LL_ITER it = ll_iter_create(cc->cards);
+	struct cc_caid_cards *caid_cards = cc_get_caid_cards(cc, cur_er->caid);
+
+	if(!caid_cards)
+	{
+		return;
+	}
+
+	LL_ITER it = ll_iter_create(caid_cards->cards);
 
 	while((card = ll_iter_next(&it)))
 	{
@@ -1679,6 +2093,7 @@ static void reopen_sids(struct cc_data *cc, int8_t ignore_time, ECM_REQUEST *cur
 					if(ignore_time || srvid->blocked_till <= utime)
 					{
 						ll_iter_remove_data(&it2);
+						cc_sid_index_update(card, cur_srvid->sid, 1, 0);
 					}
 				}
 			}
@@ -2204,6 +2619,7 @@ void cc_free_card(struct cc_card *card)
 		return;
 	}
 
+	cc_sid_index_free(card);
 	ll_destroy_data(&card->providers);
 	ll_destroy_data(&card->badsids);
 	ll_destroy_data(&card->goodsids);
@@ -2268,6 +2684,11 @@ void cc_free(struct s_client *cl)
 	cs_writelock(__func__, &cc->lockcmd);
 
 	cs_log_dbg(D_TRACE, "exit cccam1/3");
+	if(cc->cards) // reader only
+	{
+		cc_clear_cards_index(cc);
+		deinitialize_hash_table(&cc->ht_cards_caid);
+	}
 	cc_free_cardlist(cc->cards, 1);
 	ll_destroy_data(&cc->pending_emms);
 	free_extended_ecm_idx(cc);
@@ -2541,6 +2962,7 @@ struct cc_card *read_card(uint8_t *buf, int32_t buflen, int32_t ext)
 			srvid->sid = sid;
 			srvid->chid = 0;
 			srvid->ecmlen = 0;
+			cc_sid_index_add(card, sid, 0);
 			ll_append(card->goodsids, srvid);
 			offset += 2;
 		}
@@ -2560,6 +2982,7 @@ struct cc_card *read_card(uint8_t *buf, int32_t buflen, int32_t ext)
 			srvid->chid = 0;
 			srvid->ecmlen = 0;
 			srvid->blocked_till = 0;
+			cc_sid_index_add(card, sid, 1);
 			ll_append(card->badsids, srvid);
 			offset += 2;
 		}
@@ -2609,6 +3032,7 @@ void cc_card_removed(struct s_client *cl, uint32_t shareid)
 			//			card->id, card->caid, ll_count(cc->cards));
 
 			ll_iter_remove(&it);
+			cc_unindex_card(cc, card);
 			if(cc->last_emm_card == card)
 			{
 				cc->last_emm_card = NULL;
@@ -2677,6 +3101,12 @@ void move_card_to_end(struct s_client *cl, struct cc_card *card_to_move)
 		cs_log_dbg(D_READER, "%s Moving card %08X to the end...", getprefix(), card_to_move->id);
 		free_extended_ecm_idx_by_card(cl, card, 0);
 		ll_append(cc->cards, card_to_move);
+
+		struct cc_caid_cards *caid_cards = cc_get_caid_cards(cc, card_to_move->caid);
+		if(caid_cards && ll_remove(caid_cards->cards, card_to_move))
+		{
+			ll_append(caid_cards->cards, card_to_move);
+		}
 	}
 }
 
@@ -2786,6 +3216,7 @@ int32_t cc_parse_msg(struct s_client *cl, uint8_t *buf, int32_t l)
 			if(l == 0x48) // 72 bytes: normal server data
 			{
 				cs_writelock(__func__, &cc->cards_busy);
+				cc_clear_cards_index(cc);
 				cc_free_cardlist(cc->cards, 0);
 				free_extended_ecm_idx(cc);
 				cc->last_emm_card = NULL;
@@ -3037,6 +3468,7 @@ int32_t cc_parse_msg(struct s_client *cl, uint8_t *buf, int32_t l)
 				{
 					card->card_type = CT_REMOTECARD;
 					ll_append(cc->cards, card);
+					cc_index_card(cc, card);
 					set_au_data(cl, rdr, card, NULL);
 					cc->card_added_count++;
 					card->hop++;
@@ -3073,6 +3505,13 @@ int32_t cc_parse_msg(struct s_client *cl, uint8_t *buf, int32_t l)
 
 					cs_log_dbg(D_TRACE, "%s card added: id %8X remoteid %8X caid %4X hop %d reshare %d originid %8X cardtype %d",
 								getprefix(), card->id, card->remote_id, card->caid, card->hop, card->reshare, card->origin_id, card->card_type);
+
+#ifdef MODULE_CCCSHARE
+					if(cccam_share_card_added(rdr, card))
+					{
+						cc->card_shared_count++;
+					}
+#endif
 				}
 			}
 
@@ -4128,6 +4567,78 @@ void cc_send_dcw(struct s_client *cl, ECM_REQUEST *er)
 	}
 }
 
+/**
+ * reader + server:
+ * check size and parse a received message
+ */
+static int32_t cc_recv_parse(struct s_client *cl, uint8_t *buf, int32_t n)
+{
+	struct s_reader *rdr = (cl->typ == 'c') ? NULL : cl->reader;
+
+	if(n < 4)
+	{
+		cs_log("%s packet is too small (%d bytes)", getprefix(), n);
+		return -1;
+	}
+
+	if(n > CC_MAXMSGSIZE)
+	{
+		cs_log("%s packet is too big (%d bytes, max: %d)", getprefix(), n, CC_MAXMSGSIZE);
+		return -1;
+	}
+
+	// parse it and write it back, if we have received something of value
+	n = cc_parse_msg(cl, buf, n);
+	if(n == MSG_CW_ECM || n == MSG_EMM_ACK
+#ifdef CS_CACHEEX_AIO
+		 || n == MSG_CW_ECM_LGF
+#endif
+	)
+	{
+		cl->last = time(NULL); // last client action is now
+		if(rdr)
+		{
+			rdr->last_g = time(NULL); // last reader receive is now
+		}
+	}
+
+	return n;
+}
+
+/**
+ * reader:
+ * deliver a cw answer that is followed by more buffered messages,
+ * the work thread only checks the last message returned by cc_recv()
+ */
+static void cc_dispatch_dcw(struct s_client *cl, uint8_t *buf, int32_t n)
+{
+	uint8_t dcw[16];
+	int32_t i, idx, rc = n;
+
+	idx = cc_recv_chk(cl, dcw, &rc, buf, n);
+	if(idx < 0) // no dcw received
+	{
+		return;
+	}
+
+	if(!idx)
+	{
+		idx = cl->last_idx;
+	}
+
+	cl->reader->last_g = time(NULL); // for reconnect timeout
+
+	for(i = 0; i < cfg.max_pending; i++)
+	{
+		if(cl->ecmtask[i].idx == idx)
+		{
+			cl->pending--;
+			casc_check_dcw(cl->reader, i, rc, dcw);
+			break;
+		}
+	}
+}
+
 int32_t cc_recv(struct s_client *cl, uint8_t *buf, int32_t l)
 {
 	int32_t n;
@@ -4170,32 +4681,21 @@ int32_t cc_recv(struct s_client *cl, uint8_t *buf, int32_t l)
 
 		n = -1;
 	}
-	else if(n < 4)
-	{
-		cs_log("%s packet is too small (%d bytes)", getprefix(), n);
-		n = -1;
-	}
-	else if(n > CC_MAXMSGSIZE)
+	else
 	{
-		cs_log("%s packet is too big (%d bytes, max: %d)", getprefix(), n, CC_MAXMSGSIZE);
-		n = -1;
+		n = cc_recv_parse(cl, buf, n);
 	}
-	else
+
+	// messages that arrived with the same read are not signalled by the socket again
+	while(n != -1 && cc_msg_pending(cl))
 	{
-		// parse it and write it back, if we have received something of value
-		n = cc_parse_msg(cl, buf, n);
-		if(n == MSG_CW_ECM || n == MSG_EMM_ACK
-#ifdef CS_CACHEEX_AIO
-			 || n == MSG_CW_ECM_LGF
-#endif
-		)
+		if(rdr)
 		{
-			cl->last = time(NULL); // last client action is now
-			if(rdr)
-			{
-				rdr->last_g = time(NULL); // last reader receive is now
-			}
+			cc_dispatch_dcw(cl, buf, n);
 		}
+
+		n = cc_msg_recv(cl, buf, l);
+		n = (n > 0) ? cc_recv_parse(cl, buf, n) : -1;
 	}
 
 	if(n == -1)
@@ -4642,12 +5142,14 @@ int32_t cc_cli_connect(struct s_client *cl)
 
 		cc_init_locks(cc);
 		cc->cards = ll_create("cards");
+		init_hash_table(&cc->ht_cards_caid, &cc->ll_cards_caid);
 		cl->cc = cc;
 		cc->pending_emms = ll_create("pending_emms");
 		cc->extended_ecm_idx = ll_create("extended_ecm_idx");
 	}
 	else
 	{
+		cc_clear_cards_index(cc);
 		cc_free_cardlist(cc->cards, 0);
 		free_extended_ecm_idx(cc);
 	}
@@ -4690,6 +5192,8 @@ int32_t cc_cli_connect(struct s_client *cl)
 		return -1;
 	}
 
+	cc_recv_ahead_reset(cc);
+
 	int32_t no_delay = 1;
 	if(cacheex_get_rdr_mode(rdr) < 2)
 	{
@@ -4962,7 +5466,9 @@ int32_t cc_available(struct s_reader *rdr, int32_t checktype, ECM_REQUEST *er)
 	struct cc_data *cc = cl->cc;
 	if(er && cc && rdr->tcp_connected)
 	{
+		cs_readlock(__func__, &cc->cards_busy);
 		struct cc_card *card = get_matching_card(cl, er, 1);
+		cs_readunlock(__func__, &cc->cards_busy);
 		if(!card)
 		{
 			return 0;
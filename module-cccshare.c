@@ -18,6 +18,8 @@ extern uint32_t cfg_sidtab_generation;
 
 static uint32_t cc_share_id = 0x64;
 static LLIST *reported_carddatas_list[CAID_KEY];
+static hash_table ht_reported_cards; // reported cards by card_share_hash(card, 1)
+static LLIST *share_card_deltas; // new cccam reader cards, reported by the share updater
 static CS_MUTEX_LOCK cc_shares_lock;
 
 static int32_t card_added_count;
@@ -27,6 +29,12 @@ static pthread_t share_updater_thread;
 static bool share_updater_thread_active;
 static bool share_updater_refresh;
 
+struct cc_server_cards
+{
+	hash_table ht; // server cards by card_share_hash()
+	list ll; // server cards in order of adding
+};
+
 int32_t card_valid_for_client(struct s_client *cl, struct cc_card *card);
 
 LLIST *get_cardlist(uint16_t caid, LLIST **list)
@@ -61,7 +69,10 @@ void add_good_sids(struct s_sidtab *ptr, struct cc_card *card)
 		srvid->ecmlen = 0; // 0=undefined, also not used with "O" CCcam
 
 		if(!ll_contains_data(card->goodsids, srvid, sizeof(struct cc_srvid)))
-			{ ll_append(card->goodsids, srvid); }
+		{
+			cc_sid_index_add(card, srvid->sid, 0);
+			ll_append(card->goodsids, srvid);
+		}
 		else { NULLFREE(srvid);}
 	}
 }
@@ -80,7 +91,10 @@ void add_bad_sids(struct s_sidtab *ptr, struct cc_card *card)
 		srvid->blocked_till = 0;
 
 		if(!ll_contains_data(card->badsids, srvid, sizeof(struct cc_srvid_block)))
-			{ ll_append(card->badsids, srvid); }
+		{
+			cc_sid_index_add(card, srvid->sid, 1);
+			ll_append(card->badsids, srvid);
+		}
 		else { NULLFREE(srvid); }
 	}
 }
@@ -289,10 +303,12 @@ static int32_t is_client_au_allowed(struct cc_card *card, struct s_client *cl)
 	return 0;
 }
 
-static int32_t send_card_to_client(struct cc_card *card, struct s_client *cl)
+/**
+ * writes the card message for this client to buf
+ * returns the message length, 0 if the card is not shared with this client
+ */
+static int32_t write_card_to_client(struct cc_card *card, struct s_client *cl, uint8_t *buf, cc_msg_type_t *cmd)
 {
-	uint8_t buf[CC_MAXMSGSIZE];
-
 	if(!card_valid_for_client(cl, card))
 		{ return 0; }
 
@@ -338,12 +354,25 @@ static int32_t send_card_to_client(struct cc_card *card, struct s_client *cl)
 	//buf[10] = card->hop-1;
 	buf[11] = new_reshare;
 
+	*cmd = is_ext ? MSG_NEW_CARD_SIDINFO : MSG_NEW_CARD;
+	return len;
+}
+
+static int32_t send_card_to_client(struct cc_card *card, struct s_client *cl)
+{
+	uint8_t buf[CC_MAXMSGSIZE];
+	cc_msg_type_t cmd;
+
+	int32_t len = write_card_to_client(card, cl, buf, &cmd);
+	if(!len)
+		{ return 0; }
+
 	struct s_clientmsg *clientmsg;
 	if(cs_malloc(&clientmsg, sizeof(struct s_clientmsg)))
 	{
 		memcpy(clientmsg->msg, buf, len);
 		clientmsg->len = len;
-		clientmsg->cmd = is_ext ? MSG_NEW_CARD_SIDINFO : MSG_NEW_CARD;
+		clientmsg->cmd = cmd;
 		add_job(cl, ACTION_CLIENT_SEND_MSG, clientmsg, sizeof(struct s_clientmsg));
 	}
 	return 1;
@@ -489,51 +518,6 @@ int32_t chk_ident(FTAB *ftab, struct cc_card *card)
 	return res;
 }
 
-int32_t cc_clear_reported_carddata(LLIST *reported_carddatas, LLIST *except, int32_t send_removed)
-{
-	int32_t i = 0;
-	LL_ITER it = ll_iter_create(reported_carddatas);
-	struct cc_card *card;
-	while((card = ll_iter_next(&it)))
-	{
-		struct cc_card *card2 = NULL;
-		if(except)
-		{
-			LL_ITER it2 = ll_iter_create(except);
-			while((card2 = ll_iter_next(&it2)))
-			{
-				if(card == card2)
-					{ break; }
-			}
-		}
-
-		if(!card2 && ll_iter_remove(&it)) // check result of ll_iter_remove, because another thread could removed it
-		{
-			if(send_removed)
-			{
-				cs_log_dbg(D_TRACE, "s-card removed: id %8X remoteid %8X caid %4X hop %d reshare %d originid %8X cardtype %d",
-							card->id, card->remote_id, card->caid, card->hop, card->reshare, card->origin_id, card->card_type);
-
-				send_remove_card_to_clients(card);
-			}
-			cc_free_card(card);
-			i++;
-		}
-	}
-	return i;
-}
-
-int32_t cc_free_reported_carddata(LLIST *reported_carddatas, LLIST *except, int32_t send_removed)
-{
-	int32_t i = 0;
-	if(reported_carddatas)
-	{
-		i = cc_clear_reported_carddata(reported_carddatas, except, send_removed);
-		ll_destroy(&reported_carddatas);
-	}
-	return i;
-}
-
 int32_t card_valid_for_client(struct s_client *cl, struct cc_card *card)
 {
 
@@ -772,6 +756,7 @@ struct cc_card *create_card(struct cc_card *card)
 	card2->badsids = ll_create("badsids");
 	card2->goodsids = ll_create("goodsids");
 	card2->remote_nodes = ll_create("remote_nodes");
+	card2->sid_index = NULL; // copied sids below are not indexed
 
 	if(card)
 	{
@@ -928,23 +913,81 @@ void merge_sids(struct cc_card *carddst, struct cc_card *cardsrc)
 
 }
 
+/**
+ * returns true if cards are merged by caid/hops, false if only cards with same ids are merged
+ **/
+static int32_t share_minimized(void)
+{
+	return (cfg.cc_minimize_cards == MINIMIZE_CAID || cfg.cc_minimize_cards == MINIMIZE_HOPS) && !cfg.cc_forward_origin_card;
+}
+
+/**
+ * hash of the fields compared by same_card2() without group.
+ * full adds the remaining fields compared by same_card() (group, remote id, first node)
+ **/
+static uint32_t card_share_hash(struct cc_card *card, int32_t full)
+{
+	uint32_t hash = tommy_hash_u32(0, &card->caid, sizeof(card->caid));
+	hash = tommy_hash_u32(hash, &card->card_type, sizeof(card->card_type));
+	hash = tommy_hash_u32(hash, &card->sidtab, sizeof(card->sidtab));
+	hash = tommy_hash_u32(hash, card->hexserial, sizeof(card->hexserial));
+	if(full)
+	{
+		uint8_t *node1 = ll_has_elements(card->remote_nodes);
+		hash = tommy_hash_u32(hash, &card->grp, sizeof(card->grp));
+		hash = tommy_hash_u32(hash, &card->remote_id, sizeof(card->remote_id));
+		if(node1)
+			{ hash = tommy_hash_u32(hash, node1, 8); }
+	}
+	return hash;
+}
+
+/**
+ * returns the next server card with this hash and advances n
+ **/
+static struct cc_card *next_server_card(tommy_hashlin_node **n, uint32_t hash)
+{
+	while(*n)
+	{
+		struct cc_card *card = (*n)->data;
+		int32_t found = (*n)->index == hash;
+		*n = (*n)->next;
+		if(found)
+			{ return card; }
+	}
+	return NULL;
+}
+
+static void insert_server_card(struct cc_server_cards *server_cards, struct cc_card *card, uint32_t hash)
+{
+	tommy_hashlin_insert(&server_cards->ht, &card->ht_node, card, hash);
+	tommy_list_insert_tail(&server_cards->ll, &card->ll_node, card);
+}
+
+static void remove_server_card(struct cc_server_cards *server_cards, struct cc_card *card)
+{
+	remove_elem_hash_table(&server_cards->ht, &card->ht_node);
+	remove_elem_list(&server_cards->ll, &card->ll_node);
+}
+
 /**
  * Adds a new card to a cardlist.
  */
-int32_t add_card_to_serverlist(LLIST *cardlist, struct cc_card *card, int8_t free_card)
+static int32_t add_card_to_serverlist(struct cc_server_cards *server_cards, struct cc_card *card, int8_t free_card)
 {
 
 	int32_t modified = 0;
 	if(!card)
 		{ return modified; }
 
-	LL_ITER it = ll_iter_create(cardlist);
+	uint32_t hash = card_share_hash(card, !share_minimized());
+	tommy_hashlin_node *n = tommy_hashlin_bucket(&server_cards->ht, hash);
 	struct cc_card *card2;
 
 	// Minimize all, transmit just CAID, merge providers:
 	if(cfg.cc_minimize_cards == MINIMIZE_CAID && !cfg.cc_forward_origin_card)
 	{
-		while((card2 = ll_iter_next(&it)))
+		while((card2 = next_server_card(&n, hash)))
 		{
 			// compare caid, hexserial, cardtype and sidtab (if any):
 			if(same_card2(card, card2, 0))
@@ -966,7 +1009,7 @@ int32_t add_card_to_serverlist(LLIST *cardlist, struct cc_card *card, int8_t fre
 			if(free_card) // Use this card
 			{
 				free_card = 0;
-				ll_iter_insert(&it, card);
+				insert_server_card(server_cards, card, hash);
 			}
 			else
 			{
@@ -974,7 +1017,7 @@ int32_t add_card_to_serverlist(LLIST *cardlist, struct cc_card *card, int8_t fre
 				if(!card2)
 					{ return modified; }
 				card2->hop = 0;
-				ll_iter_insert(&it, card2);
+				insert_server_card(server_cards, card2, hash);
 				add_card_providers(card2, card, 1); // copy providers to new card. Copy remote nodes to new card
 			}
 			modified = 1;
@@ -993,7 +1036,7 @@ int32_t add_card_to_serverlist(LLIST *cardlist, struct cc_card *card, int8_t fre
 	// Removed duplicate cards, keeping card with lower hop:
 	else if(cfg.cc_minimize_cards == MINIMIZE_HOPS && !cfg.cc_forward_origin_card)
 	{
-		while((card2 = ll_iter_next(&it)))
+		while((card2 = next_server_card(&n, hash)))
 		{
 			// compare caid, hexserial, cardtype, sidtab (if any), providers:
 			if(same_card2(card, card2, 0) && equal_providers(card, card2))
@@ -1004,7 +1047,7 @@ int32_t add_card_to_serverlist(LLIST *cardlist, struct cc_card *card, int8_t fre
 
 		if(card2 && card2->hop > card->hop) // hop is smaller, drop old card
 		{
-			ll_iter_remove(&it);
+			remove_server_card(server_cards, card2);
 			cc_free_card(card2);
 			card2 = NULL;
 			card_dup_count++;
@@ -1015,14 +1058,14 @@ int32_t add_card_to_serverlist(LLIST *cardlist, struct cc_card *card, int8_t fre
 			if(free_card) // use this card
 			{
 				free_card = 0;
-				ll_iter_insert(&it, card);
+				insert_server_card(server_cards, card, hash);
 			}
 			else
 			{
 				card2 = create_card(card); // copy card
 				if(!card2)
 					{ return modified; }
-				ll_iter_insert(&it, card2);
+				insert_server_card(server_cards, card2, hash);
 				add_card_providers(card2, card, 1); // copy providers to new card. Copy remote nodes to new card
 			}
 			modified = 1;
@@ -1039,7 +1082,7 @@ int32_t add_card_to_serverlist(LLIST *cardlist, struct cc_card *card, int8_t fre
 	// like cccam:
 	else // just remove duplicate cards (same ids)
 	{
-		while((card2 = ll_iter_next(&it)))
+		while((card2 = next_server_card(&n, hash)))
 		{
 			// compare remote_id, first_node, caid, hexserial, cardtype, sidtab (if any), providers:
 			if(same_card(card, card2))
@@ -1048,7 +1091,7 @@ int32_t add_card_to_serverlist(LLIST *cardlist, struct cc_card *card, int8_t fre
 
 		if(card2 && card2->hop > card->hop) // same card, if hop greater drop card
 		{
-			ll_iter_remove(&it);
+			remove_server_card(server_cards, card2);
 			cc_free_card(card2);
 			card2 = NULL;
 			card_dup_count++;
@@ -1058,14 +1101,14 @@ int32_t add_card_to_serverlist(LLIST *cardlist, struct cc_card *card, int8_t fre
 			if(free_card)
 			{
 				free_card = 0;
-				ll_iter_insert(&it, card);
+				insert_server_card(server_cards, card, hash);
 			}
 			else
 			{
 				card2 = create_card(card);
 				if(!card2)
 					{ return modified; }
-				ll_iter_insert(&it, card2);
+				insert_server_card(server_cards, card2, hash);
 				add_card_providers(card2, card, 1);
 			}
 			modified = 1;
@@ -1102,20 +1145,22 @@ int32_t card_timed_out(struct cc_card *card)
  * if the card1 is already reported, we throw it away, because we build a new sharelist
  * so after finding all reported cards, we have a list of reported cards, which aren't used anymore
  **/
-int32_t find_reported_card(struct cc_card *card1)
+static int compare_reported_card(const void *arg, const void *obj)
 {
-	LL_ITER it = ll_iter_create(get_cardlist(card1->caid, reported_carddatas_list));
-	struct cc_card *card2;
-	while((card2 = ll_iter_next(&it)))
+	struct cc_card *card1 = (struct cc_card *)arg;
+	struct cc_card *card2 = (struct cc_card *)obj;
+	return !(same_card(card1, card2) && !card_timed_out(card2));
+}
+
+int32_t find_reported_card(struct cc_card *card1, uint32_t hash)
+{
+	struct cc_card *card2 = tommy_hashlin_search(&ht_reported_cards, &compare_reported_card, card1, hash);
+	if(card2)
 	{
-		if(same_card(card1, card2) && !card_timed_out(card2))
-		{
-			card1->id = card2->id; //Set old id !!
-			card1->timeout = card2->timeout;
-			cc_free_card(card2);
-			ll_iter_remove(&it);
-			return 1; //Old card and new card are equal!
-		}
+		card1->id = card2->id; //Set old id !!
+		card1->timeout = card2->timeout;
+		remove_elem_hash_table(&ht_reported_cards, &card2->ht_node); // freed with the old sharelist
+		return 1; //Old card and new card are equal!
 	}
 	return 0; //Card not found
 }
@@ -1135,9 +1180,10 @@ void cc_add_reported_carddata(LLIST *reported_carddatas, struct cc_card *card)
  * if this card is already reported, find_reported_card throws the "origin" card away
  * so the "old" sharelist is reduced
  **/
-void report_card(struct cc_card *card, LLIST *new_reported_carddatas, LLIST *new_cards)
+void report_card(struct cc_card *card, LLIST **new_reported_carddatas, hash_table *ht_new_reported, LLIST *new_cards)
 {
-	if(!find_reported_card(card))    //Add new card:
+	uint32_t hash = card_share_hash(card, 1);
+	if(!find_reported_card(card, hash))    //Add new card:
 	{
 
 		cs_log_dbg(D_TRACE, "s-card added: id %8X remoteid %8X caid %4X hop %d reshare %d originid %8X cardtype %d",
@@ -1147,7 +1193,22 @@ void report_card(struct cc_card *card, LLIST *new_reported_carddatas, LLIST *new
 
 		card_added_count++;
 	}
-	cc_add_reported_carddata(new_reported_carddatas, card);
+	tommy_hashlin_insert(ht_new_reported, &card->ht_node, card, hash);
+	cc_add_reported_carddata(get_cardlist(card->caid, new_reported_carddatas), card);
+}
+
+/**
+ * old reported card which is not in the new sharelist
+ **/
+static void report_removed_card(void *arg, void *obj)
+{
+	struct cc_card *card = obj;
+
+	cs_log_dbg(D_TRACE, "s-card removed: id %8X remoteid %8X caid %4X hop %d reshare %d originid %8X cardtype %d",
+				card->id, card->remote_id, card->caid, card->hop, card->reshare, card->origin_id, card->card_type);
+
+	send_remove_card_to_clients(card);
+	(*(int32_t *)arg)++;
 }
 
 
@@ -1165,13 +1226,14 @@ void update_card_list(void)
 {
 	int32_t i, j, k, l, card_count = 0;
 
-	LLIST *server_cards[CAID_KEY];
+	struct cc_server_cards server_cards;
 	LLIST *new_reported_carddatas[CAID_KEY];
+	hash_table ht_new_reported;
 
 	LL_ITER it, it2;
 	struct cc_card *card;
 
-	memset(server_cards, 0, sizeof(server_cards));
+	init_hash_table(&server_cards.ht, &server_cards.ll);
 	memset(new_reported_carddatas, 0, sizeof(new_reported_carddatas));
 
 	card_added_count = 0;
@@ -1200,7 +1262,7 @@ void update_card_list(void)
 					ll_append(card->providers, prov);
 				}
 
-				add_card_to_serverlist(get_cardlist(card->caid, server_cards), card, 1);
+				add_card_to_serverlist(&server_cards, card, 1);
 			}
 		}
 	}
@@ -1268,7 +1330,7 @@ void update_card_list(void)
 								if(!rdr->audisabled)
 									{ cc_UA_ncam2cccam(rdr->hexserial, card->hexserial, card->caid); }
 
-								add_card_to_serverlist(get_cardlist(card->caid, server_cards), card, 1);
+								add_card_to_serverlist(&server_cards, card, 1);
 								flt = 1;
 							}
 							else
@@ -1323,7 +1385,7 @@ void update_card_list(void)
 						}
 
 						add_good_bad_sids_by_rdr(rdr, card);
-						add_card_to_serverlist(get_cardlist(caid, server_cards), card, 1);
+						add_card_to_serverlist(&server_cards, card, 1);
 						flt = 1;
 					}
 				}
@@ -1353,7 +1415,7 @@ void update_card_list(void)
 							{ cc_UA_ncam2cccam(rdr->hexserial, card->hexserial, lcaid); }
 
 						add_good_bad_sids_by_rdr(rdr, card);
-						add_card_to_serverlist(get_cardlist(lcaid, server_cards), card, 1);
+						add_card_to_serverlist(&server_cards, card, 1);
 						flt = 1;
 					}
 				}
@@ -1398,7 +1460,7 @@ void update_card_list(void)
 							//cs_log("Main CCcam card report provider: %02X%02X%02X%02X", buf[21+(j*7)], buf[22+(j*7)], buf[23+(j*7)], buf[24+(j*7)]);
 						}
 						add_good_bad_sids_by_rdr(rdr, card);
-						add_card_to_serverlist(get_cardlist(caid, server_cards), card, 1);
+						add_card_to_serverlist(&server_cards, card, 1);
 						flt = 1;
 					}
 				}
@@ -1441,7 +1503,7 @@ void update_card_list(void)
 						//cs_log("Main CCcam card report provider: %02X%02X%02X%02X", buf[21+(j*7)], buf[22+(j*7)], buf[23+(j*7)], buf[24+(j*7)]);
 					}
 					add_good_bad_sids_by_rdr(rdr, card);
-					add_card_to_serverlist(get_cardlist(caid, server_cards), card, 1);
+					add_card_to_serverlist(&server_cards, card, 1);
 				}
 			}
 
@@ -1480,7 +1542,7 @@ void update_card_list(void)
 
 							if(dont_ignore)    //Filtered by service
 							{
-								add_card_to_serverlist(get_cardlist(card->caid, server_cards), card, 0);
+								add_card_to_serverlist(&server_cards, card, 0);
 								count++;
 							}
 						}
@@ -1497,31 +1559,31 @@ void update_card_list(void)
 
 	LLIST *new_cards = ll_create("new_cards"); //List of new (added) cards
 
+	// the hash nodes of the server cards are reused by the new sharelist:
+	deinitialize_hash_table(&server_cards.ht);
+	tommy_hashlin_init(&ht_new_reported);
+
 	cs_writelock(__func__, &cc_shares_lock);
 
 	//report reshare cards:
-	//cs_log_dbg(D_TRACE, "%s reporting %d cards", getprefix(), ll_count(server_cards));
-	for(i = 0; i < CAID_KEY; i++)
+	//we compare every card of our new list (server_cards) with the last list.
+	tommy_node *n = get_first_node_list(&server_cards.ll);
+	while(n)
 	{
-		if(server_cards[i])
-		{
-			it = ll_iter_create(server_cards[i]);
-
-			//we compare every card of our new list (server_cards) with the last list.
-			while((card = ll_iter_next(&it)))
-			{
-				//cs_log_dbg(D_TRACE, "%s card %d caid %04X hop %d", getprefix(), card->id, card->caid, card->hop);
+		card = n->data;
+		n = n->next;
+		//cs_log_dbg(D_TRACE, "%s card %d caid %04X hop %d", getprefix(), card->id, card->caid, card->hop);
+		report_card(card, new_reported_carddatas, &ht_new_reported, new_cards);
+	}
 
-				if(!new_reported_carddatas[i])
-					{ new_reported_carddatas[i] = ll_create("new_cardlist"); }
-				report_card(card, new_reported_carddatas[i], new_cards);
-				ll_iter_remove(&it);
-			}
-			cc_free_cardlist(server_cards[i], 1);
-		}
+	//remove unsed, remaining cards:
+	tommy_hashlin_foreach_arg(&ht_reported_cards, &report_removed_card, &card_removed_count);
+	deinitialize_hash_table(&ht_reported_cards);
+	ht_reported_cards = ht_new_reported;
 
-		//remove unsed, remaining cards:
-		card_removed_count += cc_free_reported_carddata(reported_carddatas_list[i], new_reported_carddatas[i], 1);
+	for(i = 0; i < CAID_KEY; i++)
+	{
+		cc_free_cardlist(reported_carddatas_list[i], 1);
 		reported_carddatas_list[i] = new_reported_carddatas[i];
 		card_count += ll_count(reported_carddatas_list[i]);
 		//cs_log_dbg(D_TRACE, "CARDS FOR INDEX %d=%d", i, ll_count(reported_carddatas[i]));
@@ -1542,25 +1604,167 @@ void update_card_list(void)
 				  card_added_count, card_removed_count, card_dup_count, card_count);
 }
 
+/**
+ * returns true if new cccam reader cards can be reported without rebuilding the sharelist:
+ * cards are only merged by same_card() and reader cards are reshared
+ **/
+static int32_t share_delta_enabled(void)
+{
+	return !share_minimized() && (cfg.cc_reshare_services < 2 || cfg.cc_reshare_services == 4);
+}
+
+/**
+ * Reader:
+ * a cccam reader received a new card, queue a copy for the share updater,
+ * which reports it to the clients without rebuilding the sharelist.
+ * call with cards_busy write locked
+ * returns 1 if the card is handled, 0 if the sharelist needs a rebuild
+ **/
+int32_t cccam_share_card_added(struct s_reader *rdr, struct cc_card *card)
+{
+	struct s_client *rc = rdr->client;
+	if(!share_card_deltas || !rc || !share_delta_enabled() || rdr->card_status == CARD_FAILURE)
+		{ return 0; }
+
+	if(!chk_ctab(card->caid, &rdr->ctab)) // Filtered by caid, not shared
+		{ return 1; }
+
+	int32_t dont_ignore = ll_count(card->providers) ? 0 : 1;
+
+	LL_ITER it = ll_iter_create(card->providers);
+	struct cc_provider *prov;
+	while((prov = ll_iter_next(&it)))
+	{
+		if(chk_srvid_by_caid_prov(rc, card->caid, prov->prov))
+		{
+			dont_ignore = 1;
+			break;
+		}
+	}
+
+	if(!dont_ignore) // Filtered by service, not shared
+		{ return 1; }
+
+	struct cc_card *card2 = create_card(card);
+	if(!card2)
+		{ return 0; }
+	add_card_providers(card2, card, 1);
+	ll_append(share_card_deltas, card2);
+	return 1;
+}
+
+/**
+ * Server:
+ * Reports the queued cccam reader cards to the connected clients
+ * returns 0 if a card replaces a reported card and the sharelist needs a rebuild
+ **/
+static int32_t report_card_deltas(void)
+{
+	int32_t res = 1, count = 0;
+	struct cc_card *card, *card2;
+
+	if(!ll_count(share_card_deltas))
+		{ return res; }
+
+	cs_writelock(__func__, &cc_shares_lock);
+
+	LL_ITER it = ll_iter_create(share_card_deltas);
+	while((card = ll_iter_next_remove(&it)))
+	{
+		if(!res || !share_delta_enabled())
+		{
+			res = 0;
+			cc_free_card(card);
+			continue;
+		}
+
+		uint32_t hash = card_share_hash(card, 1);
+		card2 = tommy_hashlin_search(&ht_reported_cards, &compare_reported_card, card, hash);
+		if(card2) // already reported, a smaller hop replaces it
+		{
+			if(card2->hop > card->hop)
+				{ res = 0; }
+			cc_free_card(card);
+			continue;
+		}
+
+		cs_log_dbg(D_TRACE, "s-card added: id %8X remoteid %8X caid %4X hop %d reshare %d originid %8X cardtype %d",
+					card->id, card->remote_id, card->caid, card->hop, card->reshare, card->origin_id, card->card_type);
+
+		tommy_hashlin_insert(&ht_reported_cards, &card->ht_node, card, hash);
+		cc_add_reported_carddata(get_cardlist(card->caid, reported_carddatas_list), card);
+		send_card_to_all_clients(card);
+		count++;
+	}
+
+	cs_writeunlock(__func__, &cc_shares_lock);
+
+	cs_log_dbg(D_TRACE, "reported +%d cards to sharelist", count);
+	return res;
+}
+
+#define REPORT_BUFSIZE 0x8000
+
+/**
+ * Server:
+ * Reports all cards to a new client. The card messages are collected
+ * in one buffer, then encrypted and sent at once on the corked socket,
+ * so no other message can get between them
+ * returns 1=ok, 0=client disconnected
+ */
 int32_t cc_srv_report_cards(struct s_client *cl)
 {
 
 	struct cc_card *card;
-	int32_t i, count = 0;
+	int32_t i, count = 0, len, size = REPORT_BUFSIZE, pos = 0;
+	uint8_t buf[CC_MAXMSGSIZE];
+	uint8_t *msgs;
+	cc_msg_type_t cmd;
 	LL_ITER it;
+
+	if(!cs_malloc(&msgs, size))
+		{ return 0; }
+
 	cs_readlock(__func__, &cc_shares_lock);
 	for(i = 0; i < CAID_KEY; i++)
 	{
 		if(reported_carddatas_list[i])
 		{
 			it = ll_iter_create(reported_carddatas_list[i]);
-			while(cl->cc && !cl->kill && (card = ll_iter_next(&it)))
+			while(msgs && cl->cc && !cl->kill && (card = ll_iter_next(&it)))
 			{
-				count += send_card_to_client(card, cl);
+				len = write_card_to_client(card, cl, buf, &cmd);
+				if(!len)
+					{ continue; }
+
+				if(pos + len + 4 > size)
+				{
+					size *= 2;
+					if(!cs_realloc(&msgs, size))
+						{ break; }
+				}
+				pos += cc_cmd_frame(cl->cc, msgs + pos, buf, len, cmd);
+				count++;
 			}
 		}
 	}
 	cs_readunlock(__func__, &cc_shares_lock);
+
+	if(msgs && pos && cl->cc && !cl->kill)
+	{
+#ifdef TCP_CORK
+		int32_t cork = 1;
+		setsockopt(cl->udp_fd, IPPROTO_TCP, TCP_CORK, &cork, sizeof(cork));
+#endif
+		cc_cmd_send_frames(cl, msgs, pos);
+#ifdef TCP_CORK
+		cork = 0;
+		if(cl->udp_fd)
+			{ setsockopt(cl->udp_fd, IPPROTO_TCP, TCP_CORK, &cork, sizeof(cork)); }
+#endif
+	}
+	NULLFREE(msgs);
+
 	cs_log_dbg(D_TRACE, "reported %d cards for %s", count, username(cl));
 
 	return cl->cc && !cl->kill;
@@ -1620,6 +1824,8 @@ void share_updater(void)
 
 		cs_log_dbg(D_TRACE, "share-updater check");
 
+		int8_t cardschanged = !report_card_deltas();
+
 		uint32_t cur_check = 0;
 		uint32_t cur_card_check = 0;
 		int8_t rdroptionchange = 0;
@@ -1634,7 +1840,7 @@ void share_updater(void)
 			struct s_client *cl = rdr->client;
 			if(cl && (cc = cl->cc))  //check cccam-cardlist:
 			{
-				cur_card_check += cc->card_added_count;
+				cur_card_check += cc->card_added_count - cc->card_shared_count;
 				cur_card_check += cc->card_removed_count;
 				card_count += ll_count(cc->cards);
 			}
@@ -1681,7 +1887,7 @@ void share_updater(void)
 			last_card_check = cur_card_check;
 		}
 		//update cardlist if cccam cards has changed:
-		else if(cur_card_check != last_card_check)
+		else if(cur_card_check != last_card_check || cardschanged)
 		{
 			cs_log_dbg(D_TRACE, "share-update [2] %u %u", cur_card_check, last_card_check);
 			refresh_shares();
@@ -1689,8 +1895,15 @@ void share_updater(void)
 		}
 		last_check_rdroptions = cur_check_rdroptions;
 	}
+	cs_writelock(__func__, &cc_shares_lock);
 	for(i = 0; i < CAID_KEY; i++)
-		{ cc_free_reported_carddata(reported_carddatas_list[i], NULL, 0); }
+	{
+		cc_free_cardlist(reported_carddatas_list[i], 1);
+		reported_carddatas_list[i] = NULL;
+	}
+	deinitialize_hash_table(&ht_reported_cards);
+	cc_free_cardlist(share_card_deltas, 0);
+	cs_writeunlock(__func__, &cc_shares_lock);
 }
 
 int32_t compare_cards_by_hop(struct cc_card **pcard1, struct cc_card **pcard2)
@@ -1723,6 +1936,8 @@ struct cc_card **get_sorted_card_copy(LLIST *cards, int32_t reverse, int32_t *si
 void cccam_init_share(void)
 {
 	memset(reported_carddatas_list, 0, sizeof(reported_carddatas_list));
+	tommy_hashlin_init(&ht_reported_cards);
+	share_card_deltas = ll_create("share_card_deltas");
 	cs_lock_create(__func__, &cc_shares_lock, "cc_shares_lock", 200000);
 
 	share_updater_thread = 0;
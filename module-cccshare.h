@@ -15,7 +15,9 @@ LLIST *get_cardlist(uint16_t caid, LLIST **list);
 
 void cc_free_card(struct cc_card *card);
 void cc_free_cardlist(LLIST *card_list, int32_t destroy_list);
+int32_t cc_cmd_frame(struct cc_data *cc, uint8_t *netbuf, uint8_t *buf, int32_t len, cc_msg_type_t cmd);
 int32_t cc_cmd_send(struct s_client *cl, uint8_t *buf, int32_t len, cc_msg_type_t cmd);
+int32_t cc_cmd_send_frames(struct s_client *cl, uint8_t *netbuf, int32_t len);
 int32_t sid_eq(struct cc_srvid *srvid1, struct cc_srvid *srvid2);
 int32_t sid_eq_nb(struct cc_srvid *srvid1, struct cc_srvid_block *srvid2);
 int32_t sid_eq_bb(struct cc_srvid_block *srvid1, struct cc_srvid_block *srvid2);
@@ -32,10 +34,12 @@ void add_good_sid(struct cc_card *card, struct cc_srvid *srvid_good);
 void remove_good_sid(struct cc_card *card, struct cc_srvid *srvid_good);
 void add_sid_block(struct cc_card *card, struct cc_srvid *srvid_blocked, bool temporary);
 void remove_sid_block(struct cc_card *card, struct cc_srvid *srvid_blocked);
+void cc_sid_index_add(struct cc_card *card, uint16_t sid, int8_t bad);
 
 void merge_sids(struct cc_card *carddst, struct cc_card *cardsrc);
 
 void cccam_refresh_share(void);
+int32_t cccam_share_card_added(struct s_reader *rdr, struct cc_card *card);
 
 int32_t hide_card_to_client(struct cc_card *card, struct s_client *cl);
 int32_t unhide_card_to_client(struct cc_card *card, struct s_client *cl);
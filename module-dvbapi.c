@@ -29,6 +29,11 @@
 #include "cscrypt/md5.h"
 extern int32_t exit_oscam;
 
+#if defined(__linux__)
+#include <sys/epoll.h>
+#define DVBAPI_EPOLL
+#endif
+
 #if defined (__CYGWIN__)
 #define F_NOTIFY 0
 #define F_SETSIG 0
@@ -388,7 +393,32 @@ static uint32_t ca_descramblers_total = 0; // total number of available descramb
 static uint32_t ca_descramblers_used = 0; // total number of used descramblers during decoding
 static int32_t ca_fd[CA_MAX]; // holds fd handle of all ca devices (0 not in use)
 static LLIST *ll_activestreampids; // list of all enabled streampids on ca devices
-static int32_t assoc_fd[MAX_ASSOC_FD]; // list of all client sockets
+
+// client socket with its partly received messages and not yet sent packets
+struct s_dvbapi_conn
+{
+	int32_t fd; // 0 = slot not in use
+	uint16_t proto_version;
+	int8_t closing;
+	int8_t polling_out;
+	uint8_t *rbuf;
+	uint32_t rstart;
+	uint32_t rend;
+	uint8_t *wbuf;
+	uint32_t wlen;
+	int8_t corked; // packets of corker are collected until dvbapi_net_uncork()
+	pthread_t corker;
+};
+
+static struct s_dvbapi_conn dvbapi_conns[MAX_ASSOC_FD]; // list of all client sockets
+#ifdef __powerpc__
+static pthread_mutex_t dvbapi_conns_lock;
+#else
+static pthread_mutex_t dvbapi_conns_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+#ifdef DVBAPI_EPOLL
+static int32_t dvbapi_epollfd = -1;
+#endif
 
 bool is_dvbapi_usr(char *usr)
 {
@@ -409,6 +439,16 @@ struct s_emm_filter
 static LLIST *ll_emm_active_filter;
 static LLIST *ll_emm_inactive_filter;
 static LLIST *ll_emm_pending_filter;
+static struct s_emm_filter *emm_filter_index[MAX_DEMUX][MAX_FILTER]; // active emmfilters by demuxer and filter number
+
+static void emm_filter_unindex(struct s_emm_filter *filter_item)
+{
+	if(filter_item->demux_id >= 0 && filter_item->demux_id < MAX_DEMUX && filter_item->num >= 1 && filter_item->num <= MAX_FILTER
+		&& emm_filter_index[filter_item->demux_id][filter_item->num - 1] == filter_item)
+	{
+		emm_filter_index[filter_item->demux_id][filter_item->num - 1] = NULL;
+	}
+}
 
 int32_t add_emmfilter_to_list(int32_t demux_id, uint8_t *filter, uint16_t caid, uint32_t provid, uint16_t emmpid, int32_t num, bool enable)
 {
@@ -452,6 +492,10 @@ int32_t add_emmfilter_to_list(int32_t demux_id, uint8_t *filter, uint16_t caid,
 	if(num > 0)
 	{
 		ll_append(ll_emm_active_filter, filter_item);
+		if(demux_id >= 0 && demux_id < MAX_DEMUX && num <= MAX_FILTER)
+		{
+			emm_filter_index[demux_id][num - 1] = filter_item;
+		}
 		cs_log_dbg(D_DVBAPI, "Demuxer %d Filter %d added to active emmfilters (CAID %04X PROVID %06X EMMPID %04X)",
 			filter_item->demux_id, filter_item->num, filter_item->caid, filter_item->provid, filter_item->pid);
 	}
@@ -479,8 +523,8 @@ int32_t is_emmfilter_in_list_internal(LLIST *ll, uint8_t *filter, uint16_t emmpi
 		itr = ll_iter_create(ll);
 		while((filter_item = ll_iter_next(&itr)) != NULL)
 		{
-			if(!memcmp(filter_item->filter, filter, 32) && (filter_item->pid == emmpid)
-				&& (filter_item->provid == provid) && (filter_item->caid == caid))
+			if((filter_item->pid == emmpid) && (filter_item->provid == provid) && (filter_item->caid == caid)
+				&& !memcmp(filter_item->filter, filter, 32))
 			{
 				return 1;
 			}
@@ -535,6 +579,12 @@ struct s_emm_filter *get_emmfilter_by_filternum_internal(LLIST *ll, int32_t demu
 
 struct s_emm_filter *get_emmfilter_by_filternum(int32_t demux_id, uint32_t num)
 {
+	// active emmfilters, the only ones with a filter number, are found without searching
+	if(demux_id >= 0 && demux_id < MAX_DEMUX && num >= 1 && num <= MAX_FILTER)
+	{
+		return emm_filter_index[demux_id][num - 1];
+	}
+
 	if(!ll_emm_active_filter)
 	{
 		ll_emm_active_filter = ll_create("ll_emm_active_filter");
@@ -585,6 +635,7 @@ int8_t remove_emmfilter_from_list_internal(LLIST *ll, int32_t demux_id, uint16_t
 		{
 			if(filter->demux_id == demux_id && filter->caid == caid && filter->provid == provid && filter->pid == pid && filter->num == num)
 			{
+				emm_filter_unindex(filter);
 				ll_iter_remove_data(&itr);
 				return 1;
 			}
@@ -603,6 +654,154 @@ void remove_emmfilter_from_list(int32_t demux_id, uint16_t caid, uint32_t provid
 	}
 }
 
+/*
+ * Lays filter and mask of a demux filter out like the section they are matched
+ * against, so filtermatch() compares whole words instead of single bytes.
+ */
+static void dvbapi_compile_filter(int32_t demux_id, int32_t num)
+{
+	FILTERTYPE *flt = &demux[demux_id].demux_fd[num];
+	int32_t i, k;
+
+	memset(flt->match_filter, 0, sizeof(flt->match_filter));
+	memset(flt->match_mask, 0, sizeof(flt->match_mask));
+	flt->match_len = 0;
+
+	for(i = 0, k = 0; i < 16; i++, k++)
+	{
+		if(k == 1) // skip len bytes
+		{
+			k += 2;
+		}
+
+		if(flt->mask[i])
+		{
+			flt->match_filter[k] = flt->filter[i] & flt->mask[i];
+			flt->match_mask[k] = flt->mask[i];
+			flt->match_len = k + 1;
+		}
+	}
+}
+
+// dvbapi_conns_lock must be held
+static struct s_dvbapi_conn *dvbapi_conn_find(int32_t fd)
+{
+	int32_t i;
+
+	for(i = 0; i < MAX_ASSOC_FD; i++)
+	{
+		if(dvbapi_conns[i].fd == fd)
+		{
+			return &dvbapi_conns[i];
+		}
+	}
+	return NULL;
+}
+
+// sends as much of the queued packets as the socket takes, dvbapi_conns_lock must be held
+static void dvbapi_conn_flush(struct s_dvbapi_conn *conn)
+{
+	uint32_t sent = 0;
+	ssize_t len;
+
+	while(sent < conn->wlen)
+	{
+		len = send(conn->fd, conn->wbuf + sent, conn->wlen - sent, MSG_DONTWAIT);
+		if(len < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if(len <= 0)
+		{
+			if(len < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+			{
+				sent = conn->wlen; // the client is gone, the receiving side cleans up
+			}
+			break;
+		}
+		sent += len;
+	}
+
+	if(sent)
+	{
+		conn->wlen -= sent;
+		memmove(conn->wbuf, conn->wbuf + sent, conn->wlen);
+	}
+
+	// wait until the socket takes the rest
+	if(conn->polling_out != (conn->wlen > 0))
+	{
+		conn->polling_out = (conn->wlen > 0);
+#ifdef DVBAPI_EPOLL
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = conn->polling_out ? (EPOLLIN | EPOLLPRI | EPOLLOUT) : (EPOLLIN | EPOLLPRI);
+		ev.data.ptr = conn;
+		epoll_ctl(dvbapi_epollfd, EPOLL_CTL_MOD, conn->fd, &ev);
+#endif
+	}
+}
+
+// dvbapi_conns_lock must be held
+static void dvbapi_conn_queue(struct s_dvbapi_conn *conn, const uint8_t *packet, int32_t size)
+{
+	if(conn->wlen + size > DVBAPI_CONN_SEND_SIZE)
+	{
+		dvbapi_conn_flush(conn);
+		if(conn->wlen + size > DVBAPI_CONN_SEND_SIZE)
+		{
+			cs_log("WARNING: dvbapi client (fd=%d) is not reading, dropping packet", conn->fd);
+			return;
+		}
+	}
+
+	memcpy(conn->wbuf + conn->wlen, packet, size);
+	conn->wlen += size;
+
+	// packets of other threads are not held back, they take the collected ones along
+	if(!conn->corked || !pthread_equal(conn->corker, pthread_self()))
+	{
+		dvbapi_conn_flush(conn);
+	}
+}
+
+// collects the packets the calling thread sends to the socket until dvbapi_net_uncork() writes them at once
+static void dvbapi_net_cork(int32_t socket_fd)
+{
+	struct s_dvbapi_conn *conn;
+
+	if(socket_fd <= 0)
+	{
+		return;
+	}
+
+	SAFE_MUTEX_LOCK(&dvbapi_conns_lock);
+	if((conn = dvbapi_conn_find(socket_fd)))
+	{
+		conn->corked = 1;
+		conn->corker = pthread_self();
+	}
+	SAFE_MUTEX_UNLOCK(&dvbapi_conns_lock);
+}
+
+static void dvbapi_net_uncork(int32_t socket_fd)
+{
+	struct s_dvbapi_conn *conn;
+
+	if(socket_fd <= 0)
+	{
+		return;
+	}
+
+	SAFE_MUTEX_LOCK(&dvbapi_conns_lock);
+	if((conn = dvbapi_conn_find(socket_fd)) && conn->corked && pthread_equal(conn->corker, pthread_self()))
+	{
+		conn->corked = 0;
+		dvbapi_conn_flush(conn);
+	}
+	SAFE_MUTEX_UNLOCK(&dvbapi_conns_lock);
+}
+
 void dvbapi_net_add_str(uint8_t *packet, int *size, const char *str)
 {
 	uint8_t *str_len = &packet[*size]; // string length
@@ -615,6 +814,7 @@ int32_t dvbapi_net_send(uint32_t request, int32_t socket_fd, uint32_t msgid, int
 			uint32_t filter_number, uint8_t *data, struct s_client *client, ECM_REQUEST *er, uint16_t client_proto_version)
 {
 	uint8_t packet[DVBAPI_MAX_PACKET_SIZE]; // maximum possible packet size
+	struct s_dvbapi_conn *conn;
 	int32_t size = 0;
 	uint32_t u32;
 
@@ -893,7 +1093,17 @@ int32_t dvbapi_net_send(uint32_t request, int32_t socket_fd, uint32_t msgid, int
 	}
 	// sending
 	cs_log_dump_dbg(D_DVBAPI, packet, size, "Sending packet to dvbapi client (fd=%d):", socket_fd);
-	send(socket_fd, &packet, size, MSG_DONTWAIT);
+	SAFE_MUTEX_LOCK(&dvbapi_conns_lock);
+	conn = dvbapi_conn_find(socket_fd);
+	if(conn)
+	{
+		dvbapi_conn_queue(conn, packet, size);
+	}
+	SAFE_MUTEX_UNLOCK(&dvbapi_conns_lock);
+	if(!conn)
+	{
+		send(socket_fd, &packet, size, MSG_DONTWAIT);
+	}
 	// always returning success as the client could close socket
 	return 0;
 }
@@ -947,6 +1157,7 @@ int32_t dvbapi_set_filter(int32_t demux_id, int32_t api, uint16_t pid, uint16_t
 		demux[demux_id].demux_fd[n].type = type;
 		memcpy(demux[demux_id].demux_fd[n].filter, filt, 16); // copy filter to check later on if receiver delivered accordingly
 		memcpy(demux[demux_id].demux_fd[n].mask, mask, 16); // copy mask to check later on if receiver delivered accordingly
+		dvbapi_compile_filter(demux_id, n);
 		return 1;
 	}
 
@@ -1104,6 +1315,7 @@ int32_t dvbapi_set_filter(int32_t demux_id, int32_t api, uint16_t pid, uint16_t
 		// copy filter and mask to check later on if receiver delivered accordingly
 		memcpy(demux[demux_id].demux_fd[n].filter, filt, 16);
 		memcpy(demux[demux_id].demux_fd[n].mask, mask, 16);
+		dvbapi_compile_filter(demux_id, n);
 
 		cs_log_dbg(D_DVBAPI, "Demuxer %d Filter %d started successfully (caid %04X provid %06X pid %04X)",
 					demux_id, n + 1, caid, provid, pid);
@@ -6468,10 +6680,11 @@ static void dvbapi_get_packet_size(uint8_t *mbuf, uint16_t mbuf_len, uint16_t *c
 	}
 }
 
-static void dvbapi_handlesockmsg(uint8_t *mbuf, uint16_t chunksize, uint16_t data_len, int32_t connfd, uint16_t *client_proto_version)
+static void dvbapi_handlesockmsg(uint8_t *mbuf, uint16_t chunksize, uint16_t data_len, struct s_dvbapi_conn *conn)
 {
+	int32_t connfd = conn->fd;
 	uint32_t msgid = 0;
-	if(*client_proto_version >= 3)
+	if(conn->proto_version >= 3)
 	{
 		if(mbuf[0] != 0xa5)
 		{
@@ -6520,7 +6733,7 @@ static void dvbapi_handlesockmsg(uint8_t *mbuf, uint16_t chunksize, uint16_t dat
 			dvbapi_net_send(DVBAPI_SERVER_INFO, connfd, msgid, -1, -1, NULL, NULL, NULL, client_proto);
 
 			// now the protocol handshake is complete set correct version so all further packets are sent with correct message id.
-			(*client_proto_version) = client_proto;
+			conn->proto_version = client_proto;
 
 			// setting the global var according to the client
 			last_client_proto_version = client_proto;
@@ -6530,7 +6743,7 @@ static void dvbapi_handlesockmsg(uint8_t *mbuf, uint16_t chunksize, uint16_t dat
 		case DVBAPI_AOT_CA_PMT:
 		{
 			cs_log_dbg(D_DVBAPI,"Received DVBAPI_AOT_CA_PMT object on socket %d:", connfd);
-			dvbapi_parse_capmt(mbuf + (chunksize - data_len), data_len, connfd, NULL, *client_proto_version, msgid);
+			dvbapi_parse_capmt(mbuf + (chunksize - data_len), data_len, connfd, NULL, conn->proto_version, msgid);
 			break;
 		}
 
@@ -6573,21 +6786,13 @@ static void dvbapi_handlesockmsg(uint8_t *mbuf, uint16_t chunksize, uint16_t dat
 					}
 					if(execlose)
 					{
-						int32_t ret = close(connfd);
-						if(ret < 0)
-						{
-							cs_log("ERROR: Could not close PMT fd (errno=%d %s)", errno, strerror(errno));
-						}
+						conn->closing = 1;
 					}
 				}
 			}
 			else if(cfg.dvbapi_pmtmode != 6)
 			{
-				int32_t ret = close(connfd);
-				if(ret < 0)
-				{
-					cs_log("ERROR: Could not close PMT fd (errno=%d %s)", errno, strerror(errno));
-				}
+				conn->closing = 1;
 			}
 			break;
 		}
@@ -6596,7 +6801,7 @@ static void dvbapi_handlesockmsg(uint8_t *mbuf, uint16_t chunksize, uint16_t dat
 			if((opcode & 0xFFFFFF00) == DVBAPI_AOT_CA_PMT)
 			{
 				cs_log_dbg(D_DVBAPI, "Received DVBAPI_AOT_CA_PMT object on socket %d:", connfd);
-				dvbapi_parse_capmt(mbuf + (chunksize - data_len), data_len, connfd, NULL, *client_proto_version, msgid);
+				dvbapi_parse_capmt(mbuf + (chunksize - data_len), data_len, connfd, NULL, conn->proto_version, msgid);
 			}
 			else
 			{
@@ -6607,125 +6812,265 @@ static void dvbapi_handlesockmsg(uint8_t *mbuf, uint16_t chunksize, uint16_t dat
 	}
 }
 
-static bool dvbapi_handlesockdata(int32_t connfd, uint8_t *mbuf, uint16_t mbuf_size, uint16_t unhandled_len, uint16_t *new_unhandled_len, uint16_t *client_proto_version)
+// reads what the client sent and handles all complete messages, false when the client is gone
+static bool dvbapi_handlesockdata(struct s_dvbapi_conn *conn)
 {
 	int32_t recv_result;
-	uint16_t chunksize = 1, data_len = 1;
-	uint8_t packet_count = 1;
-	uint32_t msgid_size = 0;
-	uint16_t missing_header_bytes = 0;
-	if(*client_proto_version >= 3)
-	{
-		msgid_size = 5;
-	}
+	uint32_t chunksize, space, msgid_size, packet_count = 0;
+	uint16_t packet_size, data_len;
+	uint8_t *mbuf;
 
 	do
 	{
-		missing_header_bytes = dvbapi_get_nbof_missing_header_bytes(mbuf, unhandled_len, msgid_size);
-
-		if(missing_header_bytes != 0)
+		// make room behind the incomplete message
+		if(conn->rstart > 0 && conn->rend == DVBAPI_CONN_RECV_SIZE)
 		{
-			// read first few bytes so we know packet type and length
-			cs_log_dbg(D_TRACE, "%s reading %" PRIu16 " bytes from connection fd %d", (unhandled_len == 0) ? "Try" : "Continue", missing_header_bytes, connfd);
-
-			recv_result = dvbapi_recv(connfd, mbuf + unhandled_len, mbuf_size - unhandled_len);
-			if(recv_result < 1)
-			{
-				(*new_unhandled_len) = unhandled_len;
-				return (recv_result != -1);
-			}
-			else
-			{
-				unhandled_len += recv_result;
-				if(unhandled_len < missing_header_bytes)
-				{
-					(*new_unhandled_len) = unhandled_len;
-					return true;
-				}
-			}
+			memmove(conn->rbuf, conn->rbuf + conn->rstart, conn->rend - conn->rstart);
+			conn->rend -= conn->rstart;
+			conn->rstart = 0;
 		}
 
-		cs_log_dump_dbg(D_DVBAPI, mbuf, unhandled_len, "Got packetdata (msgid size: %d, clientprotocol: %d)", msgid_size, *client_proto_version);
-		dvbapi_get_packet_size(mbuf+msgid_size, unhandled_len-msgid_size, &chunksize, &data_len);
-
-		chunksize+=msgid_size;
-		if(chunksize > mbuf_size)
+		space = DVBAPI_CONN_RECV_SIZE - conn->rend;
+		recv_result = dvbapi_recv(conn->fd, conn->rbuf + conn->rend, space);
+		if(recv_result < 0)
 		{
-			cs_log("***** WARNING: SOCKET DATA BUFFER OVERFLOW (%" PRIu16 " bytes), PLEASE REPORT! ****** ", chunksize);
-			(*new_unhandled_len) = 0;
-			return true;
+			return false;
 		}
+		conn->rend += recv_result;
 
-		if(unhandled_len < chunksize) // we are missing some bytes, try to read them
+		// a single read usually holds many pipelined messages
+		while(conn->rend > conn->rstart && !conn->closing)
 		{
-			cs_log_dbg(D_TRACE, "Continue to read the missing %d bytes from connection fd %d", chunksize - unhandled_len, connfd);
-			recv_result = dvbapi_recv(connfd, mbuf + unhandled_len, mbuf_size - unhandled_len);
-			if(recv_result < 1)
+			mbuf = conn->rbuf + conn->rstart;
+			msgid_size = (conn->proto_version >= 3) ? 5 : 0;
+
+			if(dvbapi_get_nbof_missing_header_bytes(mbuf, conn->rend - conn->rstart, msgid_size) != 0)
 			{
-				(*new_unhandled_len) = unhandled_len;
-				return (recv_result != -1);
+				break;
 			}
-			else
+
+			cs_log_dump_dbg(D_DVBAPI, mbuf, conn->rend - conn->rstart, "Got packetdata (msgid size: %d, clientprotocol: %d)", msgid_size, conn->proto_version);
+			dvbapi_get_packet_size(mbuf + msgid_size, conn->rend - conn->rstart - msgid_size, &packet_size, &data_len);
+
+			chunksize = packet_size + msgid_size;
+			if(chunksize > DVBAPI_CONN_RECV_SIZE)
 			{
-				unhandled_len += recv_result;
-				if(unhandled_len < chunksize)
-				{
-					(*new_unhandled_len) = unhandled_len;
-					return true;
-				}
+				cs_log("***** WARNING: SOCKET DATA BUFFER OVERFLOW (%" PRIu32 " bytes), PLEASE REPORT! ****** ", chunksize);
+				conn->rstart = conn->rend = 0;
+				break;
 			}
-		}
 
-		dvbapi_handlesockmsg(mbuf, chunksize-msgid_size, data_len, connfd, client_proto_version);
+			if(conn->rend - conn->rstart < chunksize) // we are missing some bytes
+			{
+				break;
+			}
 
-		unhandled_len -= chunksize;
-		if(unhandled_len > 0)
+			dvbapi_handlesockmsg(mbuf, packet_size, data_len, conn);
+			conn->rstart += chunksize;
+			packet_count++;
+		}
+
+		if(conn->rstart == conn->rend)
 		{
-			memmove(mbuf, mbuf + chunksize, unhandled_len);
+			conn->rstart = conn->rend = 0;
 		}
-	} while(unhandled_len != 0 && packet_count++ < 8);
+	} while((uint32_t)recv_result == space && !conn->closing); // the buffer was full, there may be more
 
-	cs_log_dbg(D_DVBAPI, "Processing socketdata completed after %d packets with %d bytes left unprocessed", packet_count, unhandled_len);
+	cs_log_dbg(D_DVBAPI, "Processing socketdata completed after %d packets with %d bytes left unprocessed",
+		packet_count, conn->rend - conn->rstart);
 
-	(*new_unhandled_len) = unhandled_len;
 	return true;
 }
 
-static void add_to_assoc_fd(int sock)
+static struct s_dvbapi_conn *dvbapi_conn_open(int32_t fd)
 {
-	uint i;
+	struct s_dvbapi_conn *conn;
 
-	for(i = 0; i < MAX_ASSOC_FD; i++)
+	SAFE_MUTEX_LOCK(&dvbapi_conns_lock);
+	if(!(conn = dvbapi_conn_find(fd)) && (conn = dvbapi_conn_find(0)))
 	{
-		if(assoc_fd[i] == sock)
+		if(!cs_malloc(&conn->rbuf, DVBAPI_CONN_RECV_SIZE) || !cs_malloc(&conn->wbuf, DVBAPI_CONN_SEND_SIZE))
 		{
-			return; // do not add twice
+			NULLFREE(conn->rbuf);
+			SAFE_MUTEX_UNLOCK(&dvbapi_conns_lock);
+			return NULL;
+		}
+		conn->fd = fd;
+		conn->proto_version = 0; // the handshake of every client starts with the old protocol
+		conn->closing = 0;
+		conn->polling_out = 0;
+		conn->corked = 0;
+		conn->rstart = conn->rend = conn->wlen = 0;
+#ifdef DVBAPI_EPOLL
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN | EPOLLPRI;
+		ev.data.ptr = conn;
+		if(epoll_ctl(dvbapi_epollfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+		{
+			cs_log("ERROR: Could not watch socket fd %d (errno=%d %s)", fd, errno, strerror(errno));
 		}
+#endif
 	}
+	SAFE_MUTEX_UNLOCK(&dvbapi_conns_lock);
 
-	for(i = 0; i < MAX_ASSOC_FD; i++)
+	if(!conn)
+	{
+		cs_log("ERROR: too many dvbapi client connections, rejecting fd %d", fd);
+	}
+	return conn;
+}
+
+// stops all decoding of the client and closes its socket
+static void dvbapi_conn_close(struct s_client *client, struct s_dvbapi_conn *conn, int32_t *listenfd)
+{
+	int32_t i, fd = conn->fd, active_conn = 0; // other active connections counter
+
+	for(i = 0; i < MAX_DEMUX; i++)
 	{
-		if(!assoc_fd[i])
+		if(demux[i].socket_fd == fd)
 		{
-			assoc_fd[i] = sock;
-			return;
+			dvbapi_stop_descrambling(i, 0);
+		}
+		else if(demux[i].socket_fd)
+		{
+			active_conn++;
 		}
 	}
+
+	SAFE_MUTEX_LOCK(&dvbapi_conns_lock);
+#ifdef DVBAPI_EPOLL
+	epoll_ctl(dvbapi_epollfd, EPOLL_CTL_DEL, fd, NULL);
+#endif
+	if(close(fd) < 0 && errno != EBADF)
+	{
+		cs_log("ERROR: Could not close demuxer socket fd (errno=%d %s)", errno, strerror(errno));
+	}
+	conn->fd = 0;
+	NULLFREE(conn->rbuf);
+	NULLFREE(conn->wbuf);
+	SAFE_MUTEX_UNLOCK(&dvbapi_conns_lock);
+
+	last_client_proto_version = 0; // reset protocol, next client could use old protocol
+
+	if(fd == *listenfd && cfg.dvbapi_pmtmode == 6)
+	{
+		*listenfd = -1;
+	}
+
+	// last connection closed
+	if(!active_conn && cfg.dvbapi_listenport)
+	{
+		// update webif data
+		client->ip = get_null_ip();
+		client->port = 0;
+	}
 }
 
-static void del_from_assoc_fd(int sock)
+static void dvbapi_conn_accept(struct s_client *client, int32_t listenfd)
 {
-	uint i;
+	struct SOCKADDR servaddr;
+	int32_t connfd, clilen = sizeof(servaddr);
 
-	for(i = 0; i < MAX_ASSOC_FD; i++)
+	connfd = accept(listenfd, (struct sockaddr *)&servaddr, (socklen_t *)&clilen);
+	cs_log_dbg(D_DVBAPI, "new socket connection fd: %d", connfd);
+
+	if(connfd <= 0)
+	{
+		cs_log_dbg(D_DVBAPI, "accept() returns error (errno=%d %s)", errno, strerror(errno));
+		return;
+	}
+
+	if(cfg.dvbapi_listenport)
+	{
+		// update webif data
+		client->ip = SIN_GET_ADDR(servaddr);
+		client->port = ntohs(SIN_GET_PORT(servaddr));
+	}
+
+	if(cfg.dvbapi_pmtmode == 3 || cfg.dvbapi_pmtmode == 0)
+	{
+		disable_pmt_files = 1;
+	}
+
+	if(!dvbapi_conn_open(connfd))
+	{
+		close(connfd);
+	}
+}
+
+static void dvbapi_conn_event(struct s_client *client, struct s_dvbapi_conn *conn, int32_t *listenfd, uint32_t revents)
+{
+	int32_t fd = conn->fd;
+
+	cs_log_dbg(D_TRACE, "Now handling fd %d that reported event %d", fd, revents);
+
+	if(revents & (POLLHUP | POLLNVAL | POLLERR))
+	{
+		dvbapi_conn_close(client, conn, listenfd);
+		cs_log_dbg(D_DVBAPI, "Socket %d reported hard connection close", fd);
+		return;
+	}
+
+	if(revents & POLLOUT)
 	{
-		if(assoc_fd[i] == sock)
+		SAFE_MUTEX_LOCK(&dvbapi_conns_lock);
+		dvbapi_conn_flush(conn);
+		SAFE_MUTEX_UNLOCK(&dvbapi_conns_lock);
+	}
+
+	if(revents & (POLLIN | POLLPRI))
+	{
+		if(fd == *listenfd && cfg.dvbapi_pmtmode == 6)
 		{
-			assoc_fd[i] = 0;
+			disable_pmt_files = 1;
+		}
+
+		if(!dvbapi_handlesockdata(conn))
+		{
+			// client disconnects, stop all assigned decoding
+			cs_log_dbg(D_DVBAPI, "Socket %d reported connection close", fd);
+			dvbapi_conn_close(client, conn, listenfd);
+		}
+		else if(conn->closing)
+		{
+			dvbapi_conn_close(client, conn, listenfd);
 		}
 	}
 }
 
+#ifdef DVBAPI_EPOLL
+// handles the events of the listen socket and all client sockets
+static void dvbapi_conn_poll(struct s_client *client, int32_t *listenfd)
+{
+	struct epoll_event events[MAX_ASSOC_FD + 1];
+	struct s_dvbapi_conn *conn;
+	int32_t i, count, do_accept = 0;
+
+	count = epoll_wait(dvbapi_epollfd, events, MAX_ASSOC_FD + 1, 0);
+
+	for(i = 0; i < count; i++)
+	{
+		if(!(conn = events[i].data.ptr))
+		{
+			do_accept = 1;
+			continue;
+		}
+
+		if(conn->fd) // not closed by an earlier event
+		{
+			dvbapi_conn_event(client, conn, listenfd, events[i].events);
+		}
+	}
+
+	// only now, a new client must not get a slot which still has events pending above
+	if(do_accept)
+	{
+		dvbapi_conn_accept(client, *listenfd);
+	}
+}
+#endif
+
 static void *dvbapi_main_local(void *cli)
 {
 	int32_t i, j, l;
@@ -6740,38 +7085,21 @@ static void *dvbapi_main_local(void *cli)
 	struct sockaddr_un saddr;
 	saddr.sun_family = AF_UNIX;
 	cs_strncpy(saddr.sun_path, PMT_SERVER_SOCKET, sizeof(saddr.sun_path));
-	int32_t rc, pfdcount, g, connfd, clilen;
+	int32_t rc, pfdcount, g;
 	int32_t ids[maxpfdsize], fdn[maxpfdsize], type[maxpfdsize];
-	struct SOCKADDR servaddr;
 	ssize_t len = 0;
 	static const uint16_t mbuf_size = 2048;
 	uint8_t *mbuf;
-	uint16_t unhandled_buf_len[maxpfdsize], unhandled_buf_used[maxpfdsize];
-	uint8_t *unhandled_buf[maxpfdsize];
 	struct s_auth *account;
 	int32_t ok = 0;
-	uint16_t client_proto_version[maxpfdsize];
 
 	if(!cs_malloc(&mbuf, sizeof(uint8_t) * mbuf_size))
 	{
 		return NULL;
 	}
 
-	for(i = 0; i < maxpfdsize; i++)
-	{
-		unhandled_buf[i] = NULL;
-		unhandled_buf_len[i] = 0;
-		unhandled_buf_used[i] = 0;
-		client_proto_version[i] = 0;
-	}
-
-	for(account = cfg.account; account != NULL; account = account->next)
-	{
-		if((ok = is_dvbapi_usr(account->usr)))
-		{
-			break;
-		}
-	}
+	account = get_account_by_name(cfg.dvbapi_usr);
+	ok = (account != NULL);
 
 	cs_auth_client(client, ok ? account : (struct s_auth *)(-1), "dvbapi");
 	memset(demux, 0, sizeof(demux));
@@ -6791,7 +7119,7 @@ static void *dvbapi_main_local(void *cli)
 	}
 
 	memset(ca_fd, 0, sizeof(ca_fd));
-	memset(assoc_fd, 0, sizeof(assoc_fd));
+	memset(dvbapi_conns, 0, sizeof(dvbapi_conns));
 	dvbapi_read_priority();
 	dvbapi_load_channel_cache();
 	dvbapi_detect_api();
@@ -6872,12 +7200,24 @@ static void *dvbapi_main_local(void *cli)
 		}
 	}
 
+#ifdef DVBAPI_EPOLL
+	// client sockets are watched by an epoll set, which itself is one entry of the poll set
+	if((dvbapi_epollfd = epoll_create(MAX_ASSOC_FD + 1)) < 0)
+	{
+		cs_log("ERROR: Could not create epoll fd (errno=%d %s)", errno, strerror(errno));
+		free(mbuf);
+		return NULL;
+	}
+
 	if(listenfd != -1)
 	{
-		pfd2[0].fd = listenfd;
-		pfd2[0].events = (POLLIN | POLLPRI);
-		type[0] = 1;
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN | EPOLLPRI;
+		ev.data.ptr = NULL; // listen socket
+		epoll_ctl(dvbapi_epollfd, EPOLL_CTL_ADD, listenfd, &ev);
 	}
+#endif
 
 #if defined WITH_COOLAPI || defined WITH_COOLAPI2 || defined WITH_NEUTRINO
 	if(system("pzapit -rz") == -1)
@@ -6912,11 +7252,13 @@ static void *dvbapi_main_local(void *cli)
 					close(listenfd);
 					listenfd = -1;
 				}
+				else if(!dvbapi_conn_open(listenfd))
+				{
+					close(listenfd);
+					listenfd = -1;
+				}
 				else
 				{
-					pfd2[0].fd = listenfd;
-					pfd2[0].events = (POLLIN | POLLPRI);
-					type[0] = 1;
 					cs_log("PMT mode 6: Successfully connected to CA PMT server (fd %d)", listenfd);
 				}
 			}
@@ -6928,18 +7270,34 @@ static void *dvbapi_main_local(void *cli)
 			}
 		}
 
-		pfdcount = (listenfd > -1) ? 1 : 0;
+		pfdcount = 0;
+
+#ifdef DVBAPI_EPOLL
+		pfd2[pfdcount].fd = dvbapi_epollfd;
+		pfd2[pfdcount].events = POLLIN;
+		type[pfdcount++] = 2;
+#else
+		if(listenfd > -1 && cfg.dvbapi_pmtmode != 6)
+		{
+			pfd2[pfdcount].fd = listenfd;
+			pfd2[pfdcount].events = (POLLIN | POLLPRI);
+			ids[pfdcount] = -1;
+			type[pfdcount++] = 1;
+		}
 
-		for(i = 0; i < MAX_ASSOC_FD; i++) // add all associated fds (this should include also demux[X].socket_fd)
+		SAFE_MUTEX_LOCK(&dvbapi_conns_lock);
+		for(i = 0; i < MAX_ASSOC_FD; i++) // add all client sockets (this should include also demux[X].socket_fd)
 		{
-			if(assoc_fd[i])
+			if(dvbapi_conns[i].fd)
 			{
-				pfd2[pfdcount].fd = assoc_fd[i];
-				pfd2[pfdcount].events = (POLLIN | POLLPRI);
-				client_proto_version[pfdcount] = last_client_proto_version;
+				pfd2[pfdcount].fd = dvbapi_conns[i].fd;
+				pfd2[pfdcount].events = (POLLIN | POLLPRI) | (dvbapi_conns[i].wlen ? POLLOUT : 0);
+				ids[pfdcount] = i;
 				type[pfdcount++] = 1;
 			}
 		}
+		SAFE_MUTEX_UNLOCK(&dvbapi_conns_lock);
+#endif
 
 		for(i = 0; i < MAX_DEMUX; i++)
 		{
@@ -7195,76 +7553,69 @@ static void *dvbapi_main_local(void *cli)
 		{
 			if(pfd2[i].revents == 0) { continue; } // skip sockets with no changes
 			rc--; //event handled!
-			cs_log_dbg(D_TRACE, "Now handling fd %d that reported event %d", pfd2[i].fd, pfd2[i].revents);
 
-			if(pfd2[i].revents & (POLLHUP | POLLNVAL | POLLERR))
+#ifdef DVBAPI_EPOLL
+			if(type[i] == 2)
+			{
+				dvbapi_conn_poll(client, &listenfd);
+				continue;
+			}
+#else
+			if(type[i] == 1)
 			{
-				if(type[i] == 1)
+				if(ids[i] < 0)
 				{
-					del_from_assoc_fd(pfd2[i].fd);
-
-					for(j = 0; j < MAX_DEMUX; j++)
-					{
-						// if listenfd closes stop all assigned decoding!
-						if(demux[j].socket_fd == pfd2[i].fd)
-						{
-							dvbapi_stop_descrambling(j, 0);
-						}
-					}
+					dvbapi_conn_accept(client, listenfd);
+				}
+				else if(dvbapi_conns[ids[i]].fd == pfd2[i].fd) // not closed by an earlier event
+				{
+					dvbapi_conn_event(client, &dvbapi_conns[ids[i]], &listenfd, pfd2[i].revents);
+				}
+				continue;
+			}
+#endif
+			cs_log_dbg(D_TRACE, "Now handling fd %d that reported event %d", pfd2[i].fd, pfd2[i].revents);
 
-					int32_t ret = close(pfd2[i].fd);
-					if(ret < 0 && errno != 9)
-					{
-						cs_log("ERROR: Could not close demuxer socket fd (errno=%d %s)", errno, strerror(errno));
-					}
+			if(pfd2[i].revents & (POLLHUP | POLLNVAL | POLLERR))
+			{
+				int32_t demux_id = ids[i];
+				int32_t n = fdn[i];
 
-					if(pfd2[i].fd == listenfd && cfg.dvbapi_pmtmode == 6)
-					{
-						listenfd = -1;
-					}
-					cs_log_dbg(D_DVBAPI, "Socket %d reported hard connection close", pfd2[i].fd);
+				if(cfg.dvbapi_boxtype != BOXTYPE_SAMYGO)
+				{
+					// stop filter since its giving errors and wont return anything good
+					dvbapi_stop_filternum(demux_id, n, 0);
 				}
-				else // type = 0
+				else
 				{
-					int32_t demux_id = ids[i];
-					int32_t n = fdn[i];
+					int32_t ret, pid;
+					uint8_t filter[32];
+					struct dmx_sct_filter_params sFP;
+					cs_log_dbg(D_DVBAPI, "re-opening connection to demux socket");
+					close(demux[demux_id].demux_fd[n].fd);
+					demux[demux_id].demux_fd[n].fd = -1;
 
-					if(cfg.dvbapi_boxtype != BOXTYPE_SAMYGO)
+					ret = dvbapi_open_device(0, demux[demux_id].demux_index, demux[demux_id].adapter_index);
+					if(ret != -1)
 					{
-						// stop filter since its giving errors and wont return anything good
-						dvbapi_stop_filternum(demux_id, n, 0);
+						demux[demux_id].demux_fd[n].fd = ret;
+						pid = demux[demux_id].curindex;
+						memset(filter, 0, 32);
+						memset(&sFP, 0, sizeof(sFP));
+						filter[0] = 0x80;
+						filter[16] = 0xF0;
+						sFP.pid = demux[demux_id].ECMpids[pid].ECM_PID;
+						sFP.timeout = 3000;
+						sFP.flags = DMX_IMMEDIATE_START;
+						memcpy(sFP.filter.filter, filter, 16);
+						memcpy(sFP.filter.mask, filter + 16, 16);
+						ret = dvbapi_ioctl(demux[demux_id].demux_fd[n].fd, DMX_SET_FILTER, &sFP);
 					}
-					else
-					{
-						int32_t ret, pid;
-						uint8_t filter[32];
-						struct dmx_sct_filter_params sFP;
-						cs_log_dbg(D_DVBAPI, "re-opening connection to demux socket");
-						close(demux[demux_id].demux_fd[n].fd);
-						demux[demux_id].demux_fd[n].fd = -1;
-
-						ret = dvbapi_open_device(0, demux[demux_id].demux_index, demux[demux_id].adapter_index);
-						if(ret != -1)
-						{
-							demux[demux_id].demux_fd[n].fd = ret;
-							pid = demux[demux_id].curindex;
-							memset(filter, 0, 32);
-							memset(&sFP, 0, sizeof(sFP));
-							filter[0] = 0x80;
-							filter[16] = 0xF0;
-							sFP.pid = demux[demux_id].ECMpids[pid].ECM_PID;
-							sFP.timeout = 3000;
-							sFP.flags = DMX_IMMEDIATE_START;
-							memcpy(sFP.filter.filter, filter, 16);
-							memcpy(sFP.filter.mask, filter + 16, 16);
-							ret = dvbapi_ioctl(demux[demux_id].demux_fd[n].fd, DMX_SET_FILTER, &sFP);
-						}
 
-						if(ret == -1)
-						{
-							// stop filter since it's giving errors and wont return anything good
-							dvbapi_stop_filternum(demux_id, n, 0);
-						}
+					if(ret == -1)
+					{
+						// stop filter since it's giving errors and wont return anything good
+						dvbapi_stop_filternum(demux_id, n, 0);
 					}
 				}
 				continue; // continue with other events
@@ -7272,145 +7623,41 @@ static void *dvbapi_main_local(void *cli)
 
 			if(pfd2[i].revents & (POLLIN | POLLPRI))
 			{
-				if(type[i] == 1)
-				{
-					if(pfd2[i].fd == listenfd)
-					{
-						if(cfg.dvbapi_pmtmode == 6)
-						{
-							connfd = listenfd;
-							disable_pmt_files = 1;
-						}
-						else
-						{
-							clilen = sizeof(servaddr);
-							connfd = accept(listenfd, (struct sockaddr *)&servaddr, (socklen_t *)&clilen);
-							cs_log_dbg(D_DVBAPI, "new socket connection fd: %d", connfd);
-
-							if(cfg.dvbapi_listenport)
-							{
-								// update webif data
-								client->ip = SIN_GET_ADDR(servaddr);
-								client->port = ntohs(SIN_GET_PORT(servaddr));
-							}
-
-							add_to_assoc_fd(connfd);
-
-							if(cfg.dvbapi_pmtmode == 3 || cfg.dvbapi_pmtmode == 0)
-							{
-								disable_pmt_files = 1;
-							}
+				int32_t demux_id = ids[i];
+				int32_t n = fdn[i];
 
-							if(connfd <= 0)
-							{
-								cs_log_dbg(D_DVBAPI, "accept() returns error on fd event %d (errno=%d %s)",
-									pfd2[i].revents, errno, strerror(errno));
-							}
-						}
-					}
-					else
-					{
-						connfd = pfd2[i].fd;
-					}
-
-					//reading and completing data from socket
-					if(connfd > 0)
-					{
-						if(unhandled_buf_used[i])
-						{
-							memcpy(mbuf, unhandled_buf[i], unhandled_buf_used[i]);
-						}
-
-						if(!dvbapi_handlesockdata(connfd, mbuf, mbuf_size, unhandled_buf_used[i], &unhandled_buf_used[i], &client_proto_version[i]))
-						{
-							unhandled_buf_used[i] = 0;
-							client_proto_version[i] = 0; // reset protocol, next client could old protocol.
-							last_client_proto_version = 0;
-							// client disconnects, stop all assigned decoding
-							cs_log_dbg(D_DVBAPI, "Socket %d reported connection close", connfd);
-							int active_conn = 0; // other active connections counter
-
-							for(j = 0; j < MAX_DEMUX; j++)
-							{
-								if(demux[j].socket_fd == connfd)
-								{
-									dvbapi_stop_descrambling(j, 0);
-								}
-								else if(demux[j].socket_fd)
-								{
-									active_conn++;
-								}
-							}
-
-							// stop polling on this socket
-							del_from_assoc_fd(connfd);
-							close(connfd);
-
-							// last connection closed
-							if(!active_conn && (cfg.dvbapi_listenport || cfg.dvbapi_boxtype == BOXTYPE_PC_NODMX))
-							{
-								if(cfg.dvbapi_listenport)
-								{
-									// update webif data
-									client->ip = get_null_ip();
-									client->port = 0;
-								}
-							}
-							continue;
-						}
-
-						if(unhandled_buf_used[i])
-						{
-							if(unhandled_buf_used[i] > unhandled_buf_len[i])
-							{
-								NULLFREE(unhandled_buf[i]);
-								unhandled_buf_len[i] = unhandled_buf_used[i] < 128 ? 128 : unhandled_buf_used[i];
-								if(!cs_malloc(&unhandled_buf[i], sizeof(uint8_t) * unhandled_buf_len[i]))
-								{
-									unhandled_buf_len[i] = 0;
-									unhandled_buf_used[i] = 0;
-									continue;
-								}
-							}
-							memcpy(unhandled_buf[i], mbuf, unhandled_buf_used[i]);
-						}
-					}
-				}
-				else // type == 0
+				if((int)demux[demux_id].demux_fd[n].fd != pfd2[i].fd)
 				{
-					int32_t demux_id = ids[i];
-					int32_t n = fdn[i];
-
-					if((int)demux[demux_id].demux_fd[n].fd != pfd2[i].fd)
-					{
-						continue; // filter already killed, no need to process this data!
-					}
+					continue; // filter already killed, no need to process this data!
+				}
 
-					len = dvbapi_read_device(pfd2[i].fd, mbuf, mbuf_size);
-					if(len < 0) // serious filterdata read error
-					{
-						// stop filter since it's giving errors and won't return anything good
-						dvbapi_stop_filternum(demux_id, n, 0);
+				len = dvbapi_read_device(pfd2[i].fd, mbuf, mbuf_size);
+				if(len < 0) // serious filterdata read error
+				{
+					// stop filter since it's giving errors and won't return anything good
+					dvbapi_stop_filternum(demux_id, n, 0);
 
-						maxfilter--; // lower maxfilters to avoid this with new filter setups!
-						continue;
-					}
+					maxfilter--; // lower maxfilters to avoid this with new filter setups!
+					continue;
+				}
 
-					if(!len) // receiver internal filter buffer overflow
-					{
-						memset(mbuf, 0, mbuf_size);
-					}
-					dvbapi_process_input(demux_id, n, mbuf, len, 0);
+				if(!len) // receiver internal filter buffer overflow
+				{
+					memset(mbuf, 0, mbuf_size);
 				}
+				dvbapi_process_input(demux_id, n, mbuf, len, 0);
 				continue; // continue with other events!
 			}
 		}
 	}
 
-	for(j = 0; j < maxpfdsize; j++)
+	SAFE_MUTEX_LOCK(&dvbapi_conns_lock);
+	for(j = 0; j < MAX_ASSOC_FD; j++)
 	{
-		NULLFREE(unhandled_buf[j]);
+		NULLFREE(dvbapi_conns[j].rbuf);
+		NULLFREE(dvbapi_conns[j].wbuf);
 	}
+	SAFE_MUTEX_UNLOCK(&dvbapi_conns_lock);
 	free(mbuf);
 
 	return NULL;
@@ -8087,6 +8334,9 @@ void dvbapi_send_dcw(struct s_client *client, ECM_REQUEST *er)
 
 		delayer(er, delay);
 
+		// the control words and ecm info of this demuxer go out in one write to its client
+		dvbapi_net_cork(demux[i].socket_fd);
+
 #if defined(WITH_EMU) || defined(WITH_DEBUG)
 		if((cs_dblevel & D_DVBAPI) && (er->selected_reader->typ == R_EMU))
 		{
@@ -8351,6 +8601,8 @@ void dvbapi_send_dcw(struct s_client *client, ECM_REQUEST *er)
 			dvbapi_write_ecminfo_file(client, er, demux[i].last_cw[0][0], demux[i].last_cw[0][1], 8);
 #endif
 		}
+
+		dvbapi_net_uncork(demux[i].socket_fd);
 	}
 
 	if(handled == 0)
@@ -8941,6 +9193,7 @@ int32_t dvbapi_activate_section_filter(int32_t demux_id, int32_t num, int32_t fd
 		// copy filter and mask to check later on if receiver delivered accordingly
 		memcpy(demux[demux_id].demux_fd[num].filter, filter, 16);
 		memcpy(demux[demux_id].demux_fd[num].mask, mask, 16);
+		dvbapi_compile_filter(demux_id, num);
 	}
 	return ret;
 }
@@ -9660,6 +9913,7 @@ void rotate_emmfilter(int32_t demux_id)
 				{
 					// stop active filter and add to pending list
 					dvbapi_stop_filternum(filter_item->demux_id, filter_item->num - 1, 0);
+					emm_filter_unindex(filter_item);
 					ll_iter_remove_data(&itr);
 					add_emmfilter_to_list(filter_item->demux_id, filter_item->filter, filter_item->caid, filter_item->provid, filter_item->pid, -1, false);
 					stopped++;
@@ -9704,37 +9958,32 @@ void rotate_emmfilter(int32_t demux_id)
 
 int32_t filtermatch(uint8_t *buffer, int32_t filter_num, int32_t demux_id, int32_t len)
 {
-	int32_t i, k, match;
-	uint8_t flt, mask;
+	FILTERTYPE *flt = &demux[demux_id].demux_fd[filter_num];
+	uint8_t section[FILTER_MATCH_SIZE];
+	uint64_t data, filter, mask;
+	int32_t i;
 
-	match = 1;
-	for(i = 0, k = 0; i < 16 && match; i++, k++)
+	if(flt->match_len > len)
 	{
-		mask = demux[demux_id].demux_fd[filter_num].mask[i];
-		if(k == 1) // skip len bytes
-		{
-			k += 2;
-		}
+		return 0; // section too short for the filter
+	}
 
-		if(!mask)
-		{
-			continue;
-		}
+	memset(section, 0, sizeof(section));
+	memcpy(section, buffer, flt->match_len);
 
-		flt = (demux[demux_id].demux_fd[filter_num].filter[i]&mask);
-		cs_log_dbg(D_DVBAPI,"Demuxer %d filter%d[%d] = %02X, filter mask[%d] = %02X, flt&mask = %02X , buffer[%d] = %02X, buffer[%d] & mask = %02X",
-			demux_id, filter_num + 1, i, demux[demux_id].demux_fd[filter_num].filter[i], i, mask, flt&mask, k, buffer[k], k, buffer[k] & mask);
+	for(i = 0; i < flt->match_len; i += 8)
+	{
+		memcpy(&data, section + i, 8);
+		memcpy(&filter, flt->match_filter + i, 8);
+		memcpy(&mask, flt->match_mask + i, 8);
 
-		if(k <= len)
-		{
-			match = (flt == (buffer[k] & mask));
-		}
-		else
+		if((data & mask) != filter)
 		{
-			match = 0;
+			cs_log_dump_dbg(D_DVBAPI, buffer, flt->match_len, "Demuxer %d filter %d does not match section:", demux_id, filter_num + 1);
+			return 0; // delivered data does not match with filter
 		}
 	}
-	return (match && i == 16); // 0 = delivered data does not match with filter, 1 = delivered data matches with filter
+	return 1; // delivered data matches with filter
 }
 
 /*
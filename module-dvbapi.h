@@ -75,6 +75,8 @@
 
 #define DVBAPI_PROTOCOL_VERSION   3
 #define DVBAPI_MAX_PACKET_SIZE    262        // maximum possible packet size
+#define DVBAPI_CONN_RECV_SIZE     8192       // receive buffer per client socket
+#define DVBAPI_CONN_SEND_SIZE     8192       // send buffer per client socket
 
 #define DVBAPI_CA_GET_DESCR_INFO  0x80086F83
 #define DVBAPI_CA_SET_DESCR       0x40106F86
@@ -317,6 +319,8 @@ struct box_devices
 	int8_t api;
 };
 
+#define FILTER_MATCH_SIZE 24 // 16 filter bytes + 2 section length bytes, padded to whole words
+
 typedef struct filter_s
 {
 	uint32_t         fd;                                 // filter handle
@@ -328,6 +332,9 @@ typedef struct filter_s
 	int32_t          count;
 	uint8_t          filter[16];
 	uint8_t          mask[16];
+	uint8_t          match_filter[FILTER_MATCH_SIZE];    // filter & mask at their section offsets
+	uint8_t          match_mask[FILTER_MATCH_SIZE];      // (the section length bytes are never masked)
+	uint8_t          match_len;                          // section bytes up to the last masked one
 	uint8_t          lastecmd5[CS_ECMSTORESIZE];         // last requested ecm md5
 	int32_t          lastresult;
 	uint8_t          prevecmd5[CS_ECMSTORESIZE];         // previous requested ecm md5
@@ -4,6 +4,7 @@
 
 #ifdef WITH_EMU
 
+#include "ncam-garbage.h"
 #include "ncam-string.h"
 #include "module-streamrelay.h"
 #include "module-emulator-nemu.h"
@@ -90,10 +91,19 @@ void date_to_str(char *dateStr, uint8_t len, int8_t offset, uint8_t format)
  * The keys are stored in structures of type "KeyDataContainer", one per CAS. Each
  * container points to a dynamically allocated array of type "KeyData", which holds
  * the actual keys. The array initially holds up to 64 keys (64 * KeyData), and it
- * is expanded by 16 every time it's filled with keys. The "KeyDataContainer" also
+ * is doubled every time it's filled with keys. The "KeyDataContainer" also
  * includes info about the number of keys it contains ("KeyCount") and the maximum
  * number of keys it can store ("KeyMax").
  *
+ * Each container also has a "KeyIndex", which hashes its keys by provider and
+ * keyName, and by keyName alone for lookups with a provider mask. Both hash chains
+ * keep the order of the key array, which "keyRef" counts in.
+ *
+ * Keys are looked up without locking. Writers are serialized by the caller
+ * (emu_key_data_mutex) and never change memory a reader may still use: a grown
+ * array or index is copied and published, and replaced keys, arrays and indexes
+ * are freed by the garbage collector.
+ *
  * The "KeyData" structure, on the other hand, stores the actual key information,
  * including the "identifier", "provider", "keyName", "key" and "keyLength". There
  * is also a "nextKey" pointer to a similar "KeyData" structure which is only used
@@ -210,16 +220,16 @@ void emu_set_keyfile_path(const char *path)
 	cs_strncpy(emu_keyfile_path, path, pathLength + 1);
 }
 
-KeyDataContainer CwKeys = { NULL, 0, 0 };
-KeyDataContainer ViKeys = { NULL, 0, 0 };
-KeyDataContainer NagraKeys = { NULL, 0, 0 };
-KeyDataContainer IrdetoKeys = { NULL, 0, 0 };
-KeyDataContainer BissSWs = { NULL, 0, 0 };
-KeyDataContainer Biss2Keys = { NULL, 0, 0 };
-KeyDataContainer OmnicryptKeys = { NULL, 0, 0 };
-KeyDataContainer PowervuKeys = { NULL, 0, 0 };
-KeyDataContainer TandbergKeys = { NULL, 0, 0 };
-KeyDataContainer StreamKeys = { NULL, 0, 0 };
+KeyDataContainer CwKeys = { NULL, 0, 0, NULL, 0 };
+KeyDataContainer ViKeys = { NULL, 0, 0, NULL, 0 };
+KeyDataContainer NagraKeys = { NULL, 0, 0, NULL, 0 };
+KeyDataContainer IrdetoKeys = { NULL, 0, 0, NULL, 0 };
+KeyDataContainer BissSWs = { NULL, 0, 0, NULL, 0 };
+KeyDataContainer Biss2Keys = { NULL, 0, 0, NULL, 0 };
+KeyDataContainer OmnicryptKeys = { NULL, 0, 0, NULL, 0 };
+KeyDataContainer PowervuKeys = { NULL, 0, 0, NULL, 0 };
+KeyDataContainer TandbergKeys = { NULL, 0, 0, NULL, 0 };
+KeyDataContainer StreamKeys = { NULL, 0, 0, NULL, 0 };
 
 KeyDataContainer *emu_get_key_container(char identifier)
 {
@@ -250,6 +260,25 @@ KeyDataContainer *emu_get_key_container(char identifier)
 	}
 }
 
+// Containers of a reload in progress, see emu_stage_keydata()
+static const char key_identifiers[] = "WVNIFGOPTA";
+static KeyDataContainer StagedKeys[sizeof(key_identifiers) - 1];
+static int8_t keys_staged = 0;
+
+// the container emu_set_key() stores to, the staged one during a reload
+static KeyDataContainer *key_container(char identifier)
+{
+	const char *slot;
+
+	if (keys_staged && identifier && (slot = strchr(key_identifiers, identifier)) != NULL)
+	{
+		return &StagedKeys[slot - key_identifiers];
+	}
+	return emu_get_key_container(identifier);
+}
+
+static void keyfile_restamp(const char *path, const struct stat *before);
+
 static void write_key_to_file(char identifier, uint32_t provider, const char *keyName, uint8_t *key,
 								uint32_t keyLength, char *comment)
 {
@@ -258,6 +287,7 @@ static void write_key_to_file(char identifier, uint32_t provider, const char *ke
 	uint32_t pathLength;
 	uint8_t fileNameLen = cs_strlen(EMU_KEY_FILENAME);
 	struct dirent *pDirent;
+	struct stat before;
 	DIR *pDir;
 	FILE *file = NULL;
 
@@ -318,10 +348,15 @@ static void write_key_to_file(char identifier, uint32_t provider, const char *ke
 
 	cs_log("Writing key file: %s", filepath);
 
+	if (stat(filepath, &before) != 0)
+	{
+		memset(&before, 0, sizeof(before));
+	}
+
 	file = fopen(filepath, "a");
-	free(filepath);
 	if (file == NULL)
 	{
+		free(filepath);
 		return;
 	}
 
@@ -331,6 +366,7 @@ static void write_key_to_file(char identifier, uint32_t provider, const char *ke
 	if (keyValue == NULL)
 	{
 		fclose(file);
+		free(filepath);
 		return;
 	}
 	cs_hexdump(0, key, keyLength, keyValue, (keyLength * 2) + 1);
@@ -352,6 +388,136 @@ static void write_key_to_file(char identifier, uint32_t provider, const char *ke
 
 	fwrite(line, cs_strlen(line), 1, file);
 	fclose(file);
+
+	// Our own key is in memory already, it must not trigger a reload
+	keyfile_restamp(filepath, &before);
+	free(filepath);
+}
+
+static uint32_t key_name_hash(const char *keyName)
+{
+	uint32_t hash = 2166136261U; // FNV-1a
+
+	while (*keyName)
+	{
+		hash = (hash ^ (uint8_t)*keyName++) * 16777619U;
+	}
+	return hash;
+}
+
+static uint32_t key_hash(char identifier, uint32_t provider, const char *keyName)
+{
+	// BISS session words are unique per provider, their keyName is an expiration date
+	uint32_t hash = (identifier == 'F') ? 2166136261U : key_name_hash(keyName);
+
+	hash = (hash ^ provider) * 0x9E3779B1U;
+	return hash ^ (hash >> 16);
+}
+
+// links a complete key of the array into the hash chains
+static void key_index_add(KeyIndex *index, uint32_t i)
+{
+	KeyData *keyData = &index->keys[i];
+	uint32_t bucket = key_hash(keyData->identifier, keyData->provider, keyData->keyName) & (index->size - 1);
+
+	index->nextByKey[i] = index->byKey[bucket];
+	index->nextByName[i] = 0;
+	__sync_synchronize(); // readers must not find the key before its links
+
+	index->byKey[bucket] = i + 1;
+
+	bucket = key_name_hash(keyData->keyName) & (index->size - 1);
+	if (index->byNameLast[bucket])
+	{
+		index->nextByName[index->byNameLast[bucket] - 1] = i + 1;
+	}
+	else
+	{
+		index->byName[bucket] = i + 1;
+	}
+	index->byNameLast[bucket] = i + 1;
+	index->count = i + 1;
+}
+
+static KeyIndex *key_index_create(KeyData *keys, uint32_t count, uint32_t size)
+{
+	KeyIndex *index;
+	uint32_t i;
+
+	index = (KeyIndex *)calloc(1, sizeof(KeyIndex) + 5 * size * sizeof(uint32_t));
+	if (index == NULL)
+	{
+		return NULL;
+	}
+
+	index->keys = keys;
+	index->size = size;
+	index->byKey = (uint32_t *)(index + 1);
+	index->byName = index->byKey + size;
+	index->byNameLast = index->byName + size;
+	index->nextByKey = index->byNameLast + size;
+	index->nextByName = index->nextByKey + size;
+
+	for (i = 0; i < count; i++)
+	{
+		key_index_add(index, i);
+	}
+	return index;
+}
+
+// returns index + 1 of the key with exactly this provider and keyName, 0 if there is none
+static uint32_t key_index_find(KeyIndex *index, char identifier, uint32_t provider, const char *keyName)
+{
+	uint32_t n;
+
+	if (index == NULL)
+	{
+		return 0;
+	}
+
+	for (n = index->byKey[key_hash(identifier, provider, keyName) & (index->size - 1)]; n; n = index->nextByKey[n - 1])
+	{
+		if (index->keys[n - 1].provider == provider && (identifier == 'F' || !strcmp(index->keys[n - 1].keyName, keyName)))
+		{
+			return n;
+		}
+	}
+	return 0;
+}
+
+// makes room for one more key, the old array and index stay valid for running lookups
+static int8_t key_container_grow(KeyDataContainer *KeyDB)
+{
+	uint32_t keyMax = KeyDB->keyMax ? KeyDB->keyMax * 2 : 64;
+	KeyData *keys, *oldKeys = KeyDB->EmuKeys;
+	KeyIndex *index, *oldIndex = KeyDB->index;
+
+	keys = (KeyData *)malloc(sizeof(KeyData) * keyMax);
+	if (keys == NULL)
+	{
+		return 0;
+	}
+
+	if (KeyDB->keyCount)
+	{
+		memcpy(keys, oldKeys, sizeof(KeyData) * KeyDB->keyCount);
+	}
+
+	index = key_index_create(keys, KeyDB->keyCount, keyMax);
+	if (index == NULL)
+	{
+		free(keys);
+		return 0;
+	}
+
+	KeyDB->EmuKeys = keys;
+	KeyDB->keyMax = keyMax;
+	__sync_synchronize();
+	KeyDB->index = index;
+
+	add_garbage(oldIndex);
+	add_garbage(oldKeys);
+	return 1;
 }
 
 int8_t emu_set_key(char identifier, uint32_t provider, char *keyName, uint8_t *orgKey, uint32_t keyLength,
@@ -360,11 +526,11 @@ int8_t emu_set_key(char identifier, uint32_t provider, char *keyName, uint8_t *o
 	uint32_t i, j;
 	uint8_t *tmpKey = NULL;
 	KeyDataContainer *KeyDB;
-	KeyData *tmpKeyData, *newKeyData;
+	KeyData *tmpKeyData, *newKeyData, *oldKeyData;
 
 	identifier = (char)toupper((int)identifier);
 
-	KeyDB = emu_get_key_container(identifier);
+	KeyDB = key_container(identifier);
 	if (KeyDB == NULL)
 	{
 		return 0;
@@ -439,19 +605,10 @@ int8_t emu_set_key(char identifier, uint32_t provider, char *keyName, uint8_t *o
 	}
 
 	// Key already exists on db, update its value
-	for (i = 0; i < KeyDB->keyCount; i++)
+	// Don't match keyName (i.e. expiration date) for BISS1 and BISS2 mode 1/E sesssion words
+	i = key_index_find(KeyDB->index, identifier, provider, keyName);
+	if (i--)
 	{
-		if (KeyDB->EmuKeys[i].provider != provider)
-		{
-			continue;
-		}
-
-		// Don't match keyName (i.e. expiration date) for BISS1 and BISS2 mode 1/E sesssion words
-		if (identifier != 'F' && strcmp(KeyDB->EmuKeys[i].keyName, keyName))
-		{
-			continue;
-		}
-
 		// Allow multiple keys for Irdeto
 		if (identifier == 'I')
 		{
@@ -506,12 +663,14 @@ int8_t emu_set_key(char identifier, uint32_t provider, char *keyName, uint8_t *o
 				j++;
 			}
 
-			if (tmpKeyData->nextKey)
+			oldKeyData = tmpKeyData->nextKey;
+			__sync_synchronize();
+			tmpKeyData->nextKey = newKeyData;
+			if (oldKeyData)
 			{
-				NULLFREE(tmpKeyData->nextKey->key);
-				NULLFREE(tmpKeyData->nextKey);
+				add_garbage(oldKeyData->key);
+				add_garbage(oldKeyData);
 			}
-			tmpKeyData->nextKey = newKeyData;
 
 			if (writeKey)
 			{
@@ -520,9 +679,31 @@ int8_t emu_set_key(char identifier, uint32_t provider, char *keyName, uint8_t *o
 		}
 		else // identifier != 'I'
 		{
-			free(KeyDB->EmuKeys[i].key);
+			uint8_t *oldKey = KeyDB->EmuKeys[i].key;
+			uint32_t oldKeyLength = KeyDB->EmuKeys[i].keyLength;
+
+			/*
+			 * emu_find_key() reads the length before the key without a lock. The new
+			 * key buffer is at least as long as the old length and is published before
+			 * the new length, so any length a reader sees fits the buffer it gets.
+			 */
+			if (oldKeyLength > keyLength)
+			{
+				uint8_t *padKey = (uint8_t *)realloc(tmpKey, oldKeyLength);
+				if (padKey == NULL)
+				{
+					free(tmpKey);
+					return 0;
+				}
+				memset(padKey + keyLength, 0, oldKeyLength - keyLength);
+				tmpKey = padKey;
+			}
+
+			__sync_synchronize();
 			KeyDB->EmuKeys[i].key = tmpKey;
+			__sync_synchronize();
 			KeyDB->EmuKeys[i].keyLength = keyLength;
+			add_garbage(oldKey);
 
 			if (identifier == 'F') // Update keyName (i.e. expiration date) for BISS
 			{
@@ -534,33 +715,15 @@ int8_t emu_set_key(char identifier, uint32_t provider, char *keyName, uint8_t *o
 				write_key_to_file(identifier, provider, keyName, tmpKey, keyLength, comment);
 			}
 		}
+		KeyDB->generation++;
 		return 1;
 	}
 
 	// Key does not exist on db
-	if (KeyDB->keyCount + 1 > KeyDB->keyMax)
+	if (KeyDB->keyCount + 1 > KeyDB->keyMax && !key_container_grow(KeyDB))
 	{
-		if (KeyDB->EmuKeys == NULL) // db is empty
-		{
-			KeyDB->EmuKeys = (KeyData *)malloc(sizeof(KeyData) * (KeyDB->keyMax + 64));
-			if (KeyDB->EmuKeys == NULL)
-			{
-				free(tmpKey);
-				return 0;
-			}
-			KeyDB->keyMax += 64;
-		}
-		else // db is full, expand it
-		{
-			tmpKeyData = (KeyData *)realloc(KeyDB->EmuKeys, sizeof(KeyData) * (KeyDB->keyMax + 16));
-			if (tmpKeyData == NULL)
-			{
-				free(tmpKey);
-				return 0;
-			}
-			KeyDB->EmuKeys = tmpKeyData;
-			KeyDB->keyMax += 16;
-		}
+		free(tmpKey);
+		return 0;
 	}
 
 	KeyDB->EmuKeys[KeyDB->keyCount].identifier = identifier;
@@ -579,7 +742,9 @@ int8_t emu_set_key(char identifier, uint32_t provider, char *keyName, uint8_t *o
 	KeyDB->EmuKeys[KeyDB->keyCount].key = tmpKey;
 	KeyDB->EmuKeys[KeyDB->keyCount].keyLength = keyLength;
 	KeyDB->EmuKeys[KeyDB->keyCount].nextKey = NULL;
+	key_index_add(KeyDB->index, KeyDB->keyCount);
 	KeyDB->keyCount++;
+	KeyDB->generation++;
 
 	if (writeKey)
 	{
@@ -592,10 +757,11 @@ int8_t emu_find_key(char identifier, uint32_t provider, uint32_t providerIgnoreM
 					uint8_t *key, uint32_t maxKeyLength, uint8_t isCriticalKey, uint32_t keyRef,
 					uint8_t matchLength, uint32_t *getProvider)
 {
-	uint32_t i;
+	uint32_t i, n, keyLength, *next = NULL;
 	uint16_t j;
-	uint8_t provider_matching_key_count = 0;
+	uint8_t provider_matching_key_count = 0, *keyData;
 	KeyDataContainer *KeyDB;
+	KeyIndex *index;
 	KeyData *tmpKeyData;
 
 	KeyDB = emu_get_key_container(identifier);
@@ -604,15 +770,37 @@ int8_t emu_find_key(char identifier, uint32_t provider, uint32_t providerIgnoreM
 		return 0;
 	}
 
-	for (i = 0; i < KeyDB->keyCount; i++)
+	// Only the keys which can match are visited, in the order of the key array
+	index = KeyDB->index;
+	if (index == NULL)
 	{
-		if ((KeyDB->EmuKeys[i].provider & ~providerIgnoreMask) != provider)
+		n = 0;
+	}
+	else if (!providerIgnoreMask)
+	{
+		n = key_index_find(index, identifier, provider, keyName); // there is only one such key
+	}
+	else if (identifier != 'F')
+	{
+		n = index->byName[key_name_hash(keyName) & (index->size - 1)];
+		next = index->nextByName;
+	}
+	else
+	{
+		n = index->count ? 1 : 0;
+	}
+
+	for (; n; n = next ? next[n - 1] : (providerIgnoreMask && n < index->count ? n + 1 : 0))
+	{
+		i = n - 1;
+
+		if ((index->keys[i].provider & ~providerIgnoreMask) != provider)
 		{
 			continue;
 		}
 
 		// Don't match keyName (i.e. expiration date) for BISS
-		if (identifier != 'F' && strcmp(KeyDB->EmuKeys[i].keyName, keyName))
+		if (identifier != 'F' && strcmp(index->keys[i].keyName, keyName))
 		{
 			continue;
 		}
@@ -620,7 +808,7 @@ int8_t emu_find_key(char identifier, uint32_t provider, uint32_t providerIgnoreM
 		// "matchLength" cannot be used when multiple keys are allowed
 		// for a single provider/keyName combination.
 		// Currently this is the case only for Irdeto keys.
-		if (matchLength && KeyDB->EmuKeys[i].keyLength != maxKeyLength)
+		if (matchLength && index->keys[i].keyLength != maxKeyLength)
 		{
 			continue;
 		}
@@ -638,7 +826,7 @@ int8_t emu_find_key(char identifier, uint32_t provider, uint32_t providerIgnoreM
 			}
 		}
 
-		tmpKeyData = &KeyDB->EmuKeys[i];
+		tmpKeyData = &index->keys[i];
 
 		j = 0;
 		while (j < keyRef && tmpKeyData->nextKey != NULL)
@@ -649,10 +837,15 @@ int8_t emu_find_key(char identifier, uint32_t provider, uint32_t providerIgnoreM
 
 		if (j == keyRef)
 		{
-			memcpy(key, tmpKeyData->key, tmpKeyData->keyLength > maxKeyLength ? maxKeyLength : tmpKeyData->keyLength);
-			if (tmpKeyData->keyLength < maxKeyLength)
+			// the length first, emu_set_key() publishes a key before its length
+			keyLength = tmpKeyData->keyLength;
+			__sync_synchronize();
+			keyData = tmpKeyData->key;
+
+			memcpy(key, keyData, keyLength > maxKeyLength ? maxKeyLength : keyLength);
+			if (keyLength < maxKeyLength)
 			{
-				memset(key + tmpKeyData->keyLength, 0, maxKeyLength - tmpKeyData->keyLength);
+				memset(key + keyLength, 0, maxKeyLength - keyLength);
 			}
 
 			// Report the keyName (i.e. expiration date) of the session word found
@@ -707,14 +900,65 @@ int8_t emu_update_key(char identifier, uint32_t provider, char *keyName, uint8_t
 	return emu_set_key(identifier, provider, keyName, key, keyLength, writeKey, comment, NULL);
 }
 
+// frees the keys of a container, through the garbage collector if lookups may still use them
+static void free_keys(KeyData *keys, uint32_t keyCount, KeyIndex *index, int8_t published)
+{
+	uint32_t i;
+	KeyData *tmpKeyData;
+
+	for (i = 0; i < keyCount; i++)
+	{
+		// For Irdeto multiple keys only (linked list structure)
+		while (keys[i].nextKey != NULL)
+		{
+			tmpKeyData = keys[i].nextKey;
+			keys[i].nextKey = tmpKeyData->nextKey;
+			if (published)
+			{
+				add_garbage(tmpKeyData->key); // Free key
+				add_garbage(tmpKeyData); // Free KeyData
+			}
+			else
+			{
+				free(tmpKeyData->key);
+				free(tmpKeyData);
+			}
+		}
+
+		// For single keys (all identifiers, including Irdeto)
+		if (published)
+		{
+			add_garbage(keys[i].key);
+		}
+		else
+		{
+			free(keys[i].key);
+		}
+	}
+
+	// Free the KeyData array and its index
+	if (published)
+	{
+		add_garbage(index);
+		add_garbage(keys);
+	}
+	else
+	{
+		free(index);
+		free(keys);
+	}
+}
+
 static int32_t delete_keys_in_container(char identifier)
 {
 	// Deletes all keys stored in memory for the specified identifier,
-	// but keeps the container itself, re-initialized at { NULL, 0, 0 }.
+	// but keeps the container itself, re-initialized at { NULL, 0, 0, NULL },
+	// with a new generation.
 	// Returns the count of deleted keys.
 
-	uint32_t oldKeyCount, i;
-	KeyData *tmpKeyData;
+	uint32_t oldKeyCount;
+	KeyData *oldKeys;
+	KeyIndex *oldIndex;
 	KeyDataContainer *KeyDB = emu_get_key_container(identifier);
 
 	if (KeyDB == NULL || KeyDB->EmuKeys == NULL || KeyDB->keyCount == 0)
@@ -722,26 +966,18 @@ static int32_t delete_keys_in_container(char identifier)
 		return 0;
 	}
 
-	for (i = 0; i < KeyDB->keyCount; i++)
-	{
-		// For Irdeto multiple keys only (linked list structure)
-		while (KeyDB->EmuKeys[i].nextKey != NULL)
-		{
-			tmpKeyData = KeyDB->EmuKeys[i].nextKey;
-			KeyDB->EmuKeys[i].nextKey = KeyDB->EmuKeys[i].nextKey->nextKey;
-			free(tmpKeyData->key); // Free key
-			free(tmpKeyData); // Free KeyData
-		}
-
-		// For single keys (all identifiers, including Irdeto)
-		free(KeyDB->EmuKeys[i].key); // Free key
-	}
-
-	// Free the KeyData array
-	NULLFREE(KeyDB->EmuKeys);
+	// Empty the container first, running lookups still use the old keys
+	oldKeys = KeyDB->EmuKeys;
+	oldIndex = KeyDB->index;
 	oldKeyCount = KeyDB->keyCount;
+	KeyDB->index = NULL;
+	__sync_synchronize();
+	KeyDB->EmuKeys = NULL;
 	KeyDB->keyCount = 0;
 	KeyDB->keyMax = 0;
+	KeyDB->generation++;
+
+	free_keys(oldKeys, oldKeyCount, oldIndex, 1);
 
 	return oldKeyCount;
 }
@@ -781,16 +1017,369 @@ void emu_clear_keydata(void)
 	}
 }
 
+/*
+ * Key reload
+ *
+ * A reload builds the complete new key set in staged containers, while lookups keep
+ * using the live ones. The staged keys are then compared with the live keys and only
+ * the containers which differ are swapped, so there is no moment without keys.
+ *
+ * The SoftCam.Key files read are remembered by their inode, size and modification
+ * time, so a changed file can be reloaded without waiting for a manual refresh. A
+ * reload which finds a remembered file missing, emptied or shorter than it was when
+ * opened is dropped and the live keys stay, the file is checked again later.
+*/
+
+#define EMU_KEYFILE_MAX_STAMPS 4
+#define EMU_KEYFILE_CHECK_INTERVAL 10 // seconds
+
+typedef struct
+{
+	char path[256];
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+} KeyFileStamp;
+
+static KeyFileStamp keyfile_stamps[EMU_KEYFILE_MAX_STAMPS];
+static uint8_t keyfile_stamp_count = 0;
+static KeyFileStamp staged_stamps[EMU_KEYFILE_MAX_STAMPS]; // of the files read for the staged keys
+static uint8_t staged_stamp_count = 0;
+static int8_t keyfile_read_failed = 0;
+static time_t keyfile_checked = 0;
+static int8_t keyfile_reload_pending = 0;
+
+void emu_stage_keydata(void)
+{
+	memset(StagedKeys, 0, sizeof(StagedKeys));
+	staged_stamp_count = 0;
+	keyfile_read_failed = 0;
+	keyfile_reload_pending = 0;
+	keys_staged = 1;
+}
+
+// a remembered key file which is gone or emptied is likely being rewritten
+static int8_t keyfile_stamps_complete(void)
+{
+	struct stat st;
+	uint8_t i, j;
+
+	// the first load takes what it gets
+	if (keyfile_read_failed && keyfile_stamp_count)
+	{
+		return 0;
+	}
+
+	for (i = 0; i < keyfile_stamp_count; i++)
+	{
+		for (j = 0; j < staged_stamp_count; j++)
+		{
+			if (strcmp(keyfile_stamps[i].path, staged_stamps[j].path) == 0)
+			{
+				break;
+			}
+		}
+
+		if (j == staged_stamp_count)
+		{
+			// not read, only a file still there was left out on purpose
+			if (stat(keyfile_stamps[i].path, &st) != 0)
+			{
+				return 0;
+			}
+		}
+		else if (staged_stamps[j].size == 0 && keyfile_stamps[i].size > 0)
+		{
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+// compares two keys including the Irdeto keys linked to them
+static int8_t key_data_equal(const KeyData *a, const KeyData *b)
+{
+	for (; a != NULL && b != NULL; a = a->nextKey, b = b->nextKey)
+	{
+		if (a->keyLength != b->keyLength || memcmp(a->key, b->key, a->keyLength) != 0 ||
+			strcmp(a->keyName, b->keyName) != 0)
+		{
+			return 0;
+		}
+	}
+	return a == b;
+}
+
+// makes the staged keys live, lookups only go through the index and see either the old or the new keys
+static void key_container_swap(KeyDataContainer *KeyDB, KeyDataContainer *newDB)
+{
+	KeyDataContainer oldDB = *KeyDB;
+
+	KeyDB->EmuKeys = newDB->EmuKeys;
+	KeyDB->keyCount = newDB->keyCount;
+	KeyDB->keyMax = newDB->keyMax;
+	__sync_synchronize();
+	KeyDB->index = newDB->index;
+	KeyDB->generation++;
+
+	free_keys(oldDB.EmuKeys, oldDB.keyCount, oldDB.index, 1);
+}
+
+void emu_commit_keydata(void)
+{
+	uint32_t i, j, n, matched, total = 0, added = 0, changed = 0, removed = 0;
+	int8_t differs;
+	KeyDataContainer *KeyDB, *newDB;
+
+	keys_staged = 0;
+
+	if (!keyfile_stamps_complete())
+	{
+		cs_log("WARNING: key file missing or incomplete, keeping the keys in memory");
+		for (i = 0; i < sizeof(StagedKeys) / sizeof(StagedKeys[0]); i++)
+		{
+			if (StagedKeys[i].EmuKeys != NULL)
+			{
+				free_keys(StagedKeys[i].EmuKeys, StagedKeys[i].keyCount, StagedKeys[i].index, 0);
+			}
+		}
+		return;
+	}
+
+	memcpy(keyfile_stamps, staged_stamps, sizeof(keyfile_stamps));
+	keyfile_stamp_count = staged_stamp_count;
+
+	for (i = 0; i < sizeof(StagedKeys) / sizeof(StagedKeys[0]); i++)
+	{
+		KeyDB = emu_get_key_container(key_identifiers[i]);
+		newDB = &StagedKeys[i];
+		differs = 0;
+		matched = 0;
+
+		for (j = 0; j < newDB->keyCount; j++)
+		{
+			n = key_index_find(KeyDB->index, key_identifiers[i], newDB->EmuKeys[j].provider, newDB->EmuKeys[j].keyName);
+			if (n == 0)
+			{
+				added++;
+				differs = 1;
+				continue;
+			}
+
+			matched++;
+			if (!key_data_equal(&KeyDB->EmuKeys[n - 1], &newDB->EmuKeys[j]))
+			{
+				changed++;
+				differs = 1;
+			}
+			else if (n - 1 != j) // keyRef counts in array order
+			{
+				differs = 1;
+			}
+		}
+
+		total += KeyDB->keyCount;
+		removed += KeyDB->keyCount - matched;
+
+		if (differs || matched != KeyDB->keyCount)
+		{
+			key_container_swap(KeyDB, newDB);
+		}
+		else if (newDB->EmuKeys != NULL) // same keys, the live ones stay
+		{
+			free_keys(newDB->EmuKeys, newDB->keyCount, newDB->index, 0);
+		}
+	}
+
+	if (total != 0)
+	{
+		cs_log("Keys reloaded: %u added, %u changed, %u removed", added, changed, removed);
+	}
+}
+
+static void keyfile_stamp(const char *path, const struct stat *st)
+{
+	KeyFileStamp *stamp;
+
+	if (staged_stamp_count >= EMU_KEYFILE_MAX_STAMPS || cs_strlen(path) >= sizeof(stamp->path))
+	{
+		return;
+	}
+
+	stamp = &staged_stamps[staged_stamp_count++];
+	cs_strncpy(stamp->path, path, sizeof(stamp->path));
+	stamp->dev = st->st_dev;
+	stamp->ino = st->st_ino;
+	stamp->size = st->st_size;
+	stamp->mtime = st->st_mtime;
+}
+
+// follows a key file after an append of ours, if nobody else changed it in between
+static void keyfile_restamp(const char *path, const struct stat *before)
+{
+	KeyFileStamp *stamp;
+	struct stat st;
+	uint8_t i;
+
+	if (stat(path, &st) != 0)
+	{
+		return;
+	}
+
+	for (i = 0; i < keyfile_stamp_count; i++)
+	{
+		stamp = &keyfile_stamps[i];
+		if (stamp->dev == st.st_dev && stamp->ino == st.st_ino &&
+			stamp->size == before->st_size && stamp->mtime == before->st_mtime)
+		{
+			stamp->size = st.st_size;
+			stamp->mtime = st.st_mtime;
+		}
+	}
+}
+
+// reports a changed key file once, until the reload it asks for stages the new keys
+int8_t emu_keyfile_changed(void)
+{
+	struct stat st;
+	time_t now = time(NULL);
+	uint8_t i;
+	int8_t changed = 0;
+
+	if (keyfile_reload_pending || now - keyfile_checked < EMU_KEYFILE_CHECK_INTERVAL)
+	{
+		return 0;
+	}
+	keyfile_checked = now;
+
+	SAFE_MUTEX_LOCK(&emu_key_data_mutex);
+	for (i = 0; i < keyfile_stamp_count && !changed; i++)
+	{
+		// A missing file may just be rewritten, the keys stay until it is back
+		if (stat(keyfile_stamps[i].path, &st) != 0)
+		{
+			continue;
+		}
+
+		changed = st.st_dev != keyfile_stamps[i].dev || st.st_ino != keyfile_stamps[i].ino ||
+					st.st_size != keyfile_stamps[i].size || st.st_mtime != keyfile_stamps[i].mtime;
+	}
+	keyfile_reload_pending = changed;
+	SAFE_MUTEX_UNLOCK(&emu_key_data_mutex);
+
+	return changed;
+}
+
+static int8_t hex_nibble(char c)
+{
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	return -1;
+}
+
+// copies the next word of at most size - 1 characters, like sscanf's " %Ns"
+static uint32_t read_word(const char **p, const char *end, char *word, uint32_t size)
+{
+	uint32_t len = 0;
+
+	while (*p < end && isspace((uint8_t)**p))
+	{
+		(*p)++;
+	}
+
+	while (*p < end && len < size - 1 && !isspace((uint8_t)**p))
+	{
+		word[len++] = *(*p)++;
+	}
+	word[len] = '\0';
+
+	return len;
+}
+
+/*
+ * Parses keys in SoftCam.Key format, a "%c %8x %11s %1024s" line per key, straight
+ * from a copy of the file or the keys built in the binary.
+*/
+static void read_keys(struct s_reader *rdr, const char *data, size_t length, const char *source)
+{
+	char keyName[EMU_MAX_CHAR_KEYNAME], keyString[1026], identifier;
+	const char *end = data + length, *lineEnd, *p;
+	uint32_t provider, keyLength, i;
+	uint8_t key[512];
+	int8_t high, low;
+
+	for (; data < end; data = lineEnd + 1)
+	{
+		lineEnd = memchr(data, '\n', end - data);
+		if (lineEnd == NULL)
+		{
+			lineEnd = end;
+		}
+
+		p = data;
+		identifier = *p++;
+
+		while (p < lineEnd && isspace((uint8_t)*p))
+		{
+			p++;
+		}
+
+		for (provider = 0, i = 0; i < 8 && p < lineEnd && hex_nibble(*p) >= 0; i++)
+		{
+			provider = (provider << 4) | hex_nibble(*p++);
+		}
+
+		if (i == 0 || !read_word(&p, lineEnd, keyName, sizeof(keyName)) ||
+			!read_word(&p, lineEnd, keyString, sizeof(keyString) - 1))
+		{
+			continue;
+		}
+
+		keyLength = cs_strlen(keyString) / 2;
+		for (i = 0; i < keyLength; i++)
+		{
+			high = hex_nibble(keyString[i * 2]);
+			low = hex_nibble(keyString[i * 2 + 1]);
+			if (high < 0 || low < 0)
+			{
+				break;
+			}
+			key[i] = (high << 4) | low;
+		}
+
+		if (i == keyLength) // Conversion OK
+		{
+			emu_set_key(identifier, provider, keyName, key, keyLength, 0, NULL, rdr);
+		}
+		else // Non-hex characters in keyString
+		{
+			if ((identifier != ';' && identifier != '#' && // Skip warning for comments, etc.
+				 identifier != '=' && identifier != '-' &&
+				 identifier != ' ') &&
+				!(identifier == 'F' && 0 == strncmp(keyString, "XXXXXXXXXXXX", 12))) // Skip warning for BISS 'Example key' lines
+			{
+				// Alert user regarding faulty line
+				cs_log("WARNING: non-hex value in %s at %c %08X %s %s",
+						source, identifier, provider, keyName, keyString);
+			}
+		}
+	}
+}
+
 uint8_t emu_read_keyfile(struct s_reader *rdr, const char *opath)
 {
-	char line[1200], keyName[EMU_MAX_CHAR_KEYNAME], keyString[1026], identifier;
-	char *path, *filepath, filename[EMU_KEY_FILENAME_MAX_LEN + 1];
-	uint32_t pathLength, provider, keyLength;
+	char *path, *filepath, filename[EMU_KEY_FILENAME_MAX_LEN + 1], *data;
+	uint32_t pathLength;
 	uint8_t fileNameLen = cs_strlen(EMU_KEY_FILENAME);
-	uint8_t *key;
 	struct dirent *pDirent;
+	struct stat st;
 	DIR *pDir;
-	FILE *file = NULL;
+	int32_t fd;
+	ssize_t len;
+	size_t size = 0;
 
 	pathLength = cs_strlen(opath);
 	path = (char *)malloc(pathLength + 1);
@@ -852,10 +1441,16 @@ uint8_t emu_read_keyfile(struct s_reader *rdr, const char *opath)
 
 	cs_log("Reading key file: %s", filepath);
 
-	file = fopen(filepath, "r");
-	free(filepath);
-	if (file == NULL)
+	fd = open(filepath, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) != 0)
 	{
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+		cs_log("Cannot read key file: %s", filepath);
+		keyfile_read_failed = 1;
+		free(filepath);
 		return 0;
 	}
 
@@ -874,40 +1469,44 @@ uint8_t emu_read_keyfile(struct s_reader *rdr, const char *opath)
 	emu_set_keyfile_path(opath);
 #endif
 
-	while (fgets(line, 1200, file))
+	if (st.st_size > 0)
 	{
-		if (sscanf(line, "%c %8x %11s %1024s", &identifier, &provider, keyName, keyString) != 4)
-		{
-			continue;
-		}
-
-		keyLength = cs_strlen(keyString) / 2;
-		key = (uint8_t *)malloc(keyLength);
-		if (key == NULL)
+		// A copy, the file may be rewritten while it is parsed
+		if (!cs_malloc(&data, st.st_size))
 		{
-			fclose(file);
+			keyfile_read_failed = 1;
+			close(fd);
+			free(filepath);
 			return 0;
 		}
 
-		if (char_to_bin(key, keyString, cs_strlen(keyString))) // Conversion OK
+		while (size < (size_t)st.st_size)
 		{
-			emu_set_key(identifier, provider, keyName, key, keyLength, 0, NULL, rdr);
-		}
-		else // Non-hex characters in keyString
-		{
-			if ((identifier != ';' && identifier != '#' && // Skip warning for comments, etc.
-				 identifier != '=' && identifier != '-' &&
-				 identifier != ' ') &&
-				!(identifier == 'F' && 0 == strncmp(keyString, "XXXXXXXXXXXX", 12))) // Skip warning for BISS 'Example key' lines
+			len = read(fd, data + size, st.st_size - size);
+			if (len < 0 && errno == EINTR)
 			{
-				// Alert user regarding faulty line
-				cs_log("WARNING: non-hex value in %s at %c %08X %s %s",
-						EMU_KEY_FILENAME, identifier, provider, keyName, keyString);
+				continue;
 			}
+			if (len <= 0)
+			{
+				break;
+			}
+			size += len;
+		}
+
+		if (size < (size_t)st.st_size)
+		{
+			cs_log("WARNING: key file %s was shortened while reading", filepath);
+			keyfile_read_failed = 1;
 		}
-		free(key);
+
+		read_keys(rdr, data, size, EMU_KEY_FILENAME);
+		NULLFREE(data);
 	}
-	fclose(file);
+	close(fd);
+
+	keyfile_stamp(filepath, &st);
+	free(filepath);
 
 	return 1;
 }
@@ -918,56 +1517,7 @@ extern uint8_t SoftCamKey_DataEnd[] __asm__("_binary_SoftCam_Key_end");
 
 void emu_read_keymemory(struct s_reader *rdr)
 {
-	char *keyData, *line, *saveptr, keyName[EMU_MAX_CHAR_KEYNAME], keyString[1026], identifier;
-	uint32_t provider, keyLength;
-	uint8_t *key;
-
-	keyData = (char *)malloc(SoftCamKey_DataEnd - SoftCamKey_Data + 1);
-	if (keyData == NULL)
-	{
-		return;
-	}
-	memcpy(keyData, SoftCamKey_Data, SoftCamKey_DataEnd - SoftCamKey_Data);
-	keyData[SoftCamKey_DataEnd-SoftCamKey_Data] = 0x00;
-
-	line = strtok_r(keyData, "\n", &saveptr);
-	while (line != NULL)
-	{
-		if (sscanf(line, "%c %8x %11s %1024s", &identifier, &provider, keyName, keyString) != 4)
-		{
-			line = strtok_r(NULL, "\n", &saveptr);
-			continue;
-		}
-
-		keyLength = cs_strlen(keyString) / 2;
-
-		key = (uint8_t *)malloc(keyLength);
-		if (key == NULL)
-		{
-			free(keyData);
-			return;
-		}
-
-		if (char_to_bin(key, keyString, cs_strlen(keyString))) // Conversion OK
-		{
-			emu_set_key(identifier, provider, keyName, key, keyLength, 0, NULL, rdr);
-		}
-		else // Non-hex characters in keyString
-		{
-			if ((identifier != ';' && identifier != '#' && // Skip warning for comments, etc.
-				 identifier != '=' && identifier != '-' &&
-				 identifier != ' ') &&
-				!(identifier == 'F' && 0 == strncmp(keyString, "XXXXXXXXXXXX", 12))) // Skip warning for BISS 'Example key' lines
-			{
-				// Alert user regarding faulty line
-				cs_log("WARNING: non-hex value in internal keyfile at %c %08X %s %s",
-						identifier, provider, keyName, keyString);
-			}
-		}
-		free(key);
-		line = strtok_r(NULL, "\n", &saveptr);
-	}
-	free(keyData);
+	read_keys(rdr, (const char *)SoftCamKey_Data, SoftCamKey_DataEnd - SoftCamKey_Data, "internal keyfile");
 }
 #else
 void emu_read_keymemory(struct s_reader *UNUSED(rdr)) { }
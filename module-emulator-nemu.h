@@ -45,11 +45,25 @@ struct KeyData
 	KeyData *nextKey;
 };
 
+typedef struct
+{
+	KeyData *keys;         // the indexed key array
+	uint32_t count;        // keys visible to readers
+	uint32_t size;         // keys the array and the index hold, a power of 2
+	uint32_t *byKey;       // per (provider, keyName) bucket: index + 1 of the first key
+	uint32_t *byName;      // per keyName bucket, for lookups with a provider mask
+	uint32_t *byNameLast;
+	uint32_t *nextByKey;   // per key: index + 1 of the next key in its bucket
+	uint32_t *nextByName;
+} KeyIndex;
+
 typedef struct
 {
 	KeyData *EmuKeys;
 	uint32_t keyCount;
 	uint32_t keyMax;
+	KeyIndex *index;
+	uint32_t generation; // changes with every key stored or removed
 } KeyDataContainer;
 
 extern KeyDataContainer CwKeys;
@@ -79,6 +93,9 @@ char *down_softcam(struct s_reader *rdr);
 #endif
 void emu_set_keyfile_path(const char *path);
 void emu_clear_keydata(void);
+void emu_stage_keydata(void);
+void emu_commit_keydata(void);
+int8_t emu_keyfile_changed(void);
 uint8_t emu_read_keyfile(struct s_reader *rdr, const char *path);
 void emu_read_keymemory(struct s_reader *rdr);
 
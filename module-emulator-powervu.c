@@ -11,6 +11,10 @@
 #include "ncam-string.h"
 #include "ncam-time.h"
 
+#ifndef MODULE_STREAMRELAY
+#define EMU_STREAM_MAX_AUDIO_SUB_TRACKS 4
+#endif
+
 #ifdef WITH_LIBCURL
 #include "ncam-files.h"
 #include <curl/curl.h>
@@ -2093,6 +2097,186 @@ static void calculate_cw(uint8_t seedType, uint8_t *seed, uint8_t csaUsed, uint8
 	}
 }
 
+// hands the cws calculated for an ecm to the stream relay and the caller
+static void deliver_cws(const uint8_t *ecm, uint8_t cw[8][8], uint8_t csaUsed, uint8_t calculateAll,
+						uint8_t *dw, EXTENDED_CW *cw_ex
+#ifdef MODULE_STREAMRELAY
+						, emu_stream_client_key_data *cdata, int8_t update_global_key, const int8_t *update_global_keys
+#endif
+)
+{
+	uint32_t j;
+#ifdef MODULE_STREAMRELAY
+	stream_key_change key_change;
+#endif
+
+	if (calculateAll)
+	{
+#ifdef MODULE_STREAMRELAY
+		if (update_global_key || cdata != NULL)
+		{
+			memset(&key_change, 0, sizeof(key_change));
+			key_change.csa_used = csaUsed;
+			key_change.parity = ecm[0] == 0x80 ? EVEN : ODD;
+			key_change.cw_count = EMU_STREAM_MAX_AUDIO_SUB_TRACKS + 2;
+			cs_ftime(&key_change.due);
+			memcpy(key_change.cw, cw, sizeof(key_change.cw));
+		}
+
+		if (cdata != NULL) // ecm of the stream itself, applied right away
+		{
+			stream_key_schedule(cdata->connid, &key_change);
+		}
+
+		if (update_global_key)
+		{
+			// the ecm comes ahead of the parity change it is for on the other streams
+			add_ms_to_timeb(&key_change.due, cfg.emu_stream_ecm_delay);
+
+			for (j = 0; j < EMU_STREAM_SERVER_MAX_CONNECTIONS; j++)
+			{
+				if (update_global_keys[j])
+				{
+					stream_key_schedule(j, &key_change);
+				}
+			}
+		}
+#endif
+		if (cw_ex != NULL)
+		{
+			cw_ex->mode = CW_MODE_MULTIPLE_CW;
+
+			if (csaUsed)
+			{
+				cw_ex->algo = CW_ALGO_CSA;
+				cw_ex->algo_mode = CW_ALGO_MODE_CBC;
+			}
+			else
+			{
+				cw_ex->algo = CW_ALGO_DES;
+				cw_ex->algo_mode = CW_ALGO_MODE_ECB;
+			}
+
+			for (j = 0; j < EMU_STREAM_MAX_AUDIO_SUB_TRACKS; j++)
+			{
+				memset(cw_ex->audio[j], 0, 16);
+
+				if (ecm[0] == 0x80)
+				{
+					memcpy(cw_ex->audio[j], cw[PVU_CW_A1 + j], 8);
+				}
+				else
+				{
+					memcpy(&cw_ex->audio[j][8], cw[PVU_CW_A1 + j], 8);
+				}
+			}
+
+			memset(cw_ex->data, 0, 16);
+
+			if (ecm[0] == 0x80)
+			{
+				memcpy(cw_ex->data, cw[PVU_CW_HSD], 8);
+			}
+			else
+			{
+				memcpy(&cw_ex->data[8], cw[PVU_CW_HSD], 8);
+			}
+		}
+	}
+
+	memset(dw, 0, 16);
+
+	if (ecm[0] == 0x80)
+	{
+		memcpy(dw, cw[PVU_CW_VID], 8);
+	}
+	else
+	{
+		memcpy(&dw[8], cw[PVU_CW_VID], 8);
+	}
+}
+
+/*
+ * ECM cache
+ *
+ * The same ecm of a channel always gives the same cws, as long as the PowerVu keys
+ * don't change. Clients watching the same channel, the stream relay and repeated
+ * ecms of a crypto period therefore share one calculation per distinct ecm. The
+ * cache is indexed by the crc of the ecm and the channel hash.
+*/
+
+#define PVU_ECM_CACHE_SIZE 32
+#define PVU_ECM_CACHE_MAX_LEN 256
+
+typedef struct
+{
+	uint32_t channel_hash;
+	uint32_t generation; // of the PowerVu keys the cws were calculated with
+	uint16_t ecmLen;
+	uint8_t ecm[PVU_ECM_CACHE_MAX_LEN];
+	uint8_t cw[8][8];
+	uint8_t csaUsed;
+	uint8_t calculateAll; // all cws are known, not just the video cw
+} pvu_ecm_cache_entry;
+
+static pvu_ecm_cache_entry ecm_cache[PVU_ECM_CACHE_SIZE];
+static uint32_t ecm_cache_hits = 0, ecm_cache_misses = 0;
+#ifdef __powerpc__
+static pthread_mutex_t ecm_cache_lock;
+#else
+static pthread_mutex_t ecm_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static pvu_ecm_cache_entry *ecm_cache_slot(const uint8_t *ecm, uint16_t ecmLen, uint32_t channel_hash)
+{
+	uint32_t hash = (b2i(4, ecm + ecmLen - 4) ^ channel_hash) * 0x9E3779B1U;
+
+	return &ecm_cache[(hash >> 16) % PVU_ECM_CACHE_SIZE];
+}
+
+static int8_t ecm_cache_find(const uint8_t *ecm, uint16_t ecmLen, uint32_t channel_hash, uint32_t generation,
+								uint8_t calculateAll, uint8_t cw[8][8], uint8_t *csaUsed)
+{
+	pvu_ecm_cache_entry *entry = ecm_cache_slot(ecm, ecmLen, channel_hash);
+	int8_t found;
+
+	SAFE_MUTEX_LOCK(&ecm_cache_lock);
+	found = entry->ecmLen == ecmLen && entry->channel_hash == channel_hash && entry->generation == generation &&
+			(entry->calculateAll || !calculateAll) && memcmp(entry->ecm, ecm, ecmLen) == 0;
+	if (found)
+	{
+		memcpy(cw, entry->cw, sizeof(entry->cw));
+		*csaUsed = entry->csaUsed;
+		ecm_cache_hits++;
+	}
+	else
+	{
+		ecm_cache_misses++;
+	}
+	SAFE_MUTEX_UNLOCK(&ecm_cache_lock);
+
+	return found;
+}
+
+static void ecm_cache_store(const uint8_t *ecm, uint16_t ecmLen, uint32_t channel_hash, uint32_t generation,
+							uint8_t calculateAll, uint8_t cw[8][8], uint8_t csaUsed)
+{
+	pvu_ecm_cache_entry *entry = ecm_cache_slot(ecm, ecmLen, channel_hash);
+
+	SAFE_MUTEX_LOCK(&ecm_cache_lock);
+	entry->channel_hash = channel_hash;
+	entry->generation = generation;
+	entry->ecmLen = ecmLen;
+	memcpy(entry->ecm, ecm, ecmLen);
+	memcpy(entry->cw, cw, sizeof(entry->cw));
+	entry->csaUsed = csaUsed;
+	entry->calculateAll = calculateAll;
+
+	cs_log_dbg(D_ATR, "ecm cache: %u hits, %u misses (%u%% hit rate)", ecm_cache_hits, ecm_cache_misses,
+				ecm_cache_hits * 100 / (ecm_cache_hits + ecm_cache_misses));
+	SAFE_MUTEX_UNLOCK(&ecm_cache_lock);
+}
+
 int8_t powervu_ecm(uint8_t *ecm, uint8_t *dw, EXTENDED_CW *cw_ex, uint16_t srvid, uint16_t caid, uint16_t tsid, uint16_t onid, uint32_t ens
 #ifdef MODULE_STREAMRELAY
 		, emu_stream_client_key_data *cdata
@@ -2113,20 +2297,63 @@ int8_t powervu_ecm(uint8_t *ecm, uint8_t *dw, EXTENDED_CW *cw_ex, uint16_t srvid
 
 	//char tmpBuffer1[512];
 	char tmpBuffer2[17];
+	uint8_t cacheable, cacheEcm[PVU_ECM_CACHE_MAX_LEN];
+	uint32_t generation;
 #ifdef MODULE_STREAMRELAY
-	emu_stream_cw_item *cw_item;
 	int8_t update_global_key = 0;
-	int8_t update_global_keys[EMU_STREAM_SERVER_MAX_CONNECTIONS];
+	int8_t update_global_keys[EMU_STREAM_SERVER_MAX_CONNECTIONS + 1]; // sized at runtime, may be 0
 
 	memset(update_global_keys, 0, sizeof(update_global_keys));
-#else
-#define EMU_STREAM_MAX_AUDIO_SUB_TRACKS 4
 #endif
 	if (ecmLen < 7)
 	{
 		return EMU_NOT_SUPPORTED;
 	}
 
+#ifdef MODULE_STREAMRELAY
+	if (cdata == NULL)
+	{
+		SAFE_MUTEX_LOCK(&emu_fixed_key_srvid_mutex);
+		for (j = 0; j < EMU_STREAM_SERVER_MAX_CONNECTIONS; j++)
+		{
+			if (!stream_server_has_ecm[j] && emu_stream_cur_srvid[j] == srvid)
+			{
+				update_global_key = 1;
+				update_global_keys[j] = 1;
+			}
+		}
+		SAFE_MUTEX_UNLOCK(&emu_fixed_key_srvid_mutex);
+	}
+
+	calculateAll = cdata != NULL || update_global_key || cw_ex != NULL;
+#else
+	calculateAll = cw_ex != NULL;
+#endif
+	channel_hash = create_channel_hash(caid, tsid, onid, ens);
+	generation = PowervuKeys.generation;
+
+	// Keys fetched by the reader from the web are not tracked by the key generation
+	cacheable = ecmLen <= PVU_ECM_CACHE_MAX_LEN;
+#ifdef WITH_LIBCURL
+	cacheable = cacheable && pvurdr[pvu_bucket].rdr == NULL;
+#endif
+	if (cacheable)
+	{
+		if (ecm_cache_find(ecm, ecmLen, channel_hash, generation, calculateAll, cw, &csaUsed))
+		{
+			cs_log_dbg(D_ATR, "cws found in ecm cache, video cw: %s",
+							cs_hexdump(0, cw[PVU_CW_VID], 8, tmpBuffer2, sizeof(tmpBuffer2)));
+
+			deliver_cws(ecm, cw, csaUsed, calculateAll, dw, cw_ex
+#ifdef MODULE_STREAMRELAY
+						, cdata, update_global_key, update_global_keys
+#endif
+						);
+			return EMU_OK;
+		}
+		memcpy(cacheEcm, ecm, ecmLen);
+	}
+
 	needsUnmasking = (ecm[3] & 0xF0) == 0x50;
 
 	//cs_log_dbg(D_ATR, "ecm1: %s", cs_hexdump(0, ecm, ecmLen, tmpBuffer1, sizeof(tmpBuffer1)));
@@ -2244,7 +2471,6 @@ int8_t powervu_ecm(uint8_t *ecm, uint8_t *dw, EXTENDED_CW *cw_ex, uint16_t srvid
 				cs_log_dbg(D_ATR, "csaUsed: %d, xorMode: %d, ecmSrvid: %04X (%d), hashModeCw: %d, modeCW: %d",
 							csaUsed, xorMode, ecmSrvid, srvid, hashModeCw, modeCW);
 
-				channel_hash = create_channel_hash(caid, tsid, onid, ens);
 				group_id = get_channel_group(channel_hash);
 
 				cs_log_dbg(D_ATR, "channel hash: %08X, group id: %04X", channel_hash, group_id);
@@ -2342,25 +2568,7 @@ int8_t powervu_ecm(uint8_t *ecm, uint8_t *dw, EXTENDED_CW *cw_ex, uint16_t srvid
 				while (!decrypt_ok);
 
 				memcpy(seedBase, ecm + i + 6 + 2, 4);
-#ifdef MODULE_STREAMRELAY
-				if (cdata == NULL)
-				{
-					SAFE_MUTEX_LOCK(&emu_fixed_key_srvid_mutex);
-					for (j = 0; j < EMU_STREAM_SERVER_MAX_CONNECTIONS; j++)
-					{
-						if (!stream_server_has_ecm[j] && emu_stream_cur_srvid[j] == srvid)
-						{
-							update_global_key = 1;
-							update_global_keys[j] = 1;
-						}
-					}
-					SAFE_MUTEX_UNLOCK(&emu_fixed_key_srvid_mutex);
-				}
 
-				calculateAll = cdata != NULL || update_global_key || cw_ex != NULL;
-#else
-				calculateAll = cw_ex != NULL;
-#endif
 				if (calculateAll) // Calculate all seeds
 				{
 					for (j = 0; j < 8; j++)
@@ -2399,100 +2607,6 @@ int8_t powervu_ecm(uint8_t *ecm, uint8_t *dw, EXTENDED_CW *cw_ex, uint16_t srvid
 					//cs_log_dbg(D_ATR, "csaUsed=%d, cw: %s cdata=%x, cw_ex=%x",
 					//			csaUsed, cs_hexdump(3, cw[0], 8, tmpBuffer1, sizeof(tmpBuffer1)),
 					//			(unsigned int)cdata, (unsigned int)cw_ex);
-#ifdef MODULE_STREAMRELAY
-					if (update_global_key)
-					{
-						for (j = 0; j < EMU_STREAM_SERVER_MAX_CONNECTIONS; j++)
-						{
-							if (update_global_keys[j])
-							{
-								cw_item = (emu_stream_cw_item *)malloc(sizeof(emu_stream_cw_item));
-								if (cw_item != NULL)
-								{
-									cw_item->csa_used = csaUsed;
-									cw_item->is_even = ecm[0] == 0x80 ? 1 : 0;
-									cs_ftime(&cw_item->write_time);
-									add_ms_to_timeb(&cw_item->write_time, cfg.emu_stream_ecm_delay);
-									memcpy(cw_item->cw, cw, sizeof(cw));
-									ll_append(ll_emu_stream_delayed_keys[j], cw_item);
-								}
-							}
-						}
-					}
-
-					if (cdata != NULL)
-					{
-						for (j = 0; j < EMU_STREAM_MAX_AUDIO_SUB_TRACKS + 2; j++)
-						{
-							if (csaUsed)
-							{
-								if (ecm[0] == 0x80)
-								{
-									dvbcsa_bs_key_set(cw[j], key_data[cdata->connid].key[j][EVEN]);
-								}
-								else
-								{
-									dvbcsa_bs_key_set(cw[j], key_data[cdata->connid].key[j][ODD]);
-								}
-
-								cdata->csa_used = 1;
-							}
-							else
-							{
-								if (ecm[0] == 0x80)
-								{
-									des_set_key(cw[j], cdata->pvu_des_ks[j][0]);
-								}
-								else
-								{
-									des_set_key(cw[j], cdata->pvu_des_ks[j][1]);
-								}
-
-								cdata->csa_used = 0;
-							}
-						}
-					}
-#endif
-					if (cw_ex != NULL)
-					{
-						cw_ex->mode = CW_MODE_MULTIPLE_CW;
-
-						if (csaUsed)
-						{
-							cw_ex->algo = CW_ALGO_CSA;
-							cw_ex->algo_mode = CW_ALGO_MODE_CBC;
-						}
-						else
-						{
-							cw_ex->algo = CW_ALGO_DES;
-							cw_ex->algo_mode = CW_ALGO_MODE_ECB;
-						}
-
-						for (j = 0; j < EMU_STREAM_MAX_AUDIO_SUB_TRACKS; j++)
-						{
-							memset(cw_ex->audio[j], 0, 16);
-
-							if (ecm[0] == 0x80)
-							{
-								memcpy(cw_ex->audio[j], cw[PVU_CW_A1 + j], 8);
-							}
-							else
-							{
-								memcpy(&cw_ex->audio[j][8], cw[PVU_CW_A1 + j], 8);
-							}
-						}
-
-						memset(cw_ex->data, 0, 16);
-
-						if (ecm[0] == 0x80)
-						{
-							memcpy(cw_ex->data, cw[PVU_CW_HSD], 8);
-						}
-						else
-						{
-							memcpy(&cw_ex->data[8], cw[PVU_CW_HSD], 8);
-						}
-					}
 				}
 				else // Calculate only video CW
 				{
@@ -2512,17 +2626,16 @@ int8_t powervu_ecm(uint8_t *ecm, uint8_t *dw, EXTENDED_CW *cw_ex, uint16_t srvid
 									cs_hexdump(0, cw[PVU_CW_VID], 8, tmpBuffer2, sizeof(tmpBuffer2)));
 				}
 
-				memset(dw, 0, 16);
-
-				if (ecm[0] == 0x80)
+				if (cacheable)
 				{
-					memcpy(dw, cw[PVU_CW_VID], 8);
-				}
-				else
-				{
-					memcpy(&dw[8], cw[PVU_CW_VID], 8);
+					ecm_cache_store(cacheEcm, SCT_LEN(cacheEcm), channel_hash, generation, calculateAll, cw, csaUsed);
 				}
 
+				deliver_cws(ecm, cw, csaUsed, calculateAll, dw, cw_ex
+#ifdef MODULE_STREAMRELAY
+							, cdata, update_global_key, update_global_keys
+#endif
+							);
 				return EMU_OK;
 			}
 
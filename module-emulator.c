@@ -13,6 +13,7 @@
 #include "ncam-config.h"
 #include "ncam-reader.h"
 #include "ncam-string.h"
+#include "ncam-work.h"
 
 /*
  * Readers in NCam consist of 2 basic parts.
@@ -195,6 +196,12 @@ static void refresh_entitlements(struct s_reader *rdr)
 
 static int32_t emu_do_ecm(struct s_reader *rdr, const ECM_REQUEST *er, struct s_ecm_answer *ea)
 {
+	// Reload the keys after a SoftCam.Key file was changed
+	if (emu_keyfile_changed())
+	{
+		add_job(rdr->client, ACTION_READER_CARDINFO, NULL, 0);
+	}
+
 	if (!emu_process_ecm(rdr, er, ea->cw, &ea->cw_ex))
 	{
 		return CS_OK;
@@ -235,8 +242,8 @@ static int32_t emu_card_info(struct s_reader *rdr)
 	int key = 0;
 	SAFE_MUTEX_LOCK(&emu_key_data_mutex);
 
-	// Delete keys from Emu's memory
-	emu_clear_keydata();
+	// Build the new key set next to the keys in use
+	emu_stage_keydata();
 	// Delete BISS2 mode CA RSA keys
 	ll_destroy_data(&rdr->ll_biss2_rsa_keys);
 
@@ -277,6 +284,9 @@ static int32_t emu_card_info(struct s_reader *rdr)
 	// Read BISS2 mode CA RSA keys from PEM files
 	biss_read_pem(rdr, BISS2_MAX_RSA_KEYS);
 #endif
+	// Swap in the keys which changed
+	emu_commit_keydata();
+
 	cs_log("Total keys in memory: W:%d V:%d N:%d I:%d F:%d G:%d O:%d P:%d T:%d A:%d",
 			CwKeys.keyCount, ViKeys.keyCount, NagraKeys.keyCount, IrdetoKeys.keyCount, BissSWs.keyCount,
 			Biss2Keys.keyCount, OmnicryptKeys.keyCount, PowervuKeys.keyCount, TandbergKeys.keyCount,
@@ -759,19 +769,15 @@ static int32_t emu_reader_init(struct s_reader *UNUSED(reader))
 #ifdef MODULE_STREAMRELAY
 	if (cfg.stream_relay_enabled && (stream_server_thread_init == 0))
 	{
-		int32_t i;
+		uint32_t i;
 		stream_server_thread_init = 1;
 		SAFE_MUTEX_INIT(&emu_fixed_key_srvid_mutex, NULL);
 
 		for (i = 0; i < EMU_STREAM_SERVER_MAX_CONNECTIONS; i++)
 		{
 			SAFE_MUTEX_INIT(&emu_fixed_key_data_mutex[i], NULL);
-			ll_emu_stream_delayed_keys[i] = ll_create("ll_emu_stream_delayed_keys");
 			memset(&emu_fixed_key_data[i], 0, sizeof(emu_stream_client_key_data));
 		}
-
-		start_thread("stream_key_delayer", stream_key_delayer, NULL, NULL, 1, 1);
-		cs_log("Stream key delayer initialized");
 	}
 
 	// Initialize mutex for exclusive access to key database and key file
@@ -55,13 +55,10 @@ static int8_t monitor_auth_client(char *usr, char *pwd)
 		cs_auth_client(cur_cl, (struct s_auth *)0, NULL);
 		return -1;
 	}
-	for(account = cfg.account; account; account = account->next)
+	account = get_account_by_name(usr);
+	if(account && account->monlvl && streq(pwd, account->pwd))
 	{
-		if(account->monlvl && streq(usr, account->usr) && streq(pwd, account->pwd))
-		{
-			module_data->auth = 1;
-			break;
-		}
+		module_data->auth = 1;
 	}
 	if(!module_data->auth)
 	{
@@ -92,10 +89,9 @@ static int32_t secmon_auth_client(uint8_t *ucrc)
 	cur_cl->crypted = 1;
 	crc = (ucrc[0] << 24) | (ucrc[1] << 16) | (ucrc[2] << 8) | ucrc[3];
 
-	for(account = cfg.account; (account) && (!module_data->auth); account = account->next)
+	for(account = get_account_by_ucrc(crc, NULL); (account) && (!module_data->auth); account = get_account_by_ucrc(crc, account))
 	{
-			if((account->monlvl) &&
-				(crc == crc32(0L, MD5((uint8_t *)account->usr, cs_strlen(account->usr), md5tmp), MD5_DIGEST_LENGTH)))
+		if(account->monlvl)
 		{
 			memcpy(module_data->ucrc, ucrc, 4);
 			aes_set_key(&module_data->aes_keys, (char *)MD5((uint8_t *)ESTR(account->pwd), cs_strlen(ESTR(account->pwd)), md5tmp));
@@ -704,13 +700,9 @@ static void monitor_set_account(char *args)
 	}
 
 	// search account
-	for(account = cfg.account; (account) ; account = account->next)
+	if((account = get_account_by_name(argarray[0])))
 	{
-		if(!strcmp(argarray[0], account->usr))
-		{
-			found = 1;
-			break;
-		}
+		found = 1;
 	}
 
 	if(found != 1)
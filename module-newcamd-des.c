@@ -14,6 +14,35 @@
 
 extern const int32_t CWS_NETMSGSIZE;
 
+struct des_key_schedule
+{
+	uint8_t K[16][8]; // round keys in round order
+	uint8_t k8; // Viaccess key byte
+};
+
+// 3-DES key schedules of a newcamd session key
+struct nc_des_ks
+{
+	uint8_t deskey[16];
+	struct des_key_schedule key1;
+	struct des_key_schedule key1_right;
+	struct des_key_schedule key2;
+	struct des_key_schedule key2_right;
+	int8_t valid;
+};
+
+#define NC_DES_KS_CACHE 4
+
+// per thread cache of the last used session keys
+struct nc_des_ks_cache
+{
+	struct nc_des_ks ks[NC_DES_KS_CACHE];
+	uint8_t next;
+};
+
+static pthread_key_t nc_des_ks_cache_key;
+static pthread_once_t nc_des_ks_cache_once = PTHREAD_ONCE_INIT;
+
 static const uint8_t PC2[8][6] =
 {
 	{ 14, 17, 11, 24,  1,  5 },
@@ -312,10 +341,9 @@ static void swap(uint8_t left[], uint8_t right[])
 	memcpy(left, x, 4);
 }
 
-static void desRound(uint8_t left[], uint8_t right[], uint8_t data[], uint8_t mode, uint8_t k8)
+static void desRound(const uint8_t K[], uint8_t data[], uint8_t mode, uint8_t k8)
 {
 	uint8_t i;
-	uint8_t K[8];
 	uint8_t r[4];
 	uint8_t tempr[4];
 	unsigned short temp;
@@ -328,8 +356,7 @@ static void desRound(uint8_t left[], uint8_t right[], uint8_t data[], uint8_t mo
 	if((temp & 0xff) - (temp >> 8) < 0)
 		{ tempr[0]++; }
 
-	makeK(left, right, K);
-	desCore(tempr, K, r);
+	desCore(tempr, (uint8_t *)K, r);
 	permut32(r);
 
 	if(mode & DES_HASH)
@@ -348,7 +375,10 @@ static void desRound(uint8_t left[], uint8_t right[], uint8_t data[], uint8_t mo
 	swap(data - 4, data);
 }
 
-void nc_des(uint8_t key[], uint8_t mode, uint8_t data[])
+/*
+ * only DES_RIGHT of mode is used, the other mode bits don't change the key schedule
+ */
+static void des_key_schedule(uint8_t key[], uint8_t mode, struct des_key_schedule *ks)
 {
 	uint8_t i;
 	uint8_t left[8];
@@ -368,8 +398,7 @@ void nc_des(uint8_t key[], uint8_t mode, uint8_t data[])
 	right[2] = key[4];
 	right[3] = key[3] & 0x0f;
 
-	if(mode & DES_IP) { doIp(data); }
-
+	i = 0;
 	do
 	{
 		if(!(mode & DES_RIGHT))
@@ -377,7 +406,7 @@ void nc_des(uint8_t key[], uint8_t mode, uint8_t data[])
 			leftRotKeys(left, right);
 			if(!(DESShift & 0x8000)) { leftRotKeys(left, right); }
 		}
-		desRound(left, right, data, mode, key[7]);
+		makeK(left, right, ks->K[i++]);
 
 		if(mode & DES_RIGHT)
 		{
@@ -388,9 +417,28 @@ void nc_des(uint8_t key[], uint8_t mode, uint8_t data[])
 	}
 	while(DESShift);
 
+	ks->k8 = key[7];
+}
+
+static void des_crypt(const struct des_key_schedule *ks, uint8_t mode, uint8_t data[])
+{
+	uint8_t i;
+
+	if(mode & DES_IP) { doIp(data); }
+
+	for(i = 0; i < 16; i++)
+		{ desRound(ks->K[i], data, mode, ks->k8); }
+
 	swap(data, data + 4);
 	if(mode & DES_IP_1) { doIp_1(data); }
+}
+
+void nc_des(uint8_t key[], uint8_t mode, uint8_t data[])
+{
+	struct des_key_schedule ks;
 
+	des_key_schedule(key, mode, &ks);
+	des_crypt(&ks, mode, data);
 }
 
 /*------------------------------------------------------------------------*/
@@ -531,6 +579,71 @@ static void EuroDes(uint8_t key1[], uint8_t key2[], uint8_t desMode, uint8_t ope
 	}
 }
 
+static void nc_des_ks_cache_key_create(void)
+{
+	pthread_key_create(&nc_des_ks_cache_key, free);
+}
+
+/*
+ * returns the key schedules of a newcamd session key, the last NC_DES_KS_CACHE
+ * keys of a thread are cached so the schedule is only built once per session
+ */
+static struct nc_des_ks *nc_des_ks_get(uint8_t *deskey)
+{
+	struct nc_des_ks_cache *cache;
+	struct nc_des_ks *ks;
+	uint8_t i;
+
+	if(deskey[7]) // Viaccess mode, not used by newcamd
+		{ return NULL; }
+
+	pthread_once(&nc_des_ks_cache_once, nc_des_ks_cache_key_create);
+	cache = pthread_getspecific(nc_des_ks_cache_key);
+	if(!cache)
+	{
+		if(!cs_malloc(&cache, sizeof(struct nc_des_ks_cache)))
+			{ return NULL; }
+		pthread_setspecific(nc_des_ks_cache_key, cache);
+	}
+
+	for(i = 0; i < NC_DES_KS_CACHE; i++)
+	{
+		ks = &cache->ks[i];
+		if(ks->valid && !memcmp(ks->deskey, deskey, sizeof(ks->deskey)))
+			{ return ks; }
+	}
+
+	ks = &cache->ks[cache->next];
+	cache->next = (cache->next + 1) % NC_DES_KS_CACHE;
+
+	memcpy(ks->deskey, deskey, sizeof(ks->deskey));
+	des_key_schedule(deskey, 0, &ks->key1);
+	des_key_schedule(deskey, DES_RIGHT, &ks->key1_right);
+	des_key_schedule(deskey + 8, 0, &ks->key2);
+	des_key_schedule(deskey + 8, DES_RIGHT, &ks->key2_right);
+	ks->valid = 1;
+	return ks;
+}
+
+/*
+ * Eurocrypt 3-DES with cached key schedules, same as EuroDes() with F_TRIPLE_DES
+ */
+static void nc_des3(struct nc_des_ks *ks, uint8_t operatingMode, uint8_t data[])
+{
+	if(operatingMode == HASH)
+	{
+		des_crypt(&ks->key1, DES_IP, data);
+		des_crypt(&ks->key2_right, DES_RIGHT, data);
+		des_crypt(&ks->key1, DES_IP_1, data);
+	}
+	else
+	{
+		des_crypt(&ks->key1_right, DES_IP | DES_RIGHT, data);
+		des_crypt(&ks->key2, 0, data);
+		des_crypt(&ks->key1_right, DES_RIGHT | DES_IP_1, data);
+	}
+}
+
 int nc_des_encrypt(uint8_t *buffer, int len, uint8_t *deskey)
 {
 	uint8_t checksum = 0;
@@ -540,6 +653,7 @@ int nc_des_encrypt(uint8_t *buffer, int len, uint8_t *deskey)
 	short i;
 
 	if(!deskey) { return len; }
+	struct nc_des_ks *ks = nc_des_ks_get(deskey);
 	noPadBytes = (8 - ((len - 1) % 8)) % 8;
 	if(len + noPadBytes + 1 >= CWS_NETMSGSIZE - 8) { return -1; }
 	des_random_get(padBytes, noPadBytes);
@@ -553,7 +667,10 @@ int nc_des_encrypt(uint8_t *buffer, int len, uint8_t *deskey)
 		uint8_t j;
 		const uint8_t flags = (1 << F_EURO_S2) | (1 << F_TRIPLE_DES);
 		for(j = 0; j < 8; j++) { buffer[i + j] ^= ivec[j]; }
-		EuroDes(deskey, deskey + 8, flags, HASH, buffer + i);
+		if(ks)
+			{ nc_des3(ks, HASH, buffer + i); }
+		else
+			{ EuroDes(deskey, deskey + 8, flags, HASH, buffer + i); }
 		memcpy(ivec, buffer + i, 8);
 	}
 	len += 8;
@@ -569,6 +686,7 @@ int nc_des_decrypt(uint8_t *buffer, int len, uint8_t *deskey)
 
 	if(!deskey) { return len; }
 	if((len - 2) % 8 || (len - 2) < 16) { return -1; }
+	struct nc_des_ks *ks = nc_des_ks_get(deskey);
 	len -= 8;
 	memcpy(nextIvec, buffer + len, 8);
 	for(i = 2; i < len; i += 8)
@@ -578,7 +696,10 @@ int nc_des_decrypt(uint8_t *buffer, int len, uint8_t *deskey)
 
 		memcpy(ivec, nextIvec, 8);
 		memcpy(nextIvec, buffer + i, 8);
-		EuroDes(deskey, deskey + 8, flags, CRYPT, buffer + i);
+		if(ks)
+			{ nc_des3(ks, CRYPT, buffer + i); }
+		else
+			{ EuroDes(deskey, deskey + 8, flags, CRYPT, buffer + i); }
 		for(j = 0; j < 8; j++)
 			{ buffer[i + j] ^= ivec[j]; }
 	}
@@ -1022,47 +1022,44 @@ static int8_t newcamd_auth_client(IN_ADDR_T ip, uint8_t *deskey)
 		sid_list = 1;
 	}
 
-	for(ok = 0, account = cfg.account; usr && account && (!ok); account = account->next)
+	ok = 0;
+	account = usr ? get_account_by_name((char *)usr) : NULL;
+	if(account)
 	{
 		cs_log_dbg(D_CLIENT, "account->usr=%s", account->usr);
 
-		if(strcmp((char *)usr, account->usr) == 0)
-		{
-			__md5_crypt(ESTR(account->pwd), "$1$abcdefgh$", (char *)passwdcrypt);
-			cs_log_dbg(D_CLIENT, "account->pwd=%s", passwdcrypt);
+		__md5_crypt(ESTR(account->pwd), "$1$abcdefgh$", (char *)passwdcrypt);
+		cs_log_dbg(D_CLIENT, "account->pwd=%s", passwdcrypt);
 
-			if(strcmp((char *)pwd, (const char *)passwdcrypt) == 0)
-			{
-				cl->crypted = 1;
-				char e_txt[20];
+		if(strcmp((char *)pwd, (const char *)passwdcrypt) == 0)
+		{
+			cl->crypted = 1;
+			char e_txt[20];
 
-				snprintf(e_txt, 20, "%s:%d", "newcamd", cfg.ncd_ptab.ports[cl->port_idx].s_port);
+			snprintf(e_txt, 20, "%s:%d", "newcamd", cfg.ncd_ptab.ports[cl->port_idx].s_port);
 
-				if((rc = cs_auth_client(cl, account, e_txt)) == 2)
-				{
-					cs_log("hostname or ip mismatch for user %s (%s)", usr, client_name);
-					break;
-				}
-				else if(rc != 0)
-				{
-					cs_log("account is invalid for user %s (%s)", usr, client_name);
-					break;
-				}
-				else
-				{
-					cs_log("user %s authenticated successfully (%s)", usr, client_name);
-					ok = 1;
-					break;
-				}
+			if((rc = cs_auth_client(cl, account, e_txt)) == 2)
+			{
+				cs_log("hostname or ip mismatch for user %s (%s)", usr, client_name);
+			}
+			else if(rc != 0)
+			{
+				cs_log("account is invalid for user %s (%s)", usr, client_name);
 			}
 			else
 			{
-				cs_log("user %s is providing a wrong password (%s)", usr, client_name);
+				cs_log("user %s authenticated successfully (%s)", usr, client_name);
+				ok = 1;
 			}
 		}
+		else
+		{
+			cs_log("user %s is providing a wrong password (%s)", usr, client_name);
+			account = NULL;
+		}
 	}
 
-	if(!ok && !account)
+	if(!ok && !account && usr)
 	{
 		cs_log("user %s is trying to connect but doesnt exist ! (%s)", usr, client_name);
 		usr = 0;
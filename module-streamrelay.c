@@ -18,6 +18,12 @@
 #ifndef STATIC_LIBDVBCSA
 #include <dlfcn.h>
 #endif
+#include <sys/epoll.h>
+#include <linux/errqueue.h>
+
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+#define STREAM_ZEROCOPY
+#endif
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wredundant-decls"
@@ -38,37 +44,139 @@ void dvbcsa_bs_key_set_ecm(const unsigned char ecm, const dvbcsa_cw_t cw, struct
 
 extern int32_t exit_oscam;
 
+enum
+{
+	STREAM_EV_LISTEN,
+	STREAM_EV_WAKE,
+	STREAM_EV_CLIENT,
+	STREAM_EV_SOURCE
+};
+
+typedef struct stream_session stream_session;
+
+/*
+ * Stream data passes the pipeline stages by reference: the event loop
+ * receives into a chunk, a worker descrambles it in place and sends it,
+ * clients which didn't take all of it keep a reference in their queue.
+ */
+typedef struct
+{
+	uint8_t *buf;
+	uint32_t len; // received bytes
+	uint32_t start; // offset of the first ts packet
+	uint32_t data_len; // whole ts packets from start
+	uint32_t seq;
+	struct timeb time; // when it was received, the position of the data for the key changes
+	int8_t busy; // being received or waiting for / in the descrambler
+	int32_t refs; // client queues holding the chunk
+	int32_t pins; // zerocopy sends the kernel may still read from the chunk
+} stream_chunk;
+
+/*
+ * Header fields of a ts packet, extracted once per chunk for the parsers and
+ * descramblers. A payload offset of 0 marks packets to skip: no sync byte or
+ * an adaptation field filling the whole packet.
+ */
+typedef struct
+{
+	uint16_t pid;
+	uint8_t flags; // 4th header byte: scrambling control, adaptation field and payload bits
+	uint8_t payload_start;
+	uint16_t offset; // of the payload
+} stream_ts_packet;
+
 typedef struct
 {
+	int8_t evtype; // STREAM_EV_CLIENT, must be first (epoll data)
 	int32_t connfd;
 	int32_t connid;
+	int8_t error; // set by a worker when sending failed
+	int8_t want_out; // EPOLLOUT is enabled
+	stream_session *session;
+	stream_chunk **queue; // chunks the client socket didn't take yet, one per chunk of the session at most
+	int32_t queue_head;
+	int32_t queue_count;
+	uint32_t queue_offset; // bytes of the head chunk already sent
+	uint8_t tail[256]; // rest of a partly sent ts packet of a dropped chunk
+	uint16_t tail_len;
+	int32_t drop_count; // chunks dropped in a row because the client is too slow
+	int8_t zerocopy; // SO_ZEROCOPY is enabled, chunks are sent with MSG_ZEROCOPY
+	stream_chunk *zc_chunks[STREAM_CLIENT_ZEROCOPY_SENDS]; // chunk of each zerocopy send in flight, by notification id
+	uint32_t zc_first; // oldest notification id still in flight
+	uint32_t zc_next; // notification id of the next zerocopy send
 } stream_client_conn_data;
 
+struct stream_session
+{
+	int8_t evtype; // STREAM_EV_SOURCE, must be first (epoll data)
+	int32_t connid; // key data slot of the stream
+	char stream_path[255];
+	stream_client_data *data;
+	pthread_mutex_t clients_mutex; // protects the clients, their queues and the chunk states
+	LLIST *clients; // stream_client_conn_data of all clients watching the stream
+	int32_t streamfd;
+	int8_t connected; // 1 = request sent, 2 = got data
+	int8_t busy; // a worker is descrambling the ready chunks
+	int8_t stalled; // no free chunk, the source is not read
+	int8_t closing;
+	int8_t descrambling;
+	struct timeb hold; // the ready chunks wait for the descrambler until then
+	int8_t connect_errors;
+	int8_t data_errors;
+	int8_t reconnect_count;
+	struct timeb last_data;
+	struct timeb next_connect;
+	stream_chunk *chunks;
+	int32_t chunk_count;
+	uint32_t chunk_size;
+	uint32_t chunk_wait; // received bytes which are handed over to the descrambler
+	uint32_t seq;
+	stream_chunk *fill; // chunk being received into
+	LLIST *ready; // received chunks waiting for the descrambler, in stream order
+	uint8_t carry[256]; // incomplete ts packet at the end of the last chunk
+	uint16_t carry_len;
+	uint16_t packet_size;
+	stream_ts_packet *packets; // headers of the chunk being descrambled
+	struct dvbcsa_bs_batch_s *tsbbatch;
+	int32_t pinned; // chunks with zerocopy sends in flight
+};
+
 static char stream_source_host[256];
+static IN_ADDR_T stream_source_addr; // of stream_source_host, resolved off the event loop
+static int8_t stream_source_lookup = 0; // a worker resolves stream_source_host again
 static char *stream_source_auth = NULL;
 static uint32_t cluster_size = 50;
 static bool has_dvbcsa_ecm = 0;
 
 static uint8_t stream_server_mutex_init = 0;
-static pthread_mutex_t stream_server_mutex;
-static int32_t glistenfd, gconncount = 0, gconnfd[STREAM_SERVER_MAX_CONNECTIONS];
+static pthread_mutex_t stream_server_mutex; // protects the worker job queue
+static pthread_cond_t stream_jobs_cond;
+static int8_t stream_server_running = 0;
+static LLIST *ll_stream_jobs; // sessions with received data for the workers
+static LLIST *ll_stream_done; // sessions the workers are done with
+static LLIST *ll_stream_stale; // closed clients and sessions, freed after the current epoll events
+static int32_t gepollfd = -1, gwakefd[2] = { -1, -1 };
+
+// connection and stream tables, owned by the event loop and sized by stream_relay_max_connections
+static int32_t glistenfd = -1, gconncount = 0, *gconnfd;
+static stream_session **gsessions; // one per stream path, the index is the key data slot
 #ifdef WITH_EMU
 #define STATIC /* none */
 #else
 #define STATIC static
 #endif
+STATIC uint32_t stream_server_max_connections = 0;
 STATIC pthread_mutex_t fixed_key_srvid_mutex;
-STATIC uint16_t stream_cur_srvid[STREAM_SERVER_MAX_CONNECTIONS];
-STATIC stream_client_key_data key_data[STREAM_SERVER_MAX_CONNECTIONS];
+STATIC uint16_t *stream_cur_srvid;
+STATIC stream_client_key_data *key_data;
 
 #ifdef WITH_EMU
 int8_t stream_server_thread_init = 0;
 int8_t emu_stream_emm_enabled = 0;
 uint8_t emu_stream_server_mutex_init = 0;
-int8_t stream_server_has_ecm[EMU_STREAM_SERVER_MAX_CONNECTIONS];
-pthread_mutex_t emu_fixed_key_data_mutex[EMU_STREAM_SERVER_MAX_CONNECTIONS];
-emu_stream_client_key_data emu_fixed_key_data[EMU_STREAM_SERVER_MAX_CONNECTIONS];
-LLIST *ll_emu_stream_delayed_keys[EMU_STREAM_SERVER_MAX_CONNECTIONS];
+int8_t *stream_server_has_ecm;
+pthread_mutex_t *emu_fixed_key_data_mutex;
+emu_stream_client_key_data *emu_fixed_key_data;
 #endif
 
 #ifdef MODULE_RADEGAST
@@ -195,61 +303,59 @@ void ParseEcmData(stream_client_data *cdata)
 #define ParseEcmData radegast_client_ecm
 #endif
 
+/*
+ * Queues a control word for the descrambler of a stream slot. Called by the
+ * ecm and emulator threads, the descrambler installs it between two batches.
+ */
+void stream_key_schedule(int32_t connid, const stream_key_change *change)
+{
+	stream_key_change *item, *old;
+
+	if (!cs_malloc(&item, sizeof(stream_key_change)))
+	{
+		return;
+	}
+	memcpy(item, change, sizeof(stream_key_change));
+
+	// nobody takes them if the stream isn't descrambled
+	while (ll_count(key_data[connid].changes) >= STREAM_KEY_MAX_CHANGES)
+	{
+		old = ll_remove_first(key_data[connid].changes);
+		NULLFREE(old);
+	}
+	ll_append(key_data[connid].changes, item);
+}
+
 static void write_cw(ECM_REQUEST *er, int32_t connid)
 {
-	const uint8_t ecm = (caid_is_videoguard(er->caid) && (er->ecm[4] != 0 && (er->ecm[2] - er->ecm[4]) == 4)) ? 4 : 0;
+	stream_key_change change;
+
+	memset(&change, 0, sizeof(change)); // due right away, a late key is needed by the data waiting already
+	change.ecm = (caid_is_videoguard(er->caid) && (er->ecm[4] != 0 && (er->ecm[2] - er->ecm[4]) == 4)) ? 4 : 0;
+	change.csa_used = 1;
+	change.cw_count = 1;
+
 	if (memcmp(er->cw, "\x00\x00\x00\x00\x00\x00\x00\x00", 8) != 0)
 	{
-		if (has_dvbcsa_ecm)
-		{
-			dvbcsa_bs_key_set_ecm(ecm, er->cw, key_data[connid].key
-#ifdef WITH_EMU
-			[0]
-#endif
-			[EVEN]);
-		}
-		else
-		{
-			dvbcsa_bs_key_set(er->cw, key_data[connid].key
-#ifdef WITH_EMU
-			[0]
-#endif
-			[EVEN]);
-		}
+		change.parity = EVEN;
+		memcpy(change.cw[0], er->cw, 8);
+		stream_key_schedule(connid, &change);
 	}
 
 	if (memcmp(er->cw + 8, "\x00\x00\x00\x00\x00\x00\x00\x00", 8) != 0)
 	{
-		if (has_dvbcsa_ecm)
-		{
-			dvbcsa_bs_key_set_ecm(ecm, er->cw + 8, key_data[connid].key
-#ifdef WITH_EMU
-			[0]
-#endif
-			[ODD]);
-		}
-		else
-		{
-			dvbcsa_bs_key_set(er->cw + 8, key_data[connid].key
-#ifdef WITH_EMU
-			[0]
-#endif
-			[ODD]);
-		}
+		change.parity = ODD;
+		memcpy(change.cw[0], er->cw + 8, 8);
+		stream_key_schedule(connid, &change);
 	}
-#ifdef WITH_EMU
-	SAFE_MUTEX_LOCK(&emu_fixed_key_data_mutex[connid]);
-	emu_fixed_key_data[connid].csa_used = 1;
-	SAFE_MUTEX_UNLOCK(&emu_fixed_key_data_mutex[connid]);
-#endif
 }
 
 bool stream_write_cw(ECM_REQUEST *er)
 {
-	int32_t i;
+	uint32_t i;
 	bool cw_written = false;
 	//SAFE_MUTEX_LOCK(&fixed_key_srvid_mutex);
-	for (i = 0; i < STREAM_SERVER_MAX_CONNECTIONS; i++)
+	for (i = 0; i < stream_server_max_connections; i++)
 	{
 		if (stream_cur_srvid[i] == er->srvid)
 		{
@@ -262,33 +368,38 @@ bool stream_write_cw(ECM_REQUEST *er)
 	return cw_written;
 }
 
+/*
+ * Finds the first sync byte three packets of the same size start with.
+ * memchr skips to the sync byte candidates a word (or vector) at a time,
+ * only the candidates followed by two more packets are checked.
+ */
 static void SearchTsPackets(const uint8_t *buf, const uint32_t bufLength, uint16_t *packetSize, uint16_t *startOffset)
 {
+	const uint8_t *sync = buf, *end = buf + (bufLength > 2 * 208 ? bufLength - 2 * 208 : 0);
 	uint32_t i;
 
-	for (i = 0; i < bufLength; i++)
+	while (sync < end && (sync = memchr(sync, 0x47, end - sync)))
 	{
-		if (buf[i] == 0x47)
+		i = sync++ - buf;
+
+		// if three packets align, probably safe to assume correct size
+		if ((buf[i + 188] == 0x47) & (buf[i + 376] == 0x47))
 		{
-			// if three packets align, probably safe to assume correct size
-			if ((buf[i + 188] == 0x47) & (buf[i + 376] == 0x47))
-			{
-				(*packetSize) = 188;
-				(*startOffset) = i;
-				return;
-			}
-			else if ((buf[i + 204] == 0x47) & (buf[i + 408] == 0x47))
-			{
-				(*packetSize) = 204;
-				(*startOffset) = i;
-				return;
-			}
-			else if ((buf[i + 208] == 0x47) & (buf[i + 416] == 0x47))
-			{
-				(*packetSize) = 208;
-				(*startOffset) = i;
-				return;
-			}
+			(*packetSize) = 188;
+			(*startOffset) = i;
+			return;
+		}
+		else if ((buf[i + 204] == 0x47) & (buf[i + 408] == 0x47))
+		{
+			(*packetSize) = 204;
+			(*startOffset) = i;
+			return;
+		}
+		else if ((buf[i + 208] == 0x47) & (buf[i + 416] == 0x47))
+		{
+			(*packetSize) = 208;
+			(*startOffset) = i;
+			return;
 		}
 	}
 
@@ -296,6 +407,30 @@ static void SearchTsPackets(const uint8_t *buf, const uint32_t bufLength, uint16
 	(*startOffset) = 0;
 }
 
+/*
+ * Extracts the headers of all packets of a chunk in one pass, returns the
+ * number of packets.
+ */
+static uint32_t ClassifyTsPackets(const uint8_t *buf, const uint32_t bufLength, const uint16_t packetSize, stream_ts_packet *packets)
+{
+	const uint8_t *p;
+	uint32_t i, count = 0;
+	uint16_t offset;
+
+	for (i = 0; i + packetSize <= bufLength; i += packetSize, count++)
+	{
+		p = buf + i;
+		offset = (p[3] & 0x20) ? 4 + p[4] + 1 : 4;
+
+		packets[count].pid = ((p[1] & 0x1F) << 8) | p[2];
+		packets[count].flags = p[3];
+		packets[count].payload_start = (p[1] & 0x40) >> 6;
+		packets[count].offset = (p[0] == 0x47 && offset < packetSize) ? offset : 0;
+	}
+
+	return count;
+}
+
 typedef void (*ts_data_callback)(stream_client_data *cdata);
 
 static void ParseTsData(const uint8_t table_id, const uint8_t table_mask, const uint8_t min_table_length, int8_t *flag,
@@ -738,28 +873,19 @@ static void ParseEmmData(stream_client_data *cdata)
 }
 #endif
 
-static void ParseTsPackets(stream_client_data *data, uint8_t *stream_buf, uint32_t bufLength, uint16_t packetSize)
+static void ParseTsPackets(stream_client_data *data, uint8_t *stream_buf, const stream_ts_packet *packets, uint32_t count, uint16_t packetSize)
 {
 	uint8_t payloadStart;
 	uint16_t pid, offset;
-	uint32_t i, tsHeader;
+	uint32_t i, n;
 
-	for (i = 0; i < bufLength; i += packetSize)
+	for (n = 0, i = 0; n < count; n++, i += packetSize)
 	{
-		tsHeader = b2i(4, stream_buf + i);
-		pid = (tsHeader & 0x1FFF00) >> 8;
-		payloadStart = (tsHeader & 0x400000) >> 22;
-
-		if (tsHeader & 0x20)
-		{
-			offset = 4 + stream_buf[i + 4] + 1;
-		}
-		else
-		{
-			offset = 4;
-		}
+		pid = packets[n].pid;
+		payloadStart = packets[n].payload_start;
+		offset = packets[n].offset;
 
-		if (packetSize - offset < 1)
+		if (!offset)
 		{
 			continue;
 		}
@@ -786,6 +912,69 @@ static void ParseTsPackets(stream_client_data *data, uint8_t *stream_buf, uint32
 	}
 }
 
+static void stream_key_install(int32_t connid, const stream_key_change *change)
+{
+	struct dvbcsa_bs_key_s *key;
+	int32_t j;
+#ifdef WITH_EMU
+	emu_stream_client_key_data *cdata = &emu_fixed_key_data[connid];
+
+	SAFE_MUTEX_LOCK(&emu_fixed_key_data_mutex[connid]);
+#endif
+	for (j = 0; j < change->cw_count; j++)
+	{
+#ifdef WITH_EMU
+		if (!change->csa_used)
+		{
+			des_set_key(change->cw[j], cdata->pvu_des_ks[j][change->parity]);
+			continue;
+		}
+		key = key_data[connid].key[j][change->parity];
+#else
+		key = key_data[connid].key[change->parity];
+#endif
+		if (has_dvbcsa_ecm)
+		{
+			dvbcsa_bs_key_set_ecm(change->ecm, change->cw[j], key);
+		}
+		else
+		{
+			dvbcsa_bs_key_set(change->cw[j], key);
+		}
+	}
+#ifdef WITH_EMU
+	cdata->csa_used = change->csa_used;
+	SAFE_MUTEX_UNLOCK(&emu_fixed_key_data_mutex[connid]);
+#endif
+}
+
+/*
+ * Installs the queued control words which are due for stream data received
+ * at time. The descramblers call it at parity changes, when no packets are
+ * collected for a batch, so keys never change under a pending batch.
+ */
+static void stream_key_apply(int32_t connid, struct timeb *time)
+{
+	stream_key_change *change;
+	LL_ITER it;
+
+	if (!ll_count(key_data[connid].changes))
+	{
+		return;
+	}
+
+	it = ll_iter_create(key_data[connid].changes);
+	while ((change = ll_iter_next(&it)))
+	{
+		if (change->due.time && comp_timeb(time, &change->due) < 0)
+		{
+			continue;
+		}
+		stream_key_install(connid, change);
+		ll_iter_remove_data(&it);
+	}
+}
+
 static void decrypt_csa(struct dvbcsa_bs_batch_s *tsbbatch, uint16_t fill[2], const uint8_t oddeven, const int32_t connid
 #ifdef WITH_EMU
 	, uint8_t cw_type
@@ -823,21 +1012,21 @@ static void decrypt_csa(struct dvbcsa_bs_batch_s *tsbbatch, uint16_t fill[2], co
 #endif
 
 #ifdef WITH_EMU
-static void DescrambleTsPacketsPowervu(stream_client_data *data, uint8_t *stream_buf, uint32_t bufLength, uint16_t packetSize, struct dvbcsa_bs_batch_s *tsbbatch)
+static void DescrambleTsPacketsPowervu(stream_client_data *data, uint8_t *stream_buf, const stream_ts_packet *packets, uint32_t count, uint16_t packetSize, struct dvbcsa_bs_batch_s *tsbbatch, struct timeb *time)
 {
-	uint32_t i, j, tsHeader, *deskey;
+	uint32_t i, j, n, *deskey;
 	uint16_t pid, offset, fill[2] = {0,0};
-	uint8_t *pdata, payloadStart, oddeven = 0, cw_type = 0;
+	uint8_t *pdata, payloadStart, scramblingControl, oddeven = 0, parity = 2, cw_type = 0;
 	int8_t oddKeyUsed;
 
-	for (i = 0; i < bufLength; i += packetSize)
+	for (n = 0, i = 0; n < count; n++, i += packetSize)
 	{
-		tsHeader = b2i(4, stream_buf + i);
-		pid = (tsHeader & 0x1FFF00) >> 8;
-		payloadStart = (tsHeader & 0x400000) >> 22;
-		offset = (tsHeader & 0x20) ? 4 + stream_buf[i + 4] + 1 : 4;
+		pid = packets[n].pid;
+		payloadStart = packets[n].payload_start;
+		scramblingControl = packets[n].flags & 0xC0;
+		offset = packets[n].offset;
 
-		if (packetSize - offset < 1)
+		if (!offset)
 		{
 			continue;
 		}
@@ -875,7 +1064,7 @@ static void DescrambleTsPacketsPowervu(stream_client_data *data, uint8_t *stream
 			continue;
 		}
 
-		if ((tsHeader & 0xC0) == 0)
+		if (scramblingControl == 0)
 		{
 			continue;
 		}
@@ -883,8 +1072,13 @@ static void DescrambleTsPacketsPowervu(stream_client_data *data, uint8_t *stream
 		if (data->key.csa_used)
 		{
 			stream_buf[i + 3] &= 0x3f; // consider it decrypted now
-			oddeven = (tsHeader & 0xC0) == 0xC0 ? ODD: EVEN;
-			decrypt_pvu(oddeven == ODD ? EVEN : ODD, cw_type);
+			oddeven = scramblingControl == 0xC0 ? ODD: EVEN;
+			if (oddeven != parity)
+			{
+				decrypt_pvu(oddeven == ODD ? EVEN : ODD, cw_type);
+				stream_key_apply(data->connid, time);
+				parity = oddeven;
+			}
 
 			if (pid == data->video_pid) // start with video pid, since it is most dominant
 			{
@@ -925,9 +1119,16 @@ static void DescrambleTsPacketsPowervu(stream_client_data *data, uint8_t *stream
 		}
 		else
 		{
-			oddKeyUsed = (tsHeader & 0xC0) == 0xC0 ? 1 : 0;
+			oddKeyUsed = scramblingControl == 0xC0 ? 1 : 0;
 			deskey = NULL;
 
+			// des packets are descrambled one by one, keys can change at any parity change
+			if (oddKeyUsed != parity)
+			{
+				stream_key_apply(data->connid, time);
+				parity = oddKeyUsed;
+			}
+
 			if (pid == data->video_pid)
 			{
 				deskey = data->key.pvu_des_ks[PVU_CW_VID][oddKeyUsed];
@@ -959,31 +1160,22 @@ static void DescrambleTsPacketsPowervu(stream_client_data *data, uint8_t *stream
 	}
 	if (data->key.csa_used) { decrypt_pvu(oddeven, cw_type); }
 }
-static void DescrambleTsPacketsRosscrypt1(emu_stream_client_data *data, uint8_t *stream_buf, uint32_t bufLength, uint16_t packetSize)
+static void DescrambleTsPacketsRosscrypt1(emu_stream_client_data *data, uint8_t *stream_buf, const stream_ts_packet *packets, uint32_t count, uint16_t packetSize)
 {
 	int8_t is_av_pid;
 	int32_t j;
 
 	uint8_t scramblingControl;
 	uint16_t pid, offset;
-	uint32_t i, tsHeader;
+	uint32_t i, n;
 
-	for (i = 0; i < bufLength; i += packetSize)
+	for (n = 0, i = 0; n < count; n++, i += packetSize)
 	{
-		tsHeader = b2i(4, stream_buf + i);
-		pid = (tsHeader & 0x1FFF00) >> 8;
-		scramblingControl = tsHeader & 0xC0;
-
-		if (tsHeader & 0x20)
-		{
-			offset = 4 + stream_buf[i + 4] + 1;
-		}
-		else
-		{
-			offset = 4;
-		}
+		pid = packets[n].pid;
+		scramblingControl = packets[n].flags & 0xC0;
+		offset = packets[n].offset;
 
-		if (packetSize - offset < 1)
+		if (!offset)
 		{
 			continue;
 		}
@@ -993,7 +1185,7 @@ static void DescrambleTsPacketsRosscrypt1(emu_stream_client_data *data, uint8_t
 			continue;
 		}
 
-		if (!(stream_buf[i + 3] & 0x10))
+		if (!(packets[n].flags & 0x10))
 		{
 			stream_buf[i + 3] &= 0x3F;
 			continue;
@@ -1052,7 +1244,7 @@ static void DescrambleTsPacketsRosscrypt1(emu_stream_client_data *data, uint8_t
 	}
 }
 
-static void DescrambleTsPacketsCompel(emu_stream_client_data *data, uint8_t *stream_buf, uint32_t bufLength, uint16_t packetSize)
+static void DescrambleTsPacketsCompel(emu_stream_client_data *data, uint8_t *stream_buf, const stream_ts_packet *packets, uint32_t count, uint16_t packetSize)
 {
 	int8_t is_pes_pid; // any PES pid
 	int32_t j;
@@ -1060,24 +1252,15 @@ static void DescrambleTsPacketsCompel(emu_stream_client_data *data, uint8_t *str
 
 	uint8_t scramblingControl;
 	uint16_t pid, offset;
-	uint32_t i, tsHeader;
+	uint32_t i, n;
 
-	for (i = 0; i < bufLength; i += packetSize)
+	for (n = 0, i = 0; n < count; n++, i += packetSize)
 	{
-		tsHeader = b2i(4, stream_buf + i);
-		pid = (tsHeader & 0x1FFF00) >> 8;
-		scramblingControl = tsHeader & 0xC0;
-
-		if (tsHeader & 0x20)
-		{
-			offset = 4 + stream_buf[i + 4] + 1;
-		}
-		else
-		{
-			offset = 4;
-		}
+		pid = packets[n].pid;
+		scramblingControl = packets[n].flags & 0xC0;
+		offset = packets[n].offset;
 
-		if (packetSize - offset < 1)
+		if (!offset)
 		{
 			continue;
 		}
@@ -1087,7 +1270,7 @@ static void DescrambleTsPacketsCompel(emu_stream_client_data *data, uint8_t *str
 			continue;
 		}
 
-		if (!(stream_buf[i + 3] & 0x10))
+		if (!(packets[n].flags & 0x10))
 		{
 			stream_buf[i + 3] &= 0x3F;
 			continue;
@@ -1334,25 +1517,25 @@ static void DescrambleTsPacketsCompel(emu_stream_client_data *data, uint8_t *str
 }
 #endif // WITH_EMU
 
-static void DescrambleTsPackets(stream_client_data *data, uint8_t *stream_buf, uint32_t bufLength, uint16_t packetSize, struct dvbcsa_bs_batch_s *tsbbatch)
+static void DescrambleTsPackets(stream_client_data *data, uint8_t *stream_buf, const stream_ts_packet *packets, uint32_t count, uint16_t packetSize, struct dvbcsa_bs_batch_s *tsbbatch, struct timeb *time)
 {
-	uint32_t i, tsHeader;
+	uint32_t i, n;
 	uint16_t offset, fill[2] = {0,0};
-	uint8_t oddeven = 0;
+	uint8_t scramblingControl, oddeven = 0, parity = 2; // 2: no scrambled packet yet
 #ifdef MODULE_RADEGAST
 	uint16_t pid;
 	uint8_t payloadStart;
 #endif
 
-	for (i = 0; i < bufLength; i += packetSize)
+	for (n = 0, i = 0; n < count; n++, i += packetSize)
 	{
-		tsHeader = b2i(4, stream_buf + i);
 #ifdef MODULE_RADEGAST
-		pid = (tsHeader & 0x1FFF00) >> 8;
-		payloadStart = (tsHeader & 0x400000) >> 22;
+		pid = packets[n].pid;
+		payloadStart = packets[n].payload_start;
 #endif
-		offset = (tsHeader & 0x20) ? 4 + stream_buf[i + 4] + 1 : 4;
-		if (packetSize - offset < 1)
+		scramblingControl = packets[n].flags & 0xC0;
+		offset = packets[n].offset;
+		if (!offset)
 		{
 			continue;
 		}
@@ -1392,14 +1575,19 @@ static void DescrambleTsPackets(stream_client_data *data, uint8_t *stream_buf, u
 			continue;
 		}
 #endif // MODULE_RADEGAST
-		if ((tsHeader & 0xC0) == 0)
+		if (scramblingControl == 0)
 		{
 			continue;
 		}
 
 		stream_buf[i + 3] &= 0x3f; // consider it decrypted now
-		oddeven = (tsHeader & 0xC0) == 0xC0 ? ODD: EVEN;
-		decrypt(oddeven == ODD ? EVEN : ODD);
+		oddeven = scramblingControl == 0xC0 ? ODD: EVEN;
+		if (oddeven != parity)
+		{
+			decrypt(oddeven == ODD ? EVEN : ODD);
+			stream_key_apply(data->connid, time);
+			parity = oddeven;
+		}
 		tsbbatch[fill[oddeven]].data = &stream_buf[i + offset];
 		tsbbatch[fill[oddeven]].len = packetSize - offset;
 		fill[oddeven]++;
@@ -1413,223 +1601,730 @@ static void DescrambleTsPackets(stream_client_data *data, uint8_t *stream_buf, u
 	decrypt(oddeven);
 }
 
-static int32_t connect_to_stream(char *http_buf, int32_t http_buf_len, char *stream_path)
+static void stream_epoll_ctl(int32_t op, int32_t fd, uint32_t events, void *ptr)
 {
-	struct SOCKADDR cservaddr;
-	IN_ADDR_T in_addr;
+	struct epoll_event ev;
 
-	int32_t streamfd = socket(DEFAULT_AF, SOCK_STREAM, 0);
-	if (streamfd == -1) { return -1; }
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.ptr = ptr;
 
-	struct timeval tv;
-	tv.tv_sec = 2;
-	tv.tv_usec = 0;
-	if (setsockopt(streamfd, SOL_SOCKET, SO_RCVTIMEO, (char *)&tv, sizeof tv))
+	if (epoll_ctl(gepollfd, op, fd, &ev) == -1 && op != EPOLL_CTL_DEL)
 	{
-		cs_log("ERROR: setsockopt() failed for SO_RCVTIMEO");
-		return -1;
+		cs_log("ERROR: epoll_ctl() failed for fd %d (errno=%d %s)", fd, errno, strerror(errno));
+	}
+}
+
+static void stream_session_stop(stream_session *session);
+
+// needs stream_server_mutex, it is released during the lookup
+static void stream_source_resolve(void)
+{
+	char host[sizeof(stream_source_host)];
+	IN_ADDR_T addr;
+
+	cs_strncpy(host, stream_source_host, sizeof(host));
+	SAFE_MUTEX_UNLOCK(&stream_server_mutex);
+	cs_resolve(host, &addr, NULL, NULL);
+	SAFE_MUTEX_LOCK(&stream_server_mutex);
+
+	if (IP_ISSET(addr) && !strcmp(host, stream_source_host))
+	{
+		stream_source_addr = addr;
+	}
+}
+
+// a failed connect may be caused by a changed address, a worker looks it up again
+static void stream_source_relookup(void)
+{
+	SAFE_MUTEX_LOCK(&stream_server_mutex);
+	stream_source_lookup = 1;
+	SAFE_COND_SIGNAL(&stream_jobs_cond);
+	SAFE_MUTEX_UNLOCK(&stream_server_mutex);
+}
+
+static void stream_source_close(stream_session *session, int32_t delay)
+{
+	if (session->streamfd != -1)
+	{
+		if (!session->stalled)
+		{
+			stream_epoll_ctl(EPOLL_CTL_DEL, session->streamfd, 0, NULL);
+		}
+		close(session->streamfd);
+		session->streamfd = -1;
+	}
+
+	// a new connection starts with an empty chunk
+	if (session->fill)
+	{
+		session->fill->len = 0;
+	}
+	session->carry_len = 0;
+	session->stalled = 0;
+	session->connected = 0;
+	cs_ftime(&session->next_connect);
+	add_ms_to_timeb(&session->next_connect, delay);
+
+	if (session->connect_errors >= 3 || session->data_errors >= 15)
+	{
+		stream_session_stop(session);
+	}
+}
+
+static void stream_source_connect(stream_session *session)
+{
+	struct SOCKADDR cservaddr;
+
+	session->streamfd = socket(DEFAULT_AF, SOCK_STREAM, 0);
+	if (session->streamfd == -1 || set_nonblock(session->streamfd, true) == -1)
+	{
+		cs_log("WARNING: stream %i cannot connect to stream source", session->connid);
+		session->connect_errors++;
+		stream_source_close(session, 500);
+		return;
 	}
 
 	bzero(&cservaddr, sizeof(cservaddr));
 	SIN_GET_FAMILY(cservaddr) = DEFAULT_AF;
 	SIN_GET_PORT(cservaddr) = htons(cfg.stream_source_port);
-	cs_resolve(stream_source_host, &in_addr, NULL, NULL);
-	SIN_GET_ADDR(cservaddr) = in_addr;
+	SAFE_MUTEX_LOCK(&stream_server_mutex);
+	SIN_GET_ADDR(cservaddr) = stream_source_addr;
+	SAFE_MUTEX_UNLOCK(&stream_server_mutex);
 
-	if (connect(streamfd, (struct sockaddr *)&cservaddr, sizeof(cservaddr)) == -1)
+	if (connect(session->streamfd, (struct sockaddr *)&cservaddr, sizeof(cservaddr)) == -1 && errno != EINPROGRESS)
 	{
 		cs_log("WARNING: Connect to stream source port %d failed", cfg.stream_source_port);
-		return -1;
+		stream_source_relookup();
+		session->connect_errors++;
+		stream_source_close(session, 500);
+		return;
+	}
+
+	// the request is sent once the socket becomes writable
+	session->connected = 0;
+	cs_ftime(&session->last_data);
+	stream_epoll_ctl(EPOLL_CTL_ADD, session->streamfd, EPOLLOUT, session);
+}
+
+static void stream_source_request(stream_session *session)
+{
+	char http_buf[1024];
+	int32_t err = 0;
+	socklen_t len = sizeof(err);
+
+	if (getsockopt(session->streamfd, SOL_SOCKET, SO_ERROR, &err, &len) == -1 || err)
+	{
+		cs_log("WARNING: Connect to stream source port %d failed", cfg.stream_source_port);
+		stream_source_relookup();
+		session->connect_errors++;
+		stream_source_close(session, 500);
+		return;
 	}
 
 	if (stream_source_auth)
 	{
-		snprintf(http_buf, http_buf_len, "GET %s HTTP/1.1\nHost: %s:%u\n"
+		snprintf(http_buf, sizeof(http_buf), "GET %s HTTP/1.1\nHost: %s:%u\n"
 				"User-Agent: Mozilla/5.0 (Windows NT 6.1; WOW64; rv:38.0) Gecko/20100101 Firefox/38.0\n"
 				"Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\n"
 				"Accept-Language: en-US\n"
 				"Authorization: Basic %s\n"
-				"Connection: keep-alive\n\n", stream_path, stream_source_host, cfg.stream_source_port, stream_source_auth);
+				"Connection: keep-alive\n\n", session->stream_path, stream_source_host, cfg.stream_source_port, stream_source_auth);
 	}
 	else
 	{
-		snprintf(http_buf, http_buf_len, "GET %s HTTP/1.1\nHost: %s:%u\n"
+		snprintf(http_buf, sizeof(http_buf), "GET %s HTTP/1.1\nHost: %s:%u\n"
 				"User-Agent: Mozilla/5.0 (Windows NT 6.1; WOW64; rv:38.0) Gecko/20100101 Firefox/38.0\n"
 				"Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\n"
 				"Accept-Language: en-US\n"
-				"Connection: keep-alive\n\n", stream_path, stream_source_host, cfg.stream_source_port);
+				"Connection: keep-alive\n\n", session->stream_path, stream_source_host, cfg.stream_source_port);
+	}
+
+	if (send(session->streamfd, http_buf, cs_strlen(http_buf), 0) != (ssize_t)cs_strlen(http_buf))
+	{
+		cs_log("WARNING: stream %i cannot send request to stream source", session->connid);
+		session->connect_errors++;
+		stream_source_close(session, 500);
+		return;
 	}
 
-	if (send(streamfd, http_buf, cs_strlen(http_buf), 0) == -1) { return -1; }
-	return streamfd;
+	session->connected = 1;
+	cs_ftime(&session->last_data);
+	stream_epoll_ctl(EPOLL_CTL_MOD, session->streamfd, EPOLLIN, session);
 }
 
-static void stream_client_disconnect(stream_client_conn_data *conndata)
+#ifdef STREAM_ZEROCOPY
+/*
+ * Zerocopy sends leave the data in the chunk until the kernel is done with
+ * it, which is reported on the error queue of the client socket. The chunk is
+ * pinned until then and not received into again. Only clients which keep up
+ * pin chunks and at most half of the chunks of a session are pinned, so slow
+ * clients get copies and are dropped as usual without stalling the stream.
+ * Called with the clients mutex of the session held.
+ */
+static int8_t stream_client_zerocopy_ok(stream_client_conn_data *conndata, stream_chunk *chunk)
 {
-	int32_t i;
+	stream_session *session = conndata->session;
 
-	SAFE_MUTEX_LOCK(&fixed_key_srvid_mutex);
-	stream_cur_srvid[conndata->connid] = NO_SRVID_VALUE;
-#ifdef WITH_EMU
-	stream_server_has_ecm[conndata->connid] = 0;
-#endif
-	SAFE_MUTEX_UNLOCK(&fixed_key_srvid_mutex);
+	return conndata->zerocopy && !conndata->drop_count
+		&& conndata->zc_next - conndata->zc_first < STREAM_CLIENT_ZEROCOPY_SENDS
+		&& (chunk->pins || session->pinned < session->chunk_count / 2);
+}
 
-	SAFE_MUTEX_LOCK(&stream_server_mutex);
-	for (i = 0; i < STREAM_SERVER_MAX_CONNECTIONS; i++)
+static void stream_client_zerocopy_pin(stream_client_conn_data *conndata, stream_chunk *chunk)
+{
+	conndata->zc_chunks[conndata->zc_next++ % STREAM_CLIENT_ZEROCOPY_SENDS] = chunk;
+	if (!chunk->pins++)
 	{
-		if (gconnfd[i] == conndata->connfd)
-		{
-			gconnfd[i] = -1;
-			gconncount--;
-		}
+		conndata->session->pinned++;
 	}
-	SAFE_MUTEX_UNLOCK(&stream_server_mutex);
-
-	shutdown(conndata->connfd, 2);
-	close(conndata->connfd);
-
-	cs_log("Stream client %i disconnected",conndata->connid);
-
-	NULLFREE(conndata);
 }
 
-static void *stream_client_handler(void *arg)
+// unpins the chunks of the completed zerocopy sends first to last, called with the clients mutex held
+static void stream_client_zerocopy_release(stream_client_conn_data *conndata, uint32_t first, uint32_t last)
 {
-	stream_client_conn_data *conndata = (stream_client_conn_data *)arg;
-	stream_client_data *data;
-
-	char *http_buf, stream_path[255], stream_path_copy[255];
-	char *saveptr, *token, http_version[4];
-
-	int8_t streamConnectErrorCount = 0, streamDataErrorCount = 0, streamReconnectCount = 0;
-	int32_t bytesRead = 0, http_status_code = 0;
-	int32_t i, clientStatus, streamStatus, streamfd;
-
-	uint8_t *stream_buf;
-	uint16_t packetCount = 0, packetSize = 0, startOffset = 0;
-	uint32_t remainingDataPos, remainingDataLength, tmp_pids[4];
-	uint8_t descrambling = 0;
-#ifdef WITH_EMU
-	int32_t cur_dvb_buffer_size, cur_dvb_buffer_wait;
-#else
-	const int32_t cur_dvb_buffer_size = DVB_BUFFER_SIZE_CSA;
-	const int32_t cur_dvb_buffer_wait = DVB_BUFFER_WAIT_CSA;
-#endif
-	struct dvbcsa_bs_batch_s *tsbbatch;
+	stream_chunk *chunk;
+	uint32_t id, index;
 
-	cs_log("Stream client %i connected", conndata->connid);
-
-	if (!cs_malloc(&http_buf, 1024))
+	if (conndata->zc_first == conndata->zc_next)
 	{
-		stream_client_disconnect(conndata);
-		return NULL;
+		return;
 	}
-
-	if (!cs_malloc(&stream_buf, DVB_BUFFER_SIZE))
+	if ((int32_t)(first - conndata->zc_first) < 0)
 	{
-		NULLFREE(http_buf);
-		stream_client_disconnect(conndata);
-		return NULL;
+		first = conndata->zc_first;
 	}
-
-	if (!cs_malloc(&data, sizeof(stream_client_data)))
+	if ((int32_t)(last - conndata->zc_next) >= 0)
 	{
-		NULLFREE(http_buf);
-		NULLFREE(stream_buf);
-		stream_client_disconnect(conndata);
-		return NULL;
+		last = conndata->zc_next - 1;
 	}
 
-	clientStatus = recv(conndata->connfd, http_buf, 1024, 0);
-	if (clientStatus < 1)
+	for (id = first; (int32_t)(last - id) >= 0; id++)
 	{
-		NULLFREE(http_buf);
-		NULLFREE(stream_buf);
-		NULLFREE(data);
-		stream_client_disconnect(conndata);
-		return NULL;
+		index = id % STREAM_CLIENT_ZEROCOPY_SENDS;
+		if ((chunk = conndata->zc_chunks[index]))
+		{
+			conndata->zc_chunks[index] = NULL;
+			if (!--chunk->pins)
+			{
+				conndata->session->pinned--;
+			}
+		}
 	}
 
-	http_buf[1023] = '\0';
-	if (sscanf(http_buf, "GET %254s ", stream_path) < 1)
+	while (conndata->zc_first != conndata->zc_next && !conndata->zc_chunks[conndata->zc_first % STREAM_CLIENT_ZEROCOPY_SENDS])
 	{
-		NULLFREE(http_buf);
-		NULLFREE(stream_buf);
-		NULLFREE(data);
-		stream_client_disconnect(conndata);
-		return NULL;
+		conndata->zc_first++;
 	}
+}
 
-	cs_strncpy(stream_path_copy, stream_path, sizeof(stream_path));
+// reads the zerocopy completion notifications from the error queue of the client socket
+static void stream_client_zerocopy_done(stream_client_conn_data *conndata)
+{
+	struct sock_extended_err *serr;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	uint8_t control[128];
 
-	token = strtok_r(stream_path_copy, ":", &saveptr); // token 0
-	for (i = 1; token != NULL && i < 7; i++) // tokens 1 to 6
+	while (1)
 	{
-		token = strtok_r(NULL, ":", &saveptr);
-		if (token == NULL)
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(conndata->connfd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
 		{
-			break;
+			return;
 		}
 
-		if (i >= 3) // We olny need token 3 (srvid), 4 (tsid), 5 (onid) and 6 (ens)
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
 		{
-			if (sscanf(token, "%x", &tmp_pids[i - 3]) != 1)
+			if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR))
 			{
-				tmp_pids[i - 3] = 0;
+				continue;
 			}
-		}
-	}
 
-	data->srvid = tmp_pids[0] & 0xFFFF;
-	data->tsid = tmp_pids[1] & 0xFFFF;
-	data->onid = tmp_pids[2] & 0xFFFF;
-	data->ens = tmp_pids[3];
+			serr = (struct sock_extended_err *)CMSG_DATA(cmsg);
+			if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno != 0)
+			{
+				continue;
+			}
+
+			SAFE_MUTEX_LOCK(&conndata->session->clients_mutex);
+			stream_client_zerocopy_release(conndata, serr->ee_info, serr->ee_data);
+			// the kernel had to copy the data anyway (e.g. loopback), plain sends are cheaper then
+			if ((serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) && conndata->zerocopy)
+			{
+				conndata->zerocopy = 0;
+				cs_log_dbg(D_READER, "Stream client %i zerocopy sends got copied, using plain sends", conndata->connid);
+			}
+			SAFE_MUTEX_UNLOCK(&conndata->session->clients_mutex);
+		}
+	}
+}
+#endif // STREAM_ZEROCOPY
 
-	if (data->srvid == 0) // We didn't get a srvid - Exit
+// called with the clients mutex of the session held
+static void stream_client_queue_clear(stream_client_conn_data *conndata)
+{
+#ifdef STREAM_ZEROCOPY
+	// the data of a closed socket isn't of interest anymore
+	stream_client_zerocopy_release(conndata, conndata->zc_first, conndata->zc_next - 1);
+#endif
+	while (conndata->queue_count)
+	{
+		conndata->queue[conndata->queue_head]->refs--;
+		conndata->queue_head = (conndata->queue_head + 1) % conndata->session->chunk_count;
+		conndata->queue_count--;
+	}
+	conndata->queue_offset = 0;
+	conndata->tail_len = 0;
+}
+
+/*
+ * Clients are only closed by the event loop. The objects are freed after the
+ * current batch of events, which might still refer to them.
+ */
+static void stream_client_disconnect(stream_client_conn_data *conndata)
+{
+	stream_session *session = conndata->session;
+
+	if (conndata->connfd == -1)
+	{
+		return;
+	}
+
+	if (session)
+	{
+		SAFE_MUTEX_LOCK(&session->clients_mutex);
+		stream_client_queue_clear(conndata);
+		ll_remove(session->clients, conndata);
+		SAFE_MUTEX_UNLOCK(&session->clients_mutex);
+		conndata->session = NULL;
+	}
+
+	gconnfd[conndata->connid] = -1;
+	gconncount--;
+
+	stream_epoll_ctl(EPOLL_CTL_DEL, conndata->connfd, 0, NULL);
+	shutdown(conndata->connfd, 2);
+	close(conndata->connfd);
+	conndata->connfd = -1;
+
+	cs_log("Stream client %i disconnected",conndata->connid);
+
+	NULLFREE(conndata->queue);
+	ll_append(ll_stream_stale, conndata);
+
+	if (session && !session->closing && !ll_count(session->clients))
+	{
+		stream_session_stop(session);
+	}
+}
+
+/*
+ * Returns the number of bytes sent, 0 if the socket is full and -1 on errors.
+ * Data of a chunk may be sent without copying it, see stream_client_zerocopy_ok().
+ */
+static int32_t stream_client_write(stream_client_conn_data *conndata, const uint8_t *buf, uint32_t len, stream_chunk *chunk)
+{
+	ssize_t sent;
+
+#ifdef STREAM_ZEROCOPY
+	if (chunk && stream_client_zerocopy_ok(conndata, chunk))
+	{
+		sent = send(conndata->connfd, buf, len, MSG_DONTWAIT | MSG_ZEROCOPY);
+		if (sent > 0)
+		{
+			stream_client_zerocopy_pin(conndata, chunk);
+			return sent;
+		}
+		if (sent < 0 && errno != ENOBUFS) // ENOBUFS: out of socket option memory, send a copy
+		{
+			return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+		}
+	}
+#endif
+
+	sent = send(conndata->connfd, buf, len, MSG_DONTWAIT);
+	if (sent < 0)
+	{
+		return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+	}
+	return sent;
+}
+
+static void stream_client_want_out(stream_client_conn_data *conndata, int8_t want_out)
+{
+	if (conndata->want_out != want_out)
+	{
+		conndata->want_out = want_out;
+		stream_epoll_ctl(EPOLL_CTL_MOD, conndata->connfd, want_out ? (EPOLLIN | EPOLLOUT) : EPOLLIN, conndata);
+	}
+}
+
+/*
+ * Sends the queued data of a client as far as the socket takes it.
+ * Called with the clients mutex of the session held.
+ */
+static int32_t stream_client_flush(stream_client_conn_data *conndata)
+{
+	stream_chunk *chunk;
+	int32_t sent;
+
+	if (conndata->tail_len)
+	{
+		if ((sent = stream_client_write(conndata, conndata->tail, conndata->tail_len, NULL)) < 0)
+		{
+			return -1;
+		}
+		conndata->tail_len -= sent;
+		memmove(conndata->tail, conndata->tail + sent, conndata->tail_len);
+		if (conndata->tail_len)
+		{
+			return 0;
+		}
+	}
+
+	while (conndata->queue_count)
+	{
+		chunk = conndata->queue[conndata->queue_head];
+
+		if ((sent = stream_client_write(conndata, chunk->buf + chunk->start + conndata->queue_offset,
+										chunk->data_len - conndata->queue_offset, chunk)) < 0)
+		{
+			return -1;
+		}
+
+		conndata->queue_offset += sent;
+		if (conndata->queue_offset < chunk->data_len)
+		{
+			return 0;
+		}
+
+		chunk->refs--;
+		conndata->queue_head = (conndata->queue_head + 1) % conndata->session->chunk_count;
+		conndata->queue_count--;
+		conndata->queue_offset = 0;
+	}
+
+	conndata->drop_count = 0;
+	stream_client_want_out(conndata, 0);
+	return 0;
+}
+
+/*
+ * Sends a chunk to a client without blocking the session. If the client
+ * socket doesn't take all of it the client keeps a reference to the chunk,
+ * the rest is sent by the event loop as soon as the socket is writable.
+ * Called with the clients mutex of the session held, returns -1 if the client
+ * has to be disconnected.
+ */
+static int32_t stream_client_send(stream_client_conn_data *conndata, stream_chunk *chunk)
+{
+	int32_t sent = 0, index;
+
+	if (stream_client_flush(conndata) < 0)
+	{
+		return -1;
+	}
+
+	if (!conndata->tail_len && !conndata->queue_count)
+	{
+		if ((sent = stream_client_write(conndata, chunk->buf + chunk->start, chunk->data_len, chunk)) < 0)
+		{
+			return -1;
+		}
+
+		if ((uint32_t)sent == chunk->data_len)
+		{
+			return 0;
+		}
+	}
+
+	index = (conndata->queue_head + conndata->queue_count) % conndata->session->chunk_count;
+	conndata->queue[index] = chunk;
+	if (!conndata->queue_count)
+	{
+		conndata->queue_offset = sent;
+	}
+	conndata->queue_count++;
+	chunk->refs++;
+
+	stream_client_want_out(conndata, 1);
+	return 0;
+}
+
+/*
+ * Takes a chunk back from the clients still sending it. The clients which
+ * are this far behind lose the rest of it, the current ts packet is kept to
+ * stay on packet boundaries. Called with the clients mutex held, returns the
+ * number of clients which were too slow for too long.
+ */
+static int32_t stream_chunk_evict(stream_session *session, stream_chunk *chunk)
+{
+	stream_client_conn_data *conndata;
+	LL_ITER it;
+	uint32_t rest;
+	int32_t failed = 0;
+
+	it = ll_iter_create(session->clients);
+	while ((conndata = ll_iter_next(&it)) && chunk->refs)
+	{
+		if (!conndata->queue_count || conndata->queue[conndata->queue_head] != chunk)
+		{
+			continue;
+		}
+
+		if (conndata->queue_offset && session->packet_size)
+		{
+			rest = session->packet_size - (conndata->queue_offset % session->packet_size);
+			if (rest < session->packet_size && conndata->tail_len + rest <= sizeof(conndata->tail))
+			{
+				memcpy(conndata->tail + conndata->tail_len, chunk->buf + chunk->start + conndata->queue_offset, rest);
+				conndata->tail_len += rest;
+			}
+		}
+
+		chunk->refs--;
+		conndata->queue_head = (conndata->queue_head + 1) % session->chunk_count;
+		conndata->queue_count--;
+		conndata->queue_offset = 0;
+
+		if (!conndata->drop_count)
+		{
+			cs_log("WARNING: stream client %i is too slow, dropping stream data", conndata->connid);
+		}
+		if (++conndata->drop_count >= STREAM_CLIENT_MAX_DROPS && !conndata->error)
+		{
+			cs_log("WARNING: stream client %i didn't take any data for %i chunks", conndata->connid, conndata->drop_count);
+			conndata->error = 1;
+			failed++;
+		}
+	}
+
+	chunk->refs = 0;
+	return failed;
+}
+
+/*
+ * Gets a free chunk to receive into. If all chunks are held by slow clients
+ * the oldest one is taken back from them. Returns NULL if all chunks are
+ * still in the pipeline or pinned by zerocopy sends.
+ */
+static stream_chunk *stream_chunk_get(stream_session *session, int32_t *failed)
+{
+	stream_chunk *chunk = NULL, *oldest = NULL;
+	int32_t i;
+
+	SAFE_MUTEX_LOCK(&session->clients_mutex);
+	for (i = 0; i < session->chunk_count; i++)
+	{
+		if (session->chunks[i].busy)
+		{
+			continue;
+		}
+		if (session->chunks[i].pins) // the kernel is still sending from it
+		{
+			continue;
+		}
+		if (!session->chunks[i].refs)
+		{
+			chunk = &session->chunks[i];
+			break;
+		}
+		if (!oldest || (int32_t)(session->chunks[i].seq - oldest->seq) < 0)
+		{
+			oldest = &session->chunks[i];
+		}
+	}
+
+	if (!chunk && oldest)
+	{
+		*failed = stream_chunk_evict(session, oldest);
+		chunk = oldest;
+	}
+
+	if (chunk)
+	{
+		chunk->busy = 1;
+		chunk->len = 0;
+	}
+	SAFE_MUTEX_UNLOCK(&session->clients_mutex);
+
+	return chunk;
+}
+
+// runs in a worker, failed clients are only flagged and closed by the event loop
+static void stream_session_send(stream_session *session, stream_chunk *chunk)
+{
+	stream_client_conn_data *conndata;
+	LL_ITER it;
+
+	SAFE_MUTEX_LOCK(&session->clients_mutex);
+	it = ll_iter_create(session->clients);
+	while ((conndata = ll_iter_next(&it)))
+	{
+		if (!conndata->error && stream_client_send(conndata, chunk) < 0)
+		{
+			conndata->error = 1;
+		}
+	}
+	chunk->busy = 0;
+	SAFE_MUTEX_UNLOCK(&session->clients_mutex);
+}
+
+static void stream_session_free(stream_session *session)
+{
+	stream_client_conn_data *conndata;
+	int32_t i;
+
+	session->closing = 1;
+
+	while ((conndata = ll_has_elements(session->clients)))
 	{
-		NULLFREE(http_buf);
-		NULLFREE(stream_buf);
-		NULLFREE(data);
 		stream_client_disconnect(conndata);
-		return NULL;
 	}
+	ll_destroy(&session->clients);
+	ll_destroy(&session->ready);
+
+	if (session->streamfd != -1)
+	{
+		stream_epoll_ctl(EPOLL_CTL_DEL, session->streamfd, 0, NULL);
+		close(session->streamfd);
+		session->streamfd = -1;
+	}
+
+	SAFE_MUTEX_LOCK(&fixed_key_srvid_mutex);
+	stream_cur_srvid[session->connid] = NO_SRVID_VALUE;
+#ifdef WITH_EMU
+	stream_server_has_ecm[session->connid] = 0;
+#endif
+	SAFE_MUTEX_UNLOCK(&fixed_key_srvid_mutex);
+
 #ifndef WITH_EMU
-	key_data[conndata->connid].key[ODD]  = dvbcsa_bs_key_alloc();
-	key_data[conndata->connid].key[EVEN] = dvbcsa_bs_key_alloc();
+	dvbcsa_bs_key_free(key_data[session->connid].key[ODD]);
+	dvbcsa_bs_key_free(key_data[session->connid].key[EVEN]);
 #else
 	for (i = 0; i < EMU_STREAM_MAX_AUDIO_SUB_TRACKS + 2; i++)
 	{
-		key_data[conndata->connid].key[i][ODD]  = dvbcsa_bs_key_alloc();
-		key_data[conndata->connid].key[i][EVEN] = dvbcsa_bs_key_alloc();
+		dvbcsa_bs_key_free(key_data[session->connid].key[i][ODD]);
+		dvbcsa_bs_key_free(key_data[session->connid].key[i][EVEN]);
 	}
 #endif
 
-	if (!cs_malloc(&tsbbatch, (cluster_size + 1) * sizeof(struct dvbcsa_bs_batch_s)))
+	cs_log("Stream %i stopped", session->connid);
+
+	pthread_mutex_destroy(&session->clients_mutex);
+	if (session->chunks)
 	{
-		NULLFREE(http_buf);
-		NULLFREE(stream_buf);
-		NULLFREE(data);
-		stream_client_disconnect(conndata);
+		for (i = 0; i < session->chunk_count; i++)
+		{
+			NULLFREE(session->chunks[i].buf);
+		}
+		NULLFREE(session->chunks);
+	}
+	NULLFREE(session->tsbbatch);
+	NULLFREE(session->packets);
+	NULLFREE(session->data);
+
+	// the key data slot is free for a new stream only now
+	if (gsessions[session->connid] == session)
+	{
+		gsessions[session->connid] = NULL;
+	}
+	ll_append(ll_stream_stale, session);
+}
+
+/*
+ * Stops a session once the last client left or the stream source failed.
+ * A session being processed by a worker is freed when the worker is done,
+ * it keeps its slot until then.
+ */
+static void stream_session_stop(stream_session *session)
+{
+	if (session->busy)
+	{
+		session->closing = 1;
+	}
+	else if (!session->closing)
+	{
+		stream_session_free(session);
+	}
+}
+
+static stream_session *stream_session_create(int32_t connid, const char *stream_path, stream_client_data *data)
+{
+	stream_session *session;
+	uint32_t packets;
+	int32_t i;
+
+	if (!cs_malloc(&session, sizeof(stream_session)))
+	{
+		return NULL;
+	}
+
+	// buffer settings are applied to new streams
+	packets = MAX(cfg.stream_relay_buffer_packets, DVB_MIN_TS_PACKETS);
+	session->chunk_size = packets * 188;
+	session->chunk_wait = (packets > 256 ? packets - 128 : packets / 2) * 188;
+	session->chunk_count = MAX(cfg.stream_relay_buffers, 2);
+
+	if (!cs_malloc(&session->chunks, session->chunk_count * sizeof(stream_chunk))
+		|| !cs_malloc(&session->tsbbatch, (cluster_size + 1) * sizeof(struct dvbcsa_bs_batch_s))
+		|| !cs_malloc(&session->packets, packets * sizeof(stream_ts_packet)))
+	{
+		NULLFREE(session->chunks);
+		NULLFREE(session->tsbbatch);
+		NULLFREE(session);
 		return NULL;
 	}
 
+	for (i = 0; i < session->chunk_count; i++)
+	{
+		if (!cs_malloc(&session->chunks[i].buf, session->chunk_size))
+		{
+			while (i--)
+			{
+				NULLFREE(session->chunks[i].buf);
+			}
+			NULLFREE(session->chunks);
+			NULLFREE(session->tsbbatch);
+			NULLFREE(session->packets);
+			NULLFREE(session);
+			return NULL;
+		}
+	}
+
+	session->evtype = STREAM_EV_SOURCE;
+	session->connid = connid;
+	session->streamfd = -1;
+	session->data = data;
+	cs_strncpy(session->stream_path, stream_path, sizeof(session->stream_path));
+	SAFE_MUTEX_INIT(&session->clients_mutex, NULL);
+	session->clients = ll_create("stream_session_clients");
+	session->ready = ll_create("stream_session_ready");
+
+	// keys left over from the last stream of the slot
+	ll_clear_data(key_data[connid].changes);
+#ifndef WITH_EMU
+	key_data[connid].key[ODD]  = dvbcsa_bs_key_alloc();
+	key_data[connid].key[EVEN] = dvbcsa_bs_key_alloc();
+#else
+	for (i = 0; i < EMU_STREAM_MAX_AUDIO_SUB_TRACKS + 2; i++)
+	{
+		key_data[connid].key[i][ODD]  = dvbcsa_bs_key_alloc();
+		key_data[connid].key[i][EVEN] = dvbcsa_bs_key_alloc();
+	}
+#endif
+
 	SAFE_MUTEX_LOCK(&fixed_key_srvid_mutex);
-	stream_cur_srvid[conndata->connid] = data->srvid;
+	stream_cur_srvid[connid] = data->srvid;
 #ifdef WITH_EMU
-	stream_server_has_ecm[conndata->connid] = 0;
+	stream_server_has_ecm[connid] = 0;
 #endif
 	SAFE_MUTEX_UNLOCK(&fixed_key_srvid_mutex);
 
-	cs_log("Stream client %i request %s", conndata->connid, stream_path);
-
-	cs_log_dbg(D_READER, "Stream client %i received srvid: %04X tsid: %04X onid: %04X ens: %08X",
-				conndata->connid, data->srvid, data->tsid, data->onid, data->ens);
-
-	snprintf(http_buf, 1024, "HTTP/1.0 200 OK\nConnection: Close\nContent-Type: video/mpeg\nServer: stream_enigma2\n\n");
-	clientStatus = send(conndata->connfd, http_buf, cs_strlen(http_buf), 0);
-
-	data->connid = conndata->connid;
+	data->connid = connid;
 	data->caid = NO_CAID_VALUE;
 	data->have_pat_data = 0;
 	data->have_pmt_data = 0;
@@ -1640,235 +2335,810 @@ static void *stream_client_handler(void *arg)
 	data->reset_key_data = 1;
 #endif
 
-	while (!exit_oscam && clientStatus != -1 && streamConnectErrorCount < 3
-			&& streamDataErrorCount < 15)
+	cs_log("Stream %i started for %s (%i x %u byte buffers)", connid, stream_path, session->chunk_count, session->chunk_size);
+
+	gsessions[connid] = session;
+	return session;
+}
+
+/*
+ * Attaches the client to the session of its stream path, a new session is
+ * started for the first client of a stream. The session takes over data.
+ */
+static int8_t stream_session_attach(stream_client_conn_data *conndata, const char *stream_path, stream_client_data *data)
+{
+	stream_session *session = NULL;
+	uint32_t i;
+	int32_t free_id = -1;
+
+	for (i = 0; i < stream_server_max_connections; i++)
 	{
-		streamfd = connect_to_stream(http_buf, 1024, stream_path);
-		if (streamfd == -1)
+		if (gsessions[i] && !gsessions[i]->closing && !strcmp(gsessions[i]->stream_path, stream_path))
 		{
-			cs_log("WARNING: stream client %i cannot connect to stream source", conndata->connid);
-			streamConnectErrorCount++;
-			cs_sleepms(500);
-			continue;
+			session = gsessions[i];
+			break;
 		}
-		streamStatus = 0;
-		bytesRead = 0;
-		while (!exit_oscam && clientStatus != -1 && streamStatus != -1
-#if 0
-				&& streamConnectErrorCount < 3 && streamDataErrorCount < 15)
-#else
-				&& (streamConnectErrorCount < 3 || streamDataErrorCount < 15))
-#endif
+		if (!gsessions[i] && free_id == -1)
 		{
-#ifdef WITH_EMU
-			if (data->key.csa_used)
-			{
-				cur_dvb_buffer_size = EMU_DVB_BUFFER_SIZE_CSA;
-				cur_dvb_buffer_wait = EMU_DVB_BUFFER_WAIT_CSA;
-			}
-			else
+			free_id = i;
+		}
+	}
+
+	if (session)
+	{
+		NULLFREE(data);
+	}
+	else if (free_id == -1 || !(session = stream_session_create(free_id, stream_path, data)))
+	{
+		NULLFREE(data);
+		return 0;
+	}
+
+	if (!cs_malloc(&conndata->queue, session->chunk_count * sizeof(stream_chunk *)))
+	{
+		if (!ll_count(session->clients))
+		{
+			stream_session_stop(session);
+		}
+		return 0;
+	}
+
+	SAFE_MUTEX_LOCK(&session->clients_mutex);
+	ll_append(session->clients, conndata);
+	SAFE_MUTEX_UNLOCK(&session->clients_mutex);
+	conndata->session = session;
+
+	if (session->streamfd == -1 && !session->connect_errors)
+	{
+		stream_source_connect(session);
+	}
+	else
+	{
+		cs_log("Stream client %i joined stream %i (%i clients)", conndata->connid, session->connid, ll_count(session->clients));
+	}
+
+	return 1;
+}
+
+static void stream_client_request(stream_client_conn_data *conndata)
+{
+	stream_client_data *data;
+
+	char http_buf[1024], stream_path[255], stream_path_copy[255];
+	char *saveptr, *token;
+
+	int32_t i, clientStatus;
+	uint32_t tmp_pids[4];
+
+	clientStatus = recv(conndata->connfd, http_buf, sizeof(http_buf), 0);
+	if (clientStatus < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+	{
+		return;
+	}
+
+	if (clientStatus < 1)
+	{
+		stream_client_disconnect(conndata);
+		return;
+	}
+
+	http_buf[clientStatus < (int32_t)sizeof(http_buf) ? clientStatus : (int32_t)sizeof(http_buf) - 1] = '\0';
+	if (sscanf(http_buf, "GET %254s ", stream_path) < 1)
+	{
+		stream_client_disconnect(conndata);
+		return;
+	}
+
+	cs_strncpy(stream_path_copy, stream_path, sizeof(stream_path));
+
+	memset(tmp_pids, 0, sizeof(tmp_pids));
+	token = strtok_r(stream_path_copy, ":", &saveptr); // token 0
+	for (i = 1; token != NULL && i < 7; i++) // tokens 1 to 6
+	{
+		token = strtok_r(NULL, ":", &saveptr);
+		if (token == NULL)
+		{
+			break;
+		}
+
+		if (i >= 3) // We olny need token 3 (srvid), 4 (tsid), 5 (onid) and 6 (ens)
+		{
+			if (sscanf(token, "%x", &tmp_pids[i - 3]) != 1)
+			{
+				tmp_pids[i - 3] = 0;
+			}
+		}
+	}
+
+	if ((tmp_pids[0] & 0xFFFF) == 0) // We didn't get a srvid - Exit
+	{
+		stream_client_disconnect(conndata);
+		return;
+	}
+
+	if (!cs_malloc(&data, sizeof(stream_client_data)))
+	{
+		stream_client_disconnect(conndata);
+		return;
+	}
+
+	data->srvid = tmp_pids[0] & 0xFFFF;
+	data->tsid = tmp_pids[1] & 0xFFFF;
+	data->onid = tmp_pids[2] & 0xFFFF;
+	data->ens = tmp_pids[3];
+
+	cs_log("Stream client %i request %s", conndata->connid, stream_path);
+
+	cs_log_dbg(D_READER, "Stream client %i received srvid: %04X tsid: %04X onid: %04X ens: %08X",
+				conndata->connid, data->srvid, data->tsid, data->onid, data->ens);
+
+	snprintf(http_buf, sizeof(http_buf), "HTTP/1.0 200 OK\nConnection: Close\nContent-Type: video/mpeg\nServer: stream_enigma2\n\n");
+	if (send(conndata->connfd, http_buf, cs_strlen(http_buf), MSG_DONTWAIT) != (ssize_t)cs_strlen(http_buf))
+	{
+		NULLFREE(data);
+		stream_client_disconnect(conndata);
+		return;
+	}
+
+	if (!stream_session_attach(conndata, stream_path, data))
+	{
+		cs_log("ERROR: stream client %i dropped because of too many streams (%u)", conndata->connid, stream_server_max_connections);
+		stream_client_disconnect(conndata);
+	}
+}
+
+static void stream_client_event(stream_client_conn_data *conndata, uint32_t events)
+{
+	uint8_t buf[256];
+	int32_t ret = 0;
+#ifdef STREAM_ZEROCOPY
+	int32_t err = 0;
+	socklen_t len = sizeof(err);
+#endif
+
+	if (conndata->connfd == -1)
+	{
+		return;
+	}
+
+	if (!conndata->session)
+	{
+		if (events & (EPOLLERR | EPOLLHUP))
+		{
+			stream_client_disconnect(conndata);
+		}
+		else
+		{
+			stream_client_request(conndata);
+		}
+		return;
+	}
+
+	if (events & EPOLLHUP)
+	{
+		ret = -1;
+	}
+	else if (events & EPOLLERR)
+	{
+#ifdef STREAM_ZEROCOPY
+		// zerocopy completions are signalled as socket errors too
+		stream_client_zerocopy_done(conndata);
+		if (getsockopt(conndata->connfd, SOL_SOCKET, SO_ERROR, &err, &len) == -1 || err)
+		{
+			ret = -1;
+		}
+#else
+		ret = -1;
+#endif
+	}
+
+	if (!ret && (events & EPOLLIN))
+	{
+		// clients don't send anything once streaming, so this is a close
+		ret = recv(conndata->connfd, buf, sizeof(buf), MSG_DONTWAIT);
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+		{
+			ret = 0;
+		}
+		else if (ret == 0)
+		{
+			ret = -1;
+		}
+	}
+
+	if (ret >= 0 && (events & EPOLLOUT))
+	{
+		SAFE_MUTEX_LOCK(&conndata->session->clients_mutex);
+		ret = stream_client_flush(conndata);
+		SAFE_MUTEX_UNLOCK(&conndata->session->clients_mutex);
+	}
+
+	if (ret < 0)
+	{
+		stream_client_disconnect(conndata);
+	}
+}
+
+// disconnects the clients a worker or the chunk eviction flagged, may stop the session
+static void stream_session_reap(stream_session *session)
+{
+	stream_client_conn_data *conndata;
+	LLIST *failed = NULL;
+	LL_ITER it;
+
+	SAFE_MUTEX_LOCK(&session->clients_mutex);
+	it = ll_iter_create(session->clients);
+	while ((conndata = ll_iter_next(&it)))
+	{
+		if (conndata->error)
+		{
+			if (!failed)
+			{
+				failed = ll_create("stream_failed_clients");
+			}
+			ll_append(failed, conndata);
+		}
+	}
+	SAFE_MUTEX_UNLOCK(&session->clients_mutex);
+
+	if (failed)
+	{
+		while ((conndata = ll_remove_first(failed)))
+		{
+			stream_client_disconnect(conndata);
+		}
+		ll_destroy(&failed);
+	}
+}
+
+// makes sure there is a chunk to receive into, the incomplete packet of the last one goes first
+static int8_t stream_chunk_fill(stream_session *session)
+{
+	int32_t failed = 0;
+
+	if (session->fill)
+	{
+		return 1;
+	}
+
+	if (!(session->fill = stream_chunk_get(session, &failed)))
+	{
+		return 0;
+	}
+
+	memcpy(session->fill->buf, session->carry, session->carry_len);
+	session->fill->len = session->carry_len;
+	session->carry_len = 0;
+
+	if (failed)
+	{
+		stream_session_reap(session);
+	}
+	return 1;
+}
+
+/*
+ * Hands the ready chunks of a session to a worker, unless a worker has them
+ * already or they are held back. One worker per session keeps them in order.
+ */
+static void stream_session_schedule(stream_session *session, struct timeb *now)
+{
+	if (session->busy || !ll_count(session->ready))
+	{
+		return;
+	}
+
+	if (session->hold.time)
+	{
+		if (comp_timeb(now, &session->hold) < 0)
+		{
+			return;
+		}
+		memset(&session->hold, 0, sizeof(session->hold));
+	}
+
+	session->busy = 1;
+	SAFE_MUTEX_LOCK(&stream_server_mutex);
+	ll_append(ll_stream_jobs, session);
+	SAFE_COND_SIGNAL(&stream_jobs_cond);
+	SAFE_MUTEX_UNLOCK(&stream_server_mutex);
+}
+
+/*
+ * Cuts the received data of the current chunk at the last whole ts packet and
+ * queues it for the descrambler, the incomplete packet is carried over.
+ */
+static void stream_chunk_ready(stream_session *session)
+{
+	stream_chunk *chunk = session->fill;
+	uint16_t startOffset = 0;
+	uint32_t rest;
+
+	// only search if not starting on ts packet or unknown packet size
+	if (chunk->buf[0] != 0x47 || session->packet_size == 0)
+	{
+		SearchTsPackets(chunk->buf, chunk->len, &session->packet_size, &startOffset);
+	}
+
+	if (session->packet_size == 0)
+	{
+		chunk->len = 0;
+		return;
+	}
+
+	chunk->start = startOffset;
+	chunk->data_len = ((chunk->len - startOffset) / session->packet_size) * session->packet_size;
+
+	rest = chunk->len - chunk->start - chunk->data_len;
+	if (rest <= sizeof(session->carry))
+	{
+		memcpy(session->carry, chunk->buf + chunk->start + chunk->data_len, rest);
+		session->carry_len = rest;
+	}
+
+	chunk->seq = session->seq++;
+	cs_ftime(&chunk->time);
+	session->fill = NULL;
+	ll_append(session->ready, chunk);
+
+	stream_session_schedule(session, &chunk->time);
+}
+
+static void stream_source_read(stream_session *session)
+{
+	char http_version[4];
+	int32_t http_status_code = 0, streamStatus;
+	uint32_t cur_dvb_buffer_size = session->chunk_size;
+	uint32_t cur_dvb_buffer_wait = session->chunk_wait;
+	stream_chunk *chunk;
+
+#ifdef WITH_EMU
+	if (!session->data->key.csa_used)
+	{
+		cur_dvb_buffer_size = MIN(cur_dvb_buffer_size, EMU_DVB_BUFFER_SIZE_DES);
+		cur_dvb_buffer_wait = MIN(cur_dvb_buffer_wait, EMU_DVB_BUFFER_WAIT_DES);
+	}
+#endif
+
+	if (!stream_chunk_fill(session))
+	{
+		// all chunks are in the pipeline, wait for the descrambler
+		stream_epoll_ctl(EPOLL_CTL_DEL, session->streamfd, 0, NULL);
+		session->stalled = 1;
+		return;
+	}
+
+	if (session->closing)
+	{
+		return;
+	}
+
+	chunk = session->fill;
+	if (chunk->len >= cur_dvb_buffer_size)
+	{
+		stream_chunk_ready(session);
+		return;
+	}
+
+	streamStatus = recv(session->streamfd, chunk->buf + chunk->len, cur_dvb_buffer_size - chunk->len, MSG_DONTWAIT);
+	if (streamStatus == 0) // socket closed
+	{
+		cs_log("WARNING: stream %i - stream source closed connection", session->connid);
+		session->connect_errors++;
+		stream_source_close(session, 100);
+		return;
+	}
+	if (streamStatus < 0) // error
+	{
+		if (errno == EWOULDBLOCK || errno == EAGAIN || errno == EINTR)
+		{
+			return;
+		}
+		cs_log("WARNING: stream %i error receiving data from stream source", session->connid);
+		session->connect_errors++;
+		stream_source_close(session, 100);
+		return;
+	}
+
+	if (session->connected == 1) // first data after the request
+	{
+		session->connected = 2;
+		if (streamStatus > 13 &&
+			sscanf((const char*)chunk->buf + chunk->len, "HTTP/%3s %d ", http_version , &http_status_code) == 2 &&
+			http_status_code != 200)
+		{
+			cs_log("ERROR: stream %i got %d response from stream source", session->connid, http_status_code);
+			session->connect_errors++;
+			stream_source_close(session, 100);
+			return;
+		}
+	}
+
+	session->connect_errors = 0;
+	session->data_errors = 0;
+	cs_ftime(&session->last_data);
+	chunk->len += streamStatus;
+
+	if (chunk->len >= cur_dvb_buffer_wait)
+	{
+		stream_chunk_ready(session);
+	}
+}
+
+/*
+ * Checks the stream source connections for timeouts, due reconnects, free
+ * chunks and held back chunks. Returns the ms until the next check is due.
+ */
+static int32_t stream_source_check(void)
+{
+	stream_session *session;
+	struct timeb now;
+	uint32_t i;
+	int32_t timeout = 100;
+
+	cs_ftime(&now);
+
+	for (i = 0; i < stream_server_max_connections; i++)
+	{
+		session = gsessions[i];
+		if (!session || session->closing)
+		{
+			continue;
+		}
+
+		if (session->hold.time)
+		{
+			stream_session_schedule(session, &now);
+			if (session->hold.time)
+			{
+				timeout = MIN(timeout, MAX((int32_t)comp_timeb(&session->hold, &now), 1));
+			}
+		}
+
+		if (session->streamfd == -1)
+		{
+			if (comp_timeb(&now, &session->next_connect) >= 0)
+			{
+				stream_source_connect(session);
+			}
+			continue;
+		}
+
+		if (session->stalled)
+		{
+			if (stream_chunk_fill(session) && !session->closing)
+			{
+				session->stalled = 0;
+				cs_ftime(&session->last_data);
+				stream_epoll_ctl(EPOLL_CTL_ADD, session->streamfd, EPOLLIN, session);
+			}
+			continue;
+		}
+
+		if (comp_timeb(&now, &session->last_data) < 2000) // former SO_RCVTIMEO of the source socket
+		{
+			continue;
+		}
+
+		if (!session->connected)
+		{
+			cs_log("WARNING: stream %i cannot connect to stream source", session->connid);
+			session->connect_errors++;
+			stream_source_close(session, 500);
+			continue;
+		}
+
+		session->last_data = now;
+
+		if (cfg.stream_relay_reconnect_count > 0)
+		{
+			session->reconnect_count++; // 2 sec timeout * cfg.stream_relay_reconnect_count = seconds no data -> close
+			cs_log("WARNING: stream %i no data from stream source. Trying to reconnect (%i/%i)", session->connid, session->reconnect_count, cfg.stream_relay_reconnect_count);
+			if (session->reconnect_count >= cfg.stream_relay_reconnect_count)
+			{
+				stream_session_stop(session);
+				continue;
+			}
+		}
+		else
+		{
+			cs_log("WARNING: stream %i no data from stream source", session->connid);
+		}
+
+		if (++session->data_errors >= 15) // 2 sec timeout * 15 = seconds no data -> close
+		{
+			stream_session_stop(session);
+		}
+	}
+
+	return timeout;
+}
+
+/*
+ * Descrambles a chunk of a session in place and sends it to the clients.
+ * Returns 0 if the chunk is held back to give the first keys time to arrive.
+ */
+static int8_t stream_session_process(stream_session *session, stream_chunk *chunk)
+{
+	stream_client_data *data = session->data;
+	uint8_t *stream_buf = chunk->buf + chunk->start;
+	struct dvbcsa_bs_batch_s *tsbbatch = session->tsbbatch;
+	stream_ts_packet *packets = session->packets;
+	const uint16_t packetSize = session->packet_size;
+	uint32_t count;
+
+	// We have both PAT and PMT data - We can start descrambling
+	if (data->have_pat_data == 1 && data->have_pmt_data == 1)
+	{
+		if (chk_ctab_ex(data->caid, &cfg.stream_relay_ctab))
+		{
+			count = ClassifyTsPackets(stream_buf, chunk->data_len, packetSize, packets);
+#ifdef WITH_EMU
+			if (caid_is_powervu(data->caid))
+			{
+				DescrambleTsPacketsPowervu(data, stream_buf, packets, count, packetSize, tsbbatch, &chunk->time);
+			}
+			else if (data->caid == 0xA101) // Rosscrypt1
 			{
-				cur_dvb_buffer_size = EMU_DVB_BUFFER_SIZE_DES;
-				cur_dvb_buffer_wait = EMU_DVB_BUFFER_WAIT_DES;
+				DescrambleTsPacketsRosscrypt1(data, stream_buf, packets, count, packetSize);
 			}
-#endif
-			streamStatus = recv(streamfd, stream_buf + bytesRead, cur_dvb_buffer_size - bytesRead, MSG_WAITALL);
-			if (streamStatus == 0) // socket closed
+			else if (data->caid == NO_CAID_VALUE) // Compel
 			{
-				cs_log("WARNING: stream client %i - stream source closed connection", conndata->connid);
-				streamConnectErrorCount++;
-				cs_sleepms(100);
-				break;
+				DescrambleTsPacketsCompel(data, stream_buf, packets, count, packetSize);
 			}
-			if (streamStatus < 0) // error
+			else
+#endif // WITH_EMU
 			{
-				if ((errno == EWOULDBLOCK) | (errno == EAGAIN))
+				// the stream is delayed by stream_relay_buffer_time without blocking the worker
+				if (!session->descrambling)
 				{
-					if(cfg.stream_relay_reconnect_count > 0)
-					{
-						streamReconnectCount++; // 2 sec timeout * cfg.stream_relay_reconnect_count = seconds no data -> close
-						cs_log("WARNING: stream client %i no data from stream source. Trying to reconnect (%i/%i)", conndata->connid, streamReconnectCount, cfg.stream_relay_reconnect_count);
-						if(streamReconnectCount >= cfg.stream_relay_reconnect_count)
-						{
-							clientStatus = -1;
-							break;
-						}
-					}
-					else
+					session->descrambling = 1;
+					if (cfg.stream_relay_buffer_time)
 					{
-						cs_log("WARNING: stream client %i no data from stream source", conndata->connid);
+						cs_ftime(&session->hold);
+						add_ms_to_timeb(&session->hold, cfg.stream_relay_buffer_time);
+						return 0;
 					}
-					streamDataErrorCount++; // 2 sec timeout * 15 = seconds no data -> close
-					cs_sleepms(100);
-					continue;
-				}
-				cs_log("WARNING: stream client %i error receiving data from stream source", conndata->connid);
-				streamConnectErrorCount++;
-				cs_sleepms(100);
-				break;
-			}
-			if (streamStatus < cur_dvb_buffer_size - bytesRead) // probably just received header but no stream
-			{
-				if (!bytesRead && streamStatus > 13 &&
-					sscanf((const char*)stream_buf, "HTTP/%3s %d ", http_version , &http_status_code) == 2 &&
-					http_status_code != 200)
-				{
-					cs_log("ERROR: stream client %i got %d response from stream source", conndata->connid, http_status_code);
-					streamConnectErrorCount++;
-					cs_sleepms(100);
-					break;
-				}
-				else
-				{
-					cs_log_dbg(0, "WARNING: stream client %i non-full buffer from stream source", conndata->connid);
-					streamDataErrorCount++;
-					cs_sleepms(100);
 				}
+				DescrambleTsPackets(data, stream_buf, packets, count, packetSize, tsbbatch, &chunk->time);
 			}
-			else
+		}
+		else
+		{
+			cs_log_dbg(D_READER, "Stream %i caid %04X not enabled in stream relay config",
+						session->connid, data->caid);
+		}
+	}
+	else // Search PAT and PMT packets for service information
+	{
+		count = ClassifyTsPackets(stream_buf, chunk->data_len, packetSize, packets);
+		ParseTsPackets(data, stream_buf, packets, count, packetSize);
+	}
+
+	stream_session_send(session, chunk);
+	return 1;
+}
+
+static void *stream_worker(void *UNUSED(arg))
+{
+	stream_session *session = NULL;
+	stream_chunk *chunk;
+
+	while (1)
+	{
+		session = NULL;
+		SAFE_MUTEX_LOCK(&stream_server_mutex);
+		while (stream_server_running && !stream_source_lookup && !(session = ll_remove_first(ll_stream_jobs)))
+		{
+			SAFE_COND_WAIT(&stream_jobs_cond, &stream_server_mutex);
+		}
+		if (stream_server_running && !session)
+		{
+			stream_source_lookup = 0;
+			stream_source_resolve();
+		}
+		SAFE_MUTEX_UNLOCK(&stream_server_mutex);
+
+		if (!stream_server_running)
+		{
+			break;
+		}
+		if (!session)
+		{
+			continue;
+		}
+
+		// the event loop keeps receiving into the other chunks meanwhile
+		while ((chunk = ll_remove_first(session->ready)))
+		{
+			if (!stream_session_process(session, chunk))
 			{
-				streamDataErrorCount = 0;
+				ll_prepend(session->ready, chunk);
+				break;
 			}
+		}
 
-			streamConnectErrorCount = 0;
-			bytesRead += streamStatus;
+		ll_append(ll_stream_done, session);
+		if (write(gwakefd[1], "", 1) == -1 && errno != EAGAIN)
+		{
+			cs_log("ERROR: stream worker cannot wake up the stream server");
+		}
+	}
 
-			if (bytesRead >= cur_dvb_buffer_wait)
-			{
-				startOffset = 0;
+	return NULL;
+}
 
-				// only search if not starting on ts packet or unknown packet size
-				if (stream_buf[0] != 0x47 || packetSize == 0)
-				{
-					SearchTsPackets(stream_buf, bytesRead, &packetSize, &startOffset);
-				}
+// takes back the sessions the workers are done with
+static void stream_session_done(void)
+{
+	stream_session *session;
+	struct timeb now;
 
-				if (packetSize == 0)
-				{
-					bytesRead = 0;
-				}
-				else
-				{
-					packetCount = ((bytesRead - startOffset) / packetSize);
+	while ((session = ll_remove_first(ll_stream_done)))
+	{
+		session->busy = 0;
 
-					// We have both PAT and PMT data - We can start descrambling
-					if (data->have_pat_data == 1 && data->have_pmt_data == 1)
-					{
-						if (chk_ctab_ex(data->caid, &cfg.stream_relay_ctab))
-						{
-#ifdef WITH_EMU
-							if (caid_is_powervu(data->caid))
-							{
-								DescrambleTsPacketsPowervu(data, stream_buf + startOffset, packetCount * packetSize, packetSize, tsbbatch);
-							}
-							else if (data->caid == 0xA101) // Rosscrypt1
-							{
-								DescrambleTsPacketsRosscrypt1(data, stream_buf + startOffset, packetCount * packetSize, packetSize);
-							}
-							else if (data->caid == NO_CAID_VALUE) // Compel
-							{
-								DescrambleTsPacketsCompel(data, stream_buf + startOffset, packetCount * packetSize, packetSize);
-							}
-							else
-#endif // WITH_EMU
-							{
-								DescrambleTsPackets(data, stream_buf + startOffset, packetCount * packetSize, packetSize, tsbbatch);
-								if (!descrambling && cfg.stream_relay_buffer_time) {
-									cs_sleepms(cfg.stream_relay_buffer_time);
-									descrambling = 1;
-								}
-							}
-						}
-						else
-						{
-							cs_log_dbg(D_READER, "Stream client %i caid %04X not enabled in stream relay config",
-										conndata->connid, data->caid);
-						}
-					}
-					else // Search PAT and PMT packets for service information
-					{
-						ParseTsPackets(data, stream_buf + startOffset, packetCount * packetSize, packetSize);
-					}
+		if (session->closing)
+		{
+			session->closing = 0;
+			stream_session_free(session);
+			continue;
+		}
 
-					clientStatus = send(conndata->connfd, stream_buf + startOffset, packetCount * packetSize, 0);
+		// chunks which got ready after the worker looked or which are held back
+		cs_ftime(&now);
+		stream_session_schedule(session, &now);
 
-					remainingDataPos = startOffset + (packetCount * packetSize);
-					remainingDataLength = bytesRead - remainingDataPos;
+		stream_session_reap(session);
+	}
+}
 
-					if (remainingDataPos < remainingDataLength)
-					{
-						memmove(stream_buf, stream_buf + remainingDataPos, remainingDataLength);
-					}
-					else
-					{
-						memcpy(stream_buf, stream_buf + remainingDataPos, remainingDataLength);
-					}
+static void stream_client_accept(void)
+{
+	struct sockaddr_in cliaddr;
+	socklen_t clilen;
+	int32_t connfd, on = 1;
+	uint32_t i;
+	stream_client_conn_data *conndata;
+
+	while (1)
+	{
+		clilen = sizeof(cliaddr);
+		connfd = accept(glistenfd, (struct sockaddr *)&cliaddr, &clilen);
+		if (connfd == -1)
+		{
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+			{
+				cs_log("ERROR: accept() failed");
+			}
+			return;
+		}
+
+#ifdef MODULE_RADEGAST
+		if(cfg.stream_client_source_host)
+		{
+			// Read ip of client who wants to play the stream
+			unsigned char *ip = (unsigned char *)&cliaddr.sin_addr.s_addr;
+			cs_log("Stream Client ip is: %d.%d.%d.%d, will fetch stream there\n", ip[0], ip[1], ip[2], ip[3]);
+
+			// Store ip of client in stream_source_host variable
+			SAFE_MUTEX_LOCK(&stream_server_mutex);
+			snprintf(stream_source_host, sizeof(stream_source_host), "%d.%d.%d.%d", ip[0], ip[1], ip[2], ip[3]);
+			cs_inet_addr(stream_source_host, &stream_source_addr);
+			SAFE_MUTEX_UNLOCK(&stream_server_mutex);
+		}
+#endif
+
+		conndata = NULL;
+		if (gconncount < (int32_t)stream_server_max_connections && cs_malloc(&conndata, sizeof(stream_client_conn_data)))
+		{
+			for (i = 0; i < stream_server_max_connections; i++)
+			{
+				if (gconnfd[i] == -1)
+				{
+					gconnfd[i] = connfd;
+					gconncount++;
 
-					bytesRead = remainingDataLength;
+					conndata->evtype = STREAM_EV_CLIENT;
+					conndata->connfd = connfd;
+					conndata->connid = i;
+					break;
 				}
 			}
 		}
 
-		close(streamfd);
-	}
+		if (!conndata)
+		{
+			shutdown(connfd, 2);
+			close(connfd);
+			cs_log("ERROR: stream server client dropped because of too many connections (%u)", stream_server_max_connections);
+			continue;
+		}
 
-	NULLFREE(http_buf);
-	NULLFREE(stream_buf);
-#ifndef WITH_EMU
-	dvbcsa_bs_key_free(key_data[conndata->connid].key[ODD]);
-	dvbcsa_bs_key_free(key_data[conndata->connid].key[EVEN]);
-#else
-	for (i = 0; i < EMU_STREAM_MAX_AUDIO_SUB_TRACKS + 2; i++)
-	{
-		dvbcsa_bs_key_free(key_data[conndata->connid].key[i][ODD]);
-		dvbcsa_bs_key_free(key_data[conndata->connid].key[i][EVEN]);
-	}
+		if (setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) < 0)
+		{
+			cs_log("ERROR: stream client %i setsockopt() failed for TCP_NODELAY", conndata->connid);
+		}
+#ifdef STREAM_ZEROCOPY
+		if (cfg.stream_relay_zerocopy)
+		{
+			if (setsockopt(connfd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) == 0)
+			{
+				conndata->zerocopy = 1;
+			}
+			else
+			{
+				cs_log_dbg(D_READER, "Stream client %i setsockopt() failed for SO_ZEROCOPY, using plain sends", conndata->connid);
+			}
+		}
 #endif
-	NULLFREE(tsbbatch);
+		set_nonblock(connfd, true);
 
-	NULLFREE(data);
+		cs_log("Stream client %i connected", conndata->connid);
 
-	stream_client_disconnect(conndata);
-	return NULL;
+		stream_epoll_ctl(EPOLL_CTL_ADD, connfd, EPOLLIN, conndata);
+	}
+}
+
+// libdvbcsa fixes its bitslice width when it is built, name it by the batch size
+static const char *stream_dvbcsa_variant(int32_t batch)
+{
+	switch (batch)
+	{
+		case 32: return "32 bit";
+		case 64: return "64 bit/mmx";
+		case 128: return "sse2/ssse3/neon/altivec";
+		case 256: return "avx2";
+		case 512: return "avx512";
+		default: return "unknown";
+	}
 }
 
+/*
+ * The stream server runs all client and stream source sockets on one epoll
+ * loop. Received stream data is descrambled and sent to the clients by a
+ * small pool of workers (one batch per session at a time).
+ */
 void *stream_server(void *UNUSED(a))
 {
-	struct sockaddr_in servaddr, cliaddr;
-	socklen_t clilen;
-	int32_t connfd, reuse = 1, i;
-	int8_t connaccepted;
-	stream_client_conn_data *conndata;
+	static int8_t ev_listen = STREAM_EV_LISTEN, ev_wake = STREAM_EV_WAKE;
+	struct epoll_event events[STREAM_SERVER_MAX_EVENTS];
+	struct sockaddr_in servaddr;
+	int32_t reuse = 1, i, nfds, timeout = 100;
+	uint32_t j;
+	uint8_t wakebuf[64];
+	stream_session *session;
+	void *obj;
 
 	cluster_size = dvbcsa_bs_batch_size();
 
 #ifdef STATIC_LIBDVBCSA
 	has_dvbcsa_ecm = DVBCSA_KEY_ECM;
-	cs_log("INFO: static dvbcsa%s parallel mode = %d (relay buffer time: %d ms)", (!has_dvbcsa_ecm) ? "" : " (with icam)", cluster_size, cfg.stream_relay_buffer_time);
+	cs_log("INFO: static dvbcsa%s parallel mode = %d (%s, relay buffer time: %d ms)", (!has_dvbcsa_ecm) ? "" : " (with icam)", cluster_size, stream_dvbcsa_variant(cluster_size), cfg.stream_relay_buffer_time);
 #else
 	has_dvbcsa_ecm = (dlsym(RTLD_DEFAULT, "dvbcsa_bs_key_set_ecm"));
-	cs_log("INFO: dynamic dvbcsa%s parallel mode = %d (relay buffer time: %d ms)", (!has_dvbcsa_ecm) ? "" : " (with icam)", cluster_size, cfg.stream_relay_buffer_time);
+	cs_log("INFO: dynamic dvbcsa%s parallel mode = %d (%s, relay buffer time: %d ms)", (!has_dvbcsa_ecm) ? "" : " (with icam)", cluster_size, stream_dvbcsa_variant(cluster_size), cfg.stream_relay_buffer_time);
 #endif
-
-	if (!stream_server_mutex_init)
+#ifndef STREAM_ZEROCOPY
+	if (cfg.stream_relay_zerocopy)
 	{
-		SAFE_MUTEX_INIT(&stream_server_mutex, NULL);
-		stream_server_mutex_init = 1;
+		cs_log("WARNING: zerocopy sends are not supported by this build, using plain sends");
 	}
+#endif
 
 	SAFE_MUTEX_LOCK(&fixed_key_srvid_mutex);
-	for (i = 0; i < STREAM_SERVER_MAX_CONNECTIONS; i++)
+	for (j = 0; j < stream_server_max_connections; j++)
 	{
-		stream_cur_srvid[i] = NO_SRVID_VALUE;
+		stream_cur_srvid[j] = NO_SRVID_VALUE;
 #ifdef WITH_EMU
-		stream_server_has_ecm[i] = 0;
+		stream_server_has_ecm[j] = 0;
 #endif
 	}
 	SAFE_MUTEX_UNLOCK(&fixed_key_srvid_mutex);
 
-	for (i = 0; i < STREAM_SERVER_MAX_CONNECTIONS; i++)
+	for (j = 0; j < stream_server_max_connections; j++)
 	{
-		gconnfd[i] = -1;
+		gconnfd[j] = -1;
 	}
 
 	glistenfd = socket(AF_INET, SOCK_STREAM, 0);
@@ -1891,82 +3161,103 @@ void *stream_server(void *UNUSED(a))
 		return NULL;
 	}
 
-	if (listen(glistenfd, 3) == -1)
+	if (listen(glistenfd, SOMAXCONN) == -1)
 	{
 		cs_log("ERROR: cannot listen to stream server socket");
 		close(glistenfd);
 		return NULL;
 	}
+	set_nonblock(glistenfd, true);
 
-	while (!exit_oscam)
+	gepollfd = epoll_create(STREAM_SERVER_MAX_EVENTS);
+	if (gepollfd == -1 || pipe(gwakefd) == -1)
 	{
-		clilen = sizeof(cliaddr);
-		connfd = accept(glistenfd,(struct sockaddr *)&cliaddr, &clilen);
+		cs_log("ERROR: cannot create stream server event loop");
+		close(glistenfd);
+		return NULL;
+	}
+	set_nonblock(gwakefd[0], true);
+	set_nonblock(gwakefd[1], true);
 
-		if (connfd == -1)
-		{
-			cs_log("ERROR: accept() failed");
-			break;
-		}
+	stream_epoll_ctl(EPOLL_CTL_ADD, glistenfd, EPOLLIN, &ev_listen);
+	stream_epoll_ctl(EPOLL_CTL_ADD, gwakefd[0], EPOLLIN, &ev_wake);
 
-		connaccepted = 0;
+	stream_server_running = 1;
+	for (i = 0; i < STREAM_SERVER_WORKERS; i++)
+	{
+		start_thread("stream worker", stream_worker, NULL, NULL, 1, 0);
+	}
 
-#ifdef MODULE_RADEGAST
-		if(cfg.stream_client_source_host)
+	while (!exit_oscam && stream_server_running)
+	{
+		nfds = epoll_wait(gepollfd, events, STREAM_SERVER_MAX_EVENTS, timeout);
+		if (nfds == -1 && errno != EINTR)
 		{
-			// Read ip of client who wants to play the stream
-			unsigned char *ip = (unsigned char *)&cliaddr.sin_addr.s_addr;
-			cs_log("Stream Client ip is: %d.%d.%d.%d, will fetch stream there\n", ip[0], ip[1], ip[2], ip[3]);
-
-			// Store ip of client in stream_source_host variable
-			snprintf(stream_source_host, sizeof(stream_source_host), "%d.%d.%d.%d", ip[0], ip[1], ip[2], ip[3]);
+			cs_log("ERROR: epoll_wait() failed");
+			break;
 		}
-#endif
 
-		if (cs_malloc(&conndata, sizeof(stream_client_conn_data)))
+		for (i = 0; i < nfds; i++)
 		{
-			SAFE_MUTEX_LOCK(&stream_server_mutex);
-			if (gconncount < STREAM_SERVER_MAX_CONNECTIONS)
+			switch (*(int8_t *)events[i].data.ptr)
 			{
-				for (i = 0; i < STREAM_SERVER_MAX_CONNECTIONS; i++)
-				{
-					if (gconnfd[i] == -1)
-					{
-						gconnfd[i] = connfd;
-						gconncount++;
-						connaccepted = 1;
+				case STREAM_EV_LISTEN:
+					stream_client_accept();
+					break;
+
+				case STREAM_EV_WAKE:
+					while (read(gwakefd[0], wakebuf, sizeof(wakebuf)) > 0);
+					break;
 
-						conndata->connfd = connfd;
-						conndata->connid = i;
+				case STREAM_EV_CLIENT:
+					stream_client_event(events[i].data.ptr, events[i].events);
+					break;
 
+				case STREAM_EV_SOURCE:
+					session = events[i].data.ptr;
+					if (session->streamfd == -1 || session->stalled || session->closing)
+					{
 						break;
 					}
-				}
+					if (!session->connected)
+					{
+						stream_source_request(session);
+					}
+					else
+					{
+						stream_source_read(session);
+					}
+					break;
 			}
-			SAFE_MUTEX_UNLOCK(&stream_server_mutex);
 		}
 
-		if (connaccepted)
-		{
-			int on = 1;
-			if (setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) < 0)
-			{
-				cs_log("ERROR: stream client %i setsockopt() failed for TCP_NODELAY", conndata->connid);
-			}
+		stream_session_done();
+		timeout = stream_source_check();
 
-			start_thread("stream client", stream_client_handler, (void*)conndata, NULL, 1, 0);
-		}
-		else
+		while ((obj = ll_remove_first(ll_stream_stale)))
 		{
-			shutdown(connfd, 2);
-			close(connfd);
-			cs_log("ERROR: stream server client dropped because of too many connections (%i)", STREAM_SERVER_MAX_CONNECTIONS);
+			NULLFREE(obj);
 		}
+	}
+
+	SAFE_MUTEX_LOCK(&stream_server_mutex);
+	stream_server_running = 0;
+	SAFE_COND_BROADCAST(&stream_jobs_cond);
+	SAFE_MUTEX_UNLOCK(&stream_server_mutex);
 
-		cs_sleepms(20);
+	for (j = 0; j < stream_server_max_connections; j++)
+	{
+		if (gconnfd[j] != -1)
+		{
+			shutdown(gconnfd[j], 2);
+			close(gconnfd[j]);
+			gconnfd[j] = -1;
+		}
 	}
+	gconncount = 0;
 
 	close(glistenfd);
+	glistenfd = -1;
 
 	return NULL;
 }
@@ -1977,8 +3268,6 @@ void init_stream_server(void)
 
 	if (cfg.stream_relay_enabled)
 	{
-		cs_strncpy(stream_source_host, cfg.stream_source_host, sizeof(stream_source_host));
-
 		if (cfg.stream_source_auth_user && cfg.stream_source_auth_password)
 		{
 			snprintf(authtmp, sizeof(authtmp), "%s:%s", cfg.stream_source_auth_user, cfg.stream_source_auth_password);
@@ -1987,105 +3276,85 @@ void init_stream_server(void)
 #ifdef WITH_EMU
 		emu_stream_emm_enabled = cfg.emu_stream_emm_enabled;
 #endif
-		start_thread("stream_server", stream_server, NULL, NULL, 1, 1);
-		cs_log("Stream Relay server initialized");
-	}
-}
-
-#if WITH_EMU
-void *stream_key_delayer(void *UNUSED(arg))
-{
-	int32_t i, j;
-	emu_stream_client_key_data *cdata;
-	LL_ITER it;
-	emu_stream_cw_item *item;
-	struct timeb t_now;
+		if (!stream_server_mutex_init)
+		{
+			SAFE_MUTEX_INIT(&stream_server_mutex, NULL);
+			SAFE_COND_INIT(&stream_jobs_cond, NULL);
+			ll_stream_jobs = ll_create("stream_jobs");
+			ll_stream_done = ll_create("stream_done");
+			ll_stream_stale = ll_create("stream_stale");
+			stream_server_mutex_init = 1;
+		}
 
-	while (!exit_oscam)
-	{
-		cs_ftime(&t_now);
+		// looked up once here, the event loop only uses the address
+		SAFE_MUTEX_LOCK(&stream_server_mutex);
+		cs_strncpy(stream_source_host, cfg.stream_source_host, sizeof(stream_source_host));
+		stream_source_resolve();
+		SAFE_MUTEX_UNLOCK(&stream_server_mutex);
 
-		for (i = 0; i < STREAM_SERVER_MAX_CONNECTIONS; i++)
+		// the tables are sized once, a changed limit needs a restart
+		if (!stream_server_max_connections)
 		{
-			it = ll_iter_create(ll_emu_stream_delayed_keys[i]);
+			uint32_t max = cfg.stream_relay_max_connections ? cfg.stream_relay_max_connections : DEFAULT_STREAM_RELAY_MAX_CONNECTIONS, i;
 
-			while ((item = ll_iter_next(&it)))
+			if (!cs_malloc(&gconnfd, max * sizeof(*gconnfd))
+				|| !cs_malloc(&gsessions, max * sizeof(*gsessions))
+				|| !cs_malloc(&stream_cur_srvid, max * sizeof(*stream_cur_srvid))
+				|| !cs_malloc(&key_data, max * sizeof(*key_data))
+#ifdef WITH_EMU
+				|| !cs_malloc(&stream_server_has_ecm, max * sizeof(*stream_server_has_ecm))
+				|| !cs_malloc(&emu_fixed_key_data_mutex, max * sizeof(*emu_fixed_key_data_mutex))
+				|| !cs_malloc(&emu_fixed_key_data, max * sizeof(*emu_fixed_key_data))
+#endif
+				)
 			{
-				if (comp_timeb(&t_now, &item->write_time) < 0)
-				{
-					break;
-				}
-
-				SAFE_MUTEX_LOCK(&emu_fixed_key_data_mutex[i]);
-
-				cdata = &emu_fixed_key_data[i];
-
-				for (j = 0; j < EMU_STREAM_MAX_AUDIO_SUB_TRACKS + 2; j++)
-				{
-					if (item->csa_used)
-					{
-						if (item->is_even)
-						{
-							dvbcsa_bs_key_set(item->cw[j], key_data[cdata->connid].key[j][EVEN]);
-						}
-						else
-						{
-							dvbcsa_bs_key_set(item->cw[j], key_data[cdata->connid].key[j][ODD]);
-						}
-
-						cdata->csa_used = 1;
-					}
-					else
-					{
-						if (item->is_even)
-						{
-							des_set_key(item->cw[j], cdata->pvu_des_ks[j][0]);
-						}
-						else
-						{
-							des_set_key(item->cw[j], cdata->pvu_des_ks[j][1]);
-						}
-
-						cdata->csa_used = 0;
-					}
-				}
-				SAFE_MUTEX_UNLOCK(&emu_fixed_key_data_mutex[i]);
+				cs_log("ERROR: cannot allocate stream relay tables for %u connections", max);
+				NULLFREE(gconnfd);
+				NULLFREE(gsessions);
+				NULLFREE(stream_cur_srvid);
+				NULLFREE(key_data);
+#ifdef WITH_EMU
+				NULLFREE(stream_server_has_ecm);
+				NULLFREE(emu_fixed_key_data_mutex);
+				NULLFREE(emu_fixed_key_data);
+#endif
+				return;
+			}
+			stream_server_max_connections = max;
 
-				ll_iter_remove_data(&it);
+			for (i = 0; i < max; i++)
+			{
+				key_data[i].changes = ll_create("stream_key_changes");
 			}
 		}
 
-		cs_sleepms(25);
+		start_thread("stream_server", stream_server, NULL, NULL, 1, 1);
+		cs_log("Stream Relay server initialized (max %u connections)", stream_server_max_connections);
 	}
-
-	return NULL;
 }
-#endif
 
 void stop_stream_server(void)
 {
-	int32_t i;
-
-	SAFE_MUTEX_LOCK(&stream_server_mutex);
-	for (i = 0; i < STREAM_SERVER_MAX_CONNECTIONS; i++)
+	if (!stream_server_mutex_init)
 	{
-		if (gconnfd[i] != -1)
-		{
-			shutdown(gconnfd[i], 2);
-			close(gconnfd[i]);
-			gconnfd[i] = -1;
-		}
+		return;
 	}
 
-	gconncount = 0;
+	// the event loop closes the sockets on its way out
+	SAFE_MUTEX_LOCK(&stream_server_mutex);
+	stream_server_running = 0;
+	SAFE_COND_BROADCAST(&stream_jobs_cond);
 	SAFE_MUTEX_UNLOCK(&stream_server_mutex);
 
+	if (gwakefd[1] != -1 && write(gwakefd[1], "", 1) == -1)
+	{
+		cs_log_dbg(D_TRACE, "cannot wake up the stream server");
+	}
+
 #ifdef MODULE_RADEGAST
 	close_radegast_connection();
 #endif
 
-	shutdown(glistenfd, 2);
-	close(glistenfd);
 }
 
 #endif // MODULE_STREAMRELAY
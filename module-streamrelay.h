@@ -3,20 +3,19 @@
 
 #ifdef MODULE_STREAMRELAY
 
-#define STREAM_SERVER_MAX_CONNECTIONS 16
+#define STREAM_SERVER_WORKERS 4 // descrambling threads shared by all streams
+#define STREAM_SERVER_MAX_EVENTS 64
 
-#define DVB_MAX_TS_PACKETS 278
-#define DVB_BUFFER_SIZE_CSA 188*DVB_MAX_TS_PACKETS
-#define DVB_BUFFER_WAIT_CSA 188*(DVB_MAX_TS_PACKETS-128)
-#define DVB_BUFFER_SIZE DVB_BUFFER_SIZE_CSA
+#define DVB_MIN_TS_PACKETS 64 // smallest stream_relay_buffer_packets
+
+#define STREAM_CLIENT_MAX_DROPS 50 // disconnect a stream client after that many dropped chunks in a row
+#define STREAM_CLIENT_ZEROCOPY_SENDS 16 // zerocopy sends in flight per stream client, power of 2
 
 #ifdef WITH_EMU
 #define EMU_STREAM_MAX_AUDIO_SUB_TRACKS 4
-#define EMU_DVB_BUFFER_SIZE_CSA DVB_BUFFER_SIZE_CSA
-#define EMU_DVB_BUFFER_WAIT_CSA DVB_BUFFER_WAIT_CSA
 #define EMU_DVB_BUFFER_SIZE_DES 188*32
 #define EMU_DVB_BUFFER_WAIT_DES 188*29
-#define EMU_STREAM_SERVER_MAX_CONNECTIONS STREAM_SERVER_MAX_CONNECTIONS
+#define EMU_STREAM_SERVER_MAX_CONNECTIONS stream_server_max_connections
 #define emu_fixed_key_srvid_mutex fixed_key_srvid_mutex
 #define emu_stream_cur_srvid stream_cur_srvid
 #define emu_stream_client_data stream_client_data
@@ -33,6 +32,28 @@
 #define EVEN 0
 #define ODD 1
 
+#ifdef WITH_EMU
+#define STREAM_KEY_CWS (EMU_STREAM_MAX_AUDIO_SUB_TRACKS + 2)
+#else
+#define STREAM_KEY_CWS 1
+#endif
+#define STREAM_KEY_MAX_CHANGES 8 // pending control words per stream, older ones are dropped
+
+/*
+ * A control word waiting for the descrambler of a stream. It is installed
+ * between two descrambler batches, at the first parity change (or chunk)
+ * of the stream data received from due on.
+ */
+typedef struct
+{
+	struct timeb due; // zero: right away
+	uint8_t parity; // EVEN or ODD
+	uint8_t ecm; // key_set_ecm() mode
+	int8_t csa_used; // DES keys of the emulator otherwise
+	uint8_t cw_count;
+	uint8_t cw[STREAM_KEY_CWS][8];
+} stream_key_change;
+
 typedef struct
 {
 	struct dvbcsa_bs_key_s *key
@@ -40,6 +61,7 @@ typedef struct
 	[EMU_STREAM_MAX_AUDIO_SUB_TRACKS + 2]
 #endif
 	[2];
+	LLIST *changes; // stream_key_change, applied by the descrambler
 } stream_client_key_data;
 
 #ifdef WITH_EMU
@@ -99,28 +121,19 @@ void init_stream_server(void);
 void stop_stream_server(void);
 
 bool stream_write_cw(ECM_REQUEST *er);
+void stream_key_schedule(int32_t connid, const stream_key_change *change);
 
 #ifdef WITH_EMU
 extern int8_t stream_server_thread_init;
+extern uint32_t stream_server_max_connections;
 extern pthread_mutex_t fixed_key_srvid_mutex;
-extern uint16_t stream_cur_srvid[STREAM_SERVER_MAX_CONNECTIONS];
-extern int8_t stream_server_has_ecm[STREAM_SERVER_MAX_CONNECTIONS];
+extern uint16_t *stream_cur_srvid;
+extern int8_t *stream_server_has_ecm;
 extern uint8_t emu_stream_server_mutex_init;
 
-typedef struct
-{
-	struct timeb write_time;
-	int8_t csa_used;
-	int8_t is_even;
-	uint8_t cw[8][8];
-} emu_stream_cw_item;
-
-extern pthread_mutex_t emu_fixed_key_data_mutex[EMU_STREAM_SERVER_MAX_CONNECTIONS];
-extern stream_client_key_data key_data[STREAM_SERVER_MAX_CONNECTIONS];
-extern emu_stream_client_key_data emu_fixed_key_data[EMU_STREAM_SERVER_MAX_CONNECTIONS];
-
-extern LLIST *ll_emu_stream_delayed_keys[EMU_STREAM_SERVER_MAX_CONNECTIONS];
-void *stream_key_delayer(void *arg);
+extern pthread_mutex_t *emu_fixed_key_data_mutex;
+extern stream_client_key_data *key_data;
+extern emu_stream_client_key_data *emu_fixed_key_data;
 #endif // WITH_EMU
 
 #endif // MODULE_STREAMRELAY
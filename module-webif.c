@@ -21,6 +21,7 @@
 #include "ncam-conf-mk.h"
 #include "ncam-config.h"
 #include "ncam-conf.h"
+#include "ncam-failban.h"
 #include "ncam-files.h"
 #include "ncam-garbage.h"
 #include "ncam-cache.h"
@@ -1332,6 +1333,10 @@ static char *send_ncam_config_streamrelay(struct templatevars *vars, struct urip
 #endif
 	tpl_printf(vars, TPLADD, "STREAM_RELAY_BUFFER_TIME", "%d", cfg.stream_relay_buffer_time);
 	tpl_printf(vars, TPLADD, "STREAM_RELAY_RECONNECT_COUNT", "%d", cfg.stream_relay_reconnect_count);
+	tpl_printf(vars, TPLADD, "STREAM_RELAY_MAX_CONNECTIONS", "%u", cfg.stream_relay_max_connections);
+	tpl_printf(vars, TPLADD, "STREAM_RELAY_BUFFER_PACKETS", "%u", cfg.stream_relay_buffer_packets);
+	tpl_printf(vars, TPLADD, "STREAM_RELAY_BUFFERS", "%u", cfg.stream_relay_buffers);
+	tpl_addVar(vars, TPLADD, "STREAM_RELAY_ZEROCOPY", (cfg.stream_relay_zerocopy == 1) ? "checked" : "");
 
 	tpl_printf(vars, TPLADD, "TMP", "STREAMRELAYENABLEDSELECTED%d", cfg.stream_relay_enabled);
 	tpl_addVar(vars, TPLADD, tpl_getVar(vars, "TMP"), "selected");
@@ -3675,6 +3680,7 @@ static char *send_ncam_user_config_edit(struct templatevars *vars, struct uripar
 		cs_strncpy((char *)account->usr, user, sizeof(account->usr));
 		if(!account->grp)
 			{ account->grp = 1; }
+		accounts_changed();
 		if(write_userdb() != 0) { tpl_addMsg(vars, "Write Config failed!"); }
 		else if(strcmp(getParam(params, "action"), "Save As") == 0) { tpl_addMsg(vars, "New user has been added with cloned settings"); }
 		else { tpl_addMsg(vars, "New user has been added with default settings"); }
@@ -4508,6 +4514,7 @@ static char *send_ncam_user_config(struct templatevars *vars, struct uriparams *
 						{ cfg.account = account->next; }
 					else
 						{ account_prev->next = account->next; }
+					accounts_changed();
 					ll_clear(account->aureader_list);
 					kill_account_thread(account);
 					add_garbage(account);
@@ -7586,12 +7593,68 @@ static char *send_ncam_files(struct templatevars * vars, struct uriparams * para
 		{ return tpl_getTpl(vars, "APIFILE"); }
 }
 
+struct failban_row
+{
+	struct templatevars *vars;
+	struct timeb now;
+	int8_t apicall;
+};
+
+static void send_ncam_failban_row(V_BAN *v_ban_entry, void *arg)
+{
+	struct failban_row *row = arg;
+	struct templatevars *vars = row->vars;
+	int8_t apicall = row->apicall;
+
+	tpl_printf(vars, TPLADD, "IPADDRESS", "%s@%d", cs_inet_ntoa(v_ban_entry->v_ip), v_ban_entry->v_port);
+	tpl_addVar(vars, TPLADD, "VIOLATIONUSER", v_ban_entry->info ? v_ban_entry->info : "unknown");
+	struct tm st ;
+	localtime_r(&v_ban_entry->v_time.time, &st); // fix me, we need walltime!
+	if(!apicall)
+	{
+		tpl_printf(vars, TPLADD, "VIOLATIONDATE", "%02d.%02d.%02d %02d:%02d:%02d",
+				   st.tm_mday, st.tm_mon + 1,
+				   st.tm_year % 100, st.tm_hour,
+				   st.tm_min, st.tm_sec);
+	}
+	else
+	{
+		char tbuffer [30];
+		strftime(tbuffer, 30, "%Y-%m-%dT%H:%M:%S%z", &st);
+		tpl_addVar(vars, TPLADD, "VIOLATIONDATE", tbuffer);
+	}
+
+	tpl_printf(vars, TPLADD, "VIOLATIONCOUNT", "%d", v_ban_entry->v_count);
+
+	int64_t gone = comp_timeb(&row->now, &v_ban_entry->v_time);
+	if(!apicall)
+	{
+		if(!v_ban_entry->acosc_entry)
+		{ tpl_addVar(vars, TPLADD, "LEFTTIME", sec2timeformat(vars, (cfg.failbantime * 60) - (gone / 1000))); }
+		else
+			{ tpl_addVar(vars, TPLADD, "LEFTTIME", sec2timeformat(vars, v_ban_entry->acosc_penalty_dur - (gone / 1000))); }
+	}
+	else
+	{
+		if(!v_ban_entry->acosc_entry)
+		{ tpl_printf(vars, TPLADD, "LEFTTIME", "%"PRId64"", (cfg.failbantime * 60) - (gone / 1000)); }
+		else
+			{ tpl_printf(vars, TPLADD, "LEFTTIME", "%"PRId64"", v_ban_entry->acosc_penalty_dur - (gone / 1000)); }
+	}
+
+	tpl_addVar(vars, TPLADD, "INTIP", cs_inet_ntoa(v_ban_entry->v_ip));
+
+	if(!apicall)
+		{ tpl_addVar(vars, TPLAPPEND, "FAILBANROW", tpl_getTpl(vars, "FAILBANBIT")); }
+	else
+		{ tpl_addVar(vars, TPLAPPEND, "APIFAILBANROW", tpl_getTpl(vars, "APIFAILBANBIT")); }
+}
+
 static char *send_ncam_failban(struct templatevars * vars, struct uriparams * params, int8_t apicall)
 {
 	IN_ADDR_T ip2delete;
 	set_null_ip(&ip2delete);
-	LL_ITER itr = ll_iter_create(cfg.v_list);
-	V_BAN *v_ban_entry;
+	struct failban_row row;
 	//int8_t apicall = 0; //remove before flight
 
 	if(!apicall) { setActiveMenu(vars, MNU_FAILBAN); }
@@ -7601,75 +7664,21 @@ static char *send_ncam_failban(struct templatevars * vars, struct uriparams * pa
 		if(strcmp(getParam(params, "intip"), "all") == 0)
 		{
 			// clear whole list
-			while(ll_iter_next(&itr))
-			{
-				ll_iter_remove_data(&itr);
-			}
+			cs_remove_violation(NULL);
 		}
 		else
 		{
 			//we have a single IP
 			cs_inet_addr(getParam(params, "intip"), &ip2delete);
-			while((v_ban_entry = ll_iter_next(&itr)))
-			{
-				if(IP_EQUAL(v_ban_entry->v_ip, ip2delete))
-				{
-					ll_iter_remove_data(&itr);
-					break;
-				}
-			}
+			cs_remove_violation(&ip2delete);
 		}
 	}
-	ll_iter_reset(&itr);
-
-	struct timeb now;
-	cs_ftime(&now);
 
-	while((v_ban_entry = ll_iter_next(&itr)))
-	{
-		tpl_printf(vars, TPLADD, "IPADDRESS", "%s@%d", cs_inet_ntoa(v_ban_entry->v_ip), v_ban_entry->v_port);
-		tpl_addVar(vars, TPLADD, "VIOLATIONUSER", v_ban_entry->info ? v_ban_entry->info : "unknown");
-		struct tm st ;
-		localtime_r(&v_ban_entry->v_time.time, &st); // fix me, we need walltime!
-		if(!apicall)
-		{
-			tpl_printf(vars, TPLADD, "VIOLATIONDATE", "%02d.%02d.%02d %02d:%02d:%02d",
-					   st.tm_mday, st.tm_mon + 1,
-					   st.tm_year % 100, st.tm_hour,
-					   st.tm_min, st.tm_sec);
-		}
-		else
-		{
-			char tbuffer [30];
-			strftime(tbuffer, 30, "%Y-%m-%dT%H:%M:%S%z", &st);
-			tpl_addVar(vars, TPLADD, "VIOLATIONDATE", tbuffer);
-		}
+	row.vars = vars;
+	row.apicall = apicall;
+	cs_ftime(&row.now);
+	cs_foreach_violation(send_ncam_failban_row, &row);
 
-		tpl_printf(vars, TPLADD, "VIOLATIONCOUNT", "%d", v_ban_entry->v_count);
-
-		int64_t gone = comp_timeb(&now, &v_ban_entry->v_time);
-		if(!apicall)
-		{
-			if(!v_ban_entry->acosc_entry)
-			{ tpl_addVar(vars, TPLADD, "LEFTTIME", sec2timeformat(vars, (cfg.failbantime * 60) - (gone / 1000))); }
-		else
-				{ tpl_addVar(vars, TPLADD, "LEFTTIME", sec2timeformat(vars, v_ban_entry->acosc_penalty_dur - (gone / 1000))); }
-		}
-		else
-		{
-			if(!v_ban_entry->acosc_entry)
-			{ tpl_printf(vars, TPLADD, "LEFTTIME", "%"PRId64"", (cfg.failbantime * 60) - (gone / 1000)); }
-			else
-				{ tpl_printf(vars, TPLADD, "LEFTTIME", "%"PRId64"", v_ban_entry->acosc_penalty_dur - (gone / 1000)); }
-		}
-
-		tpl_addVar(vars, TPLADD, "INTIP", cs_inet_ntoa(v_ban_entry->v_ip));
-
-		if(!apicall)
-			{ tpl_addVar(vars, TPLAPPEND, "FAILBANROW", tpl_getTpl(vars, "FAILBANBIT")); }
-		else
-			{ tpl_addVar(vars, TPLAPPEND, "APIFAILBANROW", tpl_getTpl(vars, "APIFAILBANBIT")); }
-	}
 	if(!apicall)
 		{ return tpl_getTpl(vars, "FAILBAN"); }
 	else
@@ -9450,7 +9459,7 @@ static int32_t process_request(FILE * f, IN_ADDR_T in)
 			if(cfg.http_readonly)
 				{ tpl_addVar(vars, TPLAPPEND, "BTNDISABLED", "DISABLED"); }
 
-			i = ll_count(cfg.v_list);
+			i = cs_count_violations();
 			if(i > 0) { tpl_printf(vars, TPLADD, "FAILBANNOTIFIER", "<SPAN CLASS=\"span_notifier\">%d</SPAN>", i); }
 			tpl_printf(vars, TPLADD, "FAILBANNOTIFIERPOLL", "%d", i);
 
@@ -4,6 +4,7 @@
 #include "ncam-cache.h"
 #include "ncam-chk.h"
 #include "ncam-ecm.h"
+#include "ncam-hashtable.h"
 #include "ncam-client.h"
 #include "ncam-lock.h"
 #include "ncam-net.h"
@@ -11,6 +12,8 @@
 #include "module-stat.h"
 #include "ncam-reader.h"
 
+extern uint32_t cfg_sidtab_generation;
+
 #define CS_NANO_CLASS 0xE2
 #define OK    1
 #define ERROR 0
@@ -154,6 +157,194 @@ int32_t chk_srvid_match(ECM_REQUEST *er, SIDTAB *sidtab)
 	return (rc == 7);
 }
 
+/*
+ * The services of cfg.sidtab compiled to bitmasks, bit nr stands for the
+ * service nr like in SIDTABS. Each caid, provid and srvid value listed in a
+ * service is hashed to the services listing it, the any masks hold the
+ * services without a list for that field. The index is rebuilt on the first
+ * check after cfg_sidtab_generation changed.
+ */
+#define SIDTAB_INDEX_CAID   0
+#define SIDTAB_INDEX_PROVID 1
+#define SIDTAB_INDEX_SRVID  2
+
+struct sidtab_index_key
+{
+	uint32_t        value;
+	uint32_t        type;
+};
+
+struct sidtab_index_entry
+{
+	struct sidtab_index_key key;
+	SIDTABBITS      sidtabs;        // services listing the value
+	node            ht_node;
+	node            ll_node;
+};
+
+static struct
+{
+	hash_table      ht;
+	list            ll;
+	uint32_t        generation;     // cfg_sidtab_generation the index was built for
+	SIDTABBITS      all;            // services in cfg.sidtab
+	SIDTABBITS      any_caid;       // services without caid
+	SIDTABBITS      any_provid;     // services without provid
+	SIDTABBITS      any_srvid;      // services without srvid
+	SIDTABBITS      used;           // services with caid, provid or srvid
+	SIDTABBITS      caid_prov;      // services with caid or provid
+} sidtab_index;
+static bool sidtab_index_initialized;
+static pthread_rwlock_t sidtab_index_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static int compare_sidtab_index(const void *arg, const void *obj)
+{
+	return memcmp(arg, &((const struct sidtab_index_entry *)obj)->key, sizeof(struct sidtab_index_key));
+}
+
+// needs sidtab_index_lock for writing
+static void sidtab_index_add(uint32_t type, uint32_t value, SIDTABBITS bit)
+{
+	struct sidtab_index_entry *e;
+	struct sidtab_index_key key;
+
+	key.value = value;
+	key.type = type;
+
+	e = find_hash_table(&sidtab_index.ht, &key, sizeof(key), &compare_sidtab_index);
+	if(!e)
+	{
+		if(!cs_malloc(&e, sizeof(struct sidtab_index_entry)))
+			{ return; }
+		e->key = key;
+		add_hash_table(&sidtab_index.ht, &e->ht_node, &sidtab_index.ll, &e->ll_node, e, &e->key, sizeof(e->key));
+	}
+	e->sidtabs |= bit;
+}
+
+// needs sidtab_index_lock for writing
+static void sidtab_index_build(void)
+{
+	struct sidtab_index_entry *e;
+	SIDTAB *sidtab;
+	SIDTABBITS bit;
+	int32_t nr, i;
+
+	if(sidtab_index_initialized)
+	{
+		while((e = get_first_elem_list(&sidtab_index.ll)))
+		{
+			remove_elem_list(&sidtab_index.ll, &e->ll_node);
+			NULLFREE(e);
+		}
+		deinitialize_hash_table(&sidtab_index.ht);
+	}
+	init_hash_table(&sidtab_index.ht, &sidtab_index.ll);
+	sidtab_index_initialized = true;
+
+	sidtab_index.generation = cfg_sidtab_generation;
+	sidtab_index.all = 0;
+	sidtab_index.any_caid = 0;
+	sidtab_index.any_provid = 0;
+	sidtab_index.any_srvid = 0;
+	sidtab_index.used = 0;
+	sidtab_index.caid_prov = 0;
+
+	// services past the width of SIDTABBITS can not be selected
+	for(nr = 0, sidtab = cfg.sidtab; sidtab && nr < (int32_t)(sizeof(SIDTABBITS) * 8); sidtab = sidtab->next, nr++)
+	{
+		bit = (SIDTABBITS)1 << nr;
+		sidtab_index.all |= bit;
+
+		if(!sidtab->num_caid)
+			{ sidtab_index.any_caid |= bit; }
+		if(!sidtab->num_provid)
+			{ sidtab_index.any_provid |= bit; }
+		if(!sidtab->num_srvid)
+			{ sidtab_index.any_srvid |= bit; }
+		if(sidtab->num_caid | sidtab->num_provid | sidtab->num_srvid)
+			{ sidtab_index.used |= bit; }
+		if(sidtab->num_caid | sidtab->num_provid)
+			{ sidtab_index.caid_prov |= bit; }
+
+		for(i = 0; i < sidtab->num_caid; i++)
+			{ sidtab_index_add(SIDTAB_INDEX_CAID, sidtab->caid[i], bit); }
+		for(i = 0; i < sidtab->num_provid; i++)
+			{ sidtab_index_add(SIDTAB_INDEX_PROVID, sidtab->provid[i], bit); }
+		for(i = 0; i < sidtab->num_srvid; i++)
+			{ sidtab_index_add(SIDTAB_INDEX_SRVID, sidtab->srvid[i], bit); }
+	}
+}
+
+// needs sidtab_index_lock for reading
+static SIDTABBITS sidtab_index_get(uint32_t type, uint32_t value)
+{
+	struct sidtab_index_entry *e;
+	struct sidtab_index_key key;
+
+	key.value = value;
+	key.type = type;
+
+	e = find_hash_table(&sidtab_index.ht, &key, sizeof(key), &compare_sidtab_index);
+	return e ? e->sidtabs : 0;
+}
+
+static void sidtab_index_rdlock(void)
+{
+	SAFE_RWLOCK_RDLOCK(&sidtab_index_lock);
+	if(sidtab_index_initialized && sidtab_index.generation == cfg_sidtab_generation)
+		{ return; }
+	SAFE_RWLOCK_UNLOCK(&sidtab_index_lock);
+
+	SAFE_RWLOCK_WRLOCK(&sidtab_index_lock);
+	if(!sidtab_index_initialized || sidtab_index.generation != cfg_sidtab_generation)
+		{ sidtab_index_build(); }
+	SAFE_RWLOCK_UNLOCK(&sidtab_index_lock);
+
+	SAFE_RWLOCK_RDLOCK(&sidtab_index_lock);
+}
+
+// services matching the ecm like chk_srvid_match(), optionally with the used and srvid masks
+static SIDTABBITS sidtab_index_match(ECM_REQUEST *er, SIDTABBITS *used, SIDTABBITS *with_srvid)
+{
+	SIDTABBITS match;
+
+	sidtab_index_rdlock();
+
+	match = sidtab_index.all;
+	match &= sidtab_index.any_caid | sidtab_index_get(SIDTAB_INDEX_CAID, er->caid);
+	if(er->prid)
+		{ match &= sidtab_index.any_provid | sidtab_index_get(SIDTAB_INDEX_PROVID, er->prid); }
+	match &= sidtab_index.any_srvid | sidtab_index_get(SIDTAB_INDEX_SRVID, er->srvid);
+
+	if(used)
+		{ *used = sidtab_index.used; }
+	if(with_srvid)
+		{ *with_srvid = sidtab_index.all & ~sidtab_index.any_srvid; }
+
+	SAFE_RWLOCK_UNLOCK(&sidtab_index_lock);
+
+	return match;
+}
+
+// services matching like chk_srvid_match_by_caid_prov(), with caid or provid set
+static SIDTABBITS sidtab_index_match_by_caid_prov(uint16_t caid, uint32_t provid, SIDTABBITS *without_srvid)
+{
+	SIDTABBITS match;
+
+	sidtab_index_rdlock();
+
+	match = sidtab_index.caid_prov;
+	match &= sidtab_index.any_caid | sidtab_index_get(SIDTAB_INDEX_CAID, caid);
+	match &= sidtab_index.any_provid | sidtab_index_get(SIDTAB_INDEX_PROVID, provid);
+
+	*without_srvid = sidtab_index.any_srvid;
+
+	SAFE_RWLOCK_UNLOCK(&sidtab_index_lock);
+
+	return match;
+}
+
 #ifdef CS_CACHEEX_AIO
 int32_t chk_srvid_disablecrccws_only_for_exception(ECM_REQUEST *er)
 {
@@ -203,46 +394,29 @@ int32_t chk_srvid_localgenerated_only_exception(ECM_REQUEST *er)
 
 int32_t chk_srvid(struct s_client *cl, ECM_REQUEST *er)
 {
-	int32_t nr, rc = 0;
-	SIDTAB *sidtab;
+	SIDTABBITS match, used;
 
-	if(!cl->sidtabs.ok)
-	{
-		if(!cl->sidtabs.no) { return (1); }
-		rc = 1;
-	}
+	if(!cl->sidtabs.ok && !cl->sidtabs.no)
+		{ return (1); }
 
-	for(nr = 0, sidtab = cfg.sidtab; sidtab; sidtab = sidtab->next, nr++)
-	{
-		if(sidtab->num_caid | sidtab->num_provid | sidtab->num_srvid)
-		{
-			if((cl->sidtabs.no & ((SIDTABBITS)1 << nr)) && (chk_srvid_match(er, sidtab)))
-				{ return (0); }
+	match = sidtab_index_match(er, &used, NULL) & used;
 
-			if((cl->sidtabs.ok & ((SIDTABBITS)1 << nr)) && (chk_srvid_match(er, sidtab)))
-				{ rc = 1; }
-		}
-	}
-	return (rc);
+	if(cl->sidtabs.no & match)
+		{ return (0); }
+
+	return (!cl->sidtabs.ok || (cl->sidtabs.ok & match));
 }
 
 int32_t has_srvid(struct s_client *cl, ECM_REQUEST *er)
 {
+	SIDTABBITS match, with_srvid;
+
 	if(!cl->sidtabs.ok)
 		{ return 0; }
 
-	int32_t nr;
-	SIDTAB *sidtab;
+	match = sidtab_index_match(er, NULL, &with_srvid);
 
-	for(nr = 0, sidtab = cfg.sidtab; sidtab; sidtab = sidtab->next, nr++)
-	{
-		if(sidtab->num_srvid)
-		{
-			if((cl->sidtabs.ok & ((SIDTABBITS)1 << nr)) && (chk_srvid_match(er, sidtab)))
-				{ return 1; }
-		}
-	}
-	return 0;
+	return (cl->sidtabs.ok & match & with_srvid) != 0;
 }
 
 int32_t has_lb_srvid(struct s_client *cl, ECM_REQUEST *er)
@@ -250,15 +424,7 @@ int32_t has_lb_srvid(struct s_client *cl, ECM_REQUEST *er)
 	if(!cl->lb_sidtabs.ok)
 		{ return 0; }
 
-	int32_t nr;
-	SIDTAB *sidtab;
-
-	for(nr = 0, sidtab = cfg.sidtab; sidtab; sidtab = sidtab->next, nr++)
-	{
-		if((cl->lb_sidtabs.ok & ((SIDTABBITS)1 << nr)) && (chk_srvid_match(er, sidtab)))
-			{ return 1; }
-	}
-	return 0;
+	return (cl->lb_sidtabs.ok & sidtab_index_match(er, NULL, NULL)) != 0;
 }
 
 int32_t chk_srvid_match_by_caid_prov(uint16_t caid, uint32_t provid, SIDTAB *sidtab)
@@ -280,58 +446,29 @@ int32_t chk_srvid_match_by_caid_prov(uint16_t caid, uint32_t provid, SIDTAB *sid
 	return (rc == 3);
 }
 
-int32_t chk_srvid_by_caid_prov(struct s_client *cl, uint16_t caid, uint32_t provid)
+static int32_t chk_sidtabs_by_caid_prov(SIDTABS *sidtabs, uint16_t caid, uint32_t provid)
 {
-	int32_t nr, rc = 0;
-	SIDTAB *sidtab;
+	SIDTABBITS match, without_srvid;
 
-	if(!cl->sidtabs.ok)
-	{
-		if(!cl->sidtabs.no) { return (1); }
-		rc = 1;
-	}
+	if(!sidtabs->ok && !sidtabs->no)
+		{ return (1); }
 
-	for(nr = 0, sidtab = cfg.sidtab; sidtab; sidtab = sidtab->next, nr++)
-	{
-		if(sidtab->num_caid | sidtab->num_provid)
-		{
-			if((cl->sidtabs.no & ((SIDTABBITS)1 << nr)) && !sidtab->num_srvid &&
-				(chk_srvid_match_by_caid_prov(caid, provid, sidtab)))
-			{ return (0); }
+	match = sidtab_index_match_by_caid_prov(caid, provid, &without_srvid);
 
-			if((cl->sidtabs.ok & ((SIDTABBITS)1 << nr)) &&
-				(chk_srvid_match_by_caid_prov(caid, provid, sidtab)))
-			{ rc = 1; }
-		}
-	}
-	return (rc);
+	if(sidtabs->no & match & without_srvid)
+		{ return (0); }
+
+	return (!sidtabs->ok || (sidtabs->ok & match));
 }
 
-int32_t chk_srvid_by_caid_prov_rdr(struct s_reader *rdr, uint16_t caid, uint32_t provid)
+int32_t chk_srvid_by_caid_prov(struct s_client *cl, uint16_t caid, uint32_t provid)
 {
-	int32_t nr, rc = 0;
-	SIDTAB *sidtab;
-
-	if(!rdr->sidtabs.ok)
-	{
-		if(!rdr->sidtabs.no) { return (1); }
-		rc = 1;
-	}
-
-	for(nr = 0, sidtab = cfg.sidtab; sidtab; sidtab = sidtab->next, nr++)
-	{
-		if(sidtab->num_caid | sidtab->num_provid)
-		{
-			if((rdr->sidtabs.no & ((SIDTABBITS)1 << nr)) && !sidtab->num_srvid &&
-					(chk_srvid_match_by_caid_prov(caid, provid, sidtab)))
-				{ return (0); }
+	return chk_sidtabs_by_caid_prov(&cl->sidtabs, caid, provid);
+}
 
-			if((rdr->sidtabs.ok & ((SIDTABBITS)1 << nr)) &&
-					(chk_srvid_match_by_caid_prov(caid, provid, sidtab)))
-				{ rc = 1; }
-		}
-	}
-	return (rc);
+int32_t chk_srvid_by_caid_prov_rdr(struct s_reader *rdr, uint16_t caid, uint32_t provid)
+{
+	return chk_sidtabs_by_caid_prov(&rdr->sidtabs, caid, provid);
 }
 
 int32_t chk_is_betatunnel_caid(uint16_t caid)
@@ -11,8 +11,10 @@
 #include "ncam-conf-chk.h"
 #include "ncam-client.h"
 #include "ncam-ecm.h"
+#include "ncam-emm-cache.h"
 #include "ncam-failban.h"
 #include "ncam-garbage.h"
+#include "ncam-hashtable.h"
 #include "ncam-lock.h"
 #include "ncam-net.h"
 #include "ncam-reader.h"
@@ -48,17 +50,137 @@ int32_t get_threadnum(struct s_client *client)
 	return 0;
 }
 
-struct s_auth *get_account_by_name(char *name)
+/*
+ * The accounts are indexed by name and by the camd35/monitor user crc (crc32
+ * of the md5 of the name). The index is rebuilt on the first lookup after
+ * accounts_changed(), which must be called whenever cfg.account is modified.
+ */
+struct account_index_entry
+{
+	struct s_auth *account;
+	uint32_t ucrc;
+	struct account_index_entry *next_ucrc; // next account with the same ucrc
+	node name_node;
+	node ucrc_node;
+	node ll_node;
+};
+
+static hash_table ht_account_name;
+static hash_table ht_account_ucrc;
+static list ll_account_index;
+static bool account_index_valid;
+static bool account_index_initialized;
+#ifdef __powerpc__
+static pthread_mutex_t account_index_lock;
+#else
+static pthread_mutex_t account_index_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static int compare_account_name(const void *arg, const void *obj)
+{
+	return strcmp(arg, ((const struct account_index_entry *)obj)->account->usr);
+}
+
+static int compare_account_ucrc(const void *arg, const void *obj)
+{
+	return *(const uint32_t *)arg != ((const struct account_index_entry *)obj)->ucrc;
+}
+
+void accounts_changed(void)
 {
+	SAFE_MUTEX_LOCK(&account_index_lock);
+	account_index_valid = false;
+	SAFE_MUTEX_UNLOCK(&account_index_lock);
+}
+
+// needs account_index_lock
+static void build_account_index(void)
+{
+	struct account_index_entry *e, *first;
 	struct s_auth *account;
-	for(account = cfg.account; (account); account = account->next)
+	uint8_t md5tmp[MD5_DIGEST_LENGTH];
+
+	if(account_index_initialized)
 	{
-		if(streq(name, account->usr))
+		while((e = get_first_elem_list(&ll_account_index)))
 		{
-			return account;
+			remove_elem_list(&ll_account_index, &e->ll_node);
+			NULLFREE(e);
 		}
+		deinitialize_hash_table(&ht_account_name);
+		deinitialize_hash_table(&ht_account_ucrc);
 	}
-	return NULL;
+	init_hash_table(&ht_account_name, &ll_account_index);
+	tommy_hashlin_init(&ht_account_ucrc);
+	account_index_initialized = true;
+
+	for(account = cfg.account; account; account = account->next)
+	{
+		if(!cs_malloc(&e, sizeof(struct account_index_entry)))
+			{ break; }
+
+		e->account = account;
+		e->ucrc = crc32(0L, MD5((uint8_t *)account->usr, cs_strlen(account->usr), md5tmp), MD5_DIGEST_LENGTH);
+
+		// the first account of a name wins, like with the list
+		if(!find_hash_table(&ht_account_name, account->usr, cs_strlen(account->usr), &compare_account_name))
+		{
+			add_hash_table(&ht_account_name, &e->name_node, &ll_account_index, &e->ll_node, e, account->usr, cs_strlen(account->usr));
+		}
+		else
+		{
+			tommy_list_insert_tail(&ll_account_index, &e->ll_node, e);
+		}
+
+		first = find_hash_table(&ht_account_ucrc, &e->ucrc, sizeof(e->ucrc), &compare_account_ucrc);
+		if(first)
+		{
+			while(first->next_ucrc)
+				{ first = first->next_ucrc; }
+			first->next_ucrc = e;
+		}
+		else
+		{
+			tommy_hashlin_insert(&ht_account_ucrc, &e->ucrc_node, e, tommy_hash_u32(0, &e->ucrc, sizeof(e->ucrc)));
+		}
+	}
+	account_index_valid = true;
+}
+
+struct s_auth *get_account_by_name(char *name)
+{
+	struct account_index_entry *e;
+
+	if(!name)
+		{ return NULL; }
+
+	SAFE_MUTEX_LOCK(&account_index_lock);
+	if(!account_index_valid)
+		{ build_account_index(); }
+	e = find_hash_table(&ht_account_name, name, cs_strlen(name), &compare_account_name);
+	SAFE_MUTEX_UNLOCK(&account_index_lock);
+
+	return e ? e->account : NULL;
+}
+
+struct s_auth *get_account_by_ucrc(uint32_t ucrc, struct s_auth *prev)
+{
+	struct account_index_entry *e;
+
+	SAFE_MUTEX_LOCK(&account_index_lock);
+	if(!account_index_valid)
+		{ build_account_index(); }
+	e = find_hash_table(&ht_account_ucrc, &ucrc, sizeof(ucrc), &compare_account_ucrc);
+	if(prev)
+	{
+		while(e && e->account != prev)
+			{ e = e->next_ucrc; }
+		if(e)
+			{ e = e->next_ucrc; }
+	}
+	SAFE_MUTEX_UNLOCK(&account_index_lock);
+
+	return e ? e->account : NULL;
 }
 
 int8_t is_valid_client(struct s_client *client)
@@ -839,7 +961,7 @@ void free_client(struct s_client *cl)
 	// Clean reader. The cleaned structures should be only used by the reader thread, so we should be save without waiting
 	if(rdr)
 	{
-		ll_destroy_data(&rdr->emmstat);
+		emm_stat_free(rdr);
 		remove_reader_from_active(rdr);
 
 		cs_sleepms(1000); // just wait a bit that really really nobody is accessing client data
@@ -907,6 +1029,7 @@ void free_client(struct s_client *cl)
 	NULLFREE(cl->cltab.bclass);
 
 	NULLFREE(cl->cw_rass);
+	NULLFREE(cl->emm_routes);
 	ll_destroy_data(&cl->ra_buf);
 	NULLFREE(cl->aes_keys);
 
@@ -8,6 +8,8 @@ static inline struct s_client *cur_client(void)
 }
 int32_t get_threadnum(struct s_client *client);
 struct s_auth *get_account_by_name(char *name);
+struct s_auth *get_account_by_ucrc(uint32_t ucrc, struct s_auth *prev); // the account after prev with this user crc
+void accounts_changed(void);
 int8_t is_valid_client(struct s_client *client);
 const char *remote_txt(void);
 const char *client_get_proto(struct s_client *cl);
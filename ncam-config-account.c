@@ -8,6 +8,7 @@
 #include "ncam-conf-chk.h"
 #include "ncam-conf-mk.h"
 #include "ncam-config.h"
+#include "ncam-emm.h"
 #include "ncam-garbage.h"
 #include "ncam-lock.h"
 #include "ncam-string.h"
@@ -135,6 +136,7 @@ static void account_au_fn(const char *token, char *value, void *setting, FILE *f
 				}
 			}
 		}
+		emm_routes_changed();
 		return;
 	}
 	if(account->autoau == 1)
@@ -535,7 +537,10 @@ static const struct config_list account_opts[] =
 void chk_account(const char *token, char *value, struct s_auth *account)
 {
 	if(config_list_parse(account_opts, token, value, account))
-		{ return; }
+	{
+		accounts_changed(); // after the change, an index built meanwhile must not stay valid
+		return;
+	}
 	else if(token[0] != '#')
 		{ fprintf(stderr, "Warning: keyword '%s' in account section not recognized\n", token); }
 }
@@ -700,6 +705,7 @@ void cs_accounts_chk(void)
 	}
 	cs_reinit_clients(new_accounts);
 	cfg.account = new_accounts;
+	accounts_changed();
 	init_free_userdb(old_accounts);
 	ac_clear();
 	cs_writeunlock(__func__, &config_lock);
@@ -8,6 +8,8 @@
 #include "ncam-conf-chk.h"
 #include "ncam-conf-mk.h"
 #include "ncam-config.h"
+#include "ncam-emm.h"
+#include "ncam-emm-cache.h"
 #include "ncam-garbage.h"
 #include "ncam-lock.h"
 #include "ncam-reader.h"
@@ -1627,7 +1629,12 @@ static bool reader_check_setting(const struct config_list *UNUSED(clist), void *
 void chk_reader(char *token, char *value, struct s_reader *rdr)
 {
 	if(config_list_parse(reader_opts, token, value, rdr))
-		{ return; }
+	{
+		// after the change, a route or index built meanwhile must not stay valid
+		emm_routes_changed();
+		active_readers_changed();
+		return;
+	}
 	else if(token[0] != '#')
 		{ fprintf(stderr, "Warning: keyword '%s' in reader section not recognized\n", token); }
 }
@@ -1770,11 +1777,13 @@ void free_reader(struct s_reader *rdr)
 
 	ll_destroy_data(&rdr->blockemmbylen);
 
-	ll_destroy_data(&rdr->emmstat);
+	emm_stat_free(rdr);
 
 	aes_clear_entries(&rdr->aes_list);
 
 	config_list_gc_values(reader_opts, rdr);
+	emm_routes_changed();
+	active_readers_changed();
 	add_garbage(rdr);
 }
 
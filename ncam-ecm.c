@@ -18,6 +18,7 @@
 #include "ncam-garbage.h"
 #include "ncam-failban.h"
 #include "ncam-net.h"
+#include "ncam-reader.h"
 #include "ncam-time.h"
 #include "ncam-lock.h"
 #include "ncam-string.h"
@@ -2831,12 +2832,16 @@ void get_cw(struct s_client *client, ECM_REQUEST *er)
 	er->readers = 0;
 
 	struct s_ecm_answer *ea, *prv = NULL;
-	struct s_reader *rdr;
+	struct s_reader *rdr, **candidates;
 
 	cs_readlock(__func__, &readerlist_lock);
 	cs_readlock(__func__, &clientlist_lock);
 
-	for(rdr = first_active_reader; rdr; rdr = rdr->next)
+	// only the readers passing the caid and group checks, all if not available
+	candidates = get_reader_candidates(er);
+
+	for(i = 0, rdr = candidates ? candidates[0] : first_active_reader; rdr;
+		rdr = candidates ? candidates[++i] : rdr->next)
 	{
 		uint8_t is_fallback = chk_is_fixed_fallback(rdr, er);
 		int8_t match = matching_reader(er, rdr);
@@ -2890,6 +2895,7 @@ void get_cw(struct s_client *client, ECM_REQUEST *er)
 OUT:
 	cs_readunlock(__func__, &clientlist_lock);
 	cs_readunlock(__func__, &readerlist_lock);
+	NULLFREE(candidates);
 
 	lb_set_best_reader(er);
 
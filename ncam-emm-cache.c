@@ -7,11 +7,151 @@
 #include "ncam-files.h"
 #include "ncam-time.h"
 #include "ncam-lock.h"
+#include "ncam-garbage.h"
+#include "ncam-hashtable.h"
 #include "cscrypt/md5.h"
 #define LINESIZE 1024
 #define DEFAULT_LOCK_TIMEOUT 1000000
 
-static LLIST *emm_cache;
+/*
+ * The emm cache and the emm stats of every reader are hash tables by emm md5.
+ * The emm cache list is kept in lastseen order, so the stale emms are always
+ * found at its head.
+ */
+struct emm_cache_entry
+{
+	struct s_emmcache c; // handed out by find_emm_cache()
+	node ht_node;
+	node ll_node;
+};
+
+struct emm_stat_entry
+{
+	struct s_emmstat s; // handed out by get_emm_stat()
+	node ht_node;
+	node ll_node;
+};
+
+struct s_emmstat_index
+{
+	hash_table ht;
+	list ll; // in order of adding
+};
+
+static hash_table ht_emm_cache;
+static list ll_emm_cache; // oldest lastseen first
+static bool emm_cache_initialized;
+#ifdef __powerpc__
+static pthread_mutex_t emm_cache_lock;
+#else
+static pthread_mutex_t emm_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static int compare_emm_cache(const void *arg, const void *obj)
+{
+	return memcmp(arg, ((const struct emm_cache_entry *)obj)->c.emmd5, MD5_DIGEST_LENGTH);
+}
+
+static int compare_emm_stat(const void *arg, const void *obj)
+{
+	return memcmp(arg, ((const struct emm_stat_entry *)obj)->s.emmd5, MD5_DIGEST_LENGTH);
+}
+
+static int compare_lastseen(const void *a, const void *b)
+{
+	const struct emm_cache_entry *ea = a, *eb = b;
+	int64_t diff = comp_timeb((struct timeb *)&ea->c.lastseen, (struct timeb *)&eb->c.lastseen);
+
+	return diff < 0 ? -1 : (diff > 0 ? 1 : 0);
+}
+
+// needs emm_cache_lock
+static void emm_cache_init(void)
+{
+	if(!emm_cache_initialized)
+	{
+		init_hash_table(&ht_emm_cache, &ll_emm_cache);
+		emm_cache_initialized = true;
+	}
+}
+
+// needs emm_cache_lock
+static struct emm_cache_entry *emm_cache_find(uint8_t *emmd5)
+{
+	emm_cache_init();
+	return find_hash_table(&ht_emm_cache, emmd5, MD5_DIGEST_LENGTH, &compare_emm_cache);
+}
+
+// needs emm_cache_lock
+static void emm_cache_remove(struct emm_cache_entry *e)
+{
+	remove_elem_hash_table(&ht_emm_cache, &e->ht_node);
+	remove_elem_list(&ll_emm_cache, &e->ll_node);
+	add_garbage(e);
+}
+
+/*
+ * returns the emm stats of a reader write locked, creates them if asked to.
+ * The lock is created once per reader and outlives emm_stat_free(), which
+ * detaches the stats under it.
+ */
+static struct s_emmstat_index *emm_stat_lock(struct s_reader *rdr, bool create)
+{
+	struct s_emmstat_index *index = rdr->emmstat;
+
+	if(!index)
+	{
+		if(!create)
+			{ return NULL; }
+
+		SAFE_MUTEX_LOCK(&emm_cache_lock);
+		if(!rdr->emmstat_lock.name)
+			{ cs_lock_create(__func__, &rdr->emmstat_lock, rdr->label, DEFAULT_LOCK_TIMEOUT); }
+		if(!rdr->emmstat && cs_malloc(&index, sizeof(struct s_emmstat_index)))
+		{
+			init_hash_table(&index->ht, &index->ll);
+			__sync_synchronize(); // the lock is complete before the stats are seen
+			rdr->emmstat = index;
+		}
+		SAFE_MUTEX_UNLOCK(&emm_cache_lock);
+	}
+
+	cs_writelock(__func__, &rdr->emmstat_lock);
+	index = rdr->emmstat;
+	if(!index)
+		{ cs_writeunlock(__func__, &rdr->emmstat_lock); }
+
+	return index;
+}
+
+static void emm_stat_garbage(void *data)
+{
+	add_garbage(data);
+}
+
+void emm_stat_free(struct s_reader *rdr)
+{
+	struct s_emmstat_index *index;
+	struct emm_stat_entry *e;
+
+	if(!rdr->emmstat)
+		{ return; }
+
+	cs_writelock(__func__, &rdr->emmstat_lock);
+	index = rdr->emmstat;
+	rdr->emmstat = NULL;
+	if(index)
+	{
+		while((e = get_first_elem_list(&index->ll)))
+		{
+			remove_elem_list(&index->ll, &e->ll_node);
+			add_garbage(e);
+		}
+		release_hash_table(&index->ht, &emm_stat_garbage);
+		add_garbage(index);
+	}
+	cs_writeunlock(__func__, &rdr->emmstat_lock);
+}
 
 bool emm_cache_configured(void)
 {
@@ -30,6 +170,11 @@ bool emm_cache_configured(void)
 
 static char *get_emmcache_filename(char *dest, size_t destlen, const char *filename)
 {
+	if(!cfg.emmlogdir)
+	{
+		return get_config_filename(dest, destlen, filename);
+	}
+
 	const char *slash = "";
 	if(cfg.emmlogdir[strlen(cfg.emmlogdir) - 1] != '/')
 	{
@@ -39,6 +184,202 @@ static char *get_emmcache_filename(char *dest, size_t destlen, const char *filen
 	return dest;
 }
 
+/*
+ * Binary snapshots of the emm cache and the emm stats, a header followed by
+ * the records. They are written to a temp file and renamed over the old one.
+ * The text files are still read if there is no snapshot or they are newer.
+ */
+#define EMM_SNAPSHOT_VERSION 1
+
+struct emm_snapshot_header
+{
+	char            magic[4];
+	uint16_t        version;
+	uint16_t        header_size;
+	uint32_t        records;
+	uint32_t        length;         // of the records
+	uint32_t        crc;            // crc32 of the records
+};
+
+// followed by the emm
+struct emm_cache_record
+{
+	uint8_t         emmd5[MD5_DIGEST_LENGTH];
+	int64_t         firstseen;
+	int64_t         lastseen;
+	uint16_t        len;
+	uint8_t         type;
+	uint8_t         reserved[5];
+};
+
+// the stats are grouped by reader: label length, label, number of stats, stats
+struct emm_stat_record
+{
+	uint8_t         emmd5[MD5_DIGEST_LENGTH];
+	int64_t         firstwritten;
+	int64_t         lastwritten;
+	int32_t         count;
+	uint8_t         type;
+	uint8_t         reserved[3];
+};
+
+struct emm_snapshot
+{
+	uint8_t         *data;
+	uint32_t        len;
+	uint32_t        size;
+	uint32_t        records;
+	int8_t          failed;
+};
+
+static void snapshot_put(struct emm_snapshot *snap, const void *data, uint32_t len)
+{
+	if(snap->failed)
+		{ return; }
+
+	if(snap->len + len > snap->size)
+	{
+		uint32_t size = MAX(snap->size * 2, snap->len + len + 0x10000);
+		if(!cs_realloc(&snap->data, size))
+		{
+			snap->failed = 1;
+			return;
+		}
+		snap->size = size;
+	}
+	memcpy(snap->data + snap->len, data, len);
+	snap->len += len;
+}
+
+static int8_t snapshot_get(const uint8_t *data, uint32_t len, uint32_t *pos, void *out, uint32_t n)
+{
+	if(*pos + n > len)
+		{ return 0; }
+
+	memcpy(out, data + *pos, n);
+	*pos += n;
+	return 1;
+}
+
+static int8_t write_all(int fd, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+	ssize_t n;
+
+	while(len > 0)
+	{
+		n = write(fd, p, len);
+		if(n < 0)
+		{
+			if(errno == EINTR)
+				{ continue; }
+			return 0;
+		}
+		p += n;
+		len -= n;
+	}
+	return 1;
+}
+
+// writes the snapshot and frees its data, returns the number of records or -1
+static int32_t snapshot_write(struct emm_snapshot *snap, const char *fname, const char *magic)
+{
+	struct emm_snapshot_header hdr;
+	char tmpname[288];
+	int32_t ret = -1;
+	int fd;
+
+	if(snap->failed)
+	{
+		NULLFREE(snap->data);
+		return -1;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, magic, sizeof(hdr.magic));
+	hdr.version = EMM_SNAPSHOT_VERSION;
+	hdr.header_size = sizeof(hdr);
+	hdr.records = snap->records;
+	hdr.length = snap->len;
+	hdr.crc = snap->len ? crc32(0L, snap->data, snap->len) : 0;
+
+	snprintf(tmpname, sizeof(tmpname), "%s.tmp", fname);
+	fd = open(tmpname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0)
+	{
+		cs_log("can't write to file %s", tmpname);
+		NULLFREE(snap->data);
+		return -1;
+	}
+
+	if(write_all(fd, &hdr, sizeof(hdr)) && write_all(fd, snap->data, snap->len) && !fsync(fd))
+	{
+		ret = snap->records;
+	}
+
+	if(close(fd) || ret < 0 || rename(tmpname, fname))
+	{
+		cs_log("error writing %s (errno=%d %s)", fname, errno, strerror(errno));
+		unlink(tmpname);
+		ret = -1;
+	}
+
+	NULLFREE(snap->data);
+	return ret;
+}
+
+// maps a snapshot and checks it, returns the mapping or NULL
+static uint8_t *snapshot_map(const char *fname, const char *magic, size_t *maplen, uint32_t *records)
+{
+	struct emm_snapshot_header hdr;
+	struct stat st;
+	uint8_t *map;
+	int fd;
+
+	fd = open(fname, O_RDONLY);
+	if(fd < 0)
+		{ return NULL; }
+
+	if(fstat(fd, &st) || st.st_size < (off_t)sizeof(hdr))
+	{
+		close(fd);
+		return NULL;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED)
+		{ return NULL; }
+
+	memcpy(&hdr, map, sizeof(hdr));
+	if(memcmp(hdr.magic, magic, sizeof(hdr.magic)) || hdr.version != EMM_SNAPSHOT_VERSION
+		|| hdr.header_size != sizeof(hdr) || (off_t)sizeof(hdr) + hdr.length != st.st_size
+		|| (hdr.length ? crc32(0L, map + sizeof(hdr), hdr.length) : 0) != hdr.crc)
+	{
+		cs_log("ignoring invalid snapshot %s", fname);
+		munmap(map, st.st_size);
+		return NULL;
+	}
+
+	*maplen = st.st_size;
+	*records = hdr.records;
+	return map;
+}
+
+// the snapshot is used unless the text file is newer
+static int8_t snapshot_preferred(const char *bname, const char *fname)
+{
+	struct stat bst, fst;
+
+	if(stat(bname, &bst))
+		{ return 0; }
+
+	if(stat(fname, &fst))
+		{ return 1; }
+
+	return bst.st_mtime >= fst.st_mtime;
+}
+
 void emm_save_cache(void)
 {
 	if(boxtype_is("dbox2")) return; // don't save emmcache on these boxes, they lack resources and will crash!
@@ -50,57 +391,142 @@ void emm_save_cache(void)
 
 	char fname[256];
 	struct timeb ts, te;
+	struct emm_snapshot snap;
+	struct emm_cache_record rec;
+	struct s_emmcache *c;
+	node *n;
 
-	if(cfg.emmlogdir)
-	{
-		get_emmcache_filename(fname, sizeof(fname), "ncam.emmcache");
-	}
-	else
+	get_emmcache_filename(fname, sizeof(fname), "ncam.emmcache.bin");
+
+	cs_ftime(&ts);
+	memset(&snap, 0, sizeof(snap));
+
+	SAFE_MUTEX_LOCK(&emm_cache_lock);
+	emm_cache_init();
+	for(n = get_first_node_list(&ll_emm_cache); n; n = n->next)
 	{
-		get_config_filename(fname, sizeof(fname), "ncam.emmcache");
+		c = &((struct emm_cache_entry *)n->data)->c;
+		memset(&rec, 0, sizeof(rec));
+		memcpy(rec.emmd5, c->emmd5, MD5_DIGEST_LENGTH);
+		rec.firstseen = c->firstseen.time;
+		rec.lastseen = c->lastseen.time;
+		rec.len = c->len;
+		rec.type = c->type;
+		snapshot_put(&snap, &rec, sizeof(rec));
+		snapshot_put(&snap, c->emm, c->len);
+		snap.records++;
 	}
-	FILE *file = fopen(fname, "w");
+	SAFE_MUTEX_UNLOCK(&emm_cache_lock);
 
-	if(!file)
+	int32_t count = snapshot_write(&snap, fname, "NEMC");
+	if(count < 0)
 	{
-		cs_log("can't write emmcache to file %s", fname);
+		cs_log("error writing cache -> cache file not saved!");
 		return;
 	}
 
-	cs_ftime(&ts);
-	int32_t count = 0, result = 0;
-	LL_ITER it = ll_iter_create(emm_cache);
-	struct s_emmcache *c;
+	cs_ftime(&te);
+	int64_t load_time = comp_timeb(&te, &ts);
+	cs_log("saved %d emmcache records to %s in %"PRId64" ms", count, fname, load_time);
+}
 
-	while((c = ll_iter_next(&it)))
+// finds the reader emmstats are loaded for
+static struct s_reader *get_emmstat_reader(const char *label)
+{
+	struct s_reader *rdr;
+	LL_ITER itr = ll_iter_create(configured_readers);
+
+	while((rdr = ll_iter_next(&itr)))
 	{
-		uint8_t tmp_emmd5[MD5_DIGEST_LENGTH * 2 + 1];
-		char_to_hex(c->emmd5, MD5_DIGEST_LENGTH, tmp_emmd5);
-		uint8_t tmp_emm[c->len * 2 + 1];
-		char_to_hex(c->emm, c->len, tmp_emm);
+		if(rdr->cachemm != 1) // skip: emmcache save is disabled
+		{
+			continue;
+		}
 
-		result = fprintf(file, "%s,%ld,%ld,%02X,%04X,%s\n", tmp_emmd5, c->firstseen.time, c->lastseen.time, c->type, c->len, tmp_emm);
-		if(result < 0)
+		if(strcmp(rdr->label, label) == 0)
 		{
-			fclose(file);
-			result = remove(fname);
-			if(!result)
-			{
-				cs_log("error writing cache -> cache file removed!");
-			}
-			else
-			{
-				cs_log("error writing cache -> cache file could not be removed either!");
-			}
-			return;
+			break;
 		}
+	}
+	return rdr;
+}
+
+// adds a loaded emmstat, frees it if the reader has it already
+static int32_t add_emmstat(struct s_reader *rdr, struct emm_stat_entry *e)
+{
+	struct s_emmstat_index *index = emm_stat_lock(rdr, true);
+	int32_t count = 0;
+
+	if(!index)
+	{
+		NULLFREE(e);
+		return 0;
+	}
+
+	if(!find_hash_table(&index->ht, e->s.emmd5, MD5_DIGEST_LENGTH, &compare_emm_stat))
+	{
+		add_hash_table(&index->ht, &e->ht_node, &index->ll, &e->ll_node, e, e->s.emmd5, MD5_DIGEST_LENGTH);
 		count++;
 	}
+	else
+	{
+		NULLFREE(e);
+	}
+	cs_writeunlock(__func__, &rdr->emmstat_lock);
 
-	fclose(file);
-	cs_ftime(&te);
-	int64_t load_time = comp_timeb(&te, &ts);
-	cs_log("saved %d emmcache records to %s in %"PRId64" ms", count, fname, load_time);
+	return count;
+}
+
+static int32_t load_emmstat_snapshot(const char *fname)
+{
+	struct s_reader *rdr;
+	struct emm_stat_entry *e;
+	struct emm_stat_record rec;
+	char label[sizeof(rdr->label)];
+	uint32_t records, pos = 0, len, i, n;
+	int32_t count = 0;
+	size_t maplen;
+	uint8_t *map, *data, label_len;
+
+	if(!(map = snapshot_map(fname, "NEMS", &maplen, &records)))
+		{ return -1; }
+
+	data = map + sizeof(struct emm_snapshot_header);
+	len = maplen - sizeof(struct emm_snapshot_header);
+
+	while(pos < len)
+	{
+		if(!snapshot_get(data, len, &pos, &label_len, sizeof(label_len)) || label_len >= sizeof(label)
+			|| !snapshot_get(data, len, &pos, label, label_len) || !snapshot_get(data, len, &pos, &n, sizeof(n)))
+		{
+			break;
+		}
+		label[label_len] = '\0';
+
+		if(!(rdr = get_emmstat_reader(label)))
+		{
+			cs_log("emmstats could not be loaded for %s", label);
+		}
+
+		for(i = 0; i < n && snapshot_get(data, len, &pos, &rec, sizeof(rec)); i++)
+		{
+			if(!rdr || !cs_malloc(&e, sizeof(struct emm_stat_entry)))
+				{ continue; }
+
+			memcpy(e->s.emmd5, rec.emmd5, MD5_DIGEST_LENGTH);
+			e->s.firstwritten.time = rec.firstwritten;
+			e->s.lastwritten.time = rec.lastwritten;
+			e->s.count = rec.count;
+			e->s.type = rec.type;
+			count += add_emmstat(rdr, e);
+		}
+
+		if(i < n)
+			{ break; }
+	}
+
+	munmap(map, maplen);
+	return count;
 }
 
 void load_emmstat_from_file(void)
@@ -114,16 +540,23 @@ void load_emmstat_from_file(void)
 
 	char buf[256];
 	char fname[256];
+	char bname[256];
 	char *line;
 	FILE *file;
 
-	if(cfg.emmlogdir)
-	{
-		get_emmcache_filename(fname, sizeof(fname), "ncam.emmstat");
-	}
-	else
+	struct timeb ts, te;
+	cs_ftime(&ts);
+
+	get_emmcache_filename(fname, sizeof(fname), "ncam.emmstat");
+	get_emmcache_filename(bname, sizeof(bname), "ncam.emmstat.bin");
+
+	int32_t count;
+	if(snapshot_preferred(bname, fname) && (count = load_emmstat_snapshot(bname)) >= 0)
 	{
-		get_config_filename(fname, sizeof(fname), "ncam.emmstat");
+		cs_ftime(&te);
+		int64_t load_time = comp_timeb(&te, &ts);
+		cs_log("loaded %d emmstat records from %s in %"PRId64" ms", count, bname, load_time);
+		return;
 	}
 
 	file = fopen(fname, "r");
@@ -139,25 +572,24 @@ void load_emmstat_from_file(void)
 		return;
 	}
 
-	struct timeb ts, te;
-	cs_ftime(&ts);
-
 	struct s_reader *rdr = NULL;
+	struct emm_stat_entry *e;
 	struct s_emmstat *s;
 
 	int32_t i = 1;
 	int32_t valid = 0;
-	int32_t count = 0;
 	char *ptr, *saveptr1 = NULL;
 	char *split[7];
 
+	count = 0;
 	while(fgets(line, LINESIZE, file))
 	{
 		if(!line[0] || line[0] == '#' || line[0] == ';')
 			{ continue; }
 
-		if(!cs_malloc(&s, sizeof(struct s_emmstat)))
+		if(!cs_malloc(&e, sizeof(struct emm_stat_entry)))
 			{ continue; }
+		s = &e->s;
 
 		for(i = 0, ptr = strtok_r(line, ",", &saveptr1); ptr && i < 7 ; ptr = strtok_r(NULL, ",", &saveptr1), i++)
 		{ split[i] = ptr; }
@@ -172,42 +604,20 @@ void load_emmstat_from_file(void)
 			s->type = a2i(split[4], 2);
 			s->count = a2i(split[5], 4);
 
-			LL_ITER itr = ll_iter_create(configured_readers);
-
-			while((rdr = ll_iter_next(&itr)))
-			{
-				if(rdr->cachemm !=1) // skip: emmcache save is disabled
-				{
-					continue;
-				}
-
-				if(strcmp(rdr->label, buf) == 0)
-				{
-					break;
-				}
-			}
-
-			if(rdr != NULL)
+			if((rdr = get_emmstat_reader(buf)))
 			{
-				if(!rdr->emmstat)
-				{
-					rdr->emmstat = ll_create("emmstat");
-					cs_lock_create(__func__, &rdr->emmstat_lock, rdr->label, DEFAULT_LOCK_TIMEOUT);
-				}
-
-				ll_append(rdr->emmstat, s);
-				count++;
+				count += add_emmstat(rdr, e);
 			}
 			else
 			{
 				cs_log("emmstats could not be loaded for %s", buf);
-				NULLFREE(s);
+				NULLFREE(e);
 			}
 		}
 		else
 		{
 			cs_log_dbg(D_EMM, "emmstat ERROR: %s count=%d type=%d", buf, s->count, s->type);
-			NULLFREE(s);
+			NULLFREE(e);
 		}
 	}
 
@@ -230,27 +640,19 @@ void save_emmstat_to_file(void)
 	}
 
 	char fname[256];
+	struct emm_snapshot snap;
+	struct emm_stat_record rec;
+	struct s_emmstat *s;
+	uint32_t n, count_pos;
+	uint8_t label_len;
+	node *nd;
 
-	if(cfg.emmlogdir)
-	{
-		get_emmcache_filename(fname, sizeof(fname), "ncam.emmstat");
-	}
-	else
-	{
-		get_config_filename(fname, sizeof(fname), "ncam.emmstat");
-	}
-	FILE *file = fopen(fname, "w");
-
-	if(!file)
-	{
-		cs_log("can't write to file %s", fname);
-		return;
-	}
+	get_emmcache_filename(fname, sizeof(fname), "ncam.emmstat.bin");
 
 	struct timeb ts, te;
 	cs_ftime(&ts);
+	memset(&snap, 0, sizeof(snap));
 
-	int32_t count = 0, result = 0;
 	struct s_reader *rdr;
 	LL_ITER itr = ll_iter_create(configured_readers);
 	while((rdr = ll_iter_next(&itr)))
@@ -261,38 +663,44 @@ void save_emmstat_to_file(void)
 			continue;
 		}
 
-		if(rdr->emmstat)
+		struct s_emmstat_index *index = emm_stat_lock(rdr, false);
+		if(index)
 		{
-			cs_writelock(__func__, &rdr->emmstat_lock);
-			LL_ITER it = ll_iter_create(rdr->emmstat);
-			struct s_emmstat *s;
-			while((s = ll_iter_next(&it)))
+			label_len = cs_strlen(rdr->label);
+			snapshot_put(&snap, &label_len, sizeof(label_len));
+			snapshot_put(&snap, rdr->label, label_len);
+			count_pos = snap.len;
+			n = 0;
+			snapshot_put(&snap, &n, sizeof(n)); // filled in below
+
+			for(nd = get_first_node_list(&index->ll); nd; nd = nd->next)
 			{
-				uint8_t tmp_emmd5[MD5_DIGEST_LENGTH * 2 + 1];
-				char_to_hex(s->emmd5, MD5_DIGEST_LENGTH, tmp_emmd5);
-				result = fprintf(file, "%s,%s,%ld,%ld,%02X,%04X\n", rdr->label, tmp_emmd5, s->firstwritten.time, s->lastwritten.time, s->type, s->count);
-				if(result < 0)
-				{
-					cs_writeunlock(__func__, &rdr->emmstat_lock);
-					fclose(file);
-					result = remove(fname);
-					if(!result)
-					{
-						cs_log("error writing stats -> stat file removed!");
-					}
-					else
-					{
-						cs_log("error writing stats -> stat file could not be removed either!");
-					}
-					return;
-				}
-				count++;
+				s = &((struct emm_stat_entry *)nd->data)->s;
+				memset(&rec, 0, sizeof(rec));
+				memcpy(rec.emmd5, s->emmd5, MD5_DIGEST_LENGTH);
+				rec.firstwritten = s->firstwritten.time;
+				rec.lastwritten = s->lastwritten.time;
+				rec.count = s->count;
+				rec.type = s->type;
+				snapshot_put(&snap, &rec, sizeof(rec));
+				n++;
 			}
 			cs_writeunlock(__func__, &rdr->emmstat_lock);
+
+			if(!snap.failed)
+			{
+				memcpy(snap.data + count_pos, &n, sizeof(n));
+			}
+			snap.records += n;
 		}
 	}
 
-	fclose(file);
+	int32_t count = snapshot_write(&snap, fname, "NEMS");
+	if(count < 0)
+	{
+		cs_log("error writing stats -> stat file not saved!");
+		return;
+	}
 
 	cs_ftime(&te);
 	int64_t load_time = comp_timeb(&te, &ts);
@@ -300,6 +708,54 @@ void save_emmstat_to_file(void)
 	cs_log("saved %d emmstat records to %s in %"PRId64" ms", count, fname, load_time);
 }
 
+// needs emm_cache_lock
+static int32_t load_emm_cache_snapshot(const char *fname)
+{
+	struct emm_cache_entry *e;
+	struct emm_cache_record rec;
+	struct s_emmcache *c;
+	uint32_t records, pos = 0, len, i;
+	int32_t count = 0;
+	size_t maplen;
+	uint8_t *map, *data;
+
+	if(!(map = snapshot_map(fname, "NEMC", &maplen, &records)))
+		{ return -1; }
+
+	data = map + sizeof(struct emm_snapshot_header);
+	len = maplen - sizeof(struct emm_snapshot_header);
+
+	for(i = 0; i < records && snapshot_get(data, len, &pos, &rec, sizeof(rec)); i++)
+	{
+		if(rec.len == 0 || rec.len > MAX_EMM_SIZE || pos + rec.len > len)
+			{ break; }
+
+		if(!cs_malloc(&e, sizeof(struct emm_cache_entry)))
+			{ break; }
+
+		c = &e->c;
+		memcpy(c->emmd5, rec.emmd5, MD5_DIGEST_LENGTH);
+		c->firstseen.time = rec.firstseen;
+		c->lastseen.time = rec.lastseen;
+		c->type = rec.type;
+		c->len = rec.len;
+		snapshot_get(data, len, &pos, c->emm, c->len);
+
+		if(!emm_cache_find(c->emmd5))
+		{
+			add_hash_table(&ht_emm_cache, &e->ht_node, &ll_emm_cache, &e->ll_node, e, c->emmd5, MD5_DIGEST_LENGTH);
+			count++;
+		}
+		else
+		{
+			NULLFREE(e);
+		}
+	}
+
+	munmap(map, maplen);
+	return count;
+}
+
 void emm_load_cache(void)
 {
 	if(boxtype_is("dbox2")) return; // don't load emmcache on these boxes, they lack resources and will crash!
@@ -310,37 +766,49 @@ void emm_load_cache(void)
 	}
 
 	char fname[256];
+	char bname[256];
 	char line[1024];
-	FILE *file;
+	FILE *file = NULL;
+	struct emm_cache_entry *e;
 	struct s_emmcache *c;
 
-	if(cfg.emmlogdir)
-	{
-		get_emmcache_filename(fname, sizeof(fname), "ncam.emmcache");
-	}
-	else
-	{
-		get_config_filename(fname, sizeof(fname), "ncam.emmcache");
-	}
-
-	file = fopen(fname, "r");
-	if(!file)
-	{
-		cs_log_dbg(D_TRACE, "can't read emmcache from file %s", fname);
-		return;
-	}
+	get_emmcache_filename(fname, sizeof(fname), "ncam.emmcache");
+	get_emmcache_filename(bname, sizeof(bname), "ncam.emmcache.bin");
 
 	struct timeb ts, te;
 	cs_ftime(&ts);
 
-	int32_t count = 0;
+	int32_t count = -1;
 	int32_t i = 1;
 	int32_t valid = 0;
 	char *ptr, *saveptr1 = NULL;
 	char *split[7];
 
+	SAFE_MUTEX_LOCK(&emm_cache_lock);
+	emm_cache_init();
+
+	if(snapshot_preferred(bname, fname))
+	{
+		count = load_emm_cache_snapshot(bname);
+	}
+
+	if(count >= 0)
+	{
+		cs_strncpy(fname, bname, sizeof(fname));
+	}
+	else if(!(file = fopen(fname, "r")))
+	{
+		SAFE_MUTEX_UNLOCK(&emm_cache_lock);
+		cs_log_dbg(D_TRACE, "can't read emmcache from file %s", fname);
+		return;
+	}
+	else
+	{
+		count = 0;
+	}
+
 	memset(line, 0, sizeof(line));
-	while(fgets(line, sizeof(line), file))
+	while(file && fgets(line, sizeof(line), file))
 	{
 		if(!line[0] || line[0] == '#' || line[0] == ';')
 			{ continue; }
@@ -353,8 +821,9 @@ void emm_load_cache(void)
 		valid = (i == 6);
 		if(valid)
 		{
-			if(!cs_malloc(&c, sizeof(struct s_emmcache)))
+			if(!cs_malloc(&e, sizeof(struct emm_cache_entry)))
 			{ continue; }
+			c = &e->c;
 			key_atob_l(split[0], c->emmd5, MD5_DIGEST_LENGTH*2);
 			c->firstseen.time = atol(split[1]);
 			c->lastseen.time = atol(split[2]);
@@ -362,23 +831,25 @@ void emm_load_cache(void)
 			c->len = a2i(split[4], 4);
 			key_atob_l(split[5], c->emm, c->len*2);
 
-			if(valid && c->len != 0)
+			if(valid && c->len != 0 && !emm_cache_find(c->emmd5))
 			{
-				if(!emm_cache)
-				{
-					emm_cache = ll_create("emm cache");
-				}
-
-				ll_append(emm_cache, c);
+				add_hash_table(&ht_emm_cache, &e->ht_node, &ll_emm_cache, &e->ll_node, e, c->emmd5, MD5_DIGEST_LENGTH);
 				count++;
 			}
 			else
 			{
-				NULLFREE(c);
+				NULLFREE(e);
 			}
 		}
 	}
-	fclose(file);
+	sort_list(&ll_emm_cache, &compare_lastseen);
+	SAFE_MUTEX_UNLOCK(&emm_cache_lock);
+
+	if(file)
+	{
+		fclose(file);
+	}
+
 	cs_ftime(&te);
 	int64_t load_time = comp_timeb(&te, &ts);
 	cs_log("loaded %d emmcache records from %s in %"PRId64" ms", count, fname, load_time);
@@ -386,96 +857,113 @@ void emm_load_cache(void)
 
 struct s_emmcache *find_emm_cache(uint8_t *emmd5)
 {
-	struct s_emmcache *c;
-	LL_ITER it;
+	struct emm_cache_entry *e;
 
-	if(!emm_cache)
-		{ emm_cache = ll_create("emm cache"); }
+	SAFE_MUTEX_LOCK(&emm_cache_lock);
+	e = emm_cache_find(emmd5);
+	SAFE_MUTEX_UNLOCK(&emm_cache_lock);
 
-	it = ll_iter_create(emm_cache);
-	while((c = ll_iter_next(&it)))
+	if(e)
 	{
-		if(!memcmp(emmd5, c->emmd5, MD5_DIGEST_LENGTH))
-		{
-			cs_log_dump_dbg(D_EMM, c->emmd5, MD5_DIGEST_LENGTH, "found emmcache match");
-			return c;
-		}
+		cs_log_dump_dbg(D_EMM, e->c.emmd5, MD5_DIGEST_LENGTH, "found emmcache match");
+		return &e->c;
 	}
 	return NULL;
 }
 
+bool emm_cache_seen(uint8_t *emmd5)
+{
+	struct emm_cache_entry *e;
+
+	SAFE_MUTEX_LOCK(&emm_cache_lock);
+	e = emm_cache_find(emmd5);
+	if(e)
+	{
+		cs_ftime(&e->c.lastseen);
+		remove_elem_list(&ll_emm_cache, &e->ll_node);
+		tommy_list_insert_tail(&ll_emm_cache, &e->ll_node, e);
+	}
+	SAFE_MUTEX_UNLOCK(&emm_cache_lock);
+
+	return e != NULL;
+}
+
 int32_t clean_stale_emm_cache_and_stat(uint8_t *emmd5, int64_t gone)
 {
 	struct timeb now;
 	cs_ftime(&now);
 	int32_t count = 0;
 
-	struct s_emmcache *c;
-	LL_ITER it;
+	struct emm_cache_entry *e;
+	node *n, *next;
 
-	if(!emm_cache)
-		{ emm_cache = ll_create("emm cache"); }
+	SAFE_MUTEX_LOCK(&emm_cache_lock);
+	emm_cache_init();
 
-	it = ll_iter_create(emm_cache);
-	while((c = ll_iter_next(&it)))
+	// clean older than gone ms, from the oldest on
+	for(n = get_first_node_list(&ll_emm_cache); n; n = next)
 	{
-		if(comp_timeb(&now, &c->lastseen) > gone && memcmp(c->emmd5, emmd5, MD5_DIGEST_LENGTH)) // clean older than gone ms and dont clean if its the current emm!
+		next = n->next;
+		e = n->data;
+
+		if(comp_timeb(&now, &e->c.lastseen) <= gone)
+			{ break; }
+
+		if(!memcmp(e->c.emmd5, emmd5, MD5_DIGEST_LENGTH)) // dont clean if its the current emm!
+			{ continue; }
+
+		struct s_reader *rdr;
+		LL_ITER rdr_itr = ll_iter_create(configured_readers);
+		while((rdr = ll_iter_next(&rdr_itr)))
 		{
-			struct s_reader *rdr;
-			LL_ITER rdr_itr = ll_iter_create(configured_readers);
-			while((rdr = ll_iter_next(&rdr_itr)))
+			if(rdr->emmstat && !(caid_is_irdeto(rdr->caid) || caid_is_videoguard(rdr->caid)))
 			{
-				if(rdr->emmstat && !(caid_is_irdeto(rdr->caid) || caid_is_videoguard(rdr->caid)))
-				{
-					remove_emm_stat(rdr, c->emmd5); // clean stale entry from stats
-					count++;
-				}
+				remove_emm_stat(rdr, e->c.emmd5); // clean stale entry from stats
+				count++;
 			}
-			ll_iter_remove_data(&it); // clean stale entry from emmcache
 		}
+		emm_cache_remove(e); // clean stale entry from emmcache
 	}
+	SAFE_MUTEX_UNLOCK(&emm_cache_lock);
+
 	return count;
 }
 
 int32_t emm_edit_cache(uint8_t *emmd5, EMM_PACKET *ep, bool add)
 {
+	struct emm_cache_entry *e;
 	struct s_emmcache *c;
-	LL_ITER it;
 	int32_t count = 0;
 
-	if(!emm_cache)
-		{ emm_cache = ll_create("emm cache"); }
-
-	it = ll_iter_create(emm_cache);
-	while((c = ll_iter_next(&it)))
+	SAFE_MUTEX_LOCK(&emm_cache_lock);
+	e = emm_cache_find(emmd5);
+	if(e)
 	{
-		if(!memcmp(emmd5, c->emmd5, MD5_DIGEST_LENGTH))
+		if(add)
 		{
-			if(add)
-			{
-				return 0; // already added
-			}
-			ll_iter_remove_data(&it);
-			count++;
+			SAFE_MUTEX_UNLOCK(&emm_cache_lock);
+			return 0; // already added
 		}
+		emm_cache_remove(e);
+		count++;
 	}
 
-	if(add)
+	if(add && cs_malloc(&e, sizeof(struct emm_cache_entry)))
 	{
-		if(!cs_malloc(&c, sizeof(struct s_emmcache)))
-			{ return count; }
+		c = &e->c;
 		memcpy(c->emmd5, emmd5, MD5_DIGEST_LENGTH);
 		c->type = ep->type;
 		c->len = SCT_LEN(ep->emm);
 		cs_ftime(&c->firstseen);
 		c->lastseen = c->firstseen;
 		memcpy(c->emm, ep->emm, c->len);
-		ll_append(emm_cache, c);
+		add_hash_table(&ht_emm_cache, &e->ht_node, &ll_emm_cache, &e->ll_node, e, c->emmd5, MD5_DIGEST_LENGTH);
 #ifdef WITH_DEBUG
 		cs_log_dump_dbg(D_EMM, c->emmd5, MD5_DIGEST_LENGTH, "added emm to cache:");
 #endif
 		count++;
 	}
+	SAFE_MUTEX_UNLOCK(&emm_cache_lock);
 
 	return count;
 }
@@ -483,21 +971,18 @@ int32_t emm_edit_cache(uint8_t *emmd5, EMM_PACKET *ep, bool add)
 int32_t remove_emm_stat(struct s_reader *rdr, uint8_t *emmd5)
 {
 	int32_t count = 0;
-	if(rdr && rdr->emmstat)
+	struct s_emmstat_index *index;
+	struct emm_stat_entry *e;
+
+	if(rdr && (index = emm_stat_lock(rdr, false)))
 	{
-		cs_writelock(__func__, &rdr->emmstat_lock);
-		struct s_emmstat *c;
-		LL_ITER itr = ll_iter_create(rdr->emmstat);
-		while((c = ll_iter_next(&itr)))
+		e = search_remove_elem_hash_table(&index->ht, emmd5, MD5_DIGEST_LENGTH, &compare_emm_stat);
+		if(e)
 		{
-			if(!memcmp(emmd5, c->emmd5, MD5_DIGEST_LENGTH))
-			{
-				ll_iter_remove_data(&itr);
-				count++;
-				break;
-			}
+			remove_elem_list(&index->ll, &e->ll_node);
+			add_garbage(e);
+			count++;
 		}
-
 		cs_writeunlock(__func__, &rdr->emmstat_lock);
 	}
 	return count;
@@ -507,28 +992,30 @@ struct s_emmstat *get_emm_stat(struct s_reader *rdr, uint8_t *emmd5, uint8_t emm
 {
 	if(!rdr->cachemm) return NULL;
 
+	struct s_emmstat_index *index = emm_stat_lock(rdr, true);
+	struct emm_stat_entry *e;
 	struct s_emmstat *c;
-	LL_ITER it;
 
-	if(!rdr->emmstat)
-		{ rdr->emmstat = ll_create("emm stat"); }
+	if(!index)
+		{ return NULL; }
 
-	it = ll_iter_create(rdr->emmstat);
-	while((c = ll_iter_next(&it)))
+	e = find_hash_table(&index->ht, emmd5, MD5_DIGEST_LENGTH, &compare_emm_stat);
+	if(e)
 	{
-		if(!memcmp(emmd5, c->emmd5, MD5_DIGEST_LENGTH))
-		{
-			cs_log_dump_dbg(D_EMM, c->emmd5, MD5_DIGEST_LENGTH, "found emmstat match (reader:%s, count:%d)", rdr->label, c->count);
-			return c;
-		}
+		cs_writeunlock(__func__, &rdr->emmstat_lock);
+		cs_log_dump_dbg(D_EMM, e->s.emmd5, MD5_DIGEST_LENGTH, "found emmstat match (reader:%s, count:%d)", rdr->label, e->s.count);
+		return &e->s;
 	}
 
-	if(cs_malloc(&c, sizeof(struct s_emmstat)))
+	c = NULL;
+	if(cs_malloc(&e, sizeof(struct emm_stat_entry)))
 	{
+		c = &e->s;
 		memcpy(c->emmd5, emmd5, MD5_DIGEST_LENGTH);
 		c->type = emmtype;
-		ll_append(rdr->emmstat, c);
+		add_hash_table(&index->ht, &e->ht_node, &index->ll, &e->ll_node, e, c->emmd5, MD5_DIGEST_LENGTH);
 		cs_log_dump_dbg(D_EMM, c->emmd5, MD5_DIGEST_LENGTH, "added emmstat (reader:%s, count:%d)", rdr->label, c->count);
 	}
+	cs_writeunlock(__func__, &rdr->emmstat_lock);
 	return c;
 }
@@ -8,10 +8,12 @@ void emm_load_cache(void);
 
 // all these functions below use emms md5 hash as indexkey
 struct s_emmcache *find_emm_cache(uint8_t *emmd5); // find a certain emm, e.g. to resend it to reader, returns null if nothing found
+bool emm_cache_seen(uint8_t *emmd5); // update lastseen of a cached emm, returns false if it is not cached
 int32_t emm_edit_cache(uint8_t *emmd5, EMM_PACKET *ep, bool add); // add = false: delete a certain emm from cache   add = true: update lastseen or add emm to cache
 struct s_emmstat *get_emm_stat(struct s_reader *rdr, uint8_t *emmd5, uint8_t emmtype); // find a certain emmstat
 int32_t remove_emm_stat(struct s_reader *rdr, uint8_t *emmd5); // remove a certain emmstat
 int32_t clean_stale_emm_cache_and_stat(uint8_t *emmd5, int64_t gone); // remove stale global emmcache + emmstat where emm lastseen is older than gone ms
+void emm_stat_free(struct s_reader *rdr); // remove all emmstats of a reader
 
 #else
 static inline void load_emmstat_from_file(void) { }
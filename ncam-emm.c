@@ -154,19 +154,13 @@ static void reader_log_emm(struct s_reader *reader, EMM_PACKET *ep, int32_t coun
 #endif
 }
 
-int32_t emm_reader_match(struct s_reader *reader, uint16_t caid, uint32_t provid)
+// matches the caid and provid of an emm with the card of a reader
+static int32_t emm_reader_match_card(struct s_reader *reader, uint16_t caid, uint32_t provid)
 {
 	int32_t i, j;
 	FTAB *ftab = &reader->ftab;
-
-	// if physical reader a card needs to be inserted
-	if(!is_network_reader(reader) && reader->card_status != CARD_INSERTED)
-		{ return 0; }
-
-	if(reader->audisabled)
-		{ return 0; }
-
 	uint16_t emmcaid;
+
 	if(reader->cak7_emm_caid != 0)
 	{
 		emmcaid = reader->cak7_emm_caid;
@@ -289,6 +283,71 @@ int32_t emm_reader_match(struct s_reader *reader, uint16_t caid, uint32_t provid
 	return 0;
 }
 
+int32_t emm_reader_match(struct s_reader *reader, uint16_t caid, uint32_t provid)
+{
+	// if physical reader a card needs to be inserted
+	if(!is_network_reader(reader) && reader->card_status != CARD_INSERTED)
+		{ return 0; }
+
+	if(reader->audisabled)
+		{ return 0; }
+
+	return emm_reader_match_card(reader, caid, provid);
+}
+
+/*
+ * do_emm() remembers per client which au readers match the caid and provid
+ * of an emm. Only local readers are remembered, network readers change caid
+ * and providers with the cards they use. A match is kept with the reader it
+ * was learned for, so a reader moving in the au list is checked again. The
+ * routes are dropped when a reader or an au list changes and at least every
+ * EMM_ROUTE_TIME seconds, in case a card learns a provider from an emm.
+ */
+#define EMM_ROUTES 16
+#define EMM_ROUTE_READERS 64
+#define EMM_ROUTE_TIME 60
+
+struct s_emm_route
+{
+	LLIST           *aureader_list;
+	uint32_t        generation;
+	time_t          created;
+	uint16_t        caid;
+	uint32_t        provid;
+	uint64_t        known;          // bit per au reader, the match is known
+	uint64_t        match;          // bit per au reader, the card matches
+	struct s_reader *reader[EMM_ROUTE_READERS]; // the au reader a bit was learned for
+};
+
+static uint32_t emm_route_generation = 1;
+
+void emm_routes_changed(void)
+{
+	emm_route_generation++;
+}
+
+static struct s_emm_route *get_emm_route(struct s_client *client, uint16_t caid, uint32_t provid, time_t now)
+{
+	struct s_emm_route *route;
+
+	if(!client->emm_routes && !cs_malloc(&client->emm_routes, EMM_ROUTES * sizeof(struct s_emm_route)))
+		{ return NULL; }
+
+	route = &client->emm_routes[(caid ^ provid ^ (provid >> 16)) % EMM_ROUTES];
+	if(route->generation != emm_route_generation || route->aureader_list != client->aureader_list
+		|| route->caid != caid || route->provid != provid || now - route->created >= EMM_ROUTE_TIME)
+	{
+		route->aureader_list = client->aureader_list;
+		route->generation = emm_route_generation;
+		route->created = now;
+		route->caid = caid;
+		route->provid = provid;
+		route->known = 0;
+		route->match = 0;
+	}
+	return route;
+}
+
 static char *get_emmlog_filename(char *dest, size_t destlen, const char *basefilename, const char *type, const char *ext)
 {
 	char filename[64 + 16];
@@ -373,6 +432,10 @@ void do_emm(struct s_client *client, EMM_PACKET *ep)
 	bool lastseendone = false;
 
 	struct s_reader *aureader = NULL;
+	struct s_emm_route *route;
+	uint64_t route_bit;
+	int32_t idx = -1;
+	time_t now = time(NULL);
 	uint16_t sct_len;
 
 	if(ep->emmlen < 3)
@@ -405,6 +468,7 @@ void do_emm(struct s_client *client, EMM_PACKET *ep)
 	LL_ITER itr = ll_iter_create(client->aureader_list);
 	while((aureader = ll_iter_next(&itr)))
 	{
+		idx++;
 		if(!aureader->enable)
 			{ continue; }
 
@@ -440,7 +504,33 @@ void do_emm(struct s_client *client, EMM_PACKET *ep)
 		}
 
 		// TODO: provider possibly not set yet, this is done in get_emm_type()
-		if(!emm_reader_match(aureader, caid, provid))
+		route = NULL;
+		route_bit = 0;
+		if(idx < EMM_ROUTE_READERS && !is_network_reader(aureader))
+		{
+			route = get_emm_route(client, caid, provid, now);
+			route_bit = (uint64_t)1 << idx;
+		}
+
+		if(route)
+		{
+			if(aureader->card_status != CARD_INSERTED)
+				{ continue; }
+
+			if(!(route->known & route_bit) || route->reader[idx] != aureader)
+			{
+				route->known |= route_bit;
+				route->reader[idx] = aureader;
+				if(emm_reader_match_card(aureader, caid, provid))
+					{ route->match |= route_bit; }
+				else
+					{ route->match &= ~route_bit; }
+			}
+
+			if(!(route->match & route_bit))
+				{ continue; }
+		}
+		else if(!emm_reader_match(aureader, caid, provid))
 			{ continue; }
 
 		const struct s_cardsystem *csystem = NULL;
@@ -624,10 +714,8 @@ void do_emm(struct s_client *client, EMM_PACKET *ep)
 
 			MD5(ep->emm, SCT_LEN(ep->emm), md5tmp);
 
-			struct s_emmcache *emmcache = find_emm_cache(md5tmp); // check emm cache
-			if(emmcache && !lastseendone)
+			if(!lastseendone && emm_cache_seen(md5tmp)) // check emm cache
 			{
-				cs_ftime(&emmcache->lastseen);
 				lastseendone = true; // in case several aureaders, only do lastseen once!
 			}
 
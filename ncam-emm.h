@@ -2,6 +2,7 @@
 #define NCAM_EMM_H_
 
 int32_t emm_reader_match(struct s_reader *reader, uint16_t caid, uint32_t provid);
+void emm_routes_changed(void);
 void do_emm(struct s_client *client, EMM_PACKET *ep);
 int32_t reader_do_emm(struct s_reader *reader, EMM_PACKET *ep);
 void do_emm_from_file(struct s_reader *reader);
@@ -2,10 +2,147 @@
 
 #include "globals.h"
 #include "module-anticasc.h"
+#include "ncam-failban.h"
+#include "ncam-hashtable.h"
 #include "ncam-net.h"
 #include "ncam-string.h"
 #include "ncam-time.h"
 
+/*
+ * The failban entries are kept in a hash table by ip and port. For the expiry
+ * they are also on a timer wheel with one slot per second, an entry which is
+ * not expired yet when its slot comes up again stays for the next round.
+ */
+#define FAILBAN_WHEEL_SLOTS 64
+
+struct failban_key
+{
+	IN_ADDR_T       ip;
+	int32_t         port;
+};
+
+struct failban_entry
+{
+	V_BAN           v;
+	struct failban_key key;
+	time_t          expire;         // second the entry is checked on the wheel
+	node            ht_node;
+	node            ll_node;
+	node            wheel_node;
+};
+
+static hash_table ht_failban;
+static list ll_failban; // in order of adding
+static list failban_wheel[FAILBAN_WHEEL_SLOTS];
+static time_t failban_wheel_time;
+static bool failban_initialized;
+#ifdef __powerpc__
+static pthread_mutex_t failban_lock;
+#else
+static pthread_mutex_t failban_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static int compare_failban(const void *arg, const void *obj)
+{
+	return memcmp(arg, &((const struct failban_entry *)obj)->key, sizeof(struct failban_key));
+}
+
+// needs failban_lock
+static void failban_init(void)
+{
+	int32_t i;
+
+	if(failban_initialized)
+		{ return; }
+
+	init_hash_table(&ht_failban, &ll_failban);
+	for(i = 0; i < FAILBAN_WHEEL_SLOTS; i++)
+		{ tommy_list_init(&failban_wheel[i]); }
+	failban_initialized = true;
+}
+
+static void failban_key(struct failban_key *key, IN_ADDR_T ip, int32_t port)
+{
+	memset(key, 0, sizeof(struct failban_key));
+	key->ip = ip;
+	key->port = port;
+}
+
+// ms since the entry was added, sets the ms it is banned for
+static int64_t failban_gone(V_BAN *v_ban_entry, struct timeb *now, int64_t *duration)
+{
+	if(v_ban_entry->acosc_entry)
+		{ *duration = (int64_t)v_ban_entry->acosc_penalty_dur * 1000; }
+	else
+		{ *duration = (int64_t)cfg.failbantime * 60 * 1000; }
+
+	return comp_timeb(now, &v_ban_entry->v_time);
+}
+
+static int8_t failban_expired(V_BAN *v_ban_entry, struct timeb *now)
+{
+	int64_t duration, gone = failban_gone(v_ban_entry, now, &duration);
+
+	if(v_ban_entry->acosc_entry)
+		{ return (gone / 1000) >= v_ban_entry->acosc_penalty_dur; }
+
+	return gone >= duration;
+}
+
+// needs failban_lock
+static void failban_schedule(struct failban_entry *e)
+{
+	int64_t duration;
+	struct timeb now = e->v.v_time;
+
+	failban_gone(&e->v, &now, &duration);
+	e->expire = e->v.v_time.time + duration / 1000 + 1;
+	tommy_list_insert_tail(&failban_wheel[e->expire % FAILBAN_WHEEL_SLOTS], &e->wheel_node, e);
+}
+
+// needs failban_lock
+static void failban_remove(struct failban_entry *e)
+{
+	remove_elem_hash_table(&ht_failban, &e->ht_node);
+	remove_elem_list(&ll_failban, &e->ll_node);
+	remove_elem_list(&failban_wheel[e->expire % FAILBAN_WHEEL_SLOTS], &e->wheel_node);
+	NULLFREE(e->v.info);
+	NULLFREE(e);
+}
+
+// removes the entries out of time, needs failban_lock
+static void failban_expire(struct timeb *now)
+{
+	struct failban_entry *e;
+	time_t t, end = now->time;
+	node *n, *next;
+	list *slot;
+
+	if(!failban_wheel_time || end - failban_wheel_time > FAILBAN_WHEEL_SLOTS)
+		{ failban_wheel_time = end - FAILBAN_WHEEL_SLOTS; }
+
+	for(t = failban_wheel_time + 1; t <= end; t++)
+	{
+		slot = &failban_wheel[t % FAILBAN_WHEEL_SLOTS];
+		for(n = get_first_node_list(slot); n; n = next)
+		{
+			next = n->next;
+			e = n->data;
+
+			if(failban_expired(&e->v, now))
+			{
+				failban_remove(e);
+			}
+			else if(e->expire <= end) // the ban time was changed
+			{
+				remove_elem_list(slot, &e->wheel_node);
+				failban_schedule(e);
+			}
+		}
+	}
+	failban_wheel_time = end;
+}
+
 static int32_t cs_check_v(IN_ADDR_T ip, int32_t port, int32_t add, char *info, int32_t acosc_penalty_duration)
 {
 	int32_t result = 0;
@@ -13,80 +150,73 @@ static int32_t cs_check_v(IN_ADDR_T ip, int32_t port, int32_t add, char *info, i
 	if(!(cfg.failbantime || acosc_enabled()))
 		return 0;
 
-	if(!cfg.v_list)
-		{ cfg.v_list = ll_create("v_list"); }
-
 	struct timeb (now);
 	cs_ftime(&now);
-	LL_ITER itr = ll_iter_create(cfg.v_list);
+	struct failban_entry *e;
+	struct failban_key key;
 	V_BAN *v_ban_entry;
-	int32_t ftime = cfg.failbantime * 60 * 1000;
+	int64_t gone, duration;
+
+	failban_key(&key, ip, port);
+
+	SAFE_MUTEX_LOCK(&failban_lock);
+	failban_init();
+
+	// housekeeping:
+	failban_expire(&now);
+
+	e = find_hash_table(&ht_failban, &key, sizeof(key), &compare_failban);
+	if(e && failban_expired(&e->v, &now)) // entry out of time->remove
+	{
+		failban_remove(e);
+		e = NULL;
+	}
 
-	// run over all banned entries to do housekeeping:
-	while((v_ban_entry = ll_iter_next(&itr)))
+	if(e)
 	{
-		// housekeeping:
-		int64_t gone = comp_timeb(&now, &v_ban_entry->v_time);
-		if(((gone >= ftime) && !v_ban_entry->acosc_entry) || (v_ban_entry->acosc_entry && ((gone/1000) >= v_ban_entry->acosc_penalty_dur))) // entry out of time->remove
+		v_ban_entry = &e->v;
+		result = 1;
+		if(!info)
+			{ info = v_ban_entry->info; }
+		else if(!v_ban_entry->info)
 		{
-			NULLFREE(v_ban_entry->info);
-			ll_iter_remove_data(&itr);
-			continue;
+			v_ban_entry->info = cs_strdup(info);
 		}
 
-		if(IP_EQUAL(ip, v_ban_entry->v_ip) && port == v_ban_entry->v_port)
+		if(!add)
 		{
-			result = 1;
-			if(!info)
-				{ info = v_ban_entry->info; }
-			else if(!v_ban_entry->info)
+			if(v_ban_entry->v_count >= cfg.failbancount)
 			{
-				v_ban_entry->info = cs_strdup(info);
-			}
-
-			if(!add)
-			{
-				if(v_ban_entry->v_count >= cfg.failbancount)
-				{
-					if(!v_ban_entry->acosc_entry)
-					{
-						cs_log_dbg(D_TRACE, "failban: banned ip %s:%d - %"PRId64" seconds left %s%s",
-									cs_inet_ntoa(v_ban_entry->v_ip), v_ban_entry->v_port,
-									(ftime - gone) / 1000, info ? ", info: " : "", info ? info : "");
-					}
-					else
-					{
-						cs_log_dbg(D_TRACE, "failban: banned ip %s:%d - %"PRId64" seconds left %s%s",
-									cs_inet_ntoa(v_ban_entry->v_ip), v_ban_entry->v_port,
-									(v_ban_entry->acosc_penalty_dur - (gone / 1000)),
-									info ? ", info: " : "", info ? info : "");
-					}
-
-				}
-				else
-				{
-					cs_log_dbg(D_TRACE, "failban: ip %s:%d chance %d of %d%s%s",
-								cs_inet_ntoa(v_ban_entry->v_ip), v_ban_entry->v_port,
-								v_ban_entry->v_count, cfg.failbancount,
-								info ? ", info: " : "", info ? info : "");
-
-					v_ban_entry->v_count++;
-				}
+				gone = failban_gone(v_ban_entry, &now, &duration);
+				cs_log_dbg(D_TRACE, "failban: banned ip %s:%d - %"PRId64" seconds left %s%s",
+							cs_inet_ntoa(v_ban_entry->v_ip), v_ban_entry->v_port,
+							v_ban_entry->acosc_entry ? v_ban_entry->acosc_penalty_dur - (gone / 1000) : (duration - gone) / 1000,
+							info ? ", info: " : "", info ? info : "");
 			}
 			else
 			{
-				cs_log_dbg(D_TRACE, "failban: banned ip %s:%d - already exist in list %s%s",
+				cs_log_dbg(D_TRACE, "failban: ip %s:%d chance %d of %d%s%s",
 							cs_inet_ntoa(v_ban_entry->v_ip), v_ban_entry->v_port,
+							v_ban_entry->v_count, cfg.failbancount,
 							info ? ", info: " : "", info ? info : "");
+
+				v_ban_entry->v_count++;
 			}
 		}
+		else
+		{
+			cs_log_dbg(D_TRACE, "failban: banned ip %s:%d - already exist in list %s%s",
+						cs_inet_ntoa(v_ban_entry->v_ip), v_ban_entry->v_port,
+						info ? ", info: " : "", info ? info : "");
+		}
 	}
 
 	if(add && !result)
 	{
-		if(cs_malloc(&v_ban_entry, sizeof(V_BAN)))
+		if(cs_malloc(&e, sizeof(struct failban_entry)))
 		{
-			cs_ftime(&v_ban_entry->v_time);
+			v_ban_entry = &e->v;
+			v_ban_entry->v_time = now;
 			v_ban_entry->v_ip = ip;
 			v_ban_entry->v_port = port;
 			v_ban_entry->v_count = 1;
@@ -103,12 +233,15 @@ static int32_t cs_check_v(IN_ADDR_T ip, int32_t port, int32_t add, char *info, i
 			if(info)
 				{ v_ban_entry->info = cs_strdup(info); }
 
-			ll_iter_insert(&itr, v_ban_entry);
+			e->key = key;
+			add_hash_table(&ht_failban, &e->ht_node, &ll_failban, &e->ll_node, e, &e->key, sizeof(e->key));
+			failban_schedule(e);
 			cs_log_dbg(D_TRACE, "failban: ban ip %s:%d with timestamp %ld%s%s",
 						cs_inet_ntoa(v_ban_entry->v_ip), v_ban_entry->v_port, v_ban_entry->v_time.time,
 						info ? ", info: " : "", info ? info : "");
 		}
 	}
+	SAFE_MUTEX_UNLOCK(&failban_lock);
 
 	return result;
 }
@@ -139,3 +272,53 @@ void cs_add_violation_acosc(struct s_client *cl, char *info, int32_t acosc_penal
 	struct s_module *module = get_module(cl);
 	cs_add_violation_by_ip_acosc(cl->ip, module->ptab.ports[cl->port_idx].s_port, info, acosc_penalty_duration);
 }
+
+int32_t cs_count_violations(void)
+{
+	int32_t count;
+
+	SAFE_MUTEX_LOCK(&failban_lock);
+	failban_init();
+	count = count_hash_table(&ht_failban);
+	SAFE_MUTEX_UNLOCK(&failban_lock);
+
+	return count;
+}
+
+void cs_remove_violation(IN_ADDR_T *ip)
+{
+	struct failban_entry *e;
+	node *n, *next;
+
+	SAFE_MUTEX_LOCK(&failban_lock);
+	failban_init();
+	for(n = get_first_node_list(&ll_failban); n; n = next)
+	{
+		next = n->next;
+		e = n->data;
+
+		if(!ip)
+		{
+			failban_remove(e);
+		}
+		else if(IP_EQUAL(e->v.v_ip, *ip))
+		{
+			failban_remove(e);
+			break;
+		}
+	}
+	SAFE_MUTEX_UNLOCK(&failban_lock);
+}
+
+void cs_foreach_violation(void (*fn)(V_BAN *v_ban_entry, void *arg), void *arg)
+{
+	node *n;
+
+	SAFE_MUTEX_LOCK(&failban_lock);
+	failban_init();
+	for(n = get_first_node_list(&ll_failban); n; n = n->next)
+	{
+		fn(&((struct failban_entry *)n->data)->v, arg);
+	}
+	SAFE_MUTEX_UNLOCK(&failban_lock);
+}
@@ -5,5 +5,8 @@ extern int32_t cs_check_violation(IN_ADDR_T ip, int32_t port);
 int32_t cs_add_violation_by_ip(IN_ADDR_T ip, int32_t port, char *info);
 extern void cs_add_violation(struct s_client *cl, char *info);
 extern void cs_add_violation_acosc(struct s_client *cl, char *info, int32_t acosc_penalty_duration);
+int32_t cs_count_violations(void);
+void cs_remove_violation(IN_ADDR_T *ip); // removes the first entry of ip, all entries if ip is NULL
+void cs_foreach_violation(void (*fn)(V_BAN *v_ban_entry, void *arg), void *arg); // fn is called with the failban list locked
 
 #endif
@@ -44,6 +44,20 @@ void deinitialize_hash_table(void *ht)
 	tommy_hashlin_done(ht);
 }
 
+// like deinitialize_hash_table(), the bucket segments are handed to release instead of free
+void release_hash_table(void *ht, void (*release)(void *))
+{
+	tommy_hashlin *hashlin = ht;
+	tommy_uint_t i;
+
+	release(hashlin->bucket[0]);
+	for(i = TOMMY_HASHLIN_BIT; i < hashlin->bucket_bit; ++i)
+	{
+		tommy_hashlin_node **segment = hashlin->bucket[i];
+		release(&segment[((tommy_ptrdiff_t)1) << i]);
+	}
+}
+
 void sort_list(void *ll, void *cmp)
 {
 	tommy_list_sort (ll, cmp);
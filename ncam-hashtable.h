@@ -1,3 +1,6 @@
+#ifndef NCAM_HASHTABLE_H_
+#define NCAM_HASHTABLE_H_
+
 #include "tommyDS_hashlin/tommytypes.h"
 #include "tommyDS_hashlin/tommyhashlin.h"
 #include "tommyDS_hashlin/tommylist.h"
@@ -13,8 +16,11 @@ void *search_remove_elem_hash_table(void *ht, void *key, int key_len, void *comp
 void *remove_elem_hash_table(void *ht, void *ht_node);
 int count_hash_table(void *ht);
 void deinitialize_hash_table(void *ht);
+void release_hash_table(void *ht, void (*release)(void *));
 void sort_list(void *ll, void *cmp);
 void *remove_elem_list(void *ll, void *ll_node);
 void *get_first_node_list(void *ll);
 void *get_first_elem_list(void *ll);
 void *get_data_from_node(void *_node);
+
+#endif
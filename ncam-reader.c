@@ -10,7 +10,9 @@
 #include "ncam-chk.h"
 #include "ncam-client.h"
 #include "ncam-ecm.h"
+#include "ncam-emm-cache.h"
 #include "ncam-garbage.h"
+#include "ncam-hashtable.h"
 #include "ncam-lock.h"
 #include "ncam-net.h"
 #include "ncam-reader.h"
@@ -1342,7 +1344,7 @@ int32_t reader_init(struct s_reader *reader)
 			{ return 0; }
 	}
 
-	ll_destroy_data(&reader->emmstat);
+	emm_stat_free(reader);
 
 	client->login = time((time_t *)0);
 	client->init_done = 1;
@@ -1454,6 +1456,7 @@ static void add_reader_to_active(struct s_reader *rdr)
 		first_active_reader = rdr;
 	}
 	rdr->active = 1;
+	active_readers_changed();
 	cs_writeunlock(__func__, &clientlist_lock);
 	cs_writeunlock(__func__, &readerlist_lock);
 }
@@ -1475,9 +1478,215 @@ void remove_reader_from_active(struct s_reader *rdr)
 	}
 	rdr->next = NULL;
 	rdr->active = 0;
+	active_readers_changed();
 	cs_writeunlock(__func__, &readerlist_lock);
 }
 
+/*
+ * Prefilter for matching_reader(): the active readers get a bit each in list
+ * order. For a caid the bitmap holds the readers with that caid in their
+ * caid list, for a group the readers in the group. The index is rebuilt on the
+ * first lookup after active_readers_changed(), the caid bitmaps are added
+ * when a caid is first asked for.
+ */
+struct reader_caid_bits
+{
+	uint16_t        caid;
+	node            ht_node;
+	node            ll_node;
+	uint64_t        bits[];
+};
+
+static struct
+{
+	struct s_reader **readers;      // active readers in list order
+	int32_t         count;
+	int32_t         words;          // uint64_t per bitmap
+	uint64_t        *group_bits;    // bitmap per group, 64 * words
+	hash_table      ht_caid;        // struct reader_caid_bits by caid
+	list            ll_caid;
+	uint32_t        generation;     // active_readers_generation the index was built for
+} reader_index;
+static uint32_t active_readers_generation = 1;
+static bool reader_index_initialized;
+static pthread_rwlock_t reader_index_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static int compare_reader_caid_bits(const void *arg, const void *obj)
+{
+	return *(const uint16_t *)arg != ((const struct reader_caid_bits *)obj)->caid;
+}
+
+void active_readers_changed(void)
+{
+	++active_readers_generation;
+}
+
+// needs reader_index_lock for writing and readerlist_lock
+static void reader_index_build(void)
+{
+	struct reader_caid_bits *e;
+	struct s_reader *rdr;
+	int32_t i, g;
+
+	if(reader_index_initialized)
+	{
+		while((e = get_first_elem_list(&reader_index.ll_caid)))
+		{
+			remove_elem_list(&reader_index.ll_caid, &e->ll_node);
+			NULLFREE(e);
+		}
+		deinitialize_hash_table(&reader_index.ht_caid);
+	}
+	init_hash_table(&reader_index.ht_caid, &reader_index.ll_caid);
+	reader_index_initialized = true;
+
+	NULLFREE(reader_index.readers);
+	NULLFREE(reader_index.group_bits);
+	reader_index.count = 0;
+	reader_index.words = 0;
+	reader_index.generation = active_readers_generation;
+
+	for(rdr = first_active_reader; rdr; rdr = rdr->next)
+		{ reader_index.count++; }
+
+	reader_index.words = (reader_index.count + 63) / 64;
+	if(!reader_index.count
+		|| !cs_malloc(&reader_index.readers, reader_index.count * sizeof(struct s_reader *))
+		|| !cs_malloc(&reader_index.group_bits, 64 * reader_index.words * sizeof(uint64_t)))
+	{
+		NULLFREE(reader_index.readers);
+		reader_index.count = 0;
+		reader_index.words = 0;
+		return;
+	}
+
+	for(i = 0, rdr = first_active_reader; rdr && i < reader_index.count; rdr = rdr->next, i++)
+	{
+		reader_index.readers[i] = rdr;
+		for(g = 0; g < 64; g++)
+		{
+			if(rdr->grp & ((uint64_t)1 << g))
+				{ reader_index.group_bits[g * reader_index.words + i / 64] |= (uint64_t)1 << (i % 64); }
+		}
+	}
+}
+
+// needs reader_index_lock for writing
+static void reader_index_add_caid(uint16_t caid)
+{
+	struct reader_caid_bits *e;
+	int32_t i;
+
+	if(!cs_malloc(&e, sizeof(struct reader_caid_bits) + reader_index.words * sizeof(uint64_t)))
+		{ return; }
+
+	e->caid = caid;
+	for(i = 0; i < reader_index.count; i++)
+	{
+		if(chk_ctab(caid, &reader_index.readers[i]->ctab))
+			{ e->bits[i / 64] |= (uint64_t)1 << (i % 64); }
+	}
+	add_hash_table(&reader_index.ht_caid, &e->ht_node, &reader_index.ll_caid, &e->ll_node, e, &e->caid, sizeof(e->caid));
+}
+
+// needs reader_index_lock
+static bool reader_index_ready(uint16_t *caids, int32_t num_caids)
+{
+	int32_t i;
+
+	if(!reader_index_initialized || reader_index.generation != active_readers_generation)
+		{ return false; }
+
+	for(i = 0; i < num_caids; i++)
+	{
+		if(!find_hash_table(&reader_index.ht_caid, &caids[i], sizeof(uint16_t), &compare_reader_caid_bits))
+			{ return false; }
+	}
+	return true;
+}
+
+/*
+ * Returns the active readers which can pass the caid and group checks of
+ * matching_reader() for the ecm, in list order and NULL terminated, or NULL
+ * if the index is not available. The caid list of a reader is checked with
+ * the caid, the ocaid and with the betatunnel caids the loadbalancer may try.
+ * Needs readerlist_lock, the returned array has to be freed.
+ */
+struct s_reader **get_reader_candidates(ECM_REQUEST *er)
+{
+	static const uint16_t betatunnel_caids[] = { 0x1702, 0x1722, 0x1801, 0x1833, 0x1834, 0x1835 };
+	struct s_reader **candidates = NULL;
+	struct reader_caid_bits *caid_bits[2 + sizeof(betatunnel_caids) / sizeof(uint16_t)];
+	uint16_t caids[2 + sizeof(betatunnel_caids) / sizeof(uint16_t)];
+	uint64_t bits, grp_bits, grp;
+	int32_t num_caids = 0, i, j, g, n = 0;
+	bool complete = true;
+
+	caids[num_caids++] = er->caid;
+	if(er->ocaid && er->ocaid != er->caid)
+		{ caids[num_caids++] = er->ocaid; }
+	if(cfg.lb_auto_betatunnel && chk_is_betatunnel_caid(er->caid))
+	{
+		for(i = 0; i < (int32_t)(sizeof(betatunnel_caids) / sizeof(uint16_t)); i++)
+			{ caids[num_caids++] = betatunnel_caids[i]; }
+	}
+
+	SAFE_RWLOCK_RDLOCK(&reader_index_lock);
+	if(!reader_index_ready(caids, num_caids))
+	{
+		SAFE_RWLOCK_UNLOCK(&reader_index_lock);
+		SAFE_RWLOCK_WRLOCK(&reader_index_lock);
+		if(!reader_index_initialized || reader_index.generation != active_readers_generation)
+			{ reader_index_build(); }
+		for(i = 0; i < num_caids; i++)
+		{
+			if(!find_hash_table(&reader_index.ht_caid, &caids[i], sizeof(uint16_t), &compare_reader_caid_bits))
+				{ reader_index_add_caid(caids[i]); }
+		}
+	}
+
+	for(i = 0; i < num_caids; i++)
+	{
+		caid_bits[i] = find_hash_table(&reader_index.ht_caid, &caids[i], sizeof(uint16_t), &compare_reader_caid_bits);
+		if(!caid_bits[i])
+			{ complete = false; } // out of memory, let the caller check all readers
+	}
+
+	if(!complete || !reader_index.count || !cs_malloc(&candidates, (reader_index.count + 1) * sizeof(struct s_reader *)))
+	{
+		SAFE_RWLOCK_UNLOCK(&reader_index_lock);
+		return NULL;
+	}
+
+	for(j = 0; j < reader_index.words; j++)
+	{
+		bits = 0;
+		for(i = 0; i < num_caids; i++)
+			{ bits |= caid_bits[i]->bits[j]; }
+
+		if(er->client)
+		{
+			grp_bits = 0;
+			for(g = 0, grp = er->client->grp; grp; g++, grp >>= 1)
+			{
+				if(grp & 1)
+					{ grp_bits |= reader_index.group_bits[g * reader_index.words + j]; }
+			}
+			bits &= grp_bits;
+		}
+
+		for(i = 0; bits; i++, bits >>= 1)
+		{
+			if(bits & 1)
+				{ candidates[n++] = reader_index.readers[j * 64 + i]; }
+		}
+	}
+	candidates[n] = NULL;
+	SAFE_RWLOCK_UNLOCK(&reader_index_lock);
+
+	return candidates;
+}
+
 /* Starts or restarts a cardreader without locking. If restart=1, the existing thread is killed before restarting,
    if restart=0 the cardreader is only started. */
 static int32_t restart_cardreader_int(struct s_reader *rdr, int32_t restart)
@@ -1591,6 +1800,7 @@ void kill_all_readers(void)
 #endif
 	}
 	first_active_reader = NULL;
+	active_readers_changed();
 }
 
 int32_t reader_slots_available(struct s_reader *reader, ECM_REQUEST *er)
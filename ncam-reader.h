@@ -26,6 +26,8 @@ int32_t reader_slots_available(struct s_reader *reader, ECM_REQUEST *er);
 void cs_card_info(void);
 int32_t reader_init(struct s_reader *reader);
 void remove_reader_from_active(struct s_reader *rdr);
+void active_readers_changed(void);
+struct s_reader **get_reader_candidates(ECM_REQUEST *er);
 int32_t restart_cardreader(struct s_reader *rdr, int32_t restart);
 void init_cardreader(void);
 void kill_all_readers(void);
@@ -1937,6 +1937,7 @@ int32_t main(int32_t argc, char *argv[])
 	add_emu_reader();
 #endif
 	cfg.account = init_userdb();
+	accounts_changed();
 	init_signal();
 	init_provid();
 	init_srvid();
@@ -2081,6 +2082,7 @@ int32_t main(int32_t argc, char *argv[])
 	webif_tpls_free();
 	init_free_userdb(cfg.account);
 	cfg.account = NULL;
+	accounts_changed();
 	init_free_sidtab();
 	free_readerdb();
 	free_irdeto_guess_tab();
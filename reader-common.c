@@ -44,6 +44,7 @@ static void reader_nullcard(struct s_reader *reader)
 #endif
 	reader->nprov = 0;
 	cs_clear_entitlement(reader);
+	emm_routes_changed();
 }
 
 int32_t reader_cmd2icc(struct s_reader *reader, const uint8_t *buf, const int32_t l, uint8_t *cta_res, uint16_t *p_cta_lr)
@@ -135,6 +136,7 @@ void cardreader_get_card_info(struct s_reader *reader)
 		{
 			reader->csystem->card_info(reader);
 		}
+		emm_routes_changed();
 	}
 }
 
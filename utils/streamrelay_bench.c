@@ -0,0 +1,771 @@
+/*
+ * Stream relay benchmark
+ *
+ * Serves a synthetic transport stream as the stream source of the relay:
+ * PAT, PMT with a CA descriptor, ECM and a video pid scrambled with known
+ * control words. The video payload carries a sequence number, the send time
+ * and a pattern, so the clients the benchmark drives through the relay can
+ * check every descrambled packet against the cleartext and measure the
+ * latency of the relay.
+ *
+ * The relay of the ncam under test has to use the benchmark as its source
+ * and the caid of the benchmark, e.g.
+ *
+ *   [streamrelay]
+ *   stream_relay_enabled = 1
+ *   stream_source_host   = 127.0.0.1
+ *   stream_source_port   = 18001
+ *   stream_relay_ctab    = 0B00
+ *
+ * and a reader answering the benchmark ECMs with its control words, the
+ * constcw lines for that are printed with -k.
+ *
+ * With -d it only times the descrambler of the libdvbcsa build it is linked
+ * against, which tells the simd variants of libdvbcsa apart.
+ *
+ * Build with `make streamrelay-bench`.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <dvbcsa/dvbcsa.h>
+
+#define TS_PACKET_SIZE 188
+#define BENCH_PMT_PID 0x0100
+#define BENCH_ECM_PID 0x0101
+#define BENCH_VIDEO_PID 0x0200
+#define BENCH_TICK 10 // ms between two bursts of the source
+#define BENCH_PSI_INTERVAL 100 // ms between PAT/PMT
+#define BENCH_ECM_INTERVAL 500 // ms between ECMs
+#define BENCH_PARITY_INTERVAL 10000 // ms the video is scrambled with the same control word
+
+typedef struct
+{
+	int32_t index;
+	uint16_t srvid;
+	pthread_t thread;
+	uint64_t bytes;
+	uint64_t descrambled;
+	uint64_t scrambled;
+	uint64_t corrupt;
+	uint64_t lost;
+	uint64_t resync;
+	uint64_t latency_sum; // us
+	uint64_t latency_max;
+	int8_t connected;
+} bench_client;
+
+static char relay_host[64] = "127.0.0.1";
+static int32_t relay_port = 17999;
+static int32_t source_port = 18001;
+static int32_t client_count = 4;
+static int32_t stream_count = 1;
+static int32_t duration = 10;
+static int32_t source_rate = 20; // Mbit/s per stream
+static int32_t ncam_pid;
+static uint16_t bench_caid = 0x0B00;
+static uint16_t first_srvid = 0x1000;
+static const uint8_t bench_cw[16] = { 0x11, 0x22, 0x33, 0x66, 0x44, 0x55, 0x66, 0xFF,   // even
+									  0x99, 0x88, 0x77, 0x98, 0x66, 0x55, 0x44, 0xFF }; // odd
+static volatile int32_t running = 1;
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void put_be64(uint8_t *buf, uint64_t value)
+{
+	int32_t i;
+
+	for (i = 7; i >= 0; i--, value >>= 8)
+	{
+		buf[i] = value & 0xFF;
+	}
+}
+
+static uint64_t get_be64(const uint8_t *buf)
+{
+	uint64_t value = 0;
+	int32_t i;
+
+	for (i = 0; i < 8; i++)
+	{
+		value = (value << 8) | buf[i];
+	}
+	return value;
+}
+
+static uint32_t crc32_mpeg(const uint8_t *data, int32_t len)
+{
+	uint32_t crc = 0xFFFFFFFF;
+	int32_t i, j;
+
+	for (i = 0; i < len; i++)
+	{
+		crc ^= (uint32_t)data[i] << 24;
+		for (j = 0; j < 8; j++)
+		{
+			crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : crc << 1;
+		}
+	}
+	return crc;
+}
+
+static void put_header(uint8_t *pkt, uint16_t pid, int8_t payload_start, uint8_t scrambling, uint8_t *cc)
+{
+	pkt[0] = 0x47;
+	pkt[1] = (payload_start ? 0x40 : 0x00) | (pid >> 8);
+	pkt[2] = pid & 0xFF;
+	pkt[3] = scrambling | 0x10 | ((*cc)++ & 0x0F);
+}
+
+// puts a psi section (with room for the crc if add_crc is set) into one ts packet
+static void put_section(uint8_t *pkt, uint16_t pid, uint8_t *cc, uint8_t *section, int32_t len, int8_t add_crc)
+{
+	uint32_t crc;
+
+	section[1] = 0xB0 | ((len - 3) >> 8);
+	section[2] = (len - 3) & 0xFF;
+	if (add_crc)
+	{
+		crc = crc32_mpeg(section, len - 4);
+		section[len - 4] = crc >> 24;
+		section[len - 3] = crc >> 16;
+		section[len - 2] = crc >> 8;
+		section[len - 1] = crc;
+	}
+
+	put_header(pkt, pid, 1, 0, cc);
+	pkt[4] = 0; // pointer field
+	memcpy(pkt + 5, section, len);
+	memset(pkt + 5 + len, 0xFF, TS_PACKET_SIZE - 5 - len);
+}
+
+static void put_pat(uint8_t *pkt, uint16_t srvid, uint8_t *cc)
+{
+	uint8_t section[16] = { 0x00, 0, 0, 0x00, 0x01, 0xC1, 0x00, 0x00 };
+
+	section[8] = srvid >> 8;
+	section[9] = srvid & 0xFF;
+	section[10] = 0xE0 | (BENCH_PMT_PID >> 8);
+	section[11] = BENCH_PMT_PID & 0xFF;
+	put_section(pkt, 0x0000, cc, section, sizeof(section), 1);
+}
+
+static void put_pmt(uint8_t *pkt, uint16_t srvid, uint8_t *cc)
+{
+	uint8_t section[27] = { 0x02, 0, 0, srvid >> 8, srvid & 0xFF, 0xC1, 0x00, 0x00,
+							0xE0 | (BENCH_VIDEO_PID >> 8), BENCH_VIDEO_PID & 0xFF, 0xF0, 6,
+							0x09, 4, bench_caid >> 8, bench_caid & 0xFF, 0xE0 | (BENCH_ECM_PID >> 8), BENCH_ECM_PID & 0xFF,
+							0x1B, 0xE0 | (BENCH_VIDEO_PID >> 8), BENCH_VIDEO_PID & 0xFF, 0xF0, 0 };
+
+	put_section(pkt, BENCH_PMT_PID, cc, section, sizeof(section), 1);
+}
+
+static void put_ecm(uint8_t *pkt, uint16_t srvid, int8_t odd, uint32_t count, uint8_t *cc)
+{
+	uint8_t section[24];
+
+	memset(section, 0, sizeof(section));
+	section[0] = odd ? 0x81 : 0x80;
+	section[3] = srvid >> 8;
+	section[4] = srvid & 0xFF;
+	section[5] = count >> 24;
+	section[6] = count >> 16;
+	section[7] = count >> 8;
+	section[8] = count;
+	put_section(pkt, BENCH_ECM_PID, cc, section, sizeof(section), 0);
+}
+
+// the cleartext of a video packet, the pattern depends on the sequence number
+static void fill_payload(uint8_t *payload, uint64_t seq, uint64_t sent)
+{
+	int32_t i;
+
+	put_be64(payload, seq);
+	put_be64(payload + 8, sent);
+	for (i = 16; i < TS_PACKET_SIZE - 4; i++)
+	{
+		payload[i] = (seq + i) & 0xFF;
+	}
+}
+
+static int8_t check_payload(const uint8_t *payload, uint64_t seq)
+{
+	int32_t i;
+
+	for (i = 16; i < TS_PACKET_SIZE - 4; i++)
+	{
+		if (payload[i] != ((seq + i) & 0xFF))
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static int32_t send_all(int32_t fd, const uint8_t *buf, int32_t len)
+{
+	int32_t sent;
+
+	while (len > 0)
+	{
+		if ((sent = send(fd, buf, len, MSG_NOSIGNAL)) <= 0)
+		{
+			if (sent < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			return -1;
+		}
+		buf += sent;
+		len -= sent;
+	}
+	return 0;
+}
+
+static uint16_t path_srvid(const char *request)
+{
+	const char *p = strchr(request, '/');
+	int32_t i;
+
+	// GET /1:0:1:SRVID:...
+	for (i = 0; p && i < 3; i++)
+	{
+		p = strchr(p + 1, ':');
+	}
+	return p ? strtoul(p + 1, NULL, 16) & 0xFFFF : 0;
+}
+
+static void *source_connection(void *arg)
+{
+	int32_t fd = (intptr_t)arg, len, count, i;
+	uint8_t *buf, cc[4] = { 0, 0, 0, 0 }, odd = 0;
+	char request[1024];
+	struct dvbcsa_key_s *key[2];
+	uint64_t start, now, sent_packets = 0, seq = 0, due, next_psi = 0, next_ecm = 0, next_parity;
+	uint32_t ecm_count = 0, burst_max;
+	uint16_t srvid;
+	const char *response = "HTTP/1.0 200 OK\r\nContent-Type: video/mpeg\r\n\r\n";
+
+	len = recv(fd, request, sizeof(request) - 1, 0);
+	request[len > 0 ? len : 0] = '\0';
+	if (!(srvid = path_srvid(request)) || send_all(fd, (const uint8_t *)response, strlen(response)))
+	{
+		close(fd);
+		return NULL;
+	}
+
+	// room for twice the packets of a tick to catch up
+	burst_max = (uint64_t)source_rate / 8 / TS_PACKET_SIZE * BENCH_TICK / 1000 * 2 + 8;
+	if (!(buf = malloc(burst_max * TS_PACKET_SIZE)))
+	{
+		close(fd);
+		return NULL;
+	}
+
+	key[0] = dvbcsa_key_alloc();
+	key[1] = dvbcsa_key_alloc();
+	dvbcsa_key_set(bench_cw, key[0]);
+	dvbcsa_key_set(bench_cw + 8, key[1]);
+
+	start = now_us();
+	next_parity = start + BENCH_PARITY_INTERVAL * 1000;
+
+	while (running)
+	{
+		now = now_us();
+		due = (now - start) * source_rate / 8 / TS_PACKET_SIZE / 1000000;
+		count = 0;
+
+		if (now >= next_parity)
+		{
+			odd ^= 1;
+			next_parity += BENCH_PARITY_INTERVAL * 1000;
+		}
+		if (now >= next_psi)
+		{
+			put_pat(buf + count++ * TS_PACKET_SIZE, srvid, &cc[0]);
+			put_pmt(buf + count++ * TS_PACKET_SIZE, srvid, &cc[1]);
+			next_psi = now + BENCH_PSI_INTERVAL * 1000;
+		}
+		if (now >= next_ecm)
+		{
+			put_ecm(buf + count++ * TS_PACKET_SIZE, srvid, odd, ecm_count++, &cc[2]);
+			next_ecm = now + BENCH_ECM_INTERVAL * 1000;
+		}
+
+		for (i = count; sent_packets + i < due && i < (int32_t)burst_max; i++)
+		{
+			uint8_t *pkt = buf + i * TS_PACKET_SIZE;
+
+			put_header(pkt, BENCH_VIDEO_PID, 0, odd ? 0xC0 : 0x80, &cc[3]);
+			fill_payload(pkt + 4, seq++, now);
+			dvbcsa_encrypt(key[odd], pkt + 4, TS_PACKET_SIZE - 4);
+		}
+		count = i;
+
+		if (count && send_all(fd, buf, count * TS_PACKET_SIZE))
+		{
+			break;
+		}
+		sent_packets += count;
+		usleep(BENCH_TICK * 1000);
+	}
+
+	dvbcsa_key_free(key[0]);
+	dvbcsa_key_free(key[1]);
+	free(buf);
+	close(fd);
+	return NULL;
+}
+
+static void *source_server(void *arg)
+{
+	int32_t listenfd = (intptr_t)arg, fd;
+	pthread_t thread;
+
+	while (running)
+	{
+		if ((fd = accept(listenfd, NULL, NULL)) < 0)
+		{
+			continue;
+		}
+		if (pthread_create(&thread, NULL, source_connection, (void *)(intptr_t)fd))
+		{
+			close(fd);
+			continue;
+		}
+		pthread_detach(thread);
+	}
+	return NULL;
+}
+
+static void client_packet(bench_client *client, const uint8_t *pkt, uint64_t *next_seq)
+{
+	uint64_t seq, latency;
+
+	if ((((pkt[1] & 0x1F) << 8) | pkt[2]) != BENCH_VIDEO_PID)
+	{
+		return;
+	}
+
+	if (pkt[3] & 0xC0)
+	{
+		client->scrambled++;
+		return;
+	}
+
+	seq = get_be64(pkt + 4);
+	if (!check_payload(pkt + 4, seq))
+	{
+		client->corrupt++;
+		return;
+	}
+
+	if (*next_seq && seq > *next_seq)
+	{
+		client->lost += seq - *next_seq;
+	}
+	*next_seq = seq + 1;
+
+	latency = now_us() - get_be64(pkt + 12);
+	client->latency_sum += latency;
+	if (latency > client->latency_max)
+	{
+		client->latency_max = latency;
+	}
+	client->descrambled++;
+}
+
+static void *client_thread(void *arg)
+{
+	bench_client *client = arg;
+	struct sockaddr_in addr;
+	struct timeval tv = { 1, 0 };
+	char request[128];
+	uint8_t buf[64 * 1024];
+	int32_t fd, len = 0, n, pos;
+	int8_t header = 1;
+	uint64_t next_seq = 0;
+	char *end;
+
+	if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+	{
+		return NULL;
+	}
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(relay_port);
+	addr.sin_addr.s_addr = inet_addr(relay_host);
+
+	snprintf(request, sizeof(request), "GET /1:0:1:%X:1:1:0:0:0:0: HTTP/1.1\r\n\r\n", client->srvid);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) || send_all(fd, (const uint8_t *)request, strlen(request)))
+	{
+		fprintf(stderr, "client %d: cannot connect to the relay at %s:%d\n", client->index, relay_host, relay_port);
+		close(fd);
+		return NULL;
+	}
+	client->connected = 1;
+
+	while (running)
+	{
+		if ((n = recv(fd, buf + len, sizeof(buf) - len, 0)) <= 0)
+		{
+			if (n < 0 && (errno == EAGAIN || errno == EINTR))
+			{
+				continue;
+			}
+			break;
+		}
+		len += n;
+		pos = 0;
+
+		if (header)
+		{
+			buf[len < (int32_t)sizeof(buf) ? len : len - 1] = '\0';
+			if (!(end = strstr((char *)buf, "\n\n")))
+			{
+				continue;
+			}
+			pos = end + 2 - (char *)buf;
+			header = 0;
+		}
+		else
+		{
+			client->bytes += n;
+		}
+
+		while (len - pos >= TS_PACKET_SIZE)
+		{
+			if (buf[pos] != 0x47)
+			{
+				client->resync++;
+				while (pos < len && buf[pos] != 0x47)
+				{
+					pos++;
+				}
+				continue;
+			}
+			client_packet(client, buf + pos, &next_seq);
+			pos += TS_PACKET_SIZE;
+		}
+
+		memmove(buf, buf + pos, len - pos);
+		len -= pos;
+	}
+
+	close(fd);
+	return NULL;
+}
+
+// cpu time of a process in clock ticks, -1 if unknown
+static int64_t process_cpu(int32_t pid)
+{
+	char path[64], stat[1024], *p;
+	unsigned long utime, stime;
+	FILE *fp;
+	size_t len;
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+	if (!pid || !(fp = fopen(path, "r")))
+	{
+		return -1;
+	}
+	len = fread(stat, 1, sizeof(stat) - 1, fp);
+	fclose(fp);
+	stat[len] = '\0';
+
+	// the fields after the command name: state ppid pgrp session tty tpgid flags minflt cminflt majflt cmajflt utime stime
+	if (!(p = strrchr(stat, ')')) || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)
+	{
+		return -1;
+	}
+	return utime + stime;
+}
+
+static void print_constcw(void)
+{
+	int32_t i, j;
+
+	printf("# streamrelay_bench control words (constcw reader)\n");
+	for (i = 0; i < stream_count; i++)
+	{
+		printf("%04X:000000:%04X:%04X:%04X::", bench_caid, first_srvid + i, BENCH_PMT_PID, BENCH_ECM_PID);
+		for (j = 0; j < 16; j++)
+		{
+			printf("%s%02X", j ? " " : "", bench_cw[j]);
+		}
+		printf("\n");
+	}
+}
+
+static const char *dvbcsa_variant(int32_t batch)
+{
+	switch (batch)
+	{
+		case 32: return "32 bit";
+		case 64: return "64 bit/mmx";
+		case 128: return "sse2/ssse3/neon/altivec";
+		case 256: return "avx2";
+		case 512: return "avx512";
+		default: return "unknown";
+	}
+}
+
+// Times the bitslice descrambler of the linked libdvbcsa build against the
+// packet by packet one, after checking both give the same cleartext. Build
+// the benchmark against each libdvbcsa build to compare their simd variants.
+static int32_t descrambler_bench(void)
+{
+	struct dvbcsa_key_s *key;
+	struct dvbcsa_bs_key_s *bs_key;
+	struct dvbcsa_bs_batch_s *batch;
+	int32_t size = dvbcsa_bs_batch_size(), len = TS_PACKET_SIZE - 4, i;
+	uint64_t start, elapsed, bs_elapsed, packets = 0, bs_packets = 0;
+	uint8_t *clear, *data;
+
+	clear = malloc(size * len);
+	data = malloc(size * len);
+	batch = calloc(size + 1, sizeof(struct dvbcsa_bs_batch_s));
+	if (!clear || !data || !batch)
+	{
+		free(clear);
+		free(data);
+		free(batch);
+		return 1;
+	}
+
+	key = dvbcsa_key_alloc();
+	bs_key = dvbcsa_bs_key_alloc();
+	dvbcsa_key_set(bench_cw, key);
+	dvbcsa_bs_key_set(bench_cw, bs_key);
+
+	srand(time(NULL));
+	for (i = 0; i < size * len; i++)
+	{
+		clear[i] = rand();
+	}
+	memcpy(data, clear, size * len);
+	for (i = 0; i < size; i++)
+	{
+		dvbcsa_encrypt(key, data + i * len, len);
+		batch[i].data = data + i * len;
+		batch[i].len = len;
+	}
+
+	dvbcsa_bs_decrypt(bs_key, batch, len);
+	if (memcmp(data, clear, size * len))
+	{
+		printf("descrambler  libdvbcsa %s bitslice output differs from the cleartext\n", dvbcsa_variant(size));
+		dvbcsa_bs_key_free(bs_key);
+		dvbcsa_key_free(key);
+		free(batch);
+		free(data);
+		free(clear);
+		return 2;
+	}
+
+	// the payload turns into garbage after the first round, the timing does not care
+	start = now_us();
+	do
+	{
+		for (i = 0; i < 64; i++)
+		{
+			dvbcsa_bs_decrypt(bs_key, batch, len);
+		}
+		bs_packets += 64 * size;
+	}
+	while ((bs_elapsed = now_us() - start) < (uint64_t)duration * 500000);
+
+	start = now_us();
+	do
+	{
+		for (i = 0; i < size; i++)
+		{
+			dvbcsa_decrypt(key, data + i * len, len);
+		}
+		packets += size;
+	}
+	while ((elapsed = now_us() - start) < (uint64_t)duration * 500000);
+
+	printf("descrambler  libdvbcsa %s, %d packets per batch\n", dvbcsa_variant(size), size);
+	printf("bitslice     %.0f packets/s, %.1f Mbit/s\n",
+		bs_packets * 1e6 / bs_elapsed, bs_packets * TS_PACKET_SIZE * 8.0 / bs_elapsed);
+	printf("per packet   %.0f packets/s, %.1f Mbit/s (bitslice is %.1fx)\n",
+		packets * 1e6 / elapsed, packets * TS_PACKET_SIZE * 8.0 / elapsed,
+		(bs_packets * 1.0 / bs_elapsed) / (packets * 1.0 / elapsed));
+
+	dvbcsa_bs_key_free(bs_key);
+	dvbcsa_key_free(key);
+	free(batch);
+	free(data);
+	free(clear);
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [options]\n"
+		" -r host:port  stream relay to test (default %s:%d)\n"
+		" -s port       port the synthetic stream source listens on (default %d)\n"
+		" -n clients    concurrent relay clients (default %d)\n"
+		" -S streams    services the clients are spread over (default %d)\n"
+		" -b mbit       source bitrate of each stream in Mbit/s (default %d)\n"
+		" -t seconds    duration (default %d)\n"
+		" -c caid       caid of the CA descriptor (default %04X)\n"
+		" -P pid        pid of ncam to report its cpu usage\n"
+		" -k            print the constcw lines for the benchmark control words\n"
+		" -d            time the descrambler of the linked libdvbcsa instead (no relay needed)\n",
+		name, relay_host, relay_port, source_port, client_count, stream_count, source_rate, duration, bench_caid);
+}
+
+int main(int argc, char *argv[])
+{
+	bench_client *clients;
+	struct sockaddr_in addr;
+	pthread_t source;
+	int32_t listenfd, reuse = 1, opt, i, connected = 0;
+	int8_t print_cw = 0, bench_csa = 0;
+	int64_t cpu_start, cpu_end;
+	uint64_t start, elapsed, bytes = 0, descrambled = 0, scrambled = 0, corrupt = 0, lost = 0, resync = 0;
+	uint64_t latency_sum = 0, latency_max = 0;
+	char *p;
+
+	while ((opt = getopt(argc, argv, "r:s:n:S:b:t:c:P:kdh")) != -1)
+	{
+		switch (opt)
+		{
+			case 'r':
+				snprintf(relay_host, sizeof(relay_host), "%s", optarg);
+				if ((p = strchr(relay_host, ':')))
+				{
+					*p = '\0';
+					relay_port = atoi(p + 1);
+				}
+				break;
+			case 's': source_port = atoi(optarg); break;
+			case 'n': client_count = atoi(optarg); break;
+			case 'S': stream_count = atoi(optarg); break;
+			case 'b': source_rate = atoi(optarg); break;
+			case 't': duration = atoi(optarg); break;
+			case 'c': bench_caid = strtoul(optarg, NULL, 16); break;
+			case 'P': ncam_pid = atoi(optarg); break;
+			case 'k': print_cw = 1; break;
+			case 'd': bench_csa = 1; break;
+			default:
+				usage(argv[0]);
+				return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (client_count < 1 || stream_count < 1 || source_rate < 1 || duration < 1)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (print_cw)
+	{
+		print_constcw();
+		return 0;
+	}
+
+	if (bench_csa)
+	{
+		return descrambler_bench();
+	}
+
+	source_rate *= 1000000; // bit/s
+
+	if ((listenfd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+	{
+		perror("socket");
+		return 1;
+	}
+	setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(source_port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(listenfd, (struct sockaddr *)&addr, sizeof(addr)) || listen(listenfd, 64))
+	{
+		perror("stream source");
+		return 1;
+	}
+	pthread_create(&source, NULL, source_server, (void *)(intptr_t)listenfd);
+	pthread_detach(source);
+
+	if (!(clients = calloc(client_count, sizeof(bench_client))))
+	{
+		return 1;
+	}
+
+	for (i = 0; i < client_count; i++)
+	{
+		clients[i].index = i;
+		clients[i].srvid = first_srvid + i % stream_count;
+		pthread_create(&clients[i].thread, NULL, client_thread, &clients[i]);
+		usleep(10000);
+	}
+
+	start = now_us();
+	cpu_start = process_cpu(ncam_pid);
+	sleep(duration);
+	cpu_end = process_cpu(ncam_pid);
+	elapsed = now_us() - start;
+	running = 0;
+
+	for (i = 0; i < client_count; i++)
+	{
+		pthread_join(clients[i].thread, NULL);
+		connected += clients[i].connected;
+		bytes += clients[i].bytes;
+		descrambled += clients[i].descrambled;
+		scrambled += clients[i].scrambled;
+		corrupt += clients[i].corrupt;
+		lost += clients[i].lost;
+		resync += clients[i].resync;
+		latency_sum += clients[i].latency_sum;
+		if (clients[i].latency_max > latency_max)
+		{
+			latency_max = clients[i].latency_max;
+		}
+	}
+
+	printf("clients      %d connected of %d, %d stream(s) at %d Mbit/s, %.1f s\n",
+		connected, client_count, stream_count, source_rate / 1000000, elapsed / 1e6);
+	printf("throughput   %.1f Mbit/s total, %.1f Mbit/s per client\n",
+		bytes * 8.0 / elapsed, connected ? bytes * 8.0 / elapsed / connected : 0);
+	printf("descrambled  %.0f packets/s, %" PRIu64 " still scrambled, %" PRIu64 " corrupt, %" PRIu64 " lost, %" PRIu64 " resyncs\n",
+		descrambled * 1e6 / elapsed, scrambled, corrupt, lost, resync);
+	printf("latency      avg %.2f ms, max %.2f ms\n",
+		descrambled ? latency_sum / 1000.0 / descrambled : 0, latency_max / 1000.0);
+	if (cpu_start >= 0 && cpu_end >= 0)
+	{
+		double cpu = (cpu_end - cpu_start) * 100.0 / sysconf(_SC_CLK_TCK) / (elapsed / 1e6);
+
+		printf("ncam cpu     %.1f %% total, %.2f %% per stream, %.2f %% per client\n",
+			cpu, cpu / stream_count, connected ? cpu / connected : 0);
+	}
+
+	free(clients);
+	close(listenfd);
+	return (corrupt || !descrambled) ? 2 : 0;
+}